@@ -57,11 +57,14 @@ INCLUDEPATH += . \
 
 # Input
 HEADERS += src/activemasternode.h \
+           src/addressindex.h \
            src/addrman.h \
            src/alert.h \
            src/allocators.h \
            src/amount.h \
            src/base58.h \
+           src/blockfilter.h \
+           src/blockreader.h \
            src/bloom.h \
            src/chain.h \
            src/chainparams.h \
@@ -361,6 +364,8 @@ SOURCES += src/activemasternode.cpp \
            src/allocators.cpp \
            src/amount.cpp \
            src/base58.cpp \
+           src/blockfilter.cpp \
+           src/blockreader.cpp \
            src/bloom.cpp \
            src/chain.cpp \
            src/chainparams.cpp \
@@ -523,6 +528,8 @@ SOURCES += src/activemasternode.cpp \
            src/test/base58_tests.cpp \
            src/test/base64_tests.cpp \
            src/test/bip32_tests.cpp \
+           src/test/blockfilter_tests.cpp \
+           src/test/blockreader_tests.cpp \
            src/test/bloom_tests.cpp \
            src/test/checkblock_tests.cpp \
            src/test/Checkpoints_tests.cpp \
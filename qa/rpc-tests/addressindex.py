@@ -0,0 +1,90 @@
+#!/usr/bin/env python2
+# Copyright (c) 2014 The Bitcoin Core developers
+# Copyright (c) 2014-2015 The Ic developers
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#
+# Test the address, spent and timestamp indexes and their rewind on disconnect
+#
+
+from test_framework import BitcoinTestFramework
+from bitcoinrpc.authproxy import JSONRPCException
+from util import *
+
+class AddressIndexTest (BitcoinTestFramework):
+
+    def setup_chain(self):
+        print("Initializing test directory "+self.options.tmpdir)
+        initialize_chain_clean(self.options.tmpdir, 1)
+
+    def setup_network(self, split=False):
+        self.nodes = start_nodes(1, self.options.tmpdir, [["-addressindex", "-spentindex", "-timestampindex"]])
+        self.is_network_split = False
+
+    def check_indexed(self, address, txid, n, prevout, blockhash, height):
+        addresses = {"addresses": [address]}
+        json_obj = self.nodes[0].getaddressbalance(addresses)
+        assert_equal(json_obj['balance'], 10)
+        assert_equal(json_obj['received'], 10)
+
+        json_obj = self.nodes[0].getaddressdeltas(addresses)
+        assert_equal(len(json_obj), 1)
+        assert_equal(json_obj[0]['txid'], txid)
+        assert_equal(json_obj[0]['index'], n)
+        assert_equal(json_obj[0]['height'], height)
+        assert_equal(json_obj[0]['amount'], 10)
+
+        json_obj = self.nodes[0].getaddressutxos(addresses)
+        assert_equal(len(json_obj), 1)
+        assert_equal(json_obj[0]['txid'], txid)
+        assert_equal(json_obj[0]['outputIndex'], n)
+        assert_equal(json_obj[0]['height'], height)
+        assert_equal(json_obj[0]['amount'], 10)
+
+        json_obj = self.nodes[0].getspentinfo({"txid": prevout['txid'], "index": prevout['vout']})
+        assert_equal(json_obj['txid'], txid)
+        assert_equal(json_obj['index'], 0)
+        assert_equal(json_obj['height'], height)
+
+        blocktime = self.nodes[0].getblock(blockhash)['time']
+        assert_equal(blockhash in self.nodes[0].getblockhashes(blocktime + 1, blocktime), True)
+
+    def check_rewound(self, address, prevout, blockhash):
+        addresses = {"addresses": [address]}
+        json_obj = self.nodes[0].getaddressbalance(addresses)
+        assert_equal(json_obj['balance'], 0)
+        assert_equal(json_obj['received'], 0)
+        assert_equal(self.nodes[0].getaddressdeltas(addresses), [])
+        assert_equal(self.nodes[0].getaddressutxos(addresses), [])
+        assert_raises(JSONRPCException, self.nodes[0].getspentinfo, {"txid": prevout['txid'], "index": prevout['vout']})
+
+        blocktime = self.nodes[0].getblock(blockhash)['time']
+        assert_equal(blockhash in self.nodes[0].getblockhashes(blocktime + 1, blocktime), False)
+
+    def run_test(self):
+        self.nodes[0].setgenerate(True, 101)
+
+        address = self.nodes[0].getnewaddress()
+        txid = self.nodes[0].sendtoaddress(address, 10)
+        tx = self.nodes[0].decoderawtransaction(self.nodes[0].gettransaction(txid)['hex'])
+        n = [vout['n'] for vout in tx['vout'] if vout['value'] == 10][0]
+        prevout = tx['vin'][0]
+        blockhash = self.nodes[0].setgenerate(True, 1)[0]
+        height = self.nodes[0].getblockcount()
+
+        # connecting the block writes the entries
+        self.check_indexed(address, txid, n, prevout, blockhash, height)
+
+        # disconnecting it rewinds them
+        self.nodes[0].invalidateblock(blockhash)
+        assert_equal(self.nodes[0].getblockcount(), height - 1)
+        self.check_rewound(address, prevout, blockhash)
+
+        # and connecting it again brings them back
+        self.nodes[0].reconsiderblock(blockhash)
+        assert_equal(self.nodes[0].getbestblockhash(), blockhash)
+        self.check_indexed(address, txid, n, prevout, blockhash, height)
+
+if __name__ == '__main__':
+    AddressIndexTest().main()
@@ -0,0 +1,69 @@
+#!/usr/bin/env python2
+# Copyright (c) 2014 The Bitcoin Core developers
+# Copyright (c) 2014-2015 The Ic developers
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#
+# Test that the node keeps answering RPCs while an import rescans the chain
+#
+
+from test_framework import BitcoinTestFramework
+from bitcoinrpc.authproxy import AuthServiceProxy
+from util import *
+import threading
+
+class ImportRescanTest (BitcoinTestFramework):
+
+    def setup_chain(self):
+        print("Initializing test directory "+self.options.tmpdir)
+        initialize_chain_clean(self.options.tmpdir, 2)
+
+    def setup_network(self, split=False):
+        self.nodes = start_nodes(2, self.options.tmpdir)
+        connect_nodes_bi(self.nodes, 0, 1)
+        self.is_network_split = False
+        self.sync_all()
+
+    def run_test(self):
+        # a chain long enough for the rescan to take a while
+        self.nodes[0].setgenerate(True, 1000)
+        self.sync_all()
+
+        address = self.nodes[1].getnewaddress()
+        key = self.nodes[1].dumpprivkey(address)
+        self.nodes[0].sendtoaddress(address, 10)
+        self.nodes[0].setgenerate(True, 1)
+        self.sync_all()
+        height = self.nodes[0].getblockcount()
+
+        # import on its own connection, the proxies aren't thread safe
+        result = {}
+        def import_key():
+            proxy = AuthServiceProxy(self.nodes[0].url)
+            result['import'] = proxy.importprivkey(key, "imported", True)
+        thread = threading.Thread(target=import_key)
+        thread.start()
+
+        answered = 0
+        while thread.is_alive():
+            assert_equal(self.nodes[0].getblockcount(), height)
+            if thread.is_alive():
+                answered += 1
+        thread.join()
+
+        assert_equal(result['import'], None)
+        assert_greater_than(answered, 0)
+        assert_equal(self.nodes[0].getreceivedbyaddress(address), 10)
+
+        # an abortrescan while no rescan runs doesn't stop the next one
+        address = self.nodes[1].getnewaddress()
+        self.nodes[0].sendtoaddress(address, 5)
+        self.nodes[0].setgenerate(True, 1)
+        self.sync_all()
+        assert_equal(self.nodes[0].abortrescan(), None)
+        self.nodes[0].importprivkey(self.nodes[1].dumpprivkey(address), "imported", True)
+        assert_equal(self.nodes[0].getreceivedbyaddress(address), 5)
+
+if __name__ == '__main__':
+    ImportRescanTest().main()
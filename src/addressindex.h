@@ -0,0 +1,225 @@
+// Copyright (c) 2014-2015 The Ic developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_ADDRESSINDEX_H
+#define BITCOIN_ADDRESSINDEX_H
+
+#include "amount.h"
+#include "hash.h"
+#include "script/script.h"
+#include "serialize.h"
+#include "uint256.h"
+
+#include <stdint.h>
+#include <utility>
+#include <vector>
+
+/**
+ * Keys and values of the -addressindex, -spentindex and -timestampindex
+ * entries kept in the block tree database. Heights and times are written
+ * big endian so that a range of them is a single LevelDB range scan.
+ */
+
+/** Kinds of addresses outputs are indexed under */
+enum IndexAddressType
+{
+    INDEX_ADDRESS_NONE = 0,
+    INDEX_ADDRESS_PUBKEYHASH = 1,
+    INDEX_ADDRESS_SCRIPTHASH = 2,
+};
+
+/** Address an output pays to: a key hash, also for pay to pubkey, or a script hash */
+struct CIndexAddress
+{
+    unsigned char nType;
+    uint160 hash;
+
+    CIndexAddress() : nType(INDEX_ADDRESS_NONE) {}
+    CIndexAddress(unsigned char nTypeIn, const uint160& hashIn) : nType(nTypeIn), hash(hashIn) {}
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType_, int nVersion) {
+        READWRITE(nType);
+        READWRITE(hash);
+    }
+
+    bool IsNull() const { return nType == INDEX_ADDRESS_NONE; }
+
+    /** Set from an output script, false if it isn't one of the indexed forms */
+    bool SetScript(const CScript& script)
+    {
+        if (script.IsPayToScriptHash()) {
+            *this = CIndexAddress(INDEX_ADDRESS_SCRIPTHASH, uint160(std::vector<unsigned char>(script.begin() + 2, script.begin() + 22)));
+        } else if (script.size() == 25 && script[0] == OP_DUP && script[1] == OP_HASH160 && script[2] == 20 &&
+                   script[23] == OP_EQUALVERIFY && script[24] == OP_CHECKSIG) {
+            *this = CIndexAddress(INDEX_ADDRESS_PUBKEYHASH, uint160(std::vector<unsigned char>(script.begin() + 3, script.begin() + 23)));
+        } else if ((script.size() == 35 && script[0] == 33) || (script.size() == 67 && script[0] == 65)) {
+            if (script.back() != OP_CHECKSIG)
+                return false;
+            *this = CIndexAddress(INDEX_ADDRESS_PUBKEYHASH, Hash160(script.begin() + 1, script.end() - 1));
+        } else {
+            return false;
+        }
+        return true;
+    }
+
+    friend bool operator==(const CIndexAddress& a, const CIndexAddress& b) { return a.nType == b.nType && a.hash == b.hash; }
+    friend bool operator!=(const CIndexAddress& a, const CIndexAddress& b) { return !(a == b); }
+};
+
+/** One amount received (positive) or spent (negative) by an address, in chain order */
+struct CAddressIndexKey
+{
+    CIndexAddress address;
+    int nHeight;
+    unsigned int nTxIndex; //!< position of the transaction in its block
+    uint256 txhash;
+    unsigned int nIndex;   //!< output, or input when fSpending
+    bool fSpending;
+
+    CAddressIndexKey() : nHeight(0), nTxIndex(0), nIndex(0), fSpending(false) {}
+    CAddressIndexKey(const CIndexAddress& addressIn, int nHeightIn, unsigned int nTxIndexIn, const uint256& txhashIn, unsigned int nIndexIn, bool fSpendingIn) :
+        address(addressIn), nHeight(nHeightIn), nTxIndex(nTxIndexIn), txhash(txhashIn), nIndex(nIndexIn), fSpending(fSpendingIn) {}
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
+        READWRITE(address);
+        READWRITE(BIGENDIAN(nHeight));
+        READWRITE(BIGENDIAN(nTxIndex));
+        READWRITE(txhash);
+        READWRITE(nIndex);
+        READWRITE(fSpending);
+    }
+};
+
+/** Output of an address that is still unspent */
+struct CAddressUnspentKey
+{
+    CIndexAddress address;
+    uint256 txhash;
+    unsigned int nIndex;
+
+    CAddressUnspentKey() : nIndex(0) {}
+    CAddressUnspentKey(const CIndexAddress& addressIn, const uint256& txhashIn, unsigned int nIndexIn) :
+        address(addressIn), txhash(txhashIn), nIndex(nIndexIn) {}
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
+        READWRITE(address);
+        READWRITE(txhash);
+        READWRITE(nIndex);
+    }
+};
+
+struct CAddressUnspentValue
+{
+    CAmount nValue;
+    CScript script;
+    int nHeight;
+
+    CAddressUnspentValue() { SetNull(); }
+    CAddressUnspentValue(CAmount nValueIn, const CScript& scriptIn, int nHeightIn) :
+        nValue(nValueIn), script(scriptIn), nHeight(nHeightIn) {}
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
+        READWRITE(nValue);
+        READWRITE(script);
+        READWRITE(nHeight);
+    }
+
+    //! A null value erases the output from the index
+    void SetNull() { nValue = -1; script.clear(); nHeight = 0; }
+    bool IsNull() const { return nValue == -1; }
+};
+
+/** Output spent in the active chain */
+struct CSpentIndexKey
+{
+    uint256 txid;
+    unsigned int nIndex;
+
+    CSpentIndexKey() : nIndex(0) {}
+    CSpentIndexKey(const uint256& txidIn, unsigned int nIndexIn) : txid(txidIn), nIndex(nIndexIn) {}
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
+        READWRITE(txid);
+        READWRITE(nIndex);
+    }
+};
+
+/** Input spending an output, with the amount and address of what it spent */
+struct CSpentIndexValue
+{
+    uint256 txid;
+    unsigned int nInputIndex;
+    int nHeight;
+    CAmount nValue;
+    CIndexAddress address;
+
+    CSpentIndexValue() { SetNull(); }
+    CSpentIndexValue(const uint256& txidIn, unsigned int nInputIndexIn, int nHeightIn, CAmount nValueIn, const CIndexAddress& addressIn) :
+        txid(txidIn), nInputIndex(nInputIndexIn), nHeight(nHeightIn), nValue(nValueIn), address(addressIn) {}
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
+        READWRITE(txid);
+        READWRITE(nInputIndex);
+        READWRITE(nHeight);
+        READWRITE(nValue);
+        READWRITE(address);
+    }
+
+    //! A null value erases the entry from the index
+    void SetNull() { txid = 0; nInputIndex = 0; nHeight = 0; nValue = 0; address = CIndexAddress(); }
+    bool IsNull() const { return txid == 0; }
+};
+
+/** Block of the active chain, ordered by block time */
+struct CTimestampIndexKey
+{
+    unsigned int nTimestamp;
+    uint256 hashBlock;
+
+    CTimestampIndexKey() : nTimestamp(0) {}
+    CTimestampIndexKey(unsigned int nTimestampIn, const uint256& hashBlockIn) : nTimestamp(nTimestampIn), hashBlock(hashBlockIn) {}
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
+        READWRITE(BIGENDIAN(nTimestamp));
+        READWRITE(hashBlock);
+    }
+};
+
+/**
+ * Entries a disconnected block leaves to erase or restore. They are only
+ * applied once the chainstate without the block is on disk, so a crash in
+ * between can't leave a connected block with its entries gone.
+ */
+struct CExplorerIndexUndo
+{
+    std::vector<std::pair<CAddressIndexKey, CAmount> > vAddressIndex;
+    std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > vAddressUnspentIndex;
+    std::vector<std::pair<CSpentIndexKey, CSpentIndexValue> > vSpentIndex;
+    std::vector<CTimestampIndexKey> vTimestampIndex;
+
+    bool IsEmpty() const { return vAddressIndex.empty() && vAddressUnspentIndex.empty() && vSpentIndex.empty() && vTimestampIndex.empty(); }
+};
+
+#endif // BITCOIN_ADDRESSINDEX_H
@@ -0,0 +1,219 @@
+// Copyright (c) 2014-2015 The Ic developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockfilter.h"
+
+#include "crypto/common.h"
+#include "hash.h"
+#include "main.h"
+#include "script/script.h"
+#include "streams.h"
+
+#include <algorithm>
+
+using namespace std;
+
+/** Appends bits to a byte vector, most significant bit first */
+class CBitWriter
+{
+private:
+    vector<unsigned char>& vch;
+    unsigned char nBuffer;
+    unsigned int nBits;
+
+public:
+    CBitWriter(vector<unsigned char>& vchIn) : vch(vchIn), nBuffer(0), nBits(0) {}
+
+    void Write(uint64_t nValue, unsigned int nCount)
+    {
+        while (nCount > 0) {
+            unsigned int nTake = min(nCount, 8 - nBits);
+            nBuffer |= ((nValue >> (nCount - nTake)) & ((1U << nTake) - 1)) << (8 - nBits - nTake);
+            nBits += nTake;
+            nCount -= nTake;
+            if (nBits == 8)
+                Flush();
+        }
+    }
+
+    /** Write the last, partly filled byte padded with zero bits */
+    void Flush()
+    {
+        if (nBits == 0)
+            return;
+        vch.push_back(nBuffer);
+        nBuffer = 0;
+        nBits = 0;
+    }
+};
+
+/** Reads bits written by CBitWriter, returns zero bits past the end */
+class CBitReader
+{
+private:
+    const unsigned char* pch;
+    const unsigned char* pchEnd;
+    unsigned int nBit;
+
+public:
+    CBitReader(const unsigned char* pchIn, const unsigned char* pchEndIn) : pch(pchIn), pchEnd(pchEndIn), nBit(0) {}
+
+    bool AtEnd() const { return pch >= pchEnd; }
+
+    uint64_t Read(unsigned int nCount)
+    {
+        uint64_t nValue = 0;
+        while (nCount > 0) {
+            unsigned int nTake = min(nCount, 8 - nBit);
+            unsigned char nByte = pch < pchEnd ? *pch : 0;
+            nValue = (nValue << nTake) | ((nByte >> (8 - nBit - nTake)) & ((1U << nTake) - 1));
+            nBit += nTake;
+            nCount -= nTake;
+            if (nBit == 8) {
+                pch++;
+                nBit = 0;
+            }
+        }
+        return nValue;
+    }
+};
+
+static void GolombRiceEncode(CBitWriter& writer, uint64_t nDelta)
+{
+    // The quotient in unary, terminated by a zero bit
+    uint64_t nQuotient = nDelta >> BASIC_FILTER_P;
+    while (nQuotient > 0) {
+        unsigned int nBits = (unsigned int)min<uint64_t>(nQuotient, 64);
+        writer.Write(~(uint64_t)0, nBits);
+        nQuotient -= nBits;
+    }
+    writer.Write(0, 1);
+    writer.Write(nDelta, BASIC_FILTER_P);
+}
+
+static bool GolombRiceDecode(CBitReader& reader, uint64_t& nDelta)
+{
+    uint64_t nQuotient = 0;
+    while (reader.Read(1) == 1) {
+        if (reader.AtEnd())
+            return false;
+        nQuotient++;
+    }
+    nDelta = (nQuotient << BASIC_FILTER_P) | reader.Read(BASIC_FILTER_P);
+    return true;
+}
+
+/** (a * b) >> 64, maps a uniform 64 bit hash uniformly into [0, b) */
+static uint64_t MulHigh64(uint64_t a, uint64_t b)
+{
+#ifdef __SIZEOF_INT128__
+    return (uint64_t)(((unsigned __int128)a * b) >> 64);
+#else
+    uint64_t a_hi = a >> 32, a_lo = a & 0xFFFFFFFF;
+    uint64_t b_hi = b >> 32, b_lo = b & 0xFFFFFFFF;
+    uint64_t lo_lo = a_lo * b_lo;
+    uint64_t hi_lo = a_hi * b_lo;
+    uint64_t lo_hi = a_lo * b_hi;
+    uint64_t cross = (lo_lo >> 32) + (hi_lo & 0xFFFFFFFF) + lo_hi;
+    return a_hi * b_hi + (hi_lo >> 32) + (cross >> 32);
+#endif
+}
+
+uint64_t CBlockFilter::HashToRange(const vector<unsigned char>& vchElement, uint64_t nRange) const
+{
+    uint64_t nHash = SipHash(ReadLE64(hashBlock.begin()), ReadLE64(hashBlock.begin() + 8),
+                             vchElement.empty() ? NULL : &vchElement[0], vchElement.size());
+    return MulHigh64(nHash, nRange);
+}
+
+CBlockFilter::CBlockFilter(const CBlock& block, const CBlockUndo& blockundo)
+{
+    BlockFilterElements elements;
+    BOOST_FOREACH(const CTransaction& tx, block.vtx) {
+        BOOST_FOREACH(const CTxOut& txout, tx.vout) {
+            const CScript& script = txout.scriptPubKey;
+            if (script.empty() || script[0] == OP_RETURN)
+                continue;
+            elements.insert(vector<unsigned char>(script.begin(), script.end()));
+        }
+    }
+    BOOST_FOREACH(const CTxUndo& txundo, blockundo.vtxundo) {
+        BOOST_FOREACH(const CTxInUndo& txinundo, txundo.vprevout) {
+            const CScript& script = txinundo.txout.scriptPubKey;
+            if (script.empty())
+                continue;
+            elements.insert(vector<unsigned char>(script.begin(), script.end()));
+        }
+    }
+    *this = CBlockFilter(block.GetHash(), elements);
+}
+
+CBlockFilter::CBlockFilter(const uint256& hashBlockIn, const BlockFilterElements& elements) : hashBlock(hashBlockIn)
+{
+    uint64_t nRange = elements.size() * BASIC_FILTER_M;
+    vector<uint64_t> vHashes;
+    vHashes.reserve(elements.size());
+    BOOST_FOREACH(const vector<unsigned char>& vchElement, elements)
+        vHashes.push_back(HashToRange(vchElement, nRange));
+    sort(vHashes.begin(), vHashes.end());
+
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    WriteCompactSize(ss, elements.size());
+    vchEncoded.assign(ss.begin(), ss.end());
+    CBitWriter writer(vchEncoded);
+    uint64_t nLast = 0;
+    BOOST_FOREACH(uint64_t nHash, vHashes) {
+        GolombRiceEncode(writer, nHash - nLast);
+        nLast = nHash;
+    }
+    writer.Flush();
+}
+
+bool CBlockFilter::MatchAny(const BlockFilterElements& elements) const
+{
+    if (elements.empty() || vchEncoded.empty())
+        return false;
+
+    CDataStream ss(vchEncoded, SER_NETWORK, PROTOCOL_VERSION);
+    uint64_t nElements = ReadCompactSize(ss);
+    if (nElements == 0)
+        return false;
+
+    uint64_t nRange = nElements * BASIC_FILTER_M;
+    vector<uint64_t> vQueries;
+    vQueries.reserve(elements.size());
+    BOOST_FOREACH(const vector<unsigned char>& vchElement, elements)
+        vQueries.push_back(HashToRange(vchElement, nRange));
+    sort(vQueries.begin(), vQueries.end());
+
+    // Walk the filter and the sorted queries together
+    const unsigned char* pchEnd = &vchEncoded[0] + vchEncoded.size();
+    CBitReader reader(pchEnd - ss.size(), pchEnd);
+    vector<uint64_t>::const_iterator itQuery = vQueries.begin();
+    uint64_t nValue = 0;
+    for (uint64_t i = 0; i < nElements; i++) {
+        uint64_t nDelta;
+        if (!GolombRiceDecode(reader, nDelta))
+            return false;
+        nValue += nDelta;
+        while (*itQuery < nValue) {
+            if (++itQuery == vQueries.end())
+                return false;
+        }
+        if (*itQuery == nValue)
+            return true;
+    }
+    return false;
+}
+
+uint256 CBlockFilter::GetHash() const
+{
+    return Hash(vchEncoded.begin(), vchEncoded.end());
+}
+
+uint256 CBlockFilter::GetHeader(const uint256& hashPrevHeader) const
+{
+    uint256 hashFilter = GetHash();
+    return Hash(hashFilter.begin(), hashFilter.end(), hashPrevHeader.begin(), hashPrevHeader.end());
+}
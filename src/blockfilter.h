@@ -0,0 +1,76 @@
+// Copyright (c) 2014-2015 The Ic developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_BLOCKFILTER_H
+#define BITCOIN_BLOCKFILTER_H
+
+#include "serialize.h"
+#include "uint256.h"
+
+#include <stdint.h>
+#include <set>
+#include <vector>
+
+class CBlock;
+class CBlockUndo;
+
+/** Filter types, as sent in the BIP157 messages */
+enum BlockFilterType
+{
+    BLOCK_FILTER_BASIC = 0,
+};
+
+//! Golomb-Rice parameter of the basic filter: bits of each delta stored as is
+static const unsigned int BASIC_FILTER_P = 19;
+//! False positive rate of the basic filter is 1/BASIC_FILTER_M per element queried
+static const uint64_t BASIC_FILTER_M = 784931;
+
+/** Scripts a filter is built from or queried for */
+typedef std::set<std::vector<unsigned char> > BlockFilterElements;
+
+/**
+ * Compact filter of a block, the BIP158 basic filter: a Golomb-coded set of
+ * the scripts of all outputs the block creates and all outputs it spends.
+ * Each script is hashed into [0, N * M) with SipHash keyed by the block
+ * hash, and the sorted hashes are stored as Golomb-Rice coded deltas.
+ *
+ * Matching can give false positives, with probability 1/M for each script
+ * queried, but never misses a script that is in the block.
+ */
+class CBlockFilter
+{
+private:
+    uint256 hashBlock;
+    std::vector<unsigned char> vchEncoded;
+
+    uint64_t HashToRange(const std::vector<unsigned char>& vchElement, uint64_t nRange) const;
+
+public:
+    CBlockFilter() {}
+    /** Build the filter of a block from the block and its undo data */
+    CBlockFilter(const CBlock& block, const CBlockUndo& blockundo);
+    /** Build a filter of the given scripts, keyed with hashBlock */
+    CBlockFilter(const uint256& hashBlockIn, const BlockFilterElements& elements);
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
+        READWRITE(hashBlock);
+        READWRITE(vchEncoded);
+    }
+
+    const uint256& GetBlockHash() const { return hashBlock; }
+    const std::vector<unsigned char>& GetEncoded() const { return vchEncoded; }
+
+    /** True if any of elements may be in the block */
+    bool MatchAny(const BlockFilterElements& elements) const;
+
+    /** Hash of the encoded filter, as chained in the filter headers */
+    uint256 GetHash() const;
+    /** Filter header of this block, given the one of the block before it */
+    uint256 GetHeader(const uint256& hashPrevHeader) const;
+};
+
+#endif // BITCOIN_BLOCKFILTER_H
@@ -0,0 +1,152 @@
+// Copyright (c) 2014-2015 The Ic developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockreader.h"
+
+#include "chainparams.h"
+#include "clientversion.h"
+#include "crypto/common.h"
+#include "main.h"
+#include "streams.h"
+#include "util.h"
+
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+
+using namespace std;
+
+CBlockFileReader blockFileReader;
+
+CBlockFileReader::CBlockFileReader() :
+    mappedFiles(MAX_MAPPED_BLOCK_FILES), openFiles(MAX_OPEN_BLOCK_FILES), cachedBlocks(MAX_BLOCKS_CACHED)
+{
+}
+
+/** Check the message start and size in front of a block, return the size or 0 if they're bad */
+static unsigned int CheckBlockPrefix(const char* pchPrefix)
+{
+    if (memcmp(pchPrefix, Params().MessageStart(), MESSAGE_START_SIZE) != 0)
+        return 0;
+    unsigned int nSize = ReadLE32((const unsigned char*)pchPrefix + MESSAGE_START_SIZE);
+    if (nSize < 80 || nSize > MAX_BLOCK_SIZE)
+        return 0;
+    return nSize;
+}
+
+CBlockFileReader::MappedFile CBlockFileReader::GetMappedFile(int nFile)
+{
+    AssertLockHeld(cs);
+
+    MappedFile region;
+    if (mappedFiles.Get(nFile, region))
+        return region;
+
+    boost::filesystem::path path = GetBlockPosFilename(CDiskBlockPos(nFile, 0), "blk");
+    try {
+        boost::interprocess::file_mapping mapping(path.string().c_str(), boost::interprocess::read_only);
+        region.reset(new boost::interprocess::mapped_region(mapping, boost::interprocess::read_only));
+    } catch (const boost::interprocess::interprocess_exception& e) {
+        LogPrint("db", "%s : can't map %s, reading it instead: %s\n", __func__, path.string(), e.what());
+        return MappedFile();
+    }
+    mappedFiles.Put(nFile, region);
+    return region;
+}
+
+bool CBlockFileReader::ReadRawFromFile(std::vector<char>& vchBlock, const CDiskBlockPos& pos)
+{
+    LOCK(cs);
+
+    OpenFile file;
+    if (!openFiles.Get(pos.nFile, file)) {
+        FILE* filein = OpenBlockFile(CDiskBlockPos(pos.nFile, 0), true);
+        if (!filein)
+            return error("%s : OpenBlockFile failed", __func__);
+        file.reset(filein, fclose);
+        openFiles.Put(pos.nFile, file);
+    }
+
+    char pchPrefix[MESSAGE_START_SIZE + 4];
+    if (fseek(file.get(), pos.nPos - sizeof(pchPrefix), SEEK_SET) != 0 ||
+        fread(pchPrefix, 1, sizeof(pchPrefix), file.get()) != sizeof(pchPrefix))
+        return error("%s : I/O error reading blk%05u.dat at %u", __func__, pos.nFile, pos.nPos);
+    unsigned int nSize = CheckBlockPrefix(pchPrefix);
+    if (nSize == 0)
+        return error("%s : bad block header in blk%05u.dat at %u", __func__, pos.nFile, pos.nPos);
+    vchBlock.resize(nSize);
+    if (fread(&vchBlock[0], 1, nSize, file.get()) != nSize)
+        return error("%s : I/O error reading blk%05u.dat at %u", __func__, pos.nFile, pos.nPos);
+    return true;
+}
+
+bool CBlockFileReader::ReadRaw(std::vector<char>& vchBlock, const CDiskBlockPos& pos, bool fFinished)
+{
+    if (pos.IsNull() || pos.nPos < MESSAGE_START_SIZE + 4)
+        return error("%s : bad block position", __func__);
+
+    // Only map files that won't grow any more, a mapping doesn't see the
+    // data appended after it was made
+    MappedFile region;
+    if (fFinished) {
+        LOCK(cs);
+        region = GetMappedFile(pos.nFile);
+    }
+    if (!region)
+        return ReadRawFromFile(vchBlock, pos);
+
+    const char* pchFile = (const char*)region->get_address();
+    size_t nFileSize = region->get_size();
+    if (pos.nPos > nFileSize)
+        return error("%s : position %u past the end of blk%05u.dat", __func__, pos.nPos, pos.nFile);
+    unsigned int nSize = CheckBlockPrefix(pchFile + pos.nPos - MESSAGE_START_SIZE - 4);
+    if (nSize == 0 || nSize > nFileSize - pos.nPos)
+        return error("%s : bad block header in blk%05u.dat at %u", __func__, pos.nFile, pos.nPos);
+    vchBlock.assign(pchFile + pos.nPos, pchFile + pos.nPos + nSize);
+    return true;
+}
+
+bool CBlockFileReader::Read(CBlock& block, const CDiskBlockPos& pos, bool fFinished)
+{
+    // A position always holds the same block, whether its file is finished or not
+    BlockKey key(pos.nFile, pos.nPos);
+    boost::shared_ptr<const CBlock> pblock;
+    {
+        LOCK(cs);
+        if (cachedBlocks.Get(key, pblock)) {
+            block = *pblock;
+            return true;
+        }
+    }
+
+    vector<char> vchBlock;
+    if (!ReadRaw(vchBlock, pos, fFinished))
+        return false;
+    boost::shared_ptr<CBlock> pblockNew(new CBlock());
+    try {
+        CDataStream ss(&vchBlock[0], &vchBlock[0] + vchBlock.size(), SER_DISK, CLIENT_VERSION);
+        ss >> *pblockNew;
+    } catch (const std::exception& e) {
+        return error("%s : Deserialize error - %s", __func__, e.what());
+    }
+    block = *pblockNew;
+
+    LOCK(cs);
+    cachedBlocks.Put(key, pblockNew);
+    return true;
+}
+
+void CBlockFileReader::CloseFile(int nFile)
+{
+    LOCK(cs);
+    mappedFiles.Erase(nFile);
+    openFiles.Erase(nFile);
+}
+
+void CBlockFileReader::Clear()
+{
+    LOCK(cs);
+    mappedFiles.Clear();
+    openFiles.Clear();
+    cachedBlocks.Clear();
+}
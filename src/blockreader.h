@@ -0,0 +1,124 @@
+// Copyright (c) 2014-2015 The Ic developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_BLOCKREADER_H
+#define BITCOIN_BLOCKREADER_H
+
+#include "chain.h"
+#include "primitives/block.h"
+#include "sync.h"
+
+#include <stdio.h>
+#include <list>
+#include <map>
+#include <utility>
+#include <vector>
+
+#include <boost/shared_ptr.hpp>
+
+namespace boost {
+namespace interprocess {
+class mapped_region;
+}
+}
+
+/** Number of finished block files kept mapped into memory */
+static const unsigned int MAX_MAPPED_BLOCK_FILES = 8;
+/** Number of block files still being written to kept open for reading */
+static const unsigned int MAX_OPEN_BLOCK_FILES = 4;
+/** Number of recently read blocks kept deserialized */
+static const unsigned int MAX_BLOCKS_CACHED = 16;
+
+/** Map that drops its least recently used entry when it grows past nMaxSize */
+template <typename K, typename V>
+class CLRUMap
+{
+private:
+    typedef std::list<std::pair<K, V> > list_type;
+    list_type entries;
+    std::map<K, typename list_type::iterator> index;
+    size_t nMaxSize;
+
+public:
+    CLRUMap(size_t nMaxSizeIn) : nMaxSize(nMaxSizeIn) {}
+
+    bool Get(const K& key, V& value)
+    {
+        typename std::map<K, typename list_type::iterator>::iterator it = index.find(key);
+        if (it == index.end())
+            return false;
+        entries.splice(entries.begin(), entries, it->second);
+        value = it->second->second;
+        return true;
+    }
+
+    void Put(const K& key, const V& value)
+    {
+        Erase(key);
+        entries.push_front(std::make_pair(key, value));
+        index[key] = entries.begin();
+        if (entries.size() > nMaxSize) {
+            index.erase(entries.back().first);
+            entries.pop_back();
+        }
+    }
+
+    void Erase(const K& key)
+    {
+        typename std::map<K, typename list_type::iterator>::iterator it = index.find(key);
+        if (it == index.end())
+            return;
+        entries.erase(it->second);
+        index.erase(it);
+    }
+
+    void Clear()
+    {
+        index.clear();
+        entries.clear();
+    }
+};
+
+/**
+ * Reads blocks from the blk?????.dat files. Files that are no longer
+ * appended to are mapped into memory and read from there, the file
+ * currently being written goes through a descriptor kept open between
+ * reads. The last blocks read are kept deserialized, so that the wallet,
+ * RPC and peers asking for the same recent block only go to disk once.
+ */
+class CBlockFileReader
+{
+public:
+    CBlockFileReader();
+
+    /**
+     * Read the serialized block at pos, without the message start and size
+     * written in front of it. fFinished tells if the file can still change.
+     */
+    bool ReadRaw(std::vector<char>& vchBlock, const CDiskBlockPos& pos, bool fFinished);
+    /** Read the block at pos, see ReadRaw */
+    bool Read(CBlock& block, const CDiskBlockPos& pos, bool fFinished);
+
+    /** Stop reading nFile through a mapping or open descriptor, call before changing it */
+    void CloseFile(int nFile);
+    /** Forget all files and blocks */
+    void Clear();
+
+private:
+    typedef boost::shared_ptr<boost::interprocess::mapped_region> MappedFile;
+    typedef boost::shared_ptr<FILE> OpenFile;
+    typedef std::pair<int, unsigned int> BlockKey;
+
+    CCriticalSection cs;
+    CLRUMap<int, MappedFile> mappedFiles;
+    CLRUMap<int, OpenFile> openFiles;
+    CLRUMap<BlockKey, boost::shared_ptr<const CBlock> > cachedBlocks;
+
+    MappedFile GetMappedFile(int nFile);
+    bool ReadRawFromFile(std::vector<char>& vchBlock, const CDiskBlockPos& pos);
+};
+
+extern CBlockFileReader blockFileReader;
+
+#endif // BITCOIN_BLOCKREADER_H
@@ -45,6 +45,14 @@
 #include <unistd.h>
 #endif
 
+// Where epoll is available the P2P socket handler waits on it and the one-off
+// waits in netbase use poll(), so sockets are not limited to FD_SETSIZE.
+#if !defined(WIN32) && defined(HAVE_SYS_EPOLL_H)
+#define USE_EPOLL
+#include <poll.h>
+#include <sys/epoll.h>
+#endif
+
 #ifdef WIN32
 #define MSG_DONTWAIT        0
 #else
@@ -91,7 +99,7 @@ typedef u_int SOCKET;
 size_t strnlen_int( const char *start, size_t max_len);
 
 bool static inline IsSelectableSocket(SOCKET s) {
-#ifdef WIN32
+#if defined(WIN32) || defined(USE_EPOLL)
     return true;
 #else
     return (s < FD_SETSIZE);
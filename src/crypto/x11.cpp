@@ -0,0 +1,173 @@
+// Copyright (c) 2014-2015 The Ic developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "crypto/x11.h"
+
+#include "crypto/sph_blake.h"
+#include "crypto/sph_bmw.h"
+#include "crypto/sph_groestl.h"
+#include "crypto/sph_jh.h"
+#include "crypto/sph_keccak.h"
+#include "crypto/sph_skein.h"
+#include "crypto/sph_luffa.h"
+#include "crypto/sph_cubehash.h"
+#include "crypto/sph_shavite.h"
+#include "crypto/sph_simd.h"
+#include "crypto/sph_echo.h"
+
+#include <string.h>
+
+#if defined(ENABLE_X11_SSE41) && (defined(__x86_64__) || defined(__amd64__) || defined(__i386__))
+#include <cpuid.h>
+#define HAVE_X86_SSE41 1
+#endif
+
+namespace {
+
+/** A stage hashing n <= X11_LANES 64-byte messages into 64-byte digests. */
+typedef void (*StageFn)(const unsigned char (*in)[64], unsigned char (*out)[64], size_t n);
+
+#define X11_GENERIC_STAGE(name)                                                             \
+    void Generic_##name(const unsigned char (*in)[64], unsigned char (*out)[64], size_t n) \
+    {                                                                                       \
+        sph_##name##_context ctx;                                                           \
+        for (size_t l = 0; l < n; l++) {                                                    \
+            sph_##name##_init(&ctx);                                                        \
+            sph_##name(&ctx, in[l], 64);                                                    \
+            sph_##name##_close(&ctx, out[l]);                                               \
+        }                                                                                   \
+    }
+
+X11_GENERIC_STAGE(bmw512)
+X11_GENERIC_STAGE(groestl512)
+X11_GENERIC_STAGE(skein512)
+X11_GENERIC_STAGE(jh512)
+X11_GENERIC_STAGE(keccak512)
+X11_GENERIC_STAGE(luffa512)
+X11_GENERIC_STAGE(cubehash512)
+X11_GENERIC_STAGE(shavite512)
+X11_GENERIC_STAGE(simd512)
+X11_GENERIC_STAGE(echo512)
+
+#undef X11_GENERIC_STAGE
+
+/** Stages 2 to 11 of the chain; stage 1 (BLAKE) hashes the variable-length input. */
+const size_t X11_INNER_STAGES = 10;
+
+const StageFn GENERIC_STAGES[X11_INNER_STAGES] = {
+    Generic_bmw512,
+    Generic_groestl512,
+    Generic_skein512,
+    Generic_jh512,
+    Generic_keccak512,
+    Generic_luffa512,
+    Generic_cubehash512,
+    Generic_shavite512,
+    Generic_simd512,
+    Generic_echo512
+};
+
+enum {
+    STAGE_CUBEHASH = 6,
+    STAGE_SHAVITE = 7,
+    STAGE_ECHO = 9
+};
+
+/** The stages X11 and X11Batch use, see SelectStages */
+StageFn stages[X11_INNER_STAGES] = {
+    Generic_bmw512,
+    Generic_groestl512,
+    Generic_skein512,
+    Generic_jh512,
+    Generic_keccak512,
+    Generic_luffa512,
+    Generic_cubehash512,
+    Generic_shavite512,
+    Generic_simd512,
+    Generic_echo512
+};
+
+void HashLanes(const StageFn* pipeline, const unsigned char* data, size_t nLen, size_t nStride, size_t n, unsigned char* out)
+{
+    unsigned char a[X11_LANES][64];
+    unsigned char b[X11_LANES][64];
+    static const unsigned char pblank[1] = {};
+
+    sph_blake512_context ctx_blake;
+    for (size_t l = 0; l < n; l++) {
+        sph_blake512_init(&ctx_blake);
+        sph_blake512(&ctx_blake, nLen ? data + l * nStride : pblank, nLen);
+        sph_blake512_close(&ctx_blake, a[l]);
+    }
+
+    unsigned char (*in)[64] = a;
+    unsigned char (*res)[64] = b;
+    for (size_t s = 0; s < X11_INNER_STAGES; s++) {
+        pipeline[s](in, res, n);
+        unsigned char (*tmp)[64] = in;
+        in = res;
+        res = tmp;
+    }
+
+    for (size_t l = 0; l < n; l++)
+        memcpy(out + l * X11_OUTPUT_SIZE, in[l], X11_OUTPUT_SIZE);
+}
+
+#ifdef HAVE_X86_SSE41
+bool HaveSSE41AndAESNI()
+{
+    uint32_t eax, ebx, ecx, edx;
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+        return false;
+    // CPUID.1:ECX bit 25 is AES-NI, bit 19 is SSE4.1.
+    return (ecx & (1 << 25)) && (ecx & (1 << 19));
+}
+#endif
+
+/** Put the fastest stages this CPU supports into stages and return a description of them */
+const char* SelectStages()
+{
+#ifdef HAVE_X86_SSE41
+    if (HaveSSE41AndAESNI()) {
+        stages[STAGE_CUBEHASH] = x11_sse41::CubeHash512_64;
+        stages[STAGE_SHAVITE] = x11_sse41::Shavite512_64;
+        stages[STAGE_ECHO] = x11_sse41::Echo512_64;
+        return "sse4.1+aesni(cubehash,shavite,echo)";
+    }
+#endif
+    return "generic";
+}
+
+/**
+ * The stages are selected once, during static initialization: that is before
+ * main() starts any thread that could hash, so stages never changes while
+ * it's read. Hashes computed by earlier static initializers, such as the
+ * genesis blocks, use the generic stages, which give the same digests.
+ */
+const char* const pszImplementation = SelectStages();
+
+} // anon namespace
+
+void X11(const unsigned char* data, size_t len, unsigned char hash[X11_OUTPUT_SIZE])
+{
+    HashLanes(stages, data, len, 0, 1, hash);
+}
+
+void X11Batch(const unsigned char* data, size_t nLen, size_t nStride, size_t nCount, unsigned char* out)
+{
+    for (size_t i = 0; i < nCount; i += X11_LANES) {
+        size_t n = nCount - i < X11_LANES ? nCount - i : X11_LANES;
+        HashLanes(stages, data + i * nStride, nLen, nStride, n, out + i * X11_OUTPUT_SIZE);
+    }
+}
+
+void X11Reference(const unsigned char* data, size_t len, unsigned char hash[X11_OUTPUT_SIZE])
+{
+    HashLanes(GENERIC_STAGES, data, len, 0, 1, hash);
+}
+
+std::string X11Implementation()
+{
+    return pszImplementation;
+}
@@ -0,0 +1,51 @@
+// Copyright (c) 2014-2015 The Ic developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_CRYPTO_X11_H
+#define BITCOIN_CRYPTO_X11_H
+
+#if defined(HAVE_CONFIG_H)
+#include "ic-config.h"
+#endif
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string>
+
+/** Size of an X11 digest: the 512-bit output of the last stage truncated to 256 bits. */
+static const size_t X11_OUTPUT_SIZE = 32;
+
+/** Number of messages X11Batch pushes through each stage together. */
+static const size_t X11_LANES = 4;
+
+/** Compute the X11 digest of a single message. */
+void X11(const unsigned char* data, size_t len, unsigned char hash[X11_OUTPUT_SIZE]);
+
+/**
+ * Compute the X11 digests of nCount messages of nLen bytes each, the i-th of
+ * which starts at data + i * nStride. Writes nCount * X11_OUTPUT_SIZE bytes to
+ * out. Messages are hashed X11_LANES at a time, one stage after the other, so
+ * the vectorized stages can interleave independent lanes.
+ */
+void X11Batch(const unsigned char* data, size_t nLen, size_t nStride, size_t nCount, unsigned char* out);
+
+/** Compute the X11 digest using only the portable sphlib code (for testing). */
+void X11Reference(const unsigned char* data, size_t len, unsigned char hash[X11_OUTPUT_SIZE]);
+
+/**
+ * Describe the X11 implementation in use, the fastest one this CPU supports.
+ * It is selected once at startup, before main() runs.
+ */
+std::string X11Implementation();
+
+#ifdef ENABLE_X11_SSE41
+namespace x11_sse41 {
+/** Stages over n <= X11_LANES 64-byte messages, built with SSE4.1/AES-NI (crypto/x11_sse41.cpp). */
+void CubeHash512_64(const unsigned char (*in)[64], unsigned char (*out)[64], size_t n);
+void Shavite512_64(const unsigned char (*in)[64], unsigned char (*out)[64], size_t n);
+void Echo512_64(const unsigned char (*in)[64], unsigned char (*out)[64], size_t n);
+}
+#endif
+
+#endif // BITCOIN_CRYPTO_X11_H
@@ -0,0 +1,290 @@
+// Copyright (c) 2014-2015 The Ic developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+// SSE4.1/AES-NI implementations of the CubeHash-512, SHAvite-3-512 and
+// ECHO-512 stages of X11, specialized for the 64-byte messages that every
+// inner X11 stage hashes. Up to X11_LANES independent messages are processed
+// in lockstep so that the latency of each AESENC (or dependent add/rotate
+// chain) is hidden behind the rounds of the other lanes. Results are
+// bit-for-bit identical to the corresponding sphlib functions.
+
+#include "crypto/x11.h"
+
+#ifdef ENABLE_X11_SSE41
+
+#include <stdint.h>
+#include <string.h>
+#include <immintrin.h>
+
+namespace x11_sse41 {
+
+namespace {
+
+/** ECHO MixColumns doubling: multiply each byte by x in GF(2^8). */
+inline __m128i XTime(__m128i x)
+{
+    const __m128i mask = _mm_cmplt_epi8(x, _mm_setzero_si128());
+    return _mm_xor_si128(_mm_add_epi8(x, x), _mm_and_si128(mask, _mm_set1_epi8(0x1b)));
+}
+
+inline void EchoMixColumn(__m128i* W, int ia, int ib, int ic, int id)
+{
+    const __m128i a = W[ia], b = W[ib], c = W[ic], d = W[id];
+    const __m128i ab = _mm_xor_si128(a, b);
+    const __m128i bc = _mm_xor_si128(b, c);
+    const __m128i cd = _mm_xor_si128(c, d);
+    const __m128i abx = XTime(ab);
+    const __m128i bcx = XTime(bc);
+    const __m128i cdx = XTime(cd);
+    W[ia] = _mm_xor_si128(abx, _mm_xor_si128(bc, d));
+    W[ib] = _mm_xor_si128(bcx, _mm_xor_si128(a, cd));
+    W[ic] = _mm_xor_si128(cdx, _mm_xor_si128(ab, d));
+    W[id] = _mm_xor_si128(_mm_xor_si128(abx, bcx), _mm_xor_si128(_mm_xor_si128(cdx, ab), c));
+}
+
+inline void EchoShiftRows(__m128i* W)
+{
+    __m128i t;
+    t = W[1]; W[1] = W[5]; W[5] = W[9]; W[9] = W[13]; W[13] = t;
+    t = W[2]; W[2] = W[10]; W[10] = t;
+    t = W[6]; W[6] = W[14]; W[14] = t;
+    t = W[15]; W[15] = W[11]; W[11] = W[7]; W[7] = W[3]; W[3] = t;
+}
+
+/** SHAvite-3 message expansion for one 128-byte block (448 round key words). */
+void ShaviteExpand(uint32_t rk[448], const unsigned char* block, uint32_t count0, uint32_t count1, uint32_t count2, uint32_t count3)
+{
+    const __m128i zero = _mm_setzero_si128();
+    memcpy(rk, block, 128);
+    size_t u = 32;
+    for (;;) {
+        for (int s = 0; s < 4; s++) {
+            for (int half = 0; half < 2; half++) {
+                __m128i x = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*)&rk[u - 32]), 0x39);
+                x = _mm_aesenc_si128(x, zero);
+                x = _mm_xor_si128(x, _mm_loadu_si128((const __m128i*)&rk[u - 4]));
+                if (u == 32)
+                    x = _mm_xor_si128(x, _mm_set_epi32(~count3, count2, count1, count0));
+                else if (u == 164)
+                    x = _mm_xor_si128(x, _mm_set_epi32(~count0, count1, count2, count3));
+                else if (u == 316)
+                    x = _mm_xor_si128(x, _mm_set_epi32(~count1, count0, count3, count2));
+                else if (u == 440)
+                    x = _mm_xor_si128(x, _mm_set_epi32(~count2, count3, count0, count1));
+                _mm_storeu_si128((__m128i*)&rk[u], x);
+                u += 4;
+            }
+        }
+        if (u == 448)
+            break;
+        for (int s = 0; s < 8; s++) {
+            __m128i x = _mm_xor_si128(_mm_loadu_si128((const __m128i*)&rk[u - 32]), _mm_loadu_si128((const __m128i*)&rk[u - 7]));
+            _mm_storeu_si128((__m128i*)&rk[u], x);
+            u += 4;
+        }
+    }
+}
+
+const uint32_t SHAVITE512_IV[16] = {
+    0x72FCCDD8, 0x79CA4727, 0x128A077B, 0x40D55AEC,
+    0xD1901A06, 0x430AE307, 0xB29F5CD1, 0xDF07FBFC,
+    0x8E45D73D, 0x681AB538, 0xBDE86578, 0xDD577E47,
+    0xE275EADE, 0x502D9FCD, 0xB9357178, 0x022A4B9A
+};
+
+const uint32_t CUBEHASH512_IV[32] = {
+    0x2AEA2A61, 0x50F494D4, 0x2D538B8B, 0x4167D83E,
+    0x3FEE2313, 0xC701CF8C, 0xCC39968E, 0x50AC5695,
+    0x4D42C787, 0xA647A8B3, 0x97CF0BEF, 0x825B4537,
+    0xEEF864D2, 0xF22090C4, 0xD0E5CD33, 0xA23911AE,
+    0xFCD398D9, 0x148FE485, 0x1B017BEF, 0xB6444532,
+    0x6A536159, 0x2FF5781C, 0x91FA7934, 0x0DBADEA9,
+    0xD65C8A2B, 0xA5A70E75, 0xB1C62456, 0xBC796576,
+    0x1921C8F7, 0xE7989AF1, 0x7795D246, 0xD43E3B44
+};
+
+template <int n>
+inline __m128i RotL32(__m128i x)
+{
+    return _mm_or_si128(_mm_slli_epi32(x, n), _mm_srli_epi32(x, 32 - n));
+}
+
+/**
+ * Sixteen CubeHash rounds over the state of each lane. x[0..3] hold words
+ * 0-15 and x[4..7] words 16-31; the word swaps of the round function are
+ * folded into register renaming and 32-bit shuffles.
+ */
+void CubeHashSixteenRounds(__m128i (*x)[8], size_t n)
+{
+    for (int r = 0; r < 16; r++) {
+        for (size_t l = 0; l < n; l++) {
+            __m128i* s = x[l];
+            s[4] = _mm_add_epi32(s[0], s[4]);
+            s[5] = _mm_add_epi32(s[1], s[5]);
+            s[6] = _mm_add_epi32(s[2], s[6]);
+            s[7] = _mm_add_epi32(s[3], s[7]);
+            __m128i y0 = s[2], y1 = s[3], y2 = s[0], y3 = s[1];
+            s[0] = _mm_xor_si128(RotL32<7>(y0), s[4]);
+            s[1] = _mm_xor_si128(RotL32<7>(y1), s[5]);
+            s[2] = _mm_xor_si128(RotL32<7>(y2), s[6]);
+            s[3] = _mm_xor_si128(RotL32<7>(y3), s[7]);
+            s[4] = _mm_shuffle_epi32(s[4], 0x4e);
+            s[5] = _mm_shuffle_epi32(s[5], 0x4e);
+            s[6] = _mm_shuffle_epi32(s[6], 0x4e);
+            s[7] = _mm_shuffle_epi32(s[7], 0x4e);
+            s[4] = _mm_add_epi32(s[0], s[4]);
+            s[5] = _mm_add_epi32(s[1], s[5]);
+            s[6] = _mm_add_epi32(s[2], s[6]);
+            s[7] = _mm_add_epi32(s[3], s[7]);
+            y0 = s[1]; y1 = s[0]; y2 = s[3]; y3 = s[2];
+            s[0] = _mm_xor_si128(RotL32<11>(y0), s[4]);
+            s[1] = _mm_xor_si128(RotL32<11>(y1), s[5]);
+            s[2] = _mm_xor_si128(RotL32<11>(y2), s[6]);
+            s[3] = _mm_xor_si128(RotL32<11>(y3), s[7]);
+            s[4] = _mm_shuffle_epi32(s[4], 0xb1);
+            s[5] = _mm_shuffle_epi32(s[5], 0xb1);
+            s[6] = _mm_shuffle_epi32(s[6], 0xb1);
+            s[7] = _mm_shuffle_epi32(s[7], 0xb1);
+        }
+    }
+}
+
+} // anon namespace
+
+void CubeHash512_64(const unsigned char (*in)[64], unsigned char (*out)[64], size_t n)
+{
+    __m128i x[X11_LANES][8];
+
+    for (size_t l = 0; l < n; l++)
+        for (int i = 0; i < 8; i++)
+            x[l][i] = _mm_loadu_si128((const __m128i*)&CUBEHASH512_IV[4 * i]);
+
+    // Two 32-byte message blocks, then the padding block holding just 0x80.
+    for (int b = 0; b < 2; b++) {
+        for (size_t l = 0; l < n; l++) {
+            x[l][0] = _mm_xor_si128(x[l][0], _mm_loadu_si128((const __m128i*)&in[l][32 * b]));
+            x[l][1] = _mm_xor_si128(x[l][1], _mm_loadu_si128((const __m128i*)&in[l][32 * b + 16]));
+        }
+        CubeHashSixteenRounds(x, n);
+    }
+    for (size_t l = 0; l < n; l++)
+        x[l][0] = _mm_xor_si128(x[l][0], _mm_set_epi32(0, 0, 0, 0x80));
+    CubeHashSixteenRounds(x, n);
+
+    // Finalization: flip the last state bit and run 10 * 16 more rounds.
+    for (size_t l = 0; l < n; l++)
+        x[l][7] = _mm_xor_si128(x[l][7], _mm_set_epi32(1, 0, 0, 0));
+    for (int i = 0; i < 10; i++)
+        CubeHashSixteenRounds(x, n);
+
+    for (size_t l = 0; l < n; l++)
+        for (int i = 0; i < 4; i++)
+            _mm_storeu_si128((__m128i*)&out[l][16 * i], x[l][i]);
+}
+
+void Shavite512_64(const unsigned char (*in)[64], unsigned char (*out)[64], size_t n)
+{
+    const __m128i zero = _mm_setzero_si128();
+    uint32_t rk[X11_LANES][448];
+    __m128i P[X11_LANES][4];
+
+    for (size_t l = 0; l < n; l++) {
+        // Single padded block: 0x80, the 512-bit message length at byte 110
+        // and the 512-bit digest size at byte 126.
+        unsigned char block[128] = {0};
+        memcpy(block, in[l], 64);
+        block[64] = 0x80;
+        block[111] = 0x02;
+        block[127] = 0x02;
+        ShaviteExpand(rk[l], block, 512, 0, 0, 0);
+        for (int i = 0; i < 4; i++)
+            P[l][i] = _mm_loadu_si128((const __m128i*)&SHAVITE512_IV[4 * i]);
+    }
+
+    for (int r = 0, u = 0; r < 14; r++, u += 32) {
+        for (size_t l = 0; l < n; l++) {
+            const __m128i* k = (const __m128i*)&rk[l][u];
+            __m128i x = _mm_xor_si128(P[l][1], _mm_loadu_si128(k + 0));
+            __m128i y = _mm_xor_si128(P[l][3], _mm_loadu_si128(k + 4));
+            x = _mm_aesenc_si128(x, _mm_loadu_si128(k + 1));
+            y = _mm_aesenc_si128(y, _mm_loadu_si128(k + 5));
+            x = _mm_aesenc_si128(x, _mm_loadu_si128(k + 2));
+            y = _mm_aesenc_si128(y, _mm_loadu_si128(k + 6));
+            x = _mm_aesenc_si128(x, _mm_loadu_si128(k + 3));
+            y = _mm_aesenc_si128(y, _mm_loadu_si128(k + 7));
+            x = _mm_aesenc_si128(x, zero);
+            y = _mm_aesenc_si128(y, zero);
+            const __m128i p0 = _mm_xor_si128(P[l][0], x);
+            const __m128i p2 = _mm_xor_si128(P[l][2], y);
+            P[l][0] = P[l][3];
+            P[l][3] = p2;
+            P[l][2] = P[l][1];
+            P[l][1] = p0;
+        }
+    }
+
+    for (size_t l = 0; l < n; l++) {
+        for (int i = 0; i < 4; i++) {
+            __m128i h = _mm_xor_si128(_mm_loadu_si128((const __m128i*)&SHAVITE512_IV[4 * i]), P[l][i]);
+            _mm_storeu_si128((__m128i*)&out[l][16 * i], h);
+        }
+    }
+}
+
+void Echo512_64(const unsigned char (*in)[64], unsigned char (*out)[64], size_t n)
+{
+    const __m128i zero = _mm_setzero_si128();
+    // Chaining value: every 128-bit word holds the 512-bit digest size.
+    const __m128i iv = _mm_set_epi32(0, 0, 0, 512);
+    // Padding words of the single 128-byte block: 0x80 after the message,
+    // the digest size at byte 110 and the 512-bit counter at byte 112.
+    const __m128i pad[4] = {
+        _mm_set_epi32(0, 0, 0, 0x80),
+        zero,
+        _mm_set_epi32(0x02000000, 0, 0, 0),
+        _mm_set_epi32(0, 0, 0, 512)
+    };
+    __m128i W[X11_LANES][16];
+
+    for (size_t l = 0; l < n; l++) {
+        for (int i = 0; i < 8; i++)
+            W[l][i] = iv;
+        for (int i = 0; i < 4; i++)
+            W[l][8 + i] = _mm_loadu_si128((const __m128i*)&in[l][16 * i]);
+        for (int i = 0; i < 4; i++)
+            W[l][12 + i] = pad[i];
+    }
+
+    __m128i k = _mm_set_epi32(0, 0, 0, 512);
+    const __m128i one = _mm_set_epi32(0, 0, 0, 1);
+    for (int r = 0; r < 10; r++) {
+        // The counter never exceeds 512 + 160, so the key increment cannot carry.
+        for (int i = 0; i < 16; i++) {
+            for (size_t l = 0; l < n; l++)
+                W[l][i] = _mm_aesenc_si128(W[l][i], k);
+            for (size_t l = 0; l < n; l++)
+                W[l][i] = _mm_aesenc_si128(W[l][i], zero);
+            k = _mm_add_epi32(k, one);
+        }
+        for (size_t l = 0; l < n; l++) {
+            EchoShiftRows(W[l]);
+            EchoMixColumn(W[l], 0, 1, 2, 3);
+            EchoMixColumn(W[l], 4, 5, 6, 7);
+            EchoMixColumn(W[l], 8, 9, 10, 11);
+            EchoMixColumn(W[l], 12, 13, 14, 15);
+        }
+    }
+
+    for (size_t l = 0; l < n; l++) {
+        for (int i = 0; i < 8; i++) {
+            const __m128i block = i < 4 ? _mm_loadu_si128((const __m128i*)&in[l][16 * i]) : pad[i - 4];
+            __m128i h = _mm_xor_si128(_mm_xor_si128(iv, block), _mm_xor_si128(W[l][i], W[l][8 + i]));
+            _mm_storeu_si128((__m128i*)&out[l][16 * i], h);
+        }
+    }
+}
+
+} // namespace x11_sse41
+
+#endif // ENABLE_X11_SSE41
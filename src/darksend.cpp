@@ -14,6 +14,7 @@
 #include <boost/filesystem.hpp>
 #include <boost/filesystem/fstream.hpp>
 #include <boost/lexical_cast.hpp>
+#include <boost/thread.hpp>
 
 #include <algorithm>
 #include <boost/assign/list_of.hpp>
@@ -26,12 +27,15 @@ using namespace boost;
 CDarksendPool darkSendPool;
 // A helper object for signing messages from Masternodes
 CDarkSendSigner darkSendSigner;
+// Checks message signatures for the masternode, budget and InstantX managers
+CDarkSendVerifier darkSendVerifier;
 // The current Darksends in progress on the network
 std::vector<CDarksendQueue> vecDarksendQueue;
 // Keep track of the used Masternodes
 std::vector<CTxIn> vecMasternodesUsed;
 // Keep track of the scanning errors I've seen
 map<uint256, CDarksendBroadcastTx> mapDarksendBroadcastTxes;
+CCriticalSection cs_mapDarksendBroadcastTxes;
 // Keep track of the active Masternode
 CActiveMasternode activeMasternode;
 
@@ -46,6 +50,8 @@ void CDarksendPool::ProcessMessageDarksend(CNode* pfrom, std::string& strCommand
     if(fLiteMode) return; //disable all Darksend/Masternode related functionality
     if(!masternodeSync.IsBlockchainSynced()) return;
 
+    LOCK(cs_process_message);
+
     if (strCommand == "dsa") { //Darksend Accept Into Pool
 
         int errorID;
@@ -145,7 +151,7 @@ void CDarksendPool::ProcessMessageDarksend(CNode* pfrom, std::string& strCommand
             }
             mnodeman.nDsqCount++;
             pmn->nLastDsq = mnodeman.nDsqCount;
-            pmn->allowFreeTx = true;
+            mnodeman.AllowFreeTx(dsq.vin);
 
             LogPrint("darksend", "dsq - new Darksend queue object - %s\n", addr.ToString());
             vecDarksendQueue.push_back(dsq);
@@ -612,14 +618,17 @@ void CDarksendPool::CheckFinalTransaction()
             return;
         }
 
-        if(!mapDarksendBroadcastTxes.count(txNew.GetHash())){
-            CDarksendBroadcastTx dstx;
-            dstx.tx = txNew;
-            dstx.vin = activeMasternode.vin;
-            dstx.vchSig = vchSig;
-            dstx.sigTime = sigTime;
-
-            mapDarksendBroadcastTxes.insert(make_pair(txNew.GetHash(), dstx));
+        {
+            LOCK(cs_mapDarksendBroadcastTxes);
+            if(!mapDarksendBroadcastTxes.count(txNew.GetHash())){
+                CDarksendBroadcastTx dstx;
+                dstx.tx = txNew;
+                dstx.vin = activeMasternode.vin;
+                dstx.vchSig = vchSig;
+                dstx.sigTime = sigTime;
+
+                mapDarksendBroadcastTxes.insert(make_pair(txNew.GetHash(), dstx));
+            }
         }
 
         CInv inv(MSG_DSTX, txNew.GetHash());
@@ -2095,22 +2104,139 @@ bool CDarkSendSigner::SignMessage(std::string strMessage, std::string& errorMess
     return true;
 }
 
-bool CDarkSendSigner::VerifyMessage(CPubKey pubkey, vector<unsigned char>& vchSig, std::string strMessage, std::string& errorMessage)
+bool CDarkSendSigner::RecoverMessageKey(const std::string& strMessage, const vector<unsigned char>& vchSig, CKeyID& keyID)
 {
     CHashWriter ss(SER_GETHASH, 0);
     ss << strMessageMagic;
     ss << strMessage;
+    uint256 hashMessage = ss.GetHash();
 
-    CPubKey pubkey2;
-    if (!pubkey2.RecoverCompact(ss.GetHash(), vchSig)) {
+    // The same message reaches us from many peers, and is checked again when it is processed
+    uint256 hashEntry = Hash(BEGIN(hashMessage), END(hashMessage), vchSig.begin(), vchSig.end());
+    {
+        LOCK(cs_mapRecoveredKeys);
+        std::map<uint256, CKeyID>::const_iterator it = mapRecoveredKeys.find(hashEntry);
+        if (it != mapRecoveredKeys.end()) {
+            keyID = it->second;
+            return keyID != CKeyID();
+        }
+    }
+
+    CPubKey pubkey;
+    bool fRecovered = pubkey.RecoverCompact(hashMessage, vchSig);
+    keyID = fRecovered ? pubkey.GetID() : CKeyID();
+
+    LOCK(cs_mapRecoveredKeys);
+    if (mapRecoveredKeys.size() >= MAX_RECOVERED_KEYS) {
+        // Evict a random entry
+        std::map<uint256, CKeyID>::iterator it = mapRecoveredKeys.lower_bound(GetRandHash());
+        mapRecoveredKeys.erase(it == mapRecoveredKeys.end() ? mapRecoveredKeys.begin() : it);
+    }
+    mapRecoveredKeys.insert(make_pair(hashEntry, keyID));
+    return fRecovered;
+}
+
+bool CDarkSendSigner::VerifyMessage(CPubKey pubkey, vector<unsigned char>& vchSig, std::string strMessage, std::string& errorMessage)
+{
+    CKeyID keyID;
+    if (!RecoverMessageKey(strMessage, vchSig, keyID)) {
         errorMessage = _("Error recovering public key.");
         return false;
     }
 
-    if (fDebug && pubkey2.GetID() != pubkey.GetID())
-        LogPrintf("CDarkSendSigner::VerifyMessage -- keys don't match: %s %s\n", pubkey2.GetID().ToString(), pubkey.GetID().ToString());
+    if (fDebug && keyID != pubkey.GetID())
+        LogPrintf("CDarkSendSigner::VerifyMessage -- keys don't match: %s %s\n", keyID.ToString(), pubkey.GetID().ToString());
 
-    return (pubkey2.GetID() == pubkey.GetID());
+    return (keyID == pubkey.GetID());
+}
+
+void CDarkSendVerifier::Start(boost::thread_group& threadGroup, int nThreadsIn)
+{
+    nThreads = nThreadsIn;
+    for (int i = 0; i < nThreads; i++)
+        threadGroup.create_thread(boost::bind(&TraceThread<boost::function<void()> >, "mnverify", boost::function<void()>(boost::bind(&CDarkSendVerifier::ThreadVerify, this))));
+}
+
+bool CDarkSendVerifier::Queue(CNode* pfrom, const std::vector<CDarkSendSigCheck>& vChecks, const boost::function<void(CNode*)>& fnProcess)
+{
+    if (nThreads == 0) {
+        fnProcess(pfrom);
+        return true;
+    }
+
+    boost::unique_lock<boost::mutex> lock(mutex);
+    if (nJobs >= MAX_DARKSEND_VERIFY_QUEUE) {
+        LogPrint("masternode", "CDarkSendVerifier::Queue - queue full, dropping message from peer=%d\n", pfrom->id);
+        return false;
+    }
+
+    {
+        LOCK(cs_vNodes);
+        pfrom->AddRef();
+    }
+
+    CJob job;
+    job.pfrom = pfrom;
+    job.vChecks = vChecks;
+    job.fnProcess = fnProcess;
+    job.fChecked = false;
+    std::list<CJob>::iterator it = listJobs.insert(listJobs.end(), job);
+    nJobs++;
+    if (itNextJob == listJobs.end())
+        itNextJob = it;
+    condWork.notify_one();
+    return true;
+}
+
+void CDarkSendVerifier::ThreadVerify()
+{
+    // Messages taken at once, so workers do not contend on the queue for every signature
+    static const size_t nBatchSize = 16;
+
+    while (true) {
+        std::vector<std::list<CJob>::iterator> vBatch;
+        {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            while (itNextJob == listJobs.end())
+                condWork.wait(lock);
+            while (itNextJob != listJobs.end() && vBatch.size() < nBatchSize)
+                vBatch.push_back(itNextJob++);
+        }
+
+        // Jobs up to itNextJob are not touched by other workers until they are checked
+        BOOST_FOREACH(std::list<CJob>::iterator it, vBatch) {
+            BOOST_FOREACH(const CDarkSendSigCheck& check, it->vChecks) {
+                CKeyID keyID;
+                darkSendSigner.RecoverMessageKey(check.first, check.second, keyID);
+            }
+        }
+
+        boost::unique_lock<boost::mutex> lock(mutex);
+        BOOST_FOREACH(std::list<CJob>::iterator it, vBatch)
+            it->fChecked = true;
+
+        // Whoever gets here first processes the checked messages at the front of the queue
+        if (fProcessing)
+            continue;
+        fProcessing = true;
+        while (!listJobs.empty() && listJobs.front().fChecked) {
+            CJob job = listJobs.front();
+            listJobs.pop_front();
+            nJobs--;
+            lock.unlock();
+            try {
+                job.fnProcess(job.pfrom);
+            } catch (std::exception& e) {
+                PrintExceptionContinue(&e, "CDarkSendVerifier::ThreadVerify()");
+            }
+            {
+                LOCK(cs_vNodes);
+                job.pfrom->Release();
+            }
+            lock.lock();
+        }
+        fProcessing = false;
+    }
 }
 
 bool CDarksendQueue::Sign()
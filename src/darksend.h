@@ -13,6 +13,16 @@
 #include "darksend-relay.h"
 #include "masternode-sync.h"
 
+#include <list>
+
+#include <boost/function.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+
+namespace boost {
+    class thread_group;
+} // namespace boost
+
 class CTxIn;
 class CDarksendPool;
 class CDarkSendSigner;
@@ -49,11 +59,25 @@ class CActiveMasternode;
 static const int64_t DARKSEND_COLLATERAL = (0.01*COIN);
 static const int64_t DARKSEND_POOL_MAX = (999.99*COIN);
 
+/** Maximum number of recovered message keys CDarkSendSigner remembers */
+static const unsigned int MAX_RECOVERED_KEYS = 50000;
+/** -mnsigthreads default: threads checking masternode, budget and InstantX signatures */
+static const int DEFAULT_DARKSEND_VERIFY_THREADS = 2;
+/** Maximum number of threads checking masternode, budget and InstantX signatures */
+static const int MAX_DARKSEND_VERIFY_THREADS = 16;
+/** Maximum number of messages waiting for CDarkSendVerifier, more are dropped */
+static const size_t MAX_DARKSEND_VERIFY_QUEUE = 50000;
+
+class CDarkSendVerifier;
+
 extern CDarksendPool darkSendPool;
 extern CDarkSendSigner darkSendSigner;
+extern CDarkSendVerifier darkSendVerifier;
 extern std::vector<CDarksendQueue> vecDarksendQueue;
 extern std::string strMasterNodePrivKey;
 extern map<uint256, CDarksendBroadcastTx> mapDarksendBroadcastTxes;
+/** Protects mapDarksendBroadcastTxes, don't take other locks while holding it */
+extern CCriticalSection cs_mapDarksendBroadcastTxes;
 extern CActiveMasternode activeMasternode;
 
 /** Holds an Darksend input
@@ -244,6 +268,11 @@ public:
  */
 class CDarkSendSigner
 {
+private:
+    // key recovered from each checked signature (null if recovery failed), by hash of the signed message and signature
+    std::map<uint256, CKeyID> mapRecoveredKeys;
+    CCriticalSection cs_mapRecoveredKeys;
+
 public:
     /// Is the inputs associated with this public key? (and there is 1000 IC - checking if valid masternode)
     bool IsVinAssociatedWithPubkey(CTxIn& vin, CPubKey& pubkey);
@@ -251,10 +280,58 @@ public:
     bool SetKey(std::string strSecret, std::string& errorMessage, CKey& key, CPubKey& pubkey);
     /// Sign the message, returns true if successful
     bool SignMessage(std::string strMessage, std::string& errorMessage, std::vector<unsigned char>& vchSig, CKey key);
+    /// Recover the key that signed the message, remembering the result; returns true if successful
+    bool RecoverMessageKey(const std::string& strMessage, const std::vector<unsigned char>& vchSig, CKeyID& keyID);
     /// Verify the message, returns true if succcessful
     bool VerifyMessage(CPubKey pubkey, std::vector<unsigned char>& vchSig, std::string strMessage, std::string& errorMessage);
 };
 
+/** A signature to check ahead of processing a message: the signed string and its compact signature */
+typedef std::pair<std::string, std::vector<unsigned char> > CDarkSendSigCheck;
+
+/**
+ * Thread pool checking the signatures of masternode, budget and InstantX messages
+ * off the message handler threads. A handler queues the signatures of a message
+ * together with the function that finishes processing it. Worker threads take
+ * queued messages in batches and recover their keys, which leaves the results in
+ * darkSendSigner's cache. The functions are then called on a worker thread, in
+ * the order their messages were queued, and find their signatures checked.
+ */
+class CDarkSendVerifier
+{
+private:
+    struct CJob
+    {
+        CNode* pfrom;
+        std::vector<CDarkSendSigCheck> vChecks;
+        boost::function<void(CNode*)> fnProcess;
+        bool fChecked;
+    };
+
+    boost::mutex mutex;
+    boost::condition_variable condWork;
+    // queued messages in arrival order, up to itNextJob the ones taken by a worker
+    std::list<CJob> listJobs;
+    size_t nJobs;
+    std::list<CJob>::iterator itNextJob;
+    // whether a worker is calling the functions of checked messages
+    bool fProcessing;
+    int nThreads;
+
+    void ThreadVerify();
+
+public:
+    CDarkSendVerifier() : nJobs(0), itNextJob(listJobs.end()), fProcessing(false), nThreads(0) {}
+
+    /// Start the worker threads; without them messages are processed right away
+    void Start(boost::thread_group& threadGroup, int nThreadsIn);
+    /**
+     * Check vChecks, then call fnProcess(pfrom). pfrom is kept referenced until then.
+     * Returns false, without calling fnProcess, if MAX_DARKSEND_VERIFY_QUEUE messages are already waiting.
+     */
+    bool Queue(CNode* pfrom, const std::vector<CDarkSendSigCheck>& vChecks, const boost::function<void(CNode*)>& fnProcess);
+};
+
 /** Used to keep track of current status of Darksend pool
  */
 class CDarksendPool
@@ -262,6 +339,9 @@ class CDarksendPool
 private:
     mutable CCriticalSection cs_darksend;
 
+    // critical section to serialize message processing
+    mutable CCriticalSection cs_process_message;
+
     std::vector<CDarkSendEntry> entries; // Masternode/clients entries
     CMutableTransaction finalTransaction; // the finalized transaction ready for signing
 
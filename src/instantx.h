@@ -39,6 +39,8 @@ extern map<uint256, CTransaction> mapTxLockReqRejected;
 extern map<uint256, CConsensusVote> mapTxLockVote;
 extern map<uint256, CTransactionLock> mapTxLocks;
 extern std::map<COutPoint, uint256> mapLockedInputs;
+/** Protects mapTxLockReq, mapTxLockReqRejected, mapTxLockVote, mapTxLocks, mapLockedInputs and mapUnknownVotes, don't take other locks while holding it */
+extern CCriticalSection cs_instantx;
 extern int nCompleteTXLocks;
 
 
@@ -74,6 +76,7 @@ public:
 
     bool SignatureValid();
     bool Sign();
+    std::string GetStrMessage() const;
 
     ADD_SERIALIZE_METHODS;
 
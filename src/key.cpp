@@ -16,10 +16,11 @@
 //! anonymous namespace
 namespace {
 
+//! Sole owner of libsecp256k1's state: starts signing and verification together and stops both
 class CSecp256k1Init {
 public:
     CSecp256k1Init() {
-        secp256k1_start(SECP256K1_START_SIGN);
+        secp256k1_start(SECP256K1_START_SIGN | SECP256K1_START_VERIFY);
     }
     ~CSecp256k1Init() {
         secp256k1_stop();
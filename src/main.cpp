@@ -6,8 +6,11 @@
 
 #include "main.h"
 
+#include "addressindex.h"
 #include "addrman.h"
 #include "alert.h"
+#include "blockfilter.h"
+#include "blockreader.h"
 #include "chainparams.h"
 #include "checkpoints.h"
 #include "checkqueue.h"
@@ -58,9 +61,14 @@ int nScriptCheckThreads = 0;
 bool fImporting = false;
 bool fReindex = false;
 bool fTxIndex = true;
+bool fBlockFilterIndex = false;
+bool fAddressIndex = false;
+bool fSpentIndex = false;
+bool fTimestampIndex = false;
 bool fIsBareMultisigStd = true;
 bool fCheckBlockIndex = false;
-unsigned int nCoinCacheSize = 5000;
+bool fCheckBlockReads = false;
+size_t nCoinCacheUsage = 5000 * 300;
 bool fAlerts = DEFAULT_ALERTS;
 
 /** Fees smaller than this (in duffs) are considered zero fee (for relaying and mining)
@@ -159,11 +167,25 @@ namespace {
     /** Number of preferable block download peers. */
     int nPreferredDownload = 0;
 
+    /** Moving average of the size of downloaded blocks, 0 until the first one. Protected by cs_main. */
+    int64_t nAverageBlockSize = 0;
+
+    /** Number of blocks requested again from a faster peer because they held up the download window. Protected by cs_main. */
+    uint64_t nBlocksRerequested = 0;
+
     /** Dirty block index entries. */
     set<CBlockIndex*> setDirtyBlockIndex;
 
     /** Dirty block file entries. */
     set<int> setDirtyFileInfo;
+
+    /** Snapshot of chainActive's tip. Only the pointer swap is under cs_tipSnapshot, readers keep their copy. */
+    CCriticalSection cs_tipSnapshot;
+    boost::shared_ptr<const CChainTipSnapshot> ptipSnapshot(new CChainTipSnapshot());
+
+    /** "block" messages recently served to peers, oldest first. Protected by cs_main. */
+    map<uint256, CSerializedMessage> mapBlockMessages;
+    deque<uint256> vBlockMessages;
 } // anon namespace
 
 //////////////////////////////////////////////////////////////////////////////
@@ -272,6 +294,16 @@ struct CNodeState {
     int64_t nStallingSince;
     list<QueuedBlock> vBlocksInFlight;
     int nBlocksInFlight;
+    //! How many blocks we keep requested from this peer, sized by its download rate.
+    int nBlocksInFlightLimit;
+    //! Moving average of the rate blocks arrive at from this peer in bytes per second, or 0 if not measured yet.
+    int64_t nBlockDownloadRate;
+    //! When the last block we requested from this peer arrived (in microseconds), or 0.
+    int64_t nLastBlockReceived;
+    uint64_t nBlocksDownloaded;
+    uint64_t nBlockBytesDownloaded;
+    //! Number of blocks in flight from this peer we requested again from a faster one.
+    uint64_t nBlocksRerequested;
     //! Whether we consider this a preferred download peer.
     bool fPreferredDownload;
 
@@ -285,6 +317,12 @@ struct CNodeState {
         fSyncStarted = false;
         nStallingSince = 0;
         nBlocksInFlight = 0;
+        nBlocksInFlightLimit = MAX_BLOCKS_IN_TRANSIT_PER_PEER;
+        nBlockDownloadRate = 0;
+        nLastBlockReceived = 0;
+        nBlocksDownloaded = 0;
+        nBlockBytesDownloaded = 0;
+        nBlocksRerequested = 0;
         fPreferredDownload = false;
     }
 };
@@ -346,10 +384,22 @@ void FinalizeNode(NodeId nodeid) {
 }
 
 // Requires cs_main.
-void MarkBlockAsReceived(const uint256& hash) {
+void MarkBlockAsReceived(const uint256& hash, NodeId nodeFrom = -1, unsigned int nSize = 0) {
     map<uint256, pair<NodeId, list<QueuedBlock>::iterator> >::iterator itInFlight = mapBlocksInFlight.find(hash);
     if (itInFlight != mapBlocksInFlight.end()) {
         CNodeState *state = State(itInFlight->second.first);
+        if (itInFlight->second.first == nodeFrom && nSize > 0) {
+            // Blocks are requested in batches and arrive one after the other, so time
+            // each from its request or from the previous block, whichever came last.
+            int64_t nNow = GetTimeMicros();
+            int64_t nElapsed = std::max<int64_t>(nNow - std::max(itInFlight->second.second->nTime, state->nLastBlockReceived), 1000);
+            int64_t nRate = (int64_t)nSize * 1000000 / nElapsed;
+            state->nBlockDownloadRate = state->nBlockDownloadRate ? (4 * state->nBlockDownloadRate + nRate) / 5 : nRate;
+            state->nLastBlockReceived = nNow;
+            state->nBlocksDownloaded++;
+            state->nBlockBytesDownloaded += nSize;
+            nAverageBlockSize = nAverageBlockSize ? (15 * nAverageBlockSize + nSize) / 16 : nSize;
+        }
         nQueuedValidatedHeaders -= itInFlight->second.second->fValidatedHeaders;
         state->vBlocksInFlight.erase(itInFlight->second.second);
         state->nBlocksInFlight--;
@@ -373,6 +423,21 @@ void MarkBlockAsInFlight(NodeId nodeid, const uint256& hash, CBlockIndex *pindex
     mapBlocksInFlight[hash] = std::make_pair(nodeid, it);
 }
 
+/**
+ * Number of blocks to keep requested from a peer: enough to cover its ping
+ * time and BLOCK_DOWNLOAD_QUEUE_TIME seconds of transfer at its measured
+ * download rate, so fast peers get more of the window and slow ones less.
+ */
+int GetBlocksInFlightLimit(const CNode* pnode, CNodeState* state) {
+    if (state->nBlockDownloadRate == 0 || nAverageBlockSize == 0)
+        state->nBlocksInFlightLimit = MAX_BLOCKS_IN_TRANSIT_PER_PEER;
+    else {
+        int64_t nBytes = state->nBlockDownloadRate * (pnode->nPingUsecTime + BLOCK_DOWNLOAD_QUEUE_TIME * 1000000) / 1000000;
+        state->nBlocksInFlightLimit = std::max<int64_t>(MIN_BLOCKS_IN_TRANSIT_PER_PEER, std::min<int64_t>(MAX_ADAPTIVE_BLOCKS_IN_TRANSIT_PER_PEER, nBytes / nAverageBlockSize));
+    }
+    return state->nBlocksInFlightLimit;
+}
+
 /** Check whether the last unknown block a peer advertized is not yet known. */
 void ProcessBlockAvailability(NodeId nodeid) {
     CNodeState *state = State(nodeid);
@@ -426,8 +491,9 @@ CBlockIndex* LastCommonAncestor(CBlockIndex* pa, CBlockIndex* pb) {
 }
 
 /** Update pindexLastCommonBlock and add not-in-flight missing successors to vBlocks, until it has
- *  at most count entries. */
-void FindNextBlocksToDownload(NodeId nodeid, unsigned int count, std::vector<CBlockIndex*>& vBlocks, NodeId& nodeStaller) {
+ *  at most count entries. If nothing can be fetched because the window is held up by a block in flight
+ *  from another peer, that peer and block are returned in nodeStaller and pindexStaller. */
+void FindNextBlocksToDownload(NodeId nodeid, unsigned int count, std::vector<CBlockIndex*>& vBlocks, NodeId& nodeStaller, CBlockIndex*& pindexStaller) {
     if (count == 0)
         return;
 
@@ -463,6 +529,7 @@ void FindNextBlocksToDownload(NodeId nodeid, unsigned int count, std::vector<CBl
     int nWindowEnd = state->pindexLastCommonBlock->nHeight + BLOCK_DOWNLOAD_WINDOW;
     int nMaxHeight = std::min<int>(state->pindexBestKnownBlock->nHeight, nWindowEnd + 1);
     NodeId waitingfor = -1;
+    CBlockIndex* pindexWaitingFor = NULL;
     while (pindexWalk->nHeight < nMaxHeight) {
         // Read up to 128 (or more, if more blocks than that are needed) successors of pindexWalk (towards
         // pindexBestKnownBlock) into vToFetch. We fetch 128, because CBlockIndex::GetAncestor may be as expensive
@@ -493,6 +560,7 @@ void FindNextBlocksToDownload(NodeId nodeid, unsigned int count, std::vector<CBl
                     if (vBlocks.size() == 0 && waitingfor != nodeid) {
                         // We aren't able to fetch anything, but we would be if the download window was one larger.
                         nodeStaller = waitingfor;
+                        pindexStaller = pindexWaitingFor;
                     }
                     return;
                 }
@@ -503,6 +571,7 @@ void FindNextBlocksToDownload(NodeId nodeid, unsigned int count, std::vector<CBl
             } else if (waitingfor == -1) {
                 // This is the first already-in-flight block.
                 waitingfor = mapBlocksInFlight[pindex->GetBlockHash()].first;
+                pindexWaitingFor = pindex;
             }
         }
     }
@@ -522,9 +591,24 @@ bool GetNodeStateStats(NodeId nodeid, CNodeStateStats &stats) {
         if (queue.pindex)
             stats.vHeightInFlight.push_back(queue.pindex->nHeight);
     }
+    stats.nBlockDownloadRate = state->nBlockDownloadRate;
+    stats.nBlocksInFlightLimit = state->nBlocksInFlightLimit;
+    stats.nBlocksDownloaded = state->nBlocksDownloaded;
+    stats.nBlockBytesDownloaded = state->nBlockBytesDownloaded;
+    stats.nBlocksRerequested = state->nBlocksRerequested;
     return true;
 }
 
+void GetBlockDownloadStats(CBlockDownloadStats &stats) {
+    LOCK(cs_main);
+    stats.nBlocksInFlight = mapBlocksInFlight.size();
+    stats.nPeersDownloading = 0;
+    for (map<NodeId, CNodeState>::const_iterator it = mapNodeState.begin(); it != mapNodeState.end(); ++it)
+        stats.nPeersDownloading += (it->second.nBlocksInFlight > 0);
+    stats.nAverageBlockSize = nAverageBlockSize;
+    stats.nBlocksRerequested = nBlocksRerequested;
+}
+
 void RegisterNodeSignals(CNodeSignals& nodeSignals)
 {
     nodeSignals.GetHeight.connect(&GetHeight);
@@ -560,6 +644,7 @@ CBlockIndex* FindForkInGlobalIndex(const CChain& chain, const CBlockLocator& loc
 
 CCoinsViewCache *pcoinsTip = NULL;
 CBlockTreeDB *pblocktree = NULL;
+CBlockFilterDB *pblockfilterdb = NULL;
 
 //////////////////////////////////////////////////////////////////////////////
 //
@@ -881,9 +966,12 @@ int GetInputAgeIX(uint256 nTXHash, CTxIn& vin)
     if(nResult < 0) nResult = 0;
 
     if (nResult < 6){
-        std::map<uint256, CTransactionLock>::iterator i = mapTxLocks.find(nTXHash);
-        if (i != mapTxLocks.end()){
-            sigs = (*i).second.CountSignatures();
+        {
+            LOCK(cs_instantx);
+            std::map<uint256, CTransactionLock>::iterator i = mapTxLocks.find(nTXHash);
+            if (i != mapTxLocks.end()){
+                sigs = (*i).second.CountSignatures();
+            }
         }
         if(sigs >= INSTANTX_SIGNATURES_REQUIRED){
             return nInstantXDepth+nResult;
@@ -897,9 +985,12 @@ int GetIXConfirmations(uint256 nTXHash)
 {    
     int sigs = 0;
 
-    std::map<uint256, CTransactionLock>::iterator i = mapTxLocks.find(nTXHash);
-    if (i != mapTxLocks.end()){
-        sigs = (*i).second.CountSignatures();
+    {
+        LOCK(cs_instantx);
+        std::map<uint256, CTransactionLock>::iterator i = mapTxLocks.find(nTXHash);
+        if (i != mapTxLocks.end()){
+            sigs = (*i).second.CountSignatures();
+        }
     }
     if(sigs >= INSTANTX_SIGNATURES_REQUIRED){
         return nInstantXDepth;
@@ -996,6 +1087,16 @@ CAmount GetMinRelayFee(const CTransaction& tx, unsigned int nBytes, bool fAllowF
 }
 
 
+/** Expire old transactions and evict the lowest fee rate packages until the pool fits -maxmempool */
+static void LimitMempoolSize(CTxMemPool& pool, size_t limit, unsigned long age)
+{
+    int expired = pool.Expire(GetTime() - age);
+    if (expired != 0)
+        LogPrint("mempool", "Expired %i transactions from the memory pool\n", expired);
+
+    pool.TrimToSize(limit);
+}
+
 bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransaction &tx, bool fLimitFree,
                         bool* pfMissingInputs, bool fRejectInsaneFee, bool ignoreFees)
 {
@@ -1025,12 +1126,15 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransa
 
     // ----------- instantX transaction scanning -----------
 
-    BOOST_FOREACH(const CTxIn& in, tx.vin){
-        if(mapLockedInputs.count(in.prevout)){
-            if(mapLockedInputs[in.prevout] != tx.GetHash()){
-                return state.DoS(0,
-                                 error("AcceptToMemoryPool : conflicts with existing transaction lock: %s", reason),
-                                 REJECT_INVALID, "tx-lock-conflict");
+    {
+        LOCK(cs_instantx);
+        BOOST_FOREACH(const CTxIn& in, tx.vin){
+            if(mapLockedInputs.count(in.prevout)){
+                if(mapLockedInputs[in.prevout] != tx.GetHash()){
+                    return state.DoS(0,
+                                     error("AcceptToMemoryPool : conflicts with existing transaction lock: %s", reason),
+                                     REJECT_INVALID, "tx-lock-conflict");
+                }
             }
         }
     }
@@ -1115,7 +1219,12 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransa
 
         // Don't accept it if it can't get into a block
         // but prioritise dstx and don't check fees for it
-        if(mapDarksendBroadcastTxes.count(hash)) {
+        bool fDarksendBroadcastTx;
+        {
+            LOCK(cs_mapDarksendBroadcastTxes);
+            fDarksendBroadcastTx = mapDarksendBroadcastTxes.count(hash);
+        }
+        if(fDarksendBroadcastTx) {
             mempool.PrioritiseTransaction(hash, hash.ToString(), 1000, 0.1*COIN);
         } else if(!ignoreFees){
             CAmount txMinFee = GetMinRelayFee(tx, nSize, true);
@@ -1124,6 +1233,11 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransa
                                           hash.ToString(), nFees, txMinFee),
                                  REJECT_INSUFFICIENTFEE, "insufficient fee");
 
+            // A full pool raises the bar to the fee rate of what it last evicted
+            CAmount mempoolRejectFee = pool.GetMinFee(GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000).GetFee(nSize);
+            if (mempoolRejectFee > 0 && nFees < mempoolRejectFee)
+                return state.DoS(0, false, REJECT_INSUFFICIENTFEE, "mempool min fee not met");
+
             // Require that free transactions have sufficient priority to be mined in the next block.
             if (GetBoolArg("-relaypriority", true) && nFees < ::minRelayTxFee.GetFee(nSize) && !AllowFree(view.GetPriority(tx, chainActive.Height() + 1))) {
                 return state.DoS(0, false, REJECT_INSUFFICIENTFEE, "insufficient priority");
@@ -1182,6 +1296,11 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransa
 
         // Store transaction in memory
         pool.addUnchecked(hash, entry);
+
+        // trim mempool and check if tx was trimmed
+        LimitMempoolSize(pool, GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000, GetArg("-mempoolexpiry", DEFAULT_MEMPOOL_EXPIRY) * 60 * 60);
+        if (!pool.exists(hash))
+            return state.DoS(0, false, REJECT_INSUFFICIENTFEE, "mempool full");
     }
 
     SyncWithWallets(tx, NULL);
@@ -1219,12 +1338,15 @@ bool AcceptableInputs(CTxMemPool& pool, CValidationState &state, const CTransact
 
     // ----------- instantX transaction scanning -----------
 
-    BOOST_FOREACH(const CTxIn& in, tx.vin){
-        if(mapLockedInputs.count(in.prevout)){
-            if(mapLockedInputs[in.prevout] != tx.GetHash()){
-                return state.DoS(0,
-                                 error("AcceptableInputs : conflicts with existing transaction lock: %s", reason),
-                                 REJECT_INVALID, "tx-lock-conflict");
+    {
+        LOCK(cs_instantx);
+        BOOST_FOREACH(const CTxIn& in, tx.vin){
+            if(mapLockedInputs.count(in.prevout)){
+                if(mapLockedInputs[in.prevout] != tx.GetHash()){
+                    return state.DoS(0,
+                                     error("AcceptableInputs : conflicts with existing transaction lock: %s", reason),
+                                     REJECT_INVALID, "tx-lock-conflict");
+                }
             }
         }
     }
@@ -1479,39 +1601,100 @@ bool WriteBlockToDisk(CBlock& block, CDiskBlockPos& pos)
     return true;
 }
 
-bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos)
+/** Whether no more blocks will be written to a block file */
+static bool IsBlockFileFinished(int nFile)
 {
-    block.SetNull();
+    // While reindexing, the block files are revisited from the start
+    LOCK(cs_LastBlockFile);
+    return nFile < nLastBlockFile && !fReindex;
+}
 
-    // Open history file to read
-    CAutoFile filein(OpenBlockFile(pos, true), SER_DISK, CLIENT_VERSION);
-    if (filein.IsNull())
-        return error("ReadBlockFromDisk : OpenBlockFile failed");
+bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos, bool fCheckPOW)
+{
+    block.SetNull();
 
-    // Read block
-    try {
-        filein >> block;
-    }
-    catch (std::exception &e) {
-        return error("%s : Deserialize or I/O error - %s", __func__, e.what());
-    }
+    if (!blockFileReader.Read(block, pos, IsBlockFileFinished(pos.nFile)))
+        return error("ReadBlockFromDisk : can't read block from blk%05u.dat at %u", pos.nFile, pos.nPos);
 
     // Check the header
-    if (!CheckProofOfWork(block.GetHash(), block.nBits))
+    if (fCheckPOW && !CheckProofOfWork(block.GetHash(), block.nBits))
         return error("ReadBlockFromDisk : Errors in block header");
 
     return true;
 }
 
+static bool BlockHeaderMatchesIndex(const CBlockHeader& header, const CBlockIndex* pindex)
+{
+    return header.nVersion == pindex->nVersion &&
+        header.hashPrevBlock == (pindex->pprev ? pindex->pprev->GetBlockHash() : uint256(0)) &&
+        header.hashMerkleRoot == pindex->hashMerkleRoot &&
+        header.nTime == pindex->nTime &&
+        header.nBits == pindex->nBits &&
+        header.nNonce == pindex->nNonce;
+}
+
 bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex)
 {
-    if (!ReadBlockFromDisk(block, pindex->GetBlockPos()))
+    if (fCheckBlockReads) {
+        if (!ReadBlockFromDisk(block, pindex->GetBlockPos()))
+            return false;
+        if (block.GetHash() != pindex->GetBlockHash())
+            return error("ReadBlockFromDisk(CBlock&, CBlockIndex*) : GetHash() doesn't match index");
+        return true;
+    }
+
+    // The header was validated before the block was written, and the index
+    // holds the hash of exactly these fields: if they all match, the hash
+    // matches too, so there is no need to rehash the block.
+    if (!ReadBlockFromDisk(block, pindex->GetBlockPos(), false))
         return false;
-    if (block.GetHash() != pindex->GetBlockHash())
-        return error("ReadBlockFromDisk(CBlock&, CBlockIndex*) : GetHash() doesn't match index");
+    if (!BlockHeaderMatchesIndex(block, pindex))
+        return error("ReadBlockFromDisk(CBlock&, CBlockIndex*) : block header doesn't match index");
     return true;
 }
 
+bool ReadRawBlockFromDisk(std::vector<char>& vchBlock, const CBlockIndex* pindex)
+{
+    CDiskBlockPos pos = pindex->GetBlockPos();
+    if (!blockFileReader.ReadRaw(vchBlock, pos, IsBlockFileFinished(pos.nFile)))
+        return error("ReadRawBlockFromDisk : can't read block from blk%05u.dat at %u", pos.nFile, pos.nPos);
+
+    // Same check as ReadBlockFromDisk, on the header alone
+    CBlockHeader header;
+    CDataStream ss(&vchBlock[0], &vchBlock[0] + 80, SER_DISK, CLIENT_VERSION);
+    ss >> header;
+    if (fCheckBlockReads ? header.GetHash() != pindex->GetBlockHash() : !BlockHeaderMatchesIndex(header, pindex))
+        return error("ReadRawBlockFromDisk : block header doesn't match index");
+    return true;
+}
+
+/**
+ * The "block" message for a block, read straight from disk. Recently served
+ * blocks are kept so that the peers asking for a new block all get the same
+ * buffer instead of each deserializing and serializing it again.
+ */
+static CSerializedMessage GetBlockMessage(const CBlockIndex* pindex)
+{
+    AssertLockHeld(cs_main);
+
+    map<uint256, CSerializedMessage>::iterator it = mapBlockMessages.find(pindex->GetBlockHash());
+    if (it != mapBlockMessages.end())
+        return it->second;
+
+    std::vector<char> vchBlock;
+    if (!ReadRawBlockFromDisk(vchBlock, pindex))
+        return CSerializedMessage();
+    CSerializedMessage msg = MakeSerializedMessage("block", &vchBlock[0], vchBlock.size());
+
+    if (vBlockMessages.size() >= MAX_BLOCK_MESSAGES_CACHED) {
+        mapBlockMessages.erase(vBlockMessages.front());
+        vBlockMessages.pop_front();
+    }
+    mapBlockMessages.insert(make_pair(pindex->GetBlockHash(), msg));
+    vBlockMessages.push_back(pindex->GetBlockHash());
+    return msg;
+}
+
 
 double ConvertBitsToDouble(unsigned int nBits)
 {
@@ -1717,12 +1900,13 @@ void CheckForkWarningConditionsOnNewFork(CBlockIndex* pindexNewForkTip)
     CheckForkWarningConditions();
 }
 
-// Requires cs_main.
+// Takes cs_main, the masternode and budget messages are handled without it
 void Misbehaving(NodeId pnode, int howmuch)
 {
     if (howmuch == 0)
         return;
 
+    LOCK(cs_main);
     CNodeState *state = State(pnode);
     if (state == NULL)
         return;
@@ -1897,7 +2081,7 @@ bool CheckInputs(const CTransaction& tx, CValidationState &state, const CCoinsVi
     return true;
 }
 
-bool DisconnectBlock(CBlock& block, CValidationState& state, CBlockIndex* pindex, CCoinsViewCache& view, bool* pfClean)
+bool DisconnectBlock(CBlock& block, CValidationState& state, CBlockIndex* pindex, CCoinsViewCache& view, bool* pfClean, CExplorerIndexUndo* pindexundo)
 {
     assert(pindex->GetBlockHash() == view.GetBestBlock());
 
@@ -1916,11 +2100,28 @@ bool DisconnectBlock(CBlock& block, CValidationState& state, CBlockIndex* pindex
     if (blockUndo.vtxundo.size() + 1 != block.vtx.size())
         return error("DisconnectBlock() : block and undo data inconsistent");
 
+    // Only rewind the explorer indexes when really disconnecting, not for
+    // the trial disconnects of VerifyDB
+    bool fAddressUndo = fAddressIndex && pindexundo;
+    bool fSpentUndo = fSpentIndex && pindexundo;
+    if (fTimestampIndex && pindexundo)
+        pindexundo->vTimestampIndex.push_back(CTimestampIndexKey(pindex->nTime, pindex->GetBlockHash()));
+
     // undo transactions in reverse order
     for (int i = block.vtx.size() - 1; i >= 0; i--) {
         const CTransaction &tx = block.vtx[i];
         uint256 hash = tx.GetHash();
 
+        if (fAddressUndo) {
+            for (unsigned int k = 0; k < tx.vout.size(); k++) {
+                CIndexAddress address;
+                if (!address.SetScript(tx.vout[k].scriptPubKey))
+                    continue;
+                pindexundo->vAddressIndex.push_back(make_pair(CAddressIndexKey(address, pindex->nHeight, i, hash, k, false), tx.vout[k].nValue));
+                pindexundo->vAddressUnspentIndex.push_back(make_pair(CAddressUnspentKey(address, hash, k), CAddressUnspentValue()));
+            }
+        }
+
         // Check that all outputs are available and match the outputs in the block itself
         // exactly. Note that transactions with only provably unspendable outputs won't
         // have outputs available even in the block itself, so we handle that case
@@ -1969,6 +2170,15 @@ bool DisconnectBlock(CBlock& block, CValidationState& state, CBlockIndex* pindex
                 if (coins->vout.size() < out.n+1)
                     coins->vout.resize(out.n+1);
                 coins->vout[out.n] = undo.txout;
+
+                CIndexAddress address;
+                if (fAddressUndo && address.SetScript(undo.txout.scriptPubKey)) {
+                    pindexundo->vAddressIndex.push_back(make_pair(CAddressIndexKey(address, pindex->nHeight, i, hash, j, true), -undo.txout.nValue));
+                    pindexundo->vAddressUnspentIndex.push_back(make_pair(CAddressUnspentKey(address, out.hash, out.n),
+                                                                         CAddressUnspentValue(undo.txout.nValue, undo.txout.scriptPubKey, coins->nHeight)));
+                }
+                if (fSpentUndo)
+                    pindexundo->vSpentIndex.push_back(make_pair(CSpentIndexKey(out.hash, out.n), CSpentIndexValue()));
             }
         }
     }
@@ -1990,6 +2200,8 @@ void static FlushBlockFile(bool fFinalize = false)
 
     CDiskBlockPos posOld(nLastBlockFile, 0);
 
+    if (fFinalize)
+        blockFileReader.CloseFile(nLastBlockFile);
     FILE *fileOld = OpenBlockFile(posOld);
     if (fileOld) {
         if (fFinalize)
@@ -2009,13 +2221,90 @@ void static FlushBlockFile(bool fFinalize = false)
 
 bool FindUndoPos(CValidationState &state, int nFile, CDiskBlockPos &pos, unsigned int nAddSize);
 
-static CCheckQueue<CScriptCheck> scriptcheckqueue(128);
+static CCheckQueue<CScriptCheck> scriptcheckqueue(SCRIPT_CHECK_BATCH_SIZE);
 
 void ThreadScriptCheck() {
     RenameThread("ic-scriptch");
     scriptcheckqueue.Thread();
 }
 
+/** Add the filter of a block to the filter index, its parent must be the last block indexed */
+static bool WriteBlockFilter(const CBlock& block, const CBlockUndo& blockundo, const CBlockIndex* pindex)
+{
+    uint256 hashPrevHeader;
+    if (pindex->pprev && !pblockfilterdb->ReadFilterHeader(pindex->pprev->GetBlockHash(), hashPrevHeader))
+        return error("%s : no filter header for %s", __func__, pindex->pprev->GetBlockHash().ToString());
+    CBlockFilter filter(block, blockundo);
+    return pblockfilterdb->WriteFilter(filter, filter.GetHeader(hashPrevHeader));
+}
+
+/** The next block of the active chain missing from the filter index, NULL if there is none */
+static CBlockIndex* NextBlockFilterToIndex()
+{
+    AssertLockHeld(cs_main);
+
+    uint256 hashBest;
+    if (!pblockfilterdb->ReadBestBlock(hashBest))
+        return chainActive.Genesis();
+    BlockMap::iterator mi = mapBlockIndex.find(hashBest);
+    if (mi == mapBlockIndex.end())
+        return chainActive.Genesis();
+
+    // Left on a fork by a crash, go back to where it joins the active chain
+    const CBlockIndex* pindexFork = chainActive.FindFork(mi->second);
+    if (!pindexFork)
+        return chainActive.Genesis();
+    if (pindexFork != mi->second)
+        pblockfilterdb->WriteBestBlock(pindexFork->GetBlockHash());
+    return chainActive.Next(pindexFork);
+}
+
+void ThreadBlockFilterIndex()
+{
+    RenameThread("ic-bfilter");
+    while (true)
+    {
+        boost::this_thread::interruption_point();
+
+        CBlockIndex* pindex;
+        CDiskBlockPos posUndo;
+        {
+            LOCK(cs_main);
+            pindex = NextBlockFilterToIndex();
+            if (!pindex && chainActive.Tip()) {
+                LogPrintf("%s : block filter index synced at height %d\n", __func__, chainActive.Height());
+                return;
+            }
+            if (pindex)
+                posUndo = pindex->GetUndoPos();
+        }
+        if (!pindex) {
+            // Still waiting for the genesis block to be imported
+            MilliSleep(1000);
+            continue;
+        }
+        if (pindex->nHeight % 10000 == 0)
+            LogPrintf("%s : building block filter index, at height %d\n", __func__, pindex->nHeight);
+
+        // The expensive part runs without cs_main, ConnectBlock takes over at the tip
+        CBlock block;
+        CBlockUndo blockundo;
+        if (!ReadBlockFromDisk(block, pindex) ||
+            (pindex->pprev && !blockundo.ReadFromDisk(posUndo, pindex->pprev->GetBlockHash()))) {
+            // The block may have been reorganized away meanwhile, try again with what's next then
+            LogPrintf("%s : can't read block %s, trying again\n", __func__, pindex->GetBlockHash().ToString());
+            MilliSleep(10000);
+            continue;
+        }
+
+        LOCK(cs_main);
+        if (NextBlockFilterToIndex() == pindex && !WriteBlockFilter(block, blockundo, pindex)) {
+            LogPrintf("%s : can't write the filter of block %s, block filter index stopped\n", __func__, pindex->GetBlockHash().ToString());
+            return;
+        }
+    }
+}
+
 static int64_t nTimeVerify = 0;
 static int64_t nTimeConnect = 0;
 static int64_t nTimeIndex = 0;
@@ -2036,6 +2325,8 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
     // Special case for the genesis block, skipping connection of its transactions
     // (its coinbase is unspendable)
     if (block.GetHash() == Params().HashGenesisBlock()) {
+        if (fTimestampIndex && !fJustCheck && !pblocktree->WriteTimestampIndex(CTimestampIndexKey(pindex->nTime, pindex->GetBlockHash())))
+            return state.Abort("Failed to write timestamp index");
         view.SetBestBlock(pindex->GetBlockHash());
         return true;
     }
@@ -2080,6 +2371,8 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
     CBlockUndo blockundo;
 
     CCheckQueueControl<CScriptCheck> control(fScriptChecks && nScriptCheckThreads ? &scriptcheckqueue : NULL);
+    std::vector<CScriptCheck> vChecks;
+    vChecks.reserve(SCRIPT_CHECK_BATCH_SIZE);
 
     int64_t nTimeStart = GetTimeMicros();
     CAmount nFees = 0;
@@ -2088,10 +2381,14 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
     CDiskTxPos pos(pindex->GetBlockPos(), GetSizeOfCompactSize(block.vtx.size()));
     std::vector<std::pair<uint256, CDiskTxPos> > vPos;
     vPos.reserve(block.vtx.size());
+    std::vector<std::pair<CAddressIndexKey, CAmount> > vAddressIndex;
+    std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > vAddressUnspentIndex;
+    std::vector<std::pair<CSpentIndexKey, CSpentIndexValue> > vSpentIndex;
     blockundo.vtxundo.reserve(block.vtx.size() - 1);
     for (unsigned int i = 0; i < block.vtx.size(); i++)
     {
         const CTransaction &tx = block.vtx[i];
+        const uint256 hash = tx.GetHash();
 
         nInputs += tx.vin.size();
         nSigOps += GetLegacySigOpCount(tx);
@@ -2118,10 +2415,41 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
 
             nFees += view.GetValueIn(tx)-tx.GetValueOut();
 
-            std::vector<CScriptCheck> vChecks;
             if (!CheckInputs(tx, state, view, fScriptChecks, flags, false, nScriptCheckThreads ? &vChecks : NULL))
                 return false;
-            control.Add(vChecks);
+            // Hand checks to the workers in batches rather than one transaction
+            // at a time, so small transactions don't each wake up every worker.
+            if (vChecks.size() >= SCRIPT_CHECK_BATCH_SIZE) {
+                control.Add(vChecks);
+                vChecks.clear();
+            }
+
+            // The outputs spent are only in the view until UpdateCoins below
+            if (fAddressIndex || fSpentIndex) {
+                for (unsigned int j = 0; j < tx.vin.size(); j++) {
+                    const COutPoint &prevout = tx.vin[j].prevout;
+                    const CTxOut &txout = view.AccessCoins(prevout.hash)->vout[prevout.n];
+                    CIndexAddress address;
+                    address.SetScript(txout.scriptPubKey);
+                    if (fAddressIndex && !address.IsNull()) {
+                        vAddressIndex.push_back(make_pair(CAddressIndexKey(address, pindex->nHeight, i, hash, j, true), -txout.nValue));
+                        vAddressUnspentIndex.push_back(make_pair(CAddressUnspentKey(address, prevout.hash, prevout.n), CAddressUnspentValue()));
+                    }
+                    if (fSpentIndex)
+                        vSpentIndex.push_back(make_pair(CSpentIndexKey(prevout.hash, prevout.n), CSpentIndexValue(hash, j, pindex->nHeight, txout.nValue, address)));
+                }
+            }
+        }
+
+        if (fAddressIndex) {
+            for (unsigned int k = 0; k < tx.vout.size(); k++) {
+                CIndexAddress address;
+                if (!address.SetScript(tx.vout[k].scriptPubKey))
+                    continue;
+                vAddressIndex.push_back(make_pair(CAddressIndexKey(address, pindex->nHeight, i, hash, k, false), tx.vout[k].nValue));
+                vAddressUnspentIndex.push_back(make_pair(CAddressUnspentKey(address, hash, k),
+                                                         CAddressUnspentValue(tx.vout[k].nValue, tx.vout[k].scriptPubKey, pindex->nHeight)));
+            }
         }
 
         CTxUndo undoDummy;
@@ -2130,7 +2458,7 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
         }
         UpdateCoins(tx, state, view, i == 0 ? undoDummy : blockundo.vtxundo.back(), pindex->nHeight);
 
-        vPos.push_back(std::make_pair(tx.GetHash(), pos));
+        vPos.push_back(std::make_pair(hash, pos));
         pos.nTxOffset += ::GetSerializeSize(tx, SER_DISK, CLIENT_VERSION);
     }
     int64_t nTime1 = GetTimeMicros(); nTimeConnect += nTime1 - nTimeStart;
@@ -2143,6 +2471,7 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
                                REJECT_INVALID, "bad-cb-amount");
     }
 
+    control.Add(vChecks);
     if (!control.Wait())
         return state.DoS(100, false);
     int64_t nTime2 = GetTimeMicros(); nTimeVerify += nTime2 - nTimeStart;
@@ -2174,6 +2503,27 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
         if (!pblocktree->WriteTxIndex(vPos))
             return state.Abort("Failed to write transaction index");
 
+    if (fAddressIndex) {
+        if (!pblocktree->WriteAddressIndex(vAddressIndex))
+            return state.Abort("Failed to write address index");
+        if (!pblocktree->UpdateAddressUnspentIndex(vAddressUnspentIndex))
+            return state.Abort("Failed to write address unspent index");
+    }
+
+    if (fSpentIndex)
+        if (!pblocktree->UpdateSpentIndex(vSpentIndex))
+            return state.Abort("Failed to write spent index");
+
+    if (fTimestampIndex)
+        if (!pblocktree->WriteTimestampIndex(CTimestampIndexKey(pindex->nTime, pindex->GetBlockHash())))
+            return state.Abort("Failed to write timestamp index");
+
+    // Only extend a synced filter index, ThreadBlockFilterIndex catches up otherwise
+    uint256 hashFilterBest;
+    if (fBlockFilterIndex && pblockfilterdb->ReadBestBlock(hashFilterBest) && hashFilterBest == pindex->pprev->GetBlockHash())
+        if (!WriteBlockFilter(block, blockundo, pindex))
+            return state.Abort("Failed to write block filter index");
+
     // add this block to the view's block chain
     view.SetBestBlock(pindex->GetBlockHash());
 
@@ -2206,9 +2556,11 @@ bool static FlushStateToDisk(CValidationState &state, FlushStateMode mode) {
     LOCK(cs_main);
     static int64_t nLastWrite = 0;
     try {
-    if ((mode == FLUSH_STATE_ALWAYS) ||
-        ((mode == FLUSH_STATE_PERIODIC || mode == FLUSH_STATE_IF_NEEDED) && pcoinsTip->GetCacheSize() > nCoinCacheSize) ||
-        (mode == FLUSH_STATE_PERIODIC && GetTimeMicros() > nLastWrite + DATABASE_WRITE_INTERVAL * 1000000)) {
+    // The cache is large and close to the limit, but we have time now (not in the middle of a block processing).
+    bool fCacheLarge = (mode == FLUSH_STATE_PERIODIC || mode == FLUSH_STATE_IF_NEEDED) && pcoinsTip->DynamicMemoryUsage() > nCoinCacheUsage;
+    // It's been a while since we wrote the block index and chain state to disk.
+    bool fPeriodicWrite = mode == FLUSH_STATE_PERIODIC && GetTimeMicros() > nLastWrite + DATABASE_WRITE_INTERVAL * 1000000;
+    if (mode == FLUSH_STATE_ALWAYS || fCacheLarge || fPeriodicWrite) {
         // Typical CCoins structures on disk are around 100 bytes in size.
         // Pushing a new one to the database can cause it to be written
         // twice (once in the log, and once in the tables). This is already
@@ -2238,7 +2590,9 @@ bool static FlushStateToDisk(CValidationState &state, FlushStateMode mode) {
         }
         pblocktree->Sync();
         // Finally flush the chainstate (which may refer to block index entries).
-        if (!pcoinsTip->Flush())
+        // Written entries stay cached; only when the cache outgrew its budget
+        // is half of it dropped, so block connection doesn't restart cold.
+        if (!pcoinsTip->Flush(fCacheLarge ? nCoinCacheUsage / 2 : nCoinCacheUsage))
             return state.Abort("Failed to write to coin database");
         // Update best block in wallet (so we can detect restored wallets).
         if (mode != FLUSH_STATE_IF_NEEDED) {
@@ -2257,18 +2611,38 @@ void FlushStateToDisk() {
     FlushStateToDisk(state, FLUSH_STATE_ALWAYS);
 }
 
+// Requires cs_main.
+static void UpdateTipSnapshot() {
+    CChainTipSnapshot* psnapshot = new CChainTipSnapshot();
+    if (chainActive.Tip()) {
+        psnapshot->nHeight = chainActive.Height();
+        psnapshot->hashBlock = chainActive.Tip()->GetBlockHash();
+        psnapshot->nTime = chainActive.Tip()->GetBlockTime();
+        psnapshot->nBits = chainActive.Tip()->nBits;
+    }
+    boost::shared_ptr<const CChainTipSnapshot> pnew(psnapshot);
+    LOCK(cs_tipSnapshot);
+    ptipSnapshot.swap(pnew);
+}
+
+boost::shared_ptr<const CChainTipSnapshot> GetChainTipSnapshot() {
+    LOCK(cs_tipSnapshot);
+    return ptipSnapshot;
+}
+
 /** Update chainActive and related internal data structures. */
 void static UpdateTip(CBlockIndex *pindexNew) {
     chainActive.SetTip(pindexNew);
+    UpdateTipSnapshot();
 
     // New best block
     nTimeBestReceived = GetTime();
     mempool.AddTransactionsUpdated(1);
 
-    LogPrintf("UpdateTip: new best=%s  height=%d  log2_work=%.8g  tx=%lu  date=%s progress=%f  cache=%u\n",
+    LogPrintf("UpdateTip: new best=%s  height=%d  log2_work=%.8g  tx=%lu  date=%s progress=%f  cache=%.1fMiB(%utx)\n",
       chainActive.Tip()->GetBlockHash().ToString(), chainActive.Height(), log(chainActive.Tip()->nChainWork.getdouble())/log(2.0), (unsigned long)chainActive.Tip()->nChainTx,
       DateTimeStrFormat("%Y-%m-%d %H:%M:%S", chainActive.Tip()->GetBlockTime()),
-      Checkpoints::GuessVerificationProgress(chainActive.Tip()), (unsigned int)pcoinsTip->GetCacheSize());
+      Checkpoints::GuessVerificationProgress(chainActive.Tip()), pcoinsTip->DynamicMemoryUsage() * (1.0 / (1<<20)), (unsigned int)pcoinsTip->GetCacheSize());
 
     cvBlockChange.notify_all();
 
@@ -2296,6 +2670,20 @@ void static UpdateTip(CBlockIndex *pindexNew) {
     }
 }
 
+/** Apply what DisconnectBlock left to rewind in the explorer indexes */
+bool static RewindExplorerIndexes(CValidationState &state, const CExplorerIndexUndo &indexundo) {
+    if (!indexundo.vAddressIndex.empty() && !pblocktree->EraseAddressIndex(indexundo.vAddressIndex))
+        return state.Abort("Failed to delete address index");
+    if (!indexundo.vAddressUnspentIndex.empty() && !pblocktree->UpdateAddressUnspentIndex(indexundo.vAddressUnspentIndex))
+        return state.Abort("Failed to write address unspent index");
+    if (!indexundo.vSpentIndex.empty() && !pblocktree->UpdateSpentIndex(indexundo.vSpentIndex))
+        return state.Abort("Failed to delete spent index");
+    BOOST_FOREACH(const CTimestampIndexKey &key, indexundo.vTimestampIndex)
+        if (!pblocktree->EraseTimestampIndex(key))
+            return state.Abort("Failed to delete timestamp index");
+    return true;
+}
+
 /** Disconnect chainActive's tip. */
 bool static DisconnectTip(CValidationState &state) {
     CBlockIndex *pindexDelete = chainActive.Tip();
@@ -2307,15 +2695,24 @@ bool static DisconnectTip(CValidationState &state) {
         return state.Abort("Failed to read block");
     // Apply the block atomically to the chain state.
     int64_t nStart = GetTimeMicros();
+    CExplorerIndexUndo indexundo;
     {
         CCoinsViewCache view(pcoinsTip);
-        if (!DisconnectBlock(block, state, pindexDelete, view))
+        if (!DisconnectBlock(block, state, pindexDelete, view, NULL, &indexundo))
             return error("DisconnectTip() : DisconnectBlock %s failed", pindexDelete->GetBlockHash().ToString());
         assert(view.Flush());
     }
     LogPrint("bench", "- Disconnect block: %.2fms\n", (GetTimeMicros() - nStart) * 0.001);
-    // Write the chain state to disk, if necessary.
-    if (!FlushStateToDisk(state, FLUSH_STATE_IF_NEEDED))
+    // The filter stays valid for when the block comes back, the index just ends before it
+    uint256 hashFilterBest;
+    if (fBlockFilterIndex && pblockfilterdb->ReadBestBlock(hashFilterBest) && hashFilterBest == pindexDelete->GetBlockHash())
+        pblockfilterdb->WriteBestBlock(pindexDelete->pprev->GetBlockHash());
+    // Write the chain state to disk, if necessary. Unlike the transaction
+    // index, the explorer indexes lose entries here, which only happens once
+    // the chain state without the block is written.
+    if (!FlushStateToDisk(state, indexundo.IsEmpty() ? FLUSH_STATE_IF_NEEDED : FLUSH_STATE_ALWAYS))
+        return false;
+    if (!RewindExplorerIndexes(state, indexundo))
         return false;
     // Resurrect mempool transactions from the disconnected block.
     BOOST_FOREACH(const CTransaction &tx, block.vtx) {
@@ -2749,10 +3146,9 @@ bool ReconsiderBlock(CValidationState& state, CBlockIndex *pindex) {
     return true;
 }
 
-CBlockIndex* AddToBlockIndex(const CBlockHeader& block)
+CBlockIndex* AddToBlockIndex(const CBlockHeader& block, const uint256& hash)
 {
     // Check for duplicate
-    uint256 hash = block.GetHash();
     BlockMap::iterator it = mapBlockIndex.find(hash);
     if (it != mapBlockIndex.end())
         return it->second;
@@ -2970,6 +3366,7 @@ bool CheckBlock(const CBlock& block, CValidationState& state, bool fCheckPOW, bo
     // ----------- instantX transaction scanning -----------
 
     if(IsSporkActive(SPORK_3_INSTANTX_BLOCK_FILTERING)){
+        LOCK(cs_instantx);
         BOOST_FOREACH(const CTransaction& tx, block.vtx){
             if (!tx.IsCoinBase()){
                 //only reject blocks when it's based on complete consensus
@@ -3129,11 +3526,11 @@ bool ContextualCheckBlock(const CBlock& block, CValidationState& state, CBlockIn
     return true;
 }
 
-bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state, CBlockIndex** ppindex)
+bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state, CBlockIndex** ppindex, const uint256* phash)
 {
     AssertLockHeld(cs_main);
     // Check for duplicate
-    uint256 hash = block.GetHash();
+    uint256 hash = phash ? *phash : block.GetHash();
     BlockMap::iterator miSelf = mapBlockIndex.find(hash);
     CBlockIndex *pindex = NULL;
 
@@ -3148,7 +3545,11 @@ bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state, CBloc
         return true;
     }
 
-    if (!CheckBlockHeader(block, state))
+    // Check proof of work against the hash we already have, the rest of the header below
+    if (!CheckProofOfWork(hash, block.nBits))
+        return state.DoS(50, error("%s : proof of work failed", __func__),
+                         REJECT_INVALID, "high-hash");
+    if (!CheckBlockHeader(block, state, false))
         return false;
 
     // Get prev block index
@@ -3166,7 +3567,7 @@ bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state, CBloc
         return false;
 
     if (pindex == NULL)
-        pindex = AddToBlockIndex(block);
+        pindex = AddToBlockIndex(block, hash);
 
     if (ppindex)
         *ppindex = pindex;
@@ -3516,11 +3917,20 @@ bool static LoadBlockIndexDB()
     pblocktree->ReadFlag("txindex", fTxIndex);
     LogPrintf("LoadBlockIndexDB(): transaction index %s\n", fTxIndex ? "enabled" : "disabled");
 
+    // Check whether we have the explorer indexes
+    pblocktree->ReadFlag("addressindex", fAddressIndex);
+    LogPrintf("LoadBlockIndexDB(): address index %s\n", fAddressIndex ? "enabled" : "disabled");
+    pblocktree->ReadFlag("spentindex", fSpentIndex);
+    LogPrintf("LoadBlockIndexDB(): spent index %s\n", fSpentIndex ? "enabled" : "disabled");
+    pblocktree->ReadFlag("timestampindex", fTimestampIndex);
+    LogPrintf("LoadBlockIndexDB(): timestamp index %s\n", fTimestampIndex ? "enabled" : "disabled");
+
     // Load pointer to end of best chain
     BlockMap::iterator it = mapBlockIndex.find(pcoinsTip->GetBestBlock());
     if (it == mapBlockIndex.end())
         return true;
     chainActive.SetTip(it->second);
+    UpdateTipSnapshot();
 
     PruneBlockIndexCandidates();
 
@@ -3583,7 +3993,7 @@ bool CVerifyDB::VerifyDB(CCoinsView *coinsview, int nCheckLevel, int nCheckDepth
             }
         }
         // check level 3: check for inconsistencies during memory-only disconnect of tip blocks
-        if (nCheckLevel >= 3 && pindex == pindexState && (coins.GetCacheSize() + pcoinsTip->GetCacheSize()) <= nCoinCacheSize) {
+        if (nCheckLevel >= 3 && pindex == pindexState && (coins.DynamicMemoryUsage() + pcoinsTip->DynamicMemoryUsage()) <= nCoinCacheUsage) {
             bool fClean = true;
             if (!DisconnectBlock(block, state, pindex, coins, &fClean))
                 return error("VerifyDB() : *** irrecoverable inconsistency in block data at %d, hash=%s", pindex->nHeight, pindex->GetBlockHash().ToString());
@@ -3625,7 +4035,9 @@ void UnloadBlockIndex()
     mapBlockIndex.clear();
     setBlockIndexCandidates.clear();
     chainActive.SetTip(NULL);
+    UpdateTipSnapshot();
     pindexBestInvalid = NULL;
+    blockFileReader.Clear();
 }
 
 bool LoadBlockIndex()
@@ -3646,6 +4058,12 @@ bool InitBlockIndex() {
     // Use the provided setting for -txindex in the new database
     fTxIndex = GetBoolArg("-txindex", true);
     pblocktree->WriteFlag("txindex", fTxIndex);
+    fAddressIndex = GetBoolArg("-addressindex", false);
+    pblocktree->WriteFlag("addressindex", fAddressIndex);
+    fSpentIndex = GetBoolArg("-spentindex", false);
+    pblocktree->WriteFlag("spentindex", fSpentIndex);
+    fTimestampIndex = GetBoolArg("-timestampindex", false);
+    pblocktree->WriteFlag("timestampindex", fTimestampIndex);
     LogPrintf("Initializing databases...\n");
 
     // Only add the genesis block if not reindexing (in which case we reuse the one already on disk)
@@ -3660,7 +4078,7 @@ bool InitBlockIndex() {
                 return error("LoadBlockIndex() : FindBlockPos failed");
             if (!WriteBlockToDisk(block, blockPos))
                 return error("LoadBlockIndex() : writing genesis block to disk failed");
-            CBlockIndex *pindex = AddToBlockIndex(block);
+            CBlockIndex *pindex = AddToBlockIndex(block, block.GetHash());
             if (!ReceivedBlockTransactions(block, state, pindex, blockPos))
                 return error("LoadBlockIndex() : genesis block not accepted");
             if (!ActivateBestChain(state, &block))
@@ -4004,16 +4422,28 @@ bool static AlreadyHave(const CInv& inv)
                 pcoinsTip->HaveCoins(inv.hash);
         }
     case MSG_DSTX:
-        return mapDarksendBroadcastTxes.count(inv.hash);
+        {
+            LOCK(cs_mapDarksendBroadcastTxes);
+            return mapDarksendBroadcastTxes.count(inv.hash);
+        }
     case MSG_BLOCK:
         return mapBlockIndex.count(inv.hash);
     case MSG_TXLOCK_REQUEST:
-        return mapTxLockReq.count(inv.hash) ||
-               mapTxLockReqRejected.count(inv.hash);
+        {
+            LOCK(cs_instantx);
+            return mapTxLockReq.count(inv.hash) ||
+                   mapTxLockReqRejected.count(inv.hash);
+        }
     case MSG_TXLOCK_VOTE:
-        return mapTxLockVote.count(inv.hash);
+        {
+            LOCK(cs_instantx);
+            return mapTxLockVote.count(inv.hash);
+        }
     case MSG_SPORK:
-        return mapSporks.count(inv.hash);
+        {
+            LOCK(cs_spork);
+            return mapSporks.count(inv.hash);
+        }
     case MSG_MASTERNODE_WINNER:
         if(masternodePayments.mapMasternodePayeeVotes.count(inv.hash)) {
             masternodeSync.AddedMasternodeWinner(inv.hash);
@@ -4098,13 +4528,18 @@ void static ProcessGetData(CNode* pfrom)
                 if (send)
                 {
                     // Send block from disk
-                    CBlock block;
-                    if (!ReadBlockFromDisk(block, (*mi).second))
-                        assert(!"cannot load block from disk");
                     if (inv.type == MSG_BLOCK)
-                        pfrom->PushMessage("block", block);
+                    {
+                        CSerializedMessage msg = GetBlockMessage((*mi).second);
+                        if (!msg)
+                            assert(!"cannot load block from disk");
+                        pfrom->PushSerializedMessage(msg);
+                    }
                     else // MSG_FILTERED_BLOCK)
                     {
+                        CBlock block;
+                        if (!ReadBlockFromDisk(block, (*mi).second))
+                            assert(!"cannot load block from disk");
                         LOCK(pfrom->cs_filter);
                         if (pfrom->pfilter)
                         {
@@ -4144,9 +4579,9 @@ void static ProcessGetData(CNode* pfrom)
                 bool pushed = false;
                 {
                     LOCK(cs_mapRelay);
-                    map<CInv, CDataStream>::iterator mi = mapRelay.find(inv);
+                    map<CInv, CSerializedMessage>::iterator mi = mapRelay.find(inv);
                     if (mi != mapRelay.end()) {
-                        pfrom->PushMessage(inv.GetCommand(), (*mi).second);
+                        pfrom->PushSerializedMessage((*mi).second);
                         pushed = true;
                     }
                 }
@@ -4163,31 +4598,43 @@ void static ProcessGetData(CNode* pfrom)
                     }
                 }
                 if (!pushed && inv.type == MSG_TXLOCK_VOTE) {
-                    if(mapTxLockVote.count(inv.hash)){
-                        CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
-                        ss.reserve(1000);
-                        ss << mapTxLockVote[inv.hash];
-                        pfrom->PushMessage("txlvote", ss);
-                        pushed = true;
+                    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+                    {
+                        LOCK(cs_instantx);
+                        if(mapTxLockVote.count(inv.hash)){
+                            ss.reserve(1000);
+                            ss << mapTxLockVote[inv.hash];
+                            pushed = true;
+                        }
                     }
+                    if(pushed)
+                        pfrom->PushMessage("txlvote", ss);
                 }
                 if (!pushed && inv.type == MSG_TXLOCK_REQUEST) {
-                    if(mapTxLockReq.count(inv.hash)){
-                        CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
-                        ss.reserve(1000);
-                        ss << mapTxLockReq[inv.hash];
-                        pfrom->PushMessage("ix", ss);
-                        pushed = true;
+                    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+                    {
+                        LOCK(cs_instantx);
+                        if(mapTxLockReq.count(inv.hash)){
+                            ss.reserve(1000);
+                            ss << mapTxLockReq[inv.hash];
+                            pushed = true;
+                        }
                     }
+                    if(pushed)
+                        pfrom->PushMessage("ix", ss);
                 }
                 if (!pushed && inv.type == MSG_SPORK) {
-                    if(mapSporks.count(inv.hash)){
-                        CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
-                        ss.reserve(1000);
-                        ss << mapSporks[inv.hash];
-                        pfrom->PushMessage("spork", ss);
-                        pushed = true;
+                    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+                    {
+                        LOCK(cs_spork);
+                        if(mapSporks.count(inv.hash)){
+                            ss.reserve(1000);
+                            ss << mapSporks[inv.hash];
+                            pushed = true;
+                        }
                     }
+                    if(pushed)
+                        pfrom->PushMessage("spork", ss);
                 }
                 if (!pushed && inv.type == MSG_MASTERNODE_WINNER) {
                     if(masternodePayments.mapMasternodePayeeVotes.count(inv.hash)){
@@ -4258,19 +4705,19 @@ void static ProcessGetData(CNode* pfrom)
                     }
                 }
 
-                if (!pushed && inv.type == MSG_DSTX) {       
-                    if(mapDarksendBroadcastTxes.count(inv.hash)){
-                        CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
-                        ss.reserve(1000);
-                        ss <<
-                            mapDarksendBroadcastTxes[inv.hash].tx <<
-                            mapDarksendBroadcastTxes[inv.hash].vin <<
-                            mapDarksendBroadcastTxes[inv.hash].vchSig <<
-                            mapDarksendBroadcastTxes[inv.hash].sigTime;
-
-                        pfrom->PushMessage("dstx", ss);
-                        pushed = true;
+                if (!pushed && inv.type == MSG_DSTX) {
+                    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+                    {
+                        LOCK(cs_mapDarksendBroadcastTxes);
+                        map<uint256, CDarksendBroadcastTx>::const_iterator mi = mapDarksendBroadcastTxes.find(inv.hash);
+                        if(mi != mapDarksendBroadcastTxes.end()){
+                            ss.reserve(1000);
+                            ss << mi->second.tx << mi->second.vin << mi->second.vchSig << mi->second.sigTime;
+                            pushed = true;
+                        }
                     }
+                    if(pushed)
+                        pfrom->PushMessage("dstx", ss);
                 }
 
 
@@ -4301,6 +4748,29 @@ void static ProcessGetData(CNode* pfrom)
     }
 }
 
+/**
+ * Check a BIP157 request for filters of the blocks up to hashStop, return
+ * the stop block or NULL if the request can't be served. Peers asking for
+ * something we don't offer or don't know are disconnected.
+ */
+static const CBlockIndex* FindBlockFilterRequestStop(CNode* pfrom, uint8_t nFilterType, const uint256& hashStop)
+{
+    AssertLockHeld(cs_main);
+
+    if (!(nLocalServices & NODE_COMPACT_FILTERS) || nFilterType != BLOCK_FILTER_BASIC) {
+        LogPrint("net", "peer=%d asked for block filters of type %d, which we don't serve\n", pfrom->id, nFilterType);
+        pfrom->fDisconnect = true;
+        return NULL;
+    }
+    BlockMap::iterator mi = mapBlockIndex.find(hashStop);
+    if (mi == mapBlockIndex.end() || !chainActive.Contains(mi->second)) {
+        LogPrint("net", "peer=%d asked for block filters up to unknown block %s\n", pfrom->id, hashStop.ToString());
+        pfrom->fDisconnect = true;
+        return NULL;
+    }
+    return mi->second;
+}
+
 bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv, int64_t nTimeReceived)
 {
     RandAddSeedPerfmon();
@@ -4372,7 +4842,10 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
         pfrom->fClient = !(pfrom->nServices & NODE_NETWORK);
 
         // Potentially mark this peer as a preferred download peer.
-        UpdatePreferredDownload(pfrom, State(pfrom->GetId()));
+        {
+            LOCK(cs_main);
+            UpdatePreferredDownload(pfrom, State(pfrom->GetId()));
+        }
 
         // Change version
         pfrom->PushMessage("verack");
@@ -4559,7 +5032,7 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
                     pfrom->PushMessage("getheaders", chainActive.GetLocator(pindexBestHeader), inv.hash);
                     CNodeState *nodestate = State(pfrom->GetId());
                     if (chainActive.Tip()->GetBlockTime() > GetAdjustedTime() - Params().TargetSpacing() * 20 &&
-                        nodestate->nBlocksInFlight < MAX_BLOCKS_IN_TRANSIT_PER_PEER) {
+                        nodestate->nBlocksInFlight < GetBlocksInFlightLimit(pfrom, nodestate)) {
                         vToFetch.push_back(inv);
                         // Mark block as in flight already, even though the actual "getdata" message only goes out
                         // later (within the same cs_main lock, though).
@@ -4682,6 +5155,72 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
     }
 
 
+    else if (strCommand == "getcfilters" || strCommand == "getcfheaders")
+    {
+        uint8_t nFilterType;
+        uint32_t nStartHeight;
+        uint256 hashStop;
+        vRecv >> nFilterType >> nStartHeight >> hashStop;
+
+        LOCK(cs_main);
+        unsigned int nMaxSize = strCommand == "getcfilters" ? MAX_GETCFILTERS_SIZE : MAX_GETCFHEADERS_SIZE;
+        const CBlockIndex* pindexStop = FindBlockFilterRequestStop(pfrom, nFilterType, hashStop);
+        if (!pindexStop)
+            return true;
+        if (nStartHeight > (uint32_t)pindexStop->nHeight || pindexStop->nHeight - nStartHeight >= nMaxSize) {
+            LogPrint("net", "%s from peer=%d asks for blocks %u to %d\n", strCommand, pfrom->id, nStartHeight, pindexStop->nHeight);
+            pfrom->fDisconnect = true;
+            return true;
+        }
+
+        uint256 hashPrevHeader;
+        vector<uint256> vFilterHashes;
+        for (int nHeight = nStartHeight; nHeight <= pindexStop->nHeight; nHeight++)
+        {
+            const CBlockIndex* pindex = pindexStop->GetAncestor(nHeight);
+            CBlockFilter filter;
+            if (!pblockfilterdb->ReadFilter(pindex->GetBlockHash(), filter)) {
+                LogPrint("net", "%s from peer=%d : no filter for block %s yet\n", strCommand, pfrom->id, pindex->GetBlockHash().ToString());
+                return true;
+            }
+            if (strCommand == "getcfilters")
+                pfrom->PushMessage("cfilter", nFilterType, pindex->GetBlockHash(), filter.GetEncoded());
+            else
+                vFilterHashes.push_back(filter.GetHash());
+        }
+        if (strCommand == "getcfheaders") {
+            if (nStartHeight > 0 && !pblockfilterdb->ReadFilterHeader(pindexStop->GetAncestor(nStartHeight - 1)->GetBlockHash(), hashPrevHeader))
+                return true;
+            pfrom->PushMessage("cfheaders", nFilterType, hashStop, hashPrevHeader, vFilterHashes);
+        }
+    }
+
+
+    else if (strCommand == "getcfcheckpt")
+    {
+        uint8_t nFilterType;
+        uint256 hashStop;
+        vRecv >> nFilterType >> hashStop;
+
+        LOCK(cs_main);
+        const CBlockIndex* pindexStop = FindBlockFilterRequestStop(pfrom, nFilterType, hashStop);
+        if (!pindexStop)
+            return true;
+
+        vector<uint256> vHeaders;
+        for (int nHeight = CFCHECKPT_INTERVAL; nHeight <= pindexStop->nHeight; nHeight += CFCHECKPT_INTERVAL)
+        {
+            uint256 hashHeader;
+            if (!pblockfilterdb->ReadFilterHeader(pindexStop->GetAncestor(nHeight)->GetBlockHash(), hashHeader)) {
+                LogPrint("net", "getcfcheckpt from peer=%d : no filter header at height %d yet\n", pfrom->id, nHeight);
+                return true;
+            }
+            vHeaders.push_back(hashHeader);
+        }
+        pfrom->PushMessage("cfcheckpt", nFilterType, hashStop, vHeaders);
+    }
+
+
     else if (strCommand == "tx"|| strCommand == "dstx")
     {
         vector<uint256> vWorkQueue;
@@ -4700,10 +5239,11 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
             //these allow masternodes to publish a limited amount of free transactions
             vRecv >> tx >> vin >> vchSig >> sigTime;
 
-            CMasternode* pmn = mnodeman.Find(vin);
-            if(pmn != NULL)
+            CPubKey pubkey2;
+            bool fAllowFreeTx;
+            if(mnodeman.GetFreeTxKey(vin, pubkey2, fAllowFreeTx))
             {
-                if(!pmn->allowFreeTx){
+                if(!fAllowFreeTx){
                     //multiple peers can send us a valid masternode transaction
                     if(fDebug) LogPrintf("dstx: Masternode sending too many transactions %s\n", tx.GetHash().ToString());
                     return true;
@@ -4712,17 +5252,23 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
                 std::string strMessage = tx.GetHash().ToString() + boost::lexical_cast<std::string>(sigTime);
 
                 std::string errorMessage = "";
-                if(!darkSendSigner.VerifyMessage(pmn->pubkey2, vchSig, strMessage, errorMessage)){
+                if(!darkSendSigner.VerifyMessage(pubkey2, vchSig, strMessage, errorMessage)){
                     LogPrintf("dstx: Got bad masternode address signature %s \n", vin.ToString());
                     //pfrom->Misbehaving(20);
                     return false;
                 }
 
+                // another handler thread may have taken it for the same transaction from another peer meanwhile
+                if(!mnodeman.UseFreeTx(vin)){
+                    if(fDebug) LogPrintf("dstx: Masternode sending too many transactions %s\n", tx.GetHash().ToString());
+                    return true;
+                }
+
                 LogPrintf("dstx: Got Masternode transaction %s\n", tx.GetHash().ToString());
 
                 ignoreFees = true;
-                pmn->allowFreeTx = false;
 
+                LOCK(cs_mapDarksendBroadcastTxes);
                 if(!mapDarksendBroadcastTxes.count(tx.GetHash())){
                     CDarksendBroadcastTx dstx;
                     dstx.tx = tx;
@@ -4860,6 +5406,11 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
             ReadCompactSize(vRecv); // ignore tx count; assume it is 0.
         }
 
+        // Hash the whole batch up front, outside cs_main, and hand the
+        // hashes to AcceptBlockHeader
+        std::vector<uint256> vHashes;
+        CBlockHeader::GetHashes(headers, vHashes);
+
         LOCK(cs_main);
 
         if (nCount == 0) {
@@ -4868,18 +5419,19 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
         }
 
         CBlockIndex *pindexLast = NULL;
-        BOOST_FOREACH(const CBlockHeader& header, headers) {
+        for (unsigned int n = 0; n < headers.size(); n++) {
+            const CBlockHeader& header = headers[n];
             CValidationState state;
             if (pindexLast != NULL && header.hashPrevBlock != pindexLast->GetBlockHash()) {
                 Misbehaving(pfrom->GetId(), 20);
                 return error("non-continuous headers sequence");
             }
-            if (!AcceptBlockHeader(header, state, &pindexLast)) {
+            if (!AcceptBlockHeader(header, state, &pindexLast, &vHashes[n])) {
                 int nDoS;
                 if (state.IsInvalid(nDoS)) {
                     if (nDoS > 0)
                         Misbehaving(pfrom->GetId(), nDoS);
-                    std::string strError = "invalid header received " + header.GetHash().ToString();
+                    std::string strError = "invalid header received " + vHashes[n].ToString();
                     return error(strError.c_str());
                 }
             }
@@ -4901,6 +5453,7 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
 
     else if (strCommand == "block" && !fImporting && !fReindex) // Ignore blocks received while importing
     {
+        unsigned int nSize = vRecv.size();
         CBlock block;
         vRecv >> block;
 
@@ -4909,6 +5462,12 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
 
         pfrom->AddInventoryKnown(inv);
 
+        {
+            // Credit the download to the peer before validation, which doesn't depend on it
+            LOCK(cs_main);
+            MarkBlockAsReceived(inv.hash, pfrom->GetId(), nSize);
+        }
+
         CValidationState state;
         ProcessNewBlock(state, pfrom, &block);
         int nDoS;
@@ -4931,7 +5490,10 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
     // getaddr message mitigates the attack.
     else if ((strCommand == "getaddr") && (pfrom->fInbound))
     {
-        pfrom->vAddrToSend.clear();
+        {
+            LOCK(pfrom->cs_vAddrToSend);
+            pfrom->vAddrToSend.clear();
+        }
         vector<CAddress> vAddr = addrman.GetAddr();
         BOOST_FOREACH(const CAddress &addr, vAddr)
             pfrom->PushAddress(addr);
@@ -5103,10 +5665,15 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
         {
             Misbehaving(pfrom->GetId(), 100);
         } else {
-            LOCK(pfrom->cs_filter);
-            if (pfrom->pfilter)
-                pfrom->pfilter->insert(vData);
-            else
+            bool fHaveFilter;
+            {
+                LOCK(pfrom->cs_filter);
+                fHaveFilter = pfrom->pfilter != NULL;
+                if (fHaveFilter)
+                    pfrom->pfilter->insert(vData);
+            }
+            // Misbehaving takes cs_main, which is held when relaying through the filters
+            if (!fHaveFilter)
                 Misbehaving(pfrom->GetId(), 100);
         }
     }
@@ -5331,8 +5898,10 @@ bool SendMessages(CNode* pto, bool fSendTrickle)
             BOOST_FOREACH(CNode* pnode, vNodes)
             {
                 // Periodically clear setAddrKnown to allow refresh broadcasts
-                if (nLastRebroadcast)
+                if (nLastRebroadcast) {
+                    LOCK(pnode->cs_vAddrToSend);
                     pnode->setAddrKnown.clear();
+                }
 
                 // Rebroadcast our address
                 AdvertizeLocal(pnode);
@@ -5347,24 +5916,20 @@ bool SendMessages(CNode* pto, bool fSendTrickle)
         if (fSendTrickle)
         {
             vector<CAddress> vAddr;
-            vAddr.reserve(pto->vAddrToSend.size());
-            BOOST_FOREACH(const CAddress& addr, pto->vAddrToSend)
             {
-                // returns true if wasn't already contained in the set
-                if (pto->setAddrKnown.insert(addr).second)
+                LOCK(pto->cs_vAddrToSend);
+                vAddr.reserve(pto->vAddrToSend.size());
+                BOOST_FOREACH(const CAddress& addr, pto->vAddrToSend)
                 {
-                    vAddr.push_back(addr);
-                    // receiver rejects addr messages larger than 1000
-                    if (vAddr.size() >= 1000)
-                    {
-                        pto->PushMessage("addr", vAddr);
-                        vAddr.clear();
-                    }
+                    // returns true if wasn't already contained in the set
+                    if (pto->setAddrKnown.insert(addr).second)
+                        vAddr.push_back(addr);
                 }
+                pto->vAddrToSend.clear();
             }
-            pto->vAddrToSend.clear();
-            if (!vAddr.empty())
-                pto->PushMessage("addr", vAddr);
+            // receiver rejects addr messages larger than 1000
+            for (size_t i = 0; i < vAddr.size(); i += 1000)
+                pto->PushMessage("addr", vector<CAddress>(vAddr.begin() + i, vAddr.begin() + min(i + 1000, vAddr.size())));
         }
 
         CNodeState &state = *State(pto->GetId());
@@ -5481,10 +6046,12 @@ bool SendMessages(CNode* pto, bool fSendTrickle)
         // Message: getdata (blocks)
         //
         vector<CInv> vGetData;
-        if (!pto->fDisconnect && !pto->fClient && fFetch && state.nBlocksInFlight < MAX_BLOCKS_IN_TRANSIT_PER_PEER) {
+        int nBlocksInFlightLimit = GetBlocksInFlightLimit(pto, &state);
+        if (!pto->fDisconnect && !pto->fClient && fFetch && state.nBlocksInFlight < nBlocksInFlightLimit) {
             vector<CBlockIndex*> vToDownload;
             NodeId staller = -1;
-            FindNextBlocksToDownload(pto->GetId(), MAX_BLOCKS_IN_TRANSIT_PER_PEER - state.nBlocksInFlight, vToDownload, staller);
+            CBlockIndex *pindexStaller = NULL;
+            FindNextBlocksToDownload(pto->GetId(), nBlocksInFlightLimit - state.nBlocksInFlight, vToDownload, staller, pindexStaller);
             BOOST_FOREACH(CBlockIndex *pindex, vToDownload) {
                 vGetData.push_back(CInv(MSG_BLOCK, pindex->GetBlockHash()));
                 MarkBlockAsInFlight(pto->GetId(), pindex->GetBlockHash(), pindex);
@@ -5492,8 +6059,20 @@ bool SendMessages(CNode* pto, bool fSendTrickle)
                     pindex->nHeight, pto->id);
             }
             if (state.nBlocksInFlight == 0 && staller != -1) {
-                if (State(staller)->nStallingSince == 0) {
-                    State(staller)->nStallingSince = nNow;
+                // This peer is idle because the window waits on a block from the staller. If we expect
+                // this peer to deliver it sooner than the staller still will, ask it for the block instead.
+                CNodeState *stateStaller = State(staller);
+                const QueuedBlock& queued = *mapBlocksInFlight[pindexStaller->GetBlockHash()].second;
+                if (state.nBlockDownloadRate > stateStaller->nBlockDownloadRate && nAverageBlockSize > 0 &&
+                    nNow - queued.nTime > pto->nPingUsecTime + nAverageBlockSize * 1000000 / state.nBlockDownloadRate) {
+                    LogPrint("net", "Requesting block %s (%d) held up by peer=%d from peer=%d\n", pindexStaller->GetBlockHash().ToString(),
+                        pindexStaller->nHeight, staller, pto->id);
+                    stateStaller->nBlocksRerequested++;
+                    nBlocksRerequested++;
+                    vGetData.push_back(CInv(MSG_BLOCK, pindexStaller->GetBlockHash()));
+                    MarkBlockAsInFlight(pto->GetId(), pindexStaller->GetBlockHash(), pindexStaller);
+                } else if (stateStaller->nStallingSince == 0) {
+                    stateStaller->nStallingSince = nNow;
                     LogPrint("net", "Stall started peer=%d\n", staller);
                 }
             }
@@ -37,8 +37,10 @@
 #include <utility>
 #include <vector>
 
+#include <boost/shared_ptr.hpp>
 #include <boost/unordered_map.hpp>
 
+class CBlockFilterDB;
 class CBlockIndex;
 class CBlockTreeDB;
 class CBloomFilter;
@@ -49,6 +51,8 @@ class CValidationState;
 
 struct CBlockTemplate;
 struct CNodeStateStats;
+struct CBlockDownloadStats;
+struct CExplorerIndexUndo;
 
 /** Default for -blockmaxsize and -blockminsize, which control the range of sizes the mining code will create **/
 static const unsigned int DEFAULT_BLOCK_MAX_SIZE = 750000;
@@ -57,6 +61,10 @@ static const unsigned int DEFAULT_BLOCK_MIN_SIZE = 0;
 static const unsigned int DEFAULT_BLOCK_PRIORITY_SIZE = 50000;
 /** Default for accepting alerts from the P2P network. */
 static const bool DEFAULT_ALERTS = true;
+/** Default for -maxmempool, maximum megabytes of mempool memory usage */
+static const unsigned int DEFAULT_MAX_MEMPOOL_SIZE = 300;
+/** Default for -mempoolexpiry, expiration time for mempool transactions in hours */
+static const unsigned int DEFAULT_MEMPOOL_EXPIRY = 72;
 /** The maximum size for transactions we're willing to relay/mine */
 static const unsigned int MAX_STANDARD_TX_SIZE = 100000;
 /** The maximum allowed number of signature check operations in a block (network rule) */
@@ -81,13 +89,28 @@ static const unsigned int LOCKTIME_THRESHOLD = 500000000; // Tue Nov  5 00:53:20
 static const int MAX_SCRIPTCHECK_THREADS = 16;
 /** -par default (number of script-checking threads, 0 = auto) */
 static const int DEFAULT_SCRIPTCHECK_THREADS = 0;
-/** Number of blocks that can be requested at any given time from a single peer. */
+/** Number of script checks ConnectBlock collects before handing them to the check queue, and the largest batch a worker takes at once */
+static const unsigned int SCRIPT_CHECK_BATCH_SIZE = 128;
+/** Number of recently served "block" messages kept in memory for the other peers asking for the same blocks */
+static const unsigned int MAX_BLOCK_MESSAGES_CACHED = 8;
+/** Number of blocks that can be requested at any given time from a single peer whose download rate isn't measured yet. */
 static const int MAX_BLOCKS_IN_TRANSIT_PER_PEER = 16;
+/** Bounds on the number of blocks requested at once from a peer, once sized by its measured download rate. */
+static const int MIN_BLOCKS_IN_TRANSIT_PER_PEER = 2;
+static const int MAX_ADAPTIVE_BLOCKS_IN_TRANSIT_PER_PEER = 128;
+/** Seconds of transfer at a peer's download rate, on top of its ping time, that we keep requested from it. */
+static const unsigned int BLOCK_DOWNLOAD_QUEUE_TIME = 2;
 /** Timeout in seconds during which a peer must stall block download progress before being disconnected. */
 static const unsigned int BLOCK_STALLING_TIMEOUT = 2;
 /** Number of headers sent in one getheaders result. We rely on the assumption that if a peer sends
  *  less than this number, we reached their tip. Changing this value is a protocol upgrade. */
 static const unsigned int MAX_HEADERS_RESULTS = 2000;
+/** Most block filters sent for one getcfilters request (BIP157) */
+static const unsigned int MAX_GETCFILTERS_SIZE = 1000;
+/** Most filter hashes sent for one getcfheaders request (BIP157) */
+static const unsigned int MAX_GETCFHEADERS_SIZE = 2000;
+/** Blocks between the filter headers sent for a getcfcheckpt request (BIP157) */
+static const int CFCHECKPT_INTERVAL = 1000;
 /** Size of the "block download window": how far ahead of our current height do we fetch?
  *  Larger windows tolerate larger download speed differences between peer, but increase the potential
  *  degree of disordering of blocks on disk (which make reindexing and in the future perhaps pruning
@@ -128,9 +151,14 @@ extern bool fImporting;
 extern bool fReindex;
 extern int nScriptCheckThreads;
 extern bool fTxIndex;
+extern bool fBlockFilterIndex;
+extern bool fAddressIndex;
+extern bool fSpentIndex;
+extern bool fTimestampIndex;
 extern bool fIsBareMultisigStd;
 extern bool fCheckBlockIndex;
-extern unsigned int nCoinCacheSize;
+extern bool fCheckBlockReads;
+extern size_t nCoinCacheUsage;
 extern CFeeRate minRelayTxFee;
 extern bool fAlerts;
 
@@ -198,6 +226,8 @@ bool ProcessMessages(CNode* pfrom);
 bool SendMessages(CNode* pto, bool fSendTrickle);
 /** Run an instance of the script checking thread */
 void ThreadScriptCheck();
+/** Build the block filters missing from the filter index, returns once it reached the tip */
+void ThreadBlockFilterIndex();
 
 // ***TODO*** probably not the right place for these 2
 /** Check whether a block hash satisfies the proof-of-work requirement specified by nBits */
@@ -227,7 +257,9 @@ CBlockIndex * InsertBlockIndex(uint256 hash);
 bool AbortNode(const std::string &msg, const std::string &userMessage="");
 /** Get statistics from node state */
 bool GetNodeStateStats(NodeId nodeid, CNodeStateStats &stats);
-/** Increase a node's misbehavior score. */
+/** Get statistics about block download across all peers */
+void GetBlockDownloadStats(CBlockDownloadStats &stats);
+/** Increase a node's misbehavior score. Takes cs_main, don't call it holding a lock taken under cs_main. */
 void Misbehaving(NodeId nodeid, int howmuch);
 /** Flush all state, indexes and buffers to disk. */
 void FlushStateToDisk();
@@ -249,6 +281,18 @@ struct CNodeStateStats {
     int nSyncHeight;
     int nCommonHeight;
     std::vector<int> vHeightInFlight;
+    int64_t nBlockDownloadRate;
+    int nBlocksInFlightLimit;
+    uint64_t nBlocksDownloaded;
+    uint64_t nBlockBytesDownloaded;
+    uint64_t nBlocksRerequested;
+};
+
+struct CBlockDownloadStats {
+    int nBlocksInFlight;
+    int nPeersDownloading;
+    int64_t nAverageBlockSize;
+    uint64_t nBlocksRerequested;
 };
 
 struct CDiskTxPos : public CDiskBlockPos
@@ -391,8 +435,18 @@ public:
 
 /** Functions for disk access for blocks */
 bool WriteBlockToDisk(CBlock& block, CDiskBlockPos& pos);
-bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos);
+bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos, bool fCheckPOW = true);
+/**
+ * Read the block referenced by an index entry. Unless -checkblockreads is
+ * set, the header is compared field by field with the index instead of
+ * rehashing the block and checking its proof of work.
+ */
 bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex);
+/**
+ * Read the serialized block referenced by an index entry as it is stored,
+ * without deserializing its transactions.
+ */
+bool ReadRawBlockFromDisk(std::vector<char>& vchBlock, const CBlockIndex* pindex);
 
 
 /** Functions for validating blocks and updating the block tree */
@@ -400,8 +454,9 @@ bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex);
 /** Undo the effects of this block (with given index) on the UTXO set represented by coins.
  *  In case pfClean is provided, operation will try to be tolerant about errors, and *pfClean
  *  will be true if no problems were found. Otherwise, the return value will be false in case
- *  of problems. Note that in any case, coins may be modified. */
-bool DisconnectBlock(CBlock& block, CValidationState& state, CBlockIndex* pindex, CCoinsViewCache& coins, bool* pfClean = NULL);
+ *  of problems. Note that in any case, coins may be modified. If pindexundo is provided, it receives
+ *  the address, spent and timestamp index entries to rewind once coins is written to disk. */
+bool DisconnectBlock(CBlock& block, CValidationState& state, CBlockIndex* pindex, CCoinsViewCache& coins, bool* pfClean = NULL, CExplorerIndexUndo* pindexundo = NULL);
 
 /** Reprocess a number of blocks to try and get on the correct chain again **/
 bool DisconnectBlocksAndReprocess(int blocks);
@@ -422,7 +477,8 @@ bool TestBlockValidity(CValidationState &state, const CBlock& block, CBlockIndex
 
 /** Store block on disk. If dbp is provided, the file is known to already reside on disk */
 bool AcceptBlock(CBlock& block, CValidationState& state, CBlockIndex **pindex, CDiskBlockPos* dbp = NULL);
-bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state, CBlockIndex **ppindex= NULL);
+/** Check a header and add it to the block index; phash, if given, is the already computed block.GetHash() */
+bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state, CBlockIndex **ppindex= NULL, const uint256* phash = NULL);
 
 
 
@@ -563,12 +619,33 @@ bool ReconsiderBlock(CValidationState& state, CBlockIndex *pindex);
 /** The currently-connected chain of blocks. */
 extern CChain chainActive;
 
+/** Summary of the active chain's tip, replaced as a whole whenever the tip changes */
+struct CChainTipSnapshot
+{
+    int nHeight;
+    uint256 hashBlock;
+    int64_t nTime;
+    unsigned int nBits;
+
+    CChainTipSnapshot() : nHeight(-1), hashBlock(0), nTime(0), nBits(0) {}
+};
+
+/** The current chain tip, for readers that don't otherwise need cs_main */
+boost::shared_ptr<const CChainTipSnapshot> GetChainTipSnapshot();
+
 /** Global variable that points to the active CCoinsView (protected by cs_main) */
 extern CCoinsViewCache *pcoinsTip;
 
 /** Global variable that points to the active block tree (protected by cs_main) */
 extern CBlockTreeDB *pblocktree;
 
+/**
+ * Global variable that points to the block filter index, if -blockfilterindex. Set before the
+ * worker threads start and deleted after they stopped; reads need no lock, writes and the
+ * best block are kept in step with the chain under cs_main.
+ */
+extern CBlockFilterDB *pblockfilterdb;
+
 struct CBlockTemplate
 {
     CBlock block;
@@ -12,6 +12,7 @@
 #include "masternode-sync.h"
 #include "util.h"
 #include "addrman.h"
+#include <boost/bind.hpp>
 #include <boost/filesystem.hpp>
 #include <boost/lexical_cast.hpp>
 
@@ -954,21 +955,12 @@ void CBudgetManager::ProcessMessage(CNode* pfrom, std::string& strCommand, CData
 
 
         mapSeenMasternodeBudgetVotes.insert(make_pair(vote.GetHash(), vote));
-        if(!vote.SignatureValid(true)){
-            LogPrintf("mvote - signature invalid\n");
-            if(masternodeSync.IsSynced()) Misbehaving(pfrom->GetId(), 20);
-            // it could just be a non-synced masternode
-            mnodeman.AskForMN(pfrom, vote.vin);
-            return;
-        }
-        
-        std::string strError = "";
-        if(UpdateProposal(vote, pfrom, strError)) {
-            vote.Relay();
-            masternodeSync.AddedBudgetItem(vote.GetHash());
-        }
 
-        LogPrintf("mvote - new budget vote - %s\n", vote.GetHash().ToString());
+        std::vector<CDarkSendSigCheck> vChecks;
+        vChecks.push_back(make_pair(vote.GetStrMessage(), vote.vchSig));
+        // dropped when the verifier is flooded, forget it so that it's accepted when sent again
+        if(!darkSendVerifier.Queue(pfrom, vChecks, boost::bind(&CBudgetManager::ProcessVote, this, _1, vote)))
+            mapSeenMasternodeBudgetVotes.erase(vote.GetHash());
     }
 
     if (strCommand == "fbs") { //Finalized Budget Suggestion
@@ -1024,23 +1016,55 @@ void CBudgetManager::ProcessMessage(CNode* pfrom, std::string& strCommand, CData
         }
 
         mapSeenFinalizedBudgetVotes.insert(make_pair(vote.GetHash(), vote));
-        if(!vote.SignatureValid(true)){
-            LogPrintf("fbvote - signature invalid\n");
-            if(masternodeSync.IsSynced()) Misbehaving(pfrom->GetId(), 20);
-            // it could just be a non-synced masternode
-            mnodeman.AskForMN(pfrom, vote.vin);
-            return;
-        }
 
-        std::string strError = "";
-        if(UpdateFinalizedBudget(vote, pfrom, strError)) {
-            vote.Relay();
-            masternodeSync.AddedBudgetItem(vote.GetHash());
+        std::vector<CDarkSendSigCheck> vChecks;
+        vChecks.push_back(make_pair(vote.GetStrMessage(), vote.vchSig));
+        if(!darkSendVerifier.Queue(pfrom, vChecks, boost::bind(&CBudgetManager::ProcessFinalizedVote, this, _1, vote)))
+            mapSeenFinalizedBudgetVotes.erase(vote.GetHash());
+    }
+}
 
-            LogPrintf("fbvote - new finalized budget vote - %s\n", vote.GetHash().ToString());
-        } else {
-            LogPrintf("fbvote - rejected finalized budget vote - %s - %s\n", vote.GetHash().ToString(), strError);
-        }
+void CBudgetManager::ProcessVote(CNode* pfrom, CBudgetVote vote)
+{
+    LOCK(cs_budget);
+
+    if(!vote.SignatureValid(true)){
+        LogPrintf("mvote - signature invalid\n");
+        if(masternodeSync.IsSynced()) Misbehaving(pfrom->GetId(), 20);
+        // it could just be a non-synced masternode
+        mnodeman.AskForMN(pfrom, vote.vin);
+        return;
+    }
+
+    std::string strError = "";
+    if(UpdateProposal(vote, pfrom, strError)) {
+        vote.Relay();
+        masternodeSync.AddedBudgetItem(vote.GetHash());
+    }
+
+    LogPrintf("mvote - new budget vote - %s\n", vote.GetHash().ToString());
+}
+
+void CBudgetManager::ProcessFinalizedVote(CNode* pfrom, CFinalizedBudgetVote vote)
+{
+    LOCK(cs_budget);
+
+    if(!vote.SignatureValid(true)){
+        LogPrintf("fbvote - signature invalid\n");
+        if(masternodeSync.IsSynced()) Misbehaving(pfrom->GetId(), 20);
+        // it could just be a non-synced masternode
+        mnodeman.AskForMN(pfrom, vote.vin);
+        return;
+    }
+
+    std::string strError = "";
+    if(UpdateFinalizedBudget(vote, pfrom, strError)) {
+        vote.Relay();
+        masternodeSync.AddedBudgetItem(vote.GetHash());
+
+        LogPrintf("fbvote - new finalized budget vote - %s\n", vote.GetHash().ToString());
+    } else {
+        LogPrintf("fbvote - rejected finalized budget vote - %s - %s\n", vote.GetHash().ToString(), strError);
     }
 }
 
@@ -1548,7 +1572,7 @@ bool CBudgetVote::Sign(CKey& keyMasternode, CPubKey& pubKeyMasternode)
     CKey keyCollateralAddress;
 
     std::string errorMessage;
-    std::string strMessage = vin.prevout.ToStringShort() + nProposalHash.ToString() + boost::lexical_cast<std::string>(nVote) + boost::lexical_cast<std::string>(nTime);
+    std::string strMessage = GetStrMessage();
 
     if(!darkSendSigner.SignMessage(strMessage, errorMessage, vchSig, keyMasternode)) {
         LogPrintf("CBudgetVote::Sign - Error upon calling SignMessage");
@@ -1563,10 +1587,15 @@ bool CBudgetVote::Sign(CKey& keyMasternode, CPubKey& pubKeyMasternode)
     return true;
 }
 
+std::string CBudgetVote::GetStrMessage() const
+{
+    return vin.prevout.ToStringShort() + nProposalHash.ToString() + boost::lexical_cast<std::string>(nVote) + boost::lexical_cast<std::string>(nTime);
+}
+
 bool CBudgetVote::SignatureValid(bool fSignatureCheck)
 {
     std::string errorMessage;
-    std::string strMessage = vin.prevout.ToStringShort() + nProposalHash.ToString() + boost::lexical_cast<std::string>(nVote) + boost::lexical_cast<std::string>(nTime);
+    std::string strMessage = GetStrMessage();
 
     CMasternode* pmn = mnodeman.Find(vin);
 
@@ -1949,7 +1978,7 @@ bool CFinalizedBudgetVote::Sign(CKey& keyMasternode, CPubKey& pubKeyMasternode)
     CKey keyCollateralAddress;
 
     std::string errorMessage;
-    std::string strMessage = vin.prevout.ToStringShort() + nBudgetHash.ToString() + boost::lexical_cast<std::string>(nTime);
+    std::string strMessage = GetStrMessage();
 
     if(!darkSendSigner.SignMessage(strMessage, errorMessage, vchSig, keyMasternode)) {
         LogPrintf("CFinalizedBudgetVote::Sign - Error upon calling SignMessage");
@@ -1964,11 +1993,16 @@ bool CFinalizedBudgetVote::Sign(CKey& keyMasternode, CPubKey& pubKeyMasternode)
     return true;
 }
 
+std::string CFinalizedBudgetVote::GetStrMessage() const
+{
+    return vin.prevout.ToStringShort() + nBudgetHash.ToString() + boost::lexical_cast<std::string>(nTime);
+}
+
 bool CFinalizedBudgetVote::SignatureValid(bool fSignatureCheck)
 {
     std::string errorMessage;
 
-    std::string strMessage = vin.prevout.ToStringShort() + nBudgetHash.ToString() + boost::lexical_cast<std::string>(nTime);
+    std::string strMessage = GetStrMessage();
 
     CMasternode* pmn = mnodeman.Find(vin);
 
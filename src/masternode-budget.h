@@ -118,6 +118,9 @@ public:
 
     void Calculate();
     void ProcessMessage(CNode* pfrom, std::string& strCommand, CDataStream& vRecv);
+    /// Finish processing a vote once darkSendVerifier has checked its signature
+    void ProcessVote(CNode* pfrom, CBudgetVote vote);
+    void ProcessFinalizedVote(CNode* pfrom, CFinalizedBudgetVote vote);
     void NewBlock();
     CBudgetProposal *FindProposal(const std::string &strProposalName);
     CBudgetProposal *FindProposal(uint256 nHash);
@@ -361,6 +364,7 @@ public:
 
     bool Sign(CKey& keyMasternode, CPubKey& pubKeyMasternode);
     bool SignatureValid(bool fSignatureCheck);
+    std::string GetStrMessage() const;
     void Relay();
 
     uint256 GetHash(){
@@ -557,6 +561,7 @@ public:
 
     bool Sign(CKey& keyMasternode, CPubKey& pubKeyMasternode);
     bool SignatureValid(bool fSignatureCheck);
+    std::string GetStrMessage() const;
     void Relay();
 
     std::string GetVoteString() {
@@ -341,6 +341,7 @@ void CMasternodePayments::ProcessMessageMasternodePayments(CNode* pfrom, std::st
 
     if(fLiteMode) return; //disable all Darksend/Masternode related functionality
 
+    LOCK(cs_process_message);
 
     if (strCommand == "mnget") { //Masternode Payments Request Sync
         if(fLiteMode) return; //disable all Darksend/Masternode related functionality
@@ -495,7 +496,12 @@ bool CMasternodePayments::AddWinningMasternode(CMasternodePaymentWinner& winnerI
 
     int n = 1;
     if(IsReferenceNode(winnerIn.vinMasternode)) n = 100;
-    mapMasternodeBlocks[winnerIn.nBlockHeight].AddPayee(winnerIn.payee, n);
+    {
+        LOCK(cs_mapMasternodeBlocks);
+        CMasternodeBlockPayees& blockPayees = mapMasternodeBlocks[winnerIn.nBlockHeight];
+        blockPayees.AddPayee(winnerIn.payee, n);
+        if(blockPayees.HasPayeeWithVotes(winnerIn.payee, 2)) IndexPayee(winnerIn.payee, winnerIn.nBlockHeight);
+    }
 
     return true;
 }
@@ -606,8 +612,9 @@ void CMasternodePayments::CleanPaymentList()
 
         if(chainActive.Tip()->nHeight - winner.nBlockHeight > nLimit){
             LogPrint("mnpayments", "CMasternodePayments::CleanPaymentList - Removing old Masternode payment - block %d\n", winner.nBlockHeight);
-            masternodeSync.mapSeenSyncMNW.erase((*it).first);
+            masternodeSync.RemovedMasternodeWinner((*it).first);
             mapMasternodePayeeVotes.erase(it++);
+            UnindexBlock(winner.nBlockHeight);
             mapMasternodeBlocks.erase(winner.nBlockHeight);
         } else {
             ++it;
@@ -807,6 +814,49 @@ std::string CMasternodePayments::ToString() const
 
 
 
+void CMasternodePayments::IndexPayee(const CScript& payee, int nBlockHeight)
+{
+    mapPayeeBlocks[payee].insert(nBlockHeight);
+}
+
+void CMasternodePayments::UnindexBlock(int nBlockHeight)
+{
+    std::map<int, CMasternodeBlockPayees>::iterator mi = mapMasternodeBlocks.find(nBlockHeight);
+    if(mi == mapMasternodeBlocks.end()) return;
+
+    BOOST_FOREACH(CMasternodePayee& payee, mi->second.vecPayments) {
+        std::map<CScript, std::set<int> >::iterator it = mapPayeeBlocks.find(payee.scriptPubKey);
+        if(it == mapPayeeBlocks.end()) continue;
+        it->second.erase(nBlockHeight);
+        if(it->second.empty()) mapPayeeBlocks.erase(it);
+    }
+}
+
+void CMasternodePayments::RebuildPayeeIndex()
+{
+    LOCK(cs_mapMasternodeBlocks);
+
+    mapPayeeBlocks.clear();
+    BOOST_FOREACH(PAIRTYPE(const int, CMasternodeBlockPayees)& item, mapMasternodeBlocks) {
+        BOOST_FOREACH(CMasternodePayee& payee, item.second.vecPayments) {
+            if(payee.nVotes >= 2) IndexPayee(payee.scriptPubKey, item.first);
+        }
+    }
+}
+
+int CMasternodePayments::GetLastPaidHeight(const CScript& payee, int nMinHeight, int nMaxHeight)
+{
+    LOCK(cs_mapMasternodeBlocks);
+
+    std::map<CScript, std::set<int> >::const_iterator it = mapPayeeBlocks.find(payee);
+    if(it == mapPayeeBlocks.end()) return -1;
+
+    std::set<int>::const_iterator hi = it->second.upper_bound(nMaxHeight);
+    if(hi == it->second.begin()) return -1;
+    --hi;
+    return *hi >= nMinHeight ? *hi : -1;
+}
+
 int CMasternodePayments::GetOldestBlock()
 {
     LOCK(cs_mapMasternodeBlocks);
@@ -223,6 +223,13 @@ class CMasternodePayments
 private:
     int nSyncedFromPeer;
     int nLastBlockHeight;
+    // critical section to serialize message processing
+    mutable CCriticalSection cs_process_message;
+    // heights in mapMasternodeBlocks at which each payee has at least 2 votes
+    std::map<CScript, std::set<int> > mapPayeeBlocks;
+
+    void IndexPayee(const CScript& payee, int nBlockHeight);
+    void UnindexBlock(int nBlockHeight);
 
 public:
     std::map<uint256, CMasternodePaymentWinner> mapMasternodePayeeVotes;
@@ -238,8 +245,14 @@ public:
         LOCK2(cs_mapMasternodeBlocks, cs_mapMasternodePayeeVotes);
         mapMasternodeBlocks.clear();
         mapMasternodePayeeVotes.clear();
+        mapPayeeBlocks.clear();
     }
 
+    /// Rebuild the last paid index from mapMasternodeBlocks
+    void RebuildPayeeIndex();
+    /// Newest height in [nMinHeight, nMaxHeight] paying this payee with at least 2 votes, -1 if there is none
+    int GetLastPaidHeight(const CScript& payee, int nMinHeight, int nMaxHeight);
+
     bool AddWinningMasternode(CMasternodePaymentWinner& winner);
     bool ProcessBlock(int nBlockHeight);
 
@@ -279,6 +292,8 @@ public:
     inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
         READWRITE(mapMasternodePayeeVotes);
         READWRITE(mapMasternodeBlocks);
+        if (ser_action.ForRead())
+            RebuildPayeeIndex();
     }
 };
 
@@ -18,11 +18,12 @@ CMasternodeSync masternodeSync;
 
 CMasternodeSync::CMasternodeSync()
 {
-    Reset();
+    SetDefaults();
 }
 
 bool CMasternodeSync::IsSynced()
 {
+    LOCK(cs);
     return RequestedMasternodeAssets == MASTERNODE_SYNC_FINISHED;
 }
 
@@ -31,14 +32,17 @@ bool CMasternodeSync::IsBlockchainSynced()
     static bool fBlockchainSynced = false;
     static int64_t lastProcess = GetTime();
 
-    // if the last call to this function was more than 60 minutes ago (client was in sleep mode) reset the sync process
-    if(GetTime() - lastProcess > 60*60) {
-        Reset();
-        fBlockchainSynced = false;
-    }
-    lastProcess = GetTime();
+    {
+        LOCK(cs);
+        // if the last call to this function was more than 60 minutes ago (client was in sleep mode) reset the sync process
+        if(GetTime() - lastProcess > 60*60) {
+            Reset();
+            fBlockchainSynced = false;
+        }
+        lastProcess = GetTime();
 
-    if(fBlockchainSynced) return true;
+        if(fBlockchainSynced) return true;
+    }
 
     if (fImporting || fReindex) return false;
 
@@ -52,13 +56,21 @@ bool CMasternodeSync::IsBlockchainSynced()
     if(pindex->nTime + 60*60 < GetTime())
         return false;
 
+    LOCK(cs);
     fBlockchainSynced = true;
 
     return true;
 }
 
 void CMasternodeSync::Reset()
-{   
+{
+    LOCK(cs);
+    SetDefaults();
+}
+
+// callers must hold cs, except the constructor
+void CMasternodeSync::SetDefaults()
+{
     lastMasternodeList = 0;
     lastMasternodeWinner = 0;
     lastBudgetItem = 0;
@@ -82,7 +94,10 @@ void CMasternodeSync::Reset()
 
 void CMasternodeSync::AddedMasternodeList(uint256 hash)
 {
-    if(mnodeman.mapSeenMasternodeBroadcast.count(hash)) {
+    bool fSeen = mnodeman.mapSeenMasternodeBroadcast.count(hash);
+
+    LOCK(cs);
+    if(fSeen) {
         if(mapSeenSyncMNB[hash] < MASTERNODE_SYNC_THRESHOLD) {
             lastMasternodeList = GetTime();
             mapSeenSyncMNB[hash]++;
@@ -95,7 +110,10 @@ void CMasternodeSync::AddedMasternodeList(uint256 hash)
 
 void CMasternodeSync::AddedMasternodeWinner(uint256 hash)
 {
-    if(masternodePayments.mapMasternodePayeeVotes.count(hash)) {
+    bool fSeen = masternodePayments.mapMasternodePayeeVotes.count(hash);
+
+    LOCK(cs);
+    if(fSeen) {
         if(mapSeenSyncMNW[hash] < MASTERNODE_SYNC_THRESHOLD) {
             lastMasternodeWinner = GetTime();
             mapSeenSyncMNW[hash]++;
@@ -108,8 +126,11 @@ void CMasternodeSync::AddedMasternodeWinner(uint256 hash)
 
 void CMasternodeSync::AddedBudgetItem(uint256 hash)
 {
-    if(budget.mapSeenMasternodeBudgetProposals.count(hash) || budget.mapSeenMasternodeBudgetVotes.count(hash) ||
-            budget.mapSeenFinalizedBudgets.count(hash) || budget.mapSeenFinalizedBudgetVotes.count(hash)) {
+    bool fSeen = budget.mapSeenMasternodeBudgetProposals.count(hash) || budget.mapSeenMasternodeBudgetVotes.count(hash) ||
+            budget.mapSeenFinalizedBudgets.count(hash) || budget.mapSeenFinalizedBudgetVotes.count(hash);
+
+    LOCK(cs);
+    if(fSeen) {
         if(mapSeenSyncBudget[hash] < MASTERNODE_SYNC_THRESHOLD) {
             lastBudgetItem = GetTime();
             mapSeenSyncBudget[hash]++;
@@ -120,46 +141,73 @@ void CMasternodeSync::AddedBudgetItem(uint256 hash)
     }
 }
 
+void CMasternodeSync::RemovedMasternodeList(uint256 hash)
+{
+    LOCK(cs);
+    mapSeenSyncMNB.erase(hash);
+}
+
+void CMasternodeSync::RemovedMasternodeWinner(uint256 hash)
+{
+    LOCK(cs);
+    mapSeenSyncMNW.erase(hash);
+}
+
 bool CMasternodeSync::IsBudgetPropEmpty()
 {
+    LOCK(cs);
     return sumBudgetItemProp==0 && countBudgetItemProp>0;
 }
 
 bool CMasternodeSync::IsBudgetFinEmpty()
 {
+    LOCK(cs);
     return sumBudgetItemFin==0 && countBudgetItemFin>0;
 }
 
 void CMasternodeSync::GetNextAsset()
 {
-    switch(RequestedMasternodeAssets)
+    bool fClearRequests = false;
     {
-        case(MASTERNODE_SYNC_INITIAL):
-        case(MASTERNODE_SYNC_FAILED): // should never be used here actually, use Reset() instead
-            ClearFulfilledRequest();
-            RequestedMasternodeAssets = MASTERNODE_SYNC_SPORKS;
-            break;
-        case(MASTERNODE_SYNC_SPORKS):
-            RequestedMasternodeAssets = MASTERNODE_SYNC_LIST;
-            break;
-        case(MASTERNODE_SYNC_LIST):
-            RequestedMasternodeAssets = MASTERNODE_SYNC_MNW;
-            break;
-        case(MASTERNODE_SYNC_MNW):
-            RequestedMasternodeAssets = MASTERNODE_SYNC_BUDGET;
-            break;
-        case(MASTERNODE_SYNC_BUDGET):
-            LogPrintf("CMasternodeSync::GetNextAsset - Sync has finished\n");
-            RequestedMasternodeAssets = MASTERNODE_SYNC_FINISHED;
-            break;
+        LOCK(cs);
+        switch(RequestedMasternodeAssets)
+        {
+            case(MASTERNODE_SYNC_INITIAL):
+            case(MASTERNODE_SYNC_FAILED): // should never be used here actually, use Reset() instead
+                fClearRequests = true;
+                RequestedMasternodeAssets = MASTERNODE_SYNC_SPORKS;
+                break;
+            case(MASTERNODE_SYNC_SPORKS):
+                RequestedMasternodeAssets = MASTERNODE_SYNC_LIST;
+                break;
+            case(MASTERNODE_SYNC_LIST):
+                RequestedMasternodeAssets = MASTERNODE_SYNC_MNW;
+                break;
+            case(MASTERNODE_SYNC_MNW):
+                RequestedMasternodeAssets = MASTERNODE_SYNC_BUDGET;
+                break;
+            case(MASTERNODE_SYNC_BUDGET):
+                LogPrintf("CMasternodeSync::GetNextAsset - Sync has finished\n");
+                RequestedMasternodeAssets = MASTERNODE_SYNC_FINISHED;
+                break;
+        }
+        RequestedMasternodeAttempt = 0;
+        nAssetSyncStarted = GetTime();
     }
-    RequestedMasternodeAttempt = 0;
-    nAssetSyncStarted = GetTime();
+
+    // takes cs_vNodes, so only once cs is released
+    if(fClearRequests) ClearFulfilledRequest();
 }
 
 std::string CMasternodeSync::GetSyncStatus()
 {
-    switch (masternodeSync.RequestedMasternodeAssets) {
+    int nAssets;
+    {
+        LOCK(cs);
+        nAssets = RequestedMasternodeAssets;
+    }
+
+    switch (nAssets) {
         case MASTERNODE_SYNC_INITIAL: return _("Synchronization pending...");
         case MASTERNODE_SYNC_SPORKS: return _("Synchronizing sporks...");
         case MASTERNODE_SYNC_LIST: return _("Synchronizing masternodes...");
@@ -178,6 +226,8 @@ void CMasternodeSync::ProcessMessage(CNode* pfrom, std::string& strCommand, CDat
         int nCount;
         vRecv >> nItemID >> nCount;
 
+        LOCK(cs);
+
         if(RequestedMasternodeAssets >= MASTERNODE_SYNC_FINISHED) return;
 
         //this means we will receive no further communication
@@ -305,6 +355,7 @@ void CMasternodeSync::Process()
                 (RequestedMasternodeAttempt >= MASTERNODE_SYNC_THRESHOLD*3 || GetTime() - nAssetSyncStarted > MASTERNODE_SYNC_TIMEOUT*5)) {
                     if(IsSporkActive(SPORK_8_MASTERNODE_PAYMENT_ENFORCEMENT)) {
                         LogPrintf("CMasternodeSync::Process - ERROR - Sync has failed, will retry later\n");
+                        LOCK(cs);
                         RequestedMasternodeAssets = MASTERNODE_SYNC_FAILED;
                         RequestedMasternodeAttempt = 0;
                         lastFailure = GetTime();
@@ -336,6 +387,7 @@ void CMasternodeSync::Process()
                 (RequestedMasternodeAttempt >= MASTERNODE_SYNC_THRESHOLD*3 || GetTime() - nAssetSyncStarted > MASTERNODE_SYNC_TIMEOUT*5)) {
                     if(IsSporkActive(SPORK_8_MASTERNODE_PAYMENT_ENFORCEMENT)) {
                         LogPrintf("CMasternodeSync::Process - ERROR - Sync has failed, will retry later\n");
+                        LOCK(cs);
                         RequestedMasternodeAssets = MASTERNODE_SYNC_FAILED;
                         RequestedMasternodeAttempt = 0;
                         lastFailure = GetTime();
@@ -27,7 +27,13 @@ extern CMasternodeSync masternodeSync;
 
 class CMasternodeSync
 {
+private:
+    void SetDefaults();
+
 public:
+    /** Protects the sync state, don't take other locks while holding it */
+    mutable CCriticalSection cs;
+
     std::map<uint256, int> mapSeenSyncMNB;
     std::map<uint256, int> mapSeenSyncMNW;
     std::map<uint256, int> mapSeenSyncBudget;
@@ -61,6 +67,8 @@ public:
     void AddedMasternodeList(uint256 hash);
     void AddedMasternodeWinner(uint256 hash);
     void AddedBudgetItem(uint256 hash);
+    void RemovedMasternodeList(uint256 hash);
+    void RemovedMasternodeWinner(uint256 hash);
     void GetNextAsset();
     std::string GetSyncStatus();
     void ProcessMessage(CNode* pfrom, std::string& strCommand, CDataStream& vRecv);
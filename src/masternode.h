@@ -26,7 +26,6 @@ using namespace std;
 class CMasternode;
 class CMasternodeBroadcast;
 class CMasternodePing;
-extern map<int64_t, uint256> mapCacheBlockHashes;
 
 bool GetBlockHash(uint256& hash, int nBlockHeight);
 
@@ -60,6 +59,7 @@ public:
 
     bool CheckAndUpdate(int& nDos, bool fRequireEnabled = true);
     bool Sign(CKey& keyMasternode, CPubKey& pubKeyMasternode);
+    std::string GetStrMessage() const;
     void Relay();
 
     uint256 GetHash(){
@@ -208,7 +208,8 @@ public:
             READWRITE(nLastScanningErrorBlockHeight);
     }
 
-    int64_t SecondsSincePayment();
+    /// nEnabled is the number of enabled masternodes, counted here if it is -1
+    int64_t SecondsSincePayment(int nEnabled = -1);
 
     bool UpdateFromNewBroadcast(CMasternodeBroadcast& mnb);
 
@@ -270,7 +271,7 @@ public:
         return strStatus;
     }
 
-    int64_t GetLastPaid();
+    int64_t GetLastPaid(int nEnabled = -1);
 
 };
 
@@ -289,6 +290,7 @@ public:
     bool CheckAndUpdate(int& nDoS);
     bool CheckInputsAndAdd(int& nDos);
     bool Sign(CKey& keyCollateralAddress);
+    std::string GetStrMessage() const;
     void Relay();
 
     ADD_SERIALIZE_METHODS;
@@ -9,6 +9,7 @@
 #include "util.h"
 #include "addrman.h"
 #include "spork.h"
+#include <boost/bind.hpp>
 #include <boost/lexical_cast.hpp>
 #include <boost/filesystem.hpp>
 
@@ -33,14 +34,15 @@ struct CompareScoreTxIn
     }
 };
 
-struct CompareScoreMN
+/** Masternodes are paid to the key hash of their collateral key, so payee lookups only need pay-to-pubkey-hash scripts */
+static bool GetPayeeKeyID(const CScript& payee, CKeyID& keyID)
 {
-    bool operator()(const pair<int64_t, CMasternode>& t1,
-                    const pair<int64_t, CMasternode>& t2) const
-    {
-        return t1.first < t2.first;
-    }
-};
+    if (payee.size() != 25 || payee[0] != OP_DUP || payee[1] != OP_HASH160 || payee[2] != 20 ||
+        payee[23] != OP_EQUALVERIFY || payee[24] != OP_CHECKSIG)
+        return false;
+    keyID = CKeyID(uint160(std::vector<unsigned char>(payee.begin() + 3, payee.begin() + 23)));
+    return true;
+}
 
 //
 // CMasternodeDB
@@ -218,6 +220,8 @@ bool CMasternodeMan::Add(CMasternode &mn)
     {
         LogPrint("masternode", "CMasternodeMan: Adding new Masternode %s - %i now\n", mn.addr.ToString(), size() + 1);
         vMasternodes.push_back(mn);
+        IndexMasternode(vMasternodes.size() - 1);
+        mapRanks.clear();
         return true;
     }
 
@@ -257,6 +261,7 @@ void CMasternodeMan::CheckAndRemove(bool forceExpiredRemoval)
     LOCK(cs);
 
     //remove inactive and outdated
+    bool fRemoved = false;
     vector<CMasternode>::iterator it = vMasternodes.begin();
     while(it != vMasternodes.end()){
         if((*it).activeState == CMasternode::MASTERNODE_REMOVE ||
@@ -271,7 +276,7 @@ void CMasternodeMan::CheckAndRemove(bool forceExpiredRemoval)
             map<uint256, CMasternodeBroadcast>::iterator it3 = mapSeenMasternodeBroadcast.begin();
             while(it3 != mapSeenMasternodeBroadcast.end()){
                 if((*it3).second.vin == (*it).vin){
-                    masternodeSync.mapSeenSyncMNB.erase((*it3).first);
+                    masternodeSync.RemovedMasternodeList((*it3).first);
                     mapSeenMasternodeBroadcast.erase(it3++);
                 } else {
                     ++it3;
@@ -289,10 +294,13 @@ void CMasternodeMan::CheckAndRemove(bool forceExpiredRemoval)
             }
 
             it = vMasternodes.erase(it);
+            fRemoved = true;
         } else {
             ++it;
         }
     }
+    if (fRemoved)
+        RebuildIndexes();
 
     // check who's asked for the Masternode list
     map<CNetAddr, int64_t>::iterator it1 = mAskedUsForMasternodeList.begin();
@@ -329,7 +337,7 @@ void CMasternodeMan::CheckAndRemove(bool forceExpiredRemoval)
     while(it3 != mapSeenMasternodeBroadcast.end()){        
         if((*it3).second.lastPing.sigTime < GetTime()-(MASTERNODE_REMOVAL_SECONDS*2)){     
             mapSeenMasternodeBroadcast.erase(it3++);       
-            masternodeSync.mapSeenSyncMNB.erase((*it3).second.GetHash());      
+            masternodeSync.RemovedMasternodeList((*it3).second.GetHash());      
         } else {       
             ++it3;     
         }      
@@ -351,6 +359,10 @@ void CMasternodeMan::Clear()
 {
     LOCK(cs);
     vMasternodes.clear();
+    mapIndexByVin.clear();
+    mapIndexByPubKey.clear();
+    mapIndexByPayee.clear();
+    mapRanks.clear();
     mAskedUsForMasternodeList.clear();
     mWeAskedForMasternodeList.clear();
     mWeAskedForMasternodeListEntry.clear();
@@ -359,6 +371,52 @@ void CMasternodeMan::Clear()
     nDsqCount = 0;
 }
 
+void CMasternodeMan::CheckCollaterals()
+{
+    AssertLockHeld(cs_main);
+    LOCK(cs);
+
+    BOOST_FOREACH(CMasternode& mn, vMasternodes) {
+        CCoins coins;
+        if(mn.activeState != CMasternode::MASTERNODE_VIN_SPENT &&
+           (!pcoinsTip->GetCoins(mn.vin.prevout.hash, coins) || !coins.IsAvailable(mn.vin.prevout.n))) {
+            LogPrint("masternode", "CMasternodeMan::CheckCollaterals - collateral %s is spent\n", mn.vin.prevout.ToString());
+            mn.activeState = CMasternode::MASTERNODE_VIN_SPENT;
+        }
+    }
+}
+
+void CMasternodeMan::SyncTransaction(const CTransaction& tx, const CBlock* pblock)
+{
+    AssertLockHeld(cs_main);
+    LOCK(cs);
+
+    if(vMasternodes.empty()) return;
+
+    BOOST_FOREACH(const CTxIn& txin, tx.vin) {
+        boost::unordered_map<COutPoint, size_t, CMasternodeIndexHasher>::const_iterator it = mapIndexByVin.find(txin.prevout);
+        if(it == mapIndexByVin.end()) continue;
+
+        CMasternode& mn = vMasternodes[it->second];
+        if(pblock == NULL) {
+            // A spend that is only in the mempool can still be evicted, expire or
+            // conflict, so it marks nothing. Once the block with the spend is
+            // disconnected, pcoinsTip has the collateral back.
+            if(mn.activeState != CMasternode::MASTERNODE_VIN_SPENT) continue;
+            CCoins coins;
+            if(!pcoinsTip->GetCoins(mn.vin.prevout.hash, coins) || !coins.IsAvailable(mn.vin.prevout.n)) continue;
+            LogPrint("masternode", "CMasternodeMan::SyncTransaction - collateral %s unspent, %s was disconnected\n", mn.vin.prevout.ToString(), tx.GetHash().ToString());
+            mn.activeState = CMasternode::MASTERNODE_ENABLED;
+            mn.Check(true);
+        } else {
+            if(mn.activeState == CMasternode::MASTERNODE_VIN_SPENT) continue;
+            LogPrint("masternode", "CMasternodeMan::SyncTransaction - collateral %s spent by %s\n", mn.vin.prevout.ToString(), tx.GetHash().ToString());
+            mn.activeState = CMasternode::MASTERNODE_VIN_SPENT;
+        }
+        mapRanks.clear();
+    }
+}
+
 int CMasternodeMan::CountEnabled(int protocolVersion)
 {
     int i = 0;
@@ -398,40 +456,81 @@ void CMasternodeMan::DsegUpdate(CNode* pnode)
 CMasternode *CMasternodeMan::Find(const CScript &payee)
 {
     LOCK(cs);
-    CScript payee2;
 
-    BOOST_FOREACH(CMasternode& mn, vMasternodes)
-    {
-        payee2 = GetScriptForDestination(mn.pubkey.GetID());
-        if(payee2 == payee)
-            return &mn;
-    }
-    return NULL;
+    CKeyID keyID;
+    if(!GetPayeeKeyID(payee, keyID)) return NULL;
+
+    boost::unordered_map<CKeyID, size_t, CMasternodeIndexHasher>::const_iterator it = mapIndexByPayee.find(keyID);
+    if(it == mapIndexByPayee.end()) return NULL;
+    return &vMasternodes[it->second];
 }
 
 CMasternode *CMasternodeMan::Find(const CTxIn &vin)
 {
     LOCK(cs);
 
-    BOOST_FOREACH(CMasternode& mn, vMasternodes)
-    {
-        if(mn.vin.prevout == vin.prevout)
-            return &mn;
-    }
-    return NULL;
+    boost::unordered_map<COutPoint, size_t, CMasternodeIndexHasher>::const_iterator it = mapIndexByVin.find(vin.prevout);
+    if(it == mapIndexByVin.end()) return NULL;
+    return &vMasternodes[it->second];
 }
 
 
+bool CMasternodeMan::GetFreeTxKey(const CTxIn& vin, CPubKey& pubkey2, bool& fAllowFreeTx)
+{
+    LOCK(cs);
+
+    CMasternode* pmn = Find(vin);
+    if(pmn == NULL) return false;
+    pubkey2 = pmn->pubkey2;
+    fAllowFreeTx = pmn->allowFreeTx;
+    return true;
+}
+
+void CMasternodeMan::AllowFreeTx(const CTxIn& vin)
+{
+    LOCK(cs);
+
+    CMasternode* pmn = Find(vin);
+    if(pmn != NULL) pmn->allowFreeTx = true;
+}
+
+bool CMasternodeMan::UseFreeTx(const CTxIn& vin)
+{
+    LOCK(cs);
+
+    CMasternode* pmn = Find(vin);
+    if(pmn == NULL || !pmn->allowFreeTx) return false;
+    pmn->allowFreeTx = false;
+    return true;
+}
+
 CMasternode *CMasternodeMan::Find(const CPubKey &pubKeyMasternode)
 {
     LOCK(cs);
 
-    BOOST_FOREACH(CMasternode& mn, vMasternodes)
-    {
-        if(mn.pubkey2 == pubKeyMasternode)
-            return &mn;
-    }
-    return NULL;
+    boost::unordered_map<CPubKey, size_t, CMasternodeIndexHasher>::const_iterator it = mapIndexByPubKey.find(pubKeyMasternode);
+    if(it == mapIndexByPubKey.end()) return NULL;
+    return &vMasternodes[it->second];
+}
+
+void CMasternodeMan::IndexMasternode(size_t i)
+{
+    const CMasternode& mn = vMasternodes[i];
+    mapIndexByVin.insert(make_pair(mn.vin.prevout, i));
+    mapIndexByPubKey.insert(make_pair(mn.pubkey2, i));
+    mapIndexByPayee.insert(make_pair(mn.pubkey.GetID(), i));
+}
+
+void CMasternodeMan::RebuildIndexes()
+{
+    LOCK(cs);
+
+    mapIndexByVin.clear();
+    mapIndexByPubKey.clear();
+    mapIndexByPayee.clear();
+    mapRanks.clear();
+    for(size_t i = 0; i < vMasternodes.size(); i++)
+        IndexMasternode(i);
 }
 
 // 
@@ -466,7 +565,7 @@ CMasternode* CMasternodeMan::GetNextMasternodeInQueueForPayment(int nBlockHeight
         //make sure it has as many confirmations as there are masternodes
         if(mn.GetMasternodeInputAge() < nMnCount) continue;
 
-        vecMasternodeLastPaid.push_back(make_pair(mn.SecondsSincePayment(), mn.vin));
+        vecMasternodeLastPaid.push_back(make_pair(mn.SecondsSincePayment(nMnCount), mn.vin));
     }
 
     nCount = (int)vecMasternodeLastPaid.size();
@@ -555,13 +654,21 @@ CMasternode* CMasternodeMan::GetCurrentMasterNode(int mod, int64_t nBlockHeight,
     return winner;
 }
 
-int CMasternodeMan::GetMasternodeRank(const CTxIn& vin, int64_t nBlockHeight, int minProtocol, bool fOnlyActive)
+const CMasternodeRanks* CMasternodeMan::GetRanks(int64_t nBlockHeight, int minProtocol, bool fOnlyActive)
 {
-    std::vector<pair<int64_t, CTxIn> > vecMasternodeScores;
+    LOCK(cs);
 
     //make sure we know about this block
     uint256 hash = 0;
-    if(!GetBlockHash(hash, nBlockHeight)) return -1;
+    if(!GetBlockHash(hash, nBlockHeight)) return NULL;
+
+    // entries are only rechecked every MASTERNODE_CHECK_SECONDS, so a table that recent is still accurate
+    boost::tuple<int64_t, int, bool> key(nBlockHeight, minProtocol, fOnlyActive);
+    std::map<boost::tuple<int64_t, int, bool>, CMasternodeRanks>::iterator it = mapRanks.find(key);
+    if(it != mapRanks.end() && it->second.hashBlock == hash && GetTime() - it->second.nTimeBuilt < MASTERNODE_CHECK_SECONDS)
+        return &it->second;
+
+    std::vector<pair<int64_t, CTxIn> > vecMasternodeScores;
 
     // scan for winner
     BOOST_FOREACH(CMasternode& mn, vMasternodes) {
@@ -578,48 +685,54 @@ int CMasternodeMan::GetMasternodeRank(const CTxIn& vin, int64_t nBlockHeight, in
 
     sort(vecMasternodeScores.rbegin(), vecMasternodeScores.rend(), CompareScoreTxIn());
 
+    if(it == mapRanks.end()) {
+        // the oldest blocks are the least likely to be asked about again
+        if(mapRanks.size() >= MASTERNODES_RANK_CACHE_SIZE)
+            mapRanks.erase(mapRanks.begin());
+        it = mapRanks.insert(make_pair(key, CMasternodeRanks())).first;
+    }
+
+    CMasternodeRanks& ranks = it->second;
+    ranks.hashBlock = hash;
+    ranks.nTimeBuilt = GetTime();
+    ranks.vRanked.clear();
+    ranks.mapRank.clear();
     int rank = 0;
     BOOST_FOREACH (PAIRTYPE(int64_t, CTxIn)& s, vecMasternodeScores){
         rank++;
-        if(s.second.prevout == vin.prevout) {
-            return rank;
-        }
+        ranks.vRanked.push_back(s.second.prevout);
+        ranks.mapRank.insert(make_pair(s.second.prevout, rank));
     }
 
-    return -1;
+    return &ranks;
 }
 
-std::vector<pair<int, CMasternode> > CMasternodeMan::GetMasternodeRanks(int64_t nBlockHeight, int minProtocol)
+int CMasternodeMan::GetMasternodeRank(const CTxIn& vin, int64_t nBlockHeight, int minProtocol, bool fOnlyActive)
 {
-    std::vector<pair<int64_t, CMasternode> > vecMasternodeScores;
-    std::vector<pair<int, CMasternode> > vecMasternodeRanks;
-
-    //make sure we know about this block
-    uint256 hash = 0;
-    if(!GetBlockHash(hash, nBlockHeight)) return vecMasternodeRanks;
+    LOCK(cs);
 
-    // scan for winner
-    BOOST_FOREACH(CMasternode& mn, vMasternodes) {
+    const CMasternodeRanks* ranks = GetRanks(nBlockHeight, minProtocol, fOnlyActive);
+    if(ranks == NULL) return -1;
 
-        mn.Check();
-
-        if(mn.protocolVersion < minProtocol) continue;
-        if(!mn.IsEnabled()) {
-            continue;
-        }
+    boost::unordered_map<COutPoint, int, CMasternodeIndexHasher>::const_iterator it = ranks->mapRank.find(vin.prevout);
+    if(it == ranks->mapRank.end()) return -1;
+    return it->second;
+}
 
-        uint256 n = mn.CalculateScore(1, nBlockHeight);
-        int64_t n2 = n.GetCompact(false);
+std::vector<pair<int, CMasternode> > CMasternodeMan::GetMasternodeRanks(int64_t nBlockHeight, int minProtocol)
+{
+    LOCK(cs);
 
-        vecMasternodeScores.push_back(make_pair(n2, mn));
-    }
+    std::vector<pair<int, CMasternode> > vecMasternodeRanks;
 
-    sort(vecMasternodeScores.rbegin(), vecMasternodeScores.rend(), CompareScoreMN());
+    const CMasternodeRanks* ranks = GetRanks(nBlockHeight, minProtocol, true);
+    if(ranks == NULL) return vecMasternodeRanks;
 
     int rank = 0;
-    BOOST_FOREACH (PAIRTYPE(int64_t, CMasternode)& s, vecMasternodeScores){
+    BOOST_FOREACH(const COutPoint& out, ranks->vRanked){
         rank++;
-        vecMasternodeRanks.push_back(make_pair(rank, s.second));
+        CMasternode* pmn = Find(CTxIn(out));
+        if(pmn != NULL) vecMasternodeRanks.push_back(make_pair(rank, *pmn));
     }
 
     return vecMasternodeRanks;
@@ -627,34 +740,12 @@ std::vector<pair<int, CMasternode> > CMasternodeMan::GetMasternodeRanks(int64_t
 
 CMasternode* CMasternodeMan::GetMasternodeByRank(int nRank, int64_t nBlockHeight, int minProtocol, bool fOnlyActive)
 {
-    std::vector<pair<int64_t, CTxIn> > vecMasternodeScores;
-
-    // scan for winner
-    BOOST_FOREACH(CMasternode& mn, vMasternodes) {
-
-        if(mn.protocolVersion < minProtocol) continue;
-        if(fOnlyActive) {
-            mn.Check();
-            if(!mn.IsEnabled()) continue;
-        }
-
-        uint256 n = mn.CalculateScore(1, nBlockHeight);
-        int64_t n2 = n.GetCompact(false);
-
-        vecMasternodeScores.push_back(make_pair(n2, mn.vin));
-    }
-
-    sort(vecMasternodeScores.rbegin(), vecMasternodeScores.rend(), CompareScoreTxIn());
+    LOCK(cs);
 
-    int rank = 0;
-    BOOST_FOREACH (PAIRTYPE(int64_t, CTxIn)& s, vecMasternodeScores){
-        rank++;
-        if(rank == nRank) {
-            return Find(s.second);
-        }
-    }
+    const CMasternodeRanks* ranks = GetRanks(nBlockHeight, minProtocol, fOnlyActive);
+    if(ranks == NULL || nRank < 1 || nRank > (int)ranks->vRanked.size()) return NULL;
 
-    return NULL;
+    return Find(CTxIn(ranks->vRanked[nRank - 1]));
 }
 
 void CMasternodeMan::ProcessMasternodeConnections()
@@ -672,6 +763,64 @@ void CMasternodeMan::ProcessMasternodeConnections()
     }
 }
 
+void CMasternodeMan::ProcessBroadcast(CNode* pfrom, CMasternodeBroadcast mnb)
+{
+    LOCK(cs_process_message);
+
+    int nDoS = 0;
+    if(!mnb.CheckAndUpdate(nDoS)){
+
+        if(nDoS > 0)
+            Misbehaving(pfrom->GetId(), nDoS);
+
+        //failed
+        return;
+    }
+
+    // make sure the vout that was signed is related to the transaction that spawned the Masternode
+    //  - this is expensive, so it's only done once per Masternode
+    if(!darkSendSigner.IsVinAssociatedWithPubkey(mnb.vin, mnb.pubkey)) {
+        LogPrintf("mnb - Got mismatched pubkey and vin\n");
+        Misbehaving(pfrom->GetId(), 33);
+        return;
+    }
+
+    // make sure it's still unspent
+    //  - this is checked later by .check() in many places and by ThreadCheckDarkSendPool()
+    if(mnb.CheckInputsAndAdd(nDoS)) {
+        // use this as a peer
+        addrman.Add(CAddress(mnb.addr), pfrom->addr, 2*60*60);
+        masternodeSync.AddedMasternodeList(mnb.GetHash());
+    } else {
+        LogPrintf("mnb - Rejected Masternode entry %s\n", mnb.addr.ToString());
+
+        if (nDoS > 0)
+            Misbehaving(pfrom->GetId(), nDoS);
+    }
+}
+
+void CMasternodeMan::ProcessPing(CNode* pfrom, CMasternodePing mnp)
+{
+    LOCK(cs_process_message);
+
+    int nDoS = 0;
+    if(mnp.CheckAndUpdate(nDoS)) return;
+
+    if(nDoS > 0) {
+        // if anything significant failed, mark that node
+        Misbehaving(pfrom->GetId(), nDoS);
+    } else {
+        // if nothing significant failed, search existing Masternode list
+        CMasternode* pmn = Find(mnp.vin);
+        // if it's known, don't ask for the mnb, just return
+        if(pmn != NULL) return;
+    }
+
+    // something significant is broken or mn is unknown,
+    // we might have to ask for a masternode entry once
+    AskForMN(pfrom, mnp.vin);
+}
+
 void CMasternodeMan::ProcessMessage(CNode* pfrom, std::string& strCommand, CDataStream& vRecv)
 {
 
@@ -690,36 +839,12 @@ void CMasternodeMan::ProcessMessage(CNode* pfrom, std::string& strCommand, CData
         }
         mapSeenMasternodeBroadcast.insert(make_pair(mnb.GetHash(), mnb));
 
-        int nDoS = 0;
-        if(!mnb.CheckAndUpdate(nDoS)){
-
-            if(nDoS > 0)
-                Misbehaving(pfrom->GetId(), nDoS);
-
-            //failed
-            return;
-        }
-
-        // make sure the vout that was signed is related to the transaction that spawned the Masternode
-        //  - this is expensive, so it's only done once per Masternode
-        if(!darkSendSigner.IsVinAssociatedWithPubkey(mnb.vin, mnb.pubkey)) {
-            LogPrintf("mnb - Got mismatched pubkey and vin\n");
-            Misbehaving(pfrom->GetId(), 33);
-            return;
-        }
-
-        // make sure it's still unspent
-        //  - this is checked later by .check() in many places and by ThreadCheckDarkSendPool()
-        if(mnb.CheckInputsAndAdd(nDoS)) {
-            // use this as a peer
-            addrman.Add(CAddress(mnb.addr), pfrom->addr, 2*60*60);
-            masternodeSync.AddedMasternodeList(mnb.GetHash());
-        } else {
-            LogPrintf("mnb - Rejected Masternode entry %s\n", mnb.addr.ToString());
-
-            if (nDoS > 0)
-                Misbehaving(pfrom->GetId(), nDoS);
-        }
+        std::vector<CDarkSendSigCheck> vChecks;
+        vChecks.push_back(make_pair(mnb.GetStrMessage(), mnb.sig));
+        vChecks.push_back(make_pair(mnb.lastPing.GetStrMessage(), mnb.lastPing.vchSig));
+        // dropped when the verifier is flooded, forget it so that it's accepted when sent again
+        if(!darkSendVerifier.Queue(pfrom, vChecks, boost::bind(&CMasternodeMan::ProcessBroadcast, this, _1, mnb)))
+            mapSeenMasternodeBroadcast.erase(mnb.GetHash());
     }
 
     else if (strCommand == "mnp") { //Masternode Ping
@@ -731,22 +856,10 @@ void CMasternodeMan::ProcessMessage(CNode* pfrom, std::string& strCommand, CData
         if(mapSeenMasternodePing.count(mnp.GetHash())) return; //seen
         mapSeenMasternodePing.insert(make_pair(mnp.GetHash(), mnp));
 
-        int nDoS = 0;
-        if(mnp.CheckAndUpdate(nDoS)) return;
-
-        if(nDoS > 0) {
-            // if anything significant failed, mark that node
-            Misbehaving(pfrom->GetId(), nDoS);
-        } else {
-            // if nothing significant failed, search existing Masternode list
-            CMasternode* pmn = Find(mnp.vin);
-            // if it's known, don't ask for the mnb, just return
-            if(pmn != NULL) return;
-        }
-
-        // something significant is broken or mn is unknown,
-        // we might have to ask for a masternode entry once
-        AskForMN(pfrom, mnp.vin);
+        std::vector<CDarkSendSigCheck> vChecks;
+        vChecks.push_back(make_pair(mnp.GetStrMessage(), mnp.vchSig));
+        if(!darkSendVerifier.Queue(pfrom, vChecks, boost::bind(&CMasternodeMan::ProcessPing, this, _1, mnp)))
+            mapSeenMasternodePing.erase(mnp.GetHash());
 
     } else if (strCommand == "dseg") { //Get Masternode list or specific entry
 
@@ -893,7 +1006,10 @@ void CMasternodeMan::ProcessMessage(CNode* pfrom, std::string& strCommand, CData
                 if(pmn->nLastDsee < sigTime){ //take the newest entry
                     LogPrintf("dsee - Got updated entry for %s\n", addr.ToString().c_str());
                     if(pmn->protocolVersion < GETHEADERS_VERSION) {
-                        pmn->pubkey2 = pubkey2;
+                        if(pmn->pubkey2 != pubkey2) {
+                            pmn->pubkey2 = pubkey2;
+                            RebuildIndexes();
+                        }
                         pmn->sigTime = sigTime;
                         pmn->sig = vchSig;
                         pmn->protocolVersion = protocolVersion;
@@ -1100,6 +1216,7 @@ void CMasternodeMan::Remove(CTxIn vin)
         if((*it).vin == vin){
             LogPrint("masternode", "CMasternodeMan: Removing Masternode %s - %i now\n", (*it).addr.ToString(), size() - 1);
             vMasternodes.erase(it);
+            RebuildIndexes();
             break;
         }
         ++it;
@@ -12,9 +12,15 @@
 #include "base58.h"
 #include "main.h"
 #include "masternode.h"
+#include "crypto/common.h"
+
+#include <boost/tuple/tuple.hpp>
+#include <boost/tuple/tuple_comparison.hpp>
+#include <boost/unordered_map.hpp>
 
 #define MASTERNODES_DUMP_SECONDS               (15*60)
 #define MASTERNODES_DSEG_SECONDS               (3*60*60)
+#define MASTERNODES_RANK_CACHE_SIZE            32
 
 using namespace std;
 
@@ -23,6 +29,27 @@ class CMasternodeMan;
 extern CMasternodeMan mnodeman;
 void DumpMasternodes();
 
+/** Hasher for the masternode list indexes; their keys are hashes or public keys, so a slice of them is enough */
+struct CMasternodeIndexHasher
+{
+    size_t operator()(const COutPoint& out) const { return out.hash.GetLow64() ^ out.n; }
+    size_t operator()(const CKeyID& keyID) const { return keyID.GetLow64(); }
+    size_t operator()(const CPubKey& pubkey) const { return pubkey.size() >= 9 ? ReadLE64(pubkey.begin() + 1) : 0; }
+};
+
+/** Masternodes ordered by score for one block, as used by the ranking functions */
+class CMasternodeRanks
+{
+public:
+    // block the scores were computed from, a reorg replaces it
+    uint256 hashBlock;
+    int64_t nTimeBuilt;
+    // collateral outpoints, best score first
+    std::vector<COutPoint> vRanked;
+    // 1-based rank by collateral outpoint
+    boost::unordered_map<COutPoint, int, CMasternodeIndexHasher> mapRank;
+};
+
 /** Access to the MN database (mncache.dat)
  */
 class CMasternodeDB
@@ -46,7 +73,7 @@ public:
     ReadResult Read(CMasternodeMan& mnodemanToLoad, bool fDryRun = false);
 };
 
-class CMasternodeMan
+class CMasternodeMan : public CValidationInterface
 {
 private:
     // critical section to protect the inner data structures
@@ -57,6 +84,13 @@ private:
 
     // map to hold all MNs
     std::vector<CMasternode> vMasternodes;
+    // positions in vMasternodes by collateral outpoint, masternode key and collateral key (payee);
+    // where several entries share a key, the first one is indexed
+    boost::unordered_map<COutPoint, size_t, CMasternodeIndexHasher> mapIndexByVin;
+    boost::unordered_map<CPubKey, size_t, CMasternodeIndexHasher> mapIndexByPubKey;
+    boost::unordered_map<CKeyID, size_t, CMasternodeIndexHasher> mapIndexByPayee;
+    // rank tables by (block height, minimum protocol, only enabled masternodes)
+    std::map<boost::tuple<int64_t, int, bool>, CMasternodeRanks> mapRanks;
     // who's asked for the Masternode list and the last time
     std::map<CNetAddr, int64_t> mAskedUsForMasternodeList;
     // who we asked for the Masternode list and the last time
@@ -64,6 +98,16 @@ private:
     // which Masternodes we've asked for
     std::map<COutPoint, int64_t> mWeAskedForMasternodeListEntry;
 
+    /// Index the entry at position i of vMasternodes
+    void IndexMasternode(size_t i);
+
+    /// Get the rank table for a block, scoring the list if it is not cached yet; NULL if the block is unknown
+    const CMasternodeRanks* GetRanks(int64_t nBlockHeight, int minProtocol, bool fOnlyActive);
+
+protected:
+    /// Mark the entries whose collateral tx spends once tx is connected in a block, and restore them if that block is disconnected
+    void SyncTransaction(const CTransaction& tx, const CBlock* pblock);
+
 public:
     // Keep track of all broadcasts I've seen
     map<uint256, CMasternodeBroadcast> mapSeenMasternodeBroadcast;
@@ -86,6 +130,8 @@ public:
 
         READWRITE(mapSeenMasternodeBroadcast);
         READWRITE(mapSeenMasternodePing);
+        if (ser_action.ForRead())
+            RebuildIndexes();
     }
 
     CMasternodeMan();
@@ -100,6 +146,9 @@ public:
     /// Check all Masternodes
     void Check();
 
+    /// Mark the entries whose collateral isn't in the UTXO set (after loading mncache.dat), requires cs_main
+    void CheckCollaterals();
+
     /// Check all Masternodes and remove inactive
     void CheckAndRemove(bool forceExpiredRemoval = false);
 
@@ -115,6 +164,13 @@ public:
     CMasternode* Find(const CTxIn& vin);
     CMasternode* Find(const CPubKey& pubKeyMasternode);
 
+    /// Get the masternode key of an entry and whether its last dsq still allows it a free transaction, false if it isn't known
+    bool GetFreeTxKey(const CTxIn& vin, CPubKey& pubkey2, bool& fAllowFreeTx);
+    /// Allow an entry one free transaction after a dsq
+    void AllowFreeTx(const CTxIn& vin);
+    /// Take the free transaction of an entry, false if it has none left
+    bool UseFreeTx(const CTxIn& vin);
+
     /// Find an entry in the masternode list that is next to be paid
     CMasternode* GetNextMasternodeInQueueForPayment(int nBlockHeight, bool fFilterSigTime, int& nCount);
 
@@ -133,6 +189,9 @@ public:
     void ProcessMasternodeConnections();
 
     void ProcessMessage(CNode* pfrom, std::string& strCommand, CDataStream& vRecv);
+    /// Finish processing a broadcast or ping once darkSendVerifier has checked its signatures
+    void ProcessBroadcast(CNode* pfrom, CMasternodeBroadcast mnb);
+    void ProcessPing(CNode* pfrom, CMasternodePing mnp);
 
     /// Return the number of (unique) Masternodes
     int size() { return vMasternodes.size(); }
@@ -141,6 +200,9 @@ public:
 
     void Remove(CTxIn vin);
 
+    /// Rebuild the lookup indexes and drop the rank tables, e.g. after the masternode key of an entry changed
+    void RebuildIndexes();
+
 };
 
 #endif
@@ -32,6 +32,7 @@
 #endif
 
 #include <boost/filesystem.hpp>
+#include <boost/function.hpp>
 #include <boost/thread.hpp>
 
 // Dump addresses to peers.dat every 15 minutes (900s)
@@ -81,11 +82,12 @@ uint64_t nLocalHostNonce = 0;
 static std::vector<ListenSocket> vhListenSocket;
 CAddrMan addrman;
 int nMaxConnections = 125;
+int nMessageHandlerThreads = DEFAULT_MESSAGE_HANDLER_THREADS;
 bool fAddressesInitialized = false;
 
 vector<CNode*> vNodes;
 CCriticalSection cs_vNodes;
-map<CInv, CDataStream> mapRelay;
+map<CInv, CSerializedMessage> mapRelay;
 deque<pair<int64_t, CInv> > vRelayExpiration;
 CCriticalSection cs_mapRelay;
 limitedmap<CInv, int64_t> mapAlreadyAskedFor(MAX_INV_SZ);
@@ -671,10 +673,10 @@ int CNetMessage::readData(const char *pch, unsigned int nBytes)
 // requires LOCK(cs_vSend)
 void SocketSendData(CNode *pnode)
 {
-    std::deque<CSerializeData>::iterator it = pnode->vSendMsg.begin();
+    std::deque<CSerializedMessage>::iterator it = pnode->vSendMsg.begin();
 
     while (it != pnode->vSendMsg.end()) {
-        const CSerializeData &data = *it;
+        const CSerializeData &data = **it;
         assert(data.size() > pnode->nSendOffset);
         int nBytes = send(pnode->hSocket, &data[pnode->nSendOffset], data.size() - pnode->nSendOffset, MSG_NOSIGNAL | MSG_DONTWAIT);
         if (nBytes > 0) {
@@ -714,9 +716,123 @@ void SocketSendData(CNode *pnode)
 
 static list<CNode*> vNodesDisconnected;
 
+static void AcceptConnection(const ListenSocket& hListenSocket)
+{
+    struct sockaddr_storage sockaddr;
+    socklen_t len = sizeof(sockaddr);
+    SOCKET hSocket = accept(hListenSocket.socket, (struct sockaddr*)&sockaddr, &len);
+    CAddress addr;
+    int nInbound = 0;
+
+    if (hSocket != INVALID_SOCKET)
+        if (!addr.SetSockAddr((const struct sockaddr*)&sockaddr))
+            LogPrintf("Warning: Unknown socket family\n");
+
+    bool whitelisted = hListenSocket.whitelisted || CNode::IsWhitelistedRange(addr);
+    {
+        LOCK(cs_vNodes);
+        BOOST_FOREACH(CNode* pnode, vNodes)
+            if (pnode->fInbound)
+                nInbound++;
+    }
+
+    if (hSocket == INVALID_SOCKET)
+    {
+        int nErr = WSAGetLastError();
+        if (nErr != WSAEWOULDBLOCK)
+            LogPrintf("socket error accept failed: %s\n", NetworkErrorString(nErr));
+    }
+    else if (!IsSelectableSocket(hSocket))
+    {
+        LogPrintf("connection from %s dropped: non-selectable socket\n", addr.ToString());
+        CloseSocket(hSocket);
+    }
+    else if (nInbound >= nMaxConnections - MAX_OUTBOUND_CONNECTIONS)
+    {
+        LogPrint("net", "connection from %s dropped (full)\n", addr.ToString());
+        CloseSocket(hSocket);
+    }
+    else if (CNode::IsBanned(addr) && !whitelisted)
+    {
+        LogPrintf("connection from %s dropped (banned)\n", addr.ToString());
+        CloseSocket(hSocket);
+    }
+    else
+    {
+        CNode* pnode = new CNode(hSocket, addr, "", true);
+        pnode->AddRef();
+        pnode->fWhitelisted = whitelisted;
+
+        {
+            LOCK(cs_vNodes);
+            vNodes.push_back(pnode);
+        }
+    }
+}
+
+#ifdef USE_EPOLL
+/** Maximum number of socket events handled per epoll_wait() call; the rest are reported by the next one. */
+static const int MAX_POLL_EVENTS = 256;
+
+/** epoll data of a listening socket: its index in vhListenSocket with the top bit set. Node ids never have it set. */
+static const uint64_t POLL_LISTEN_SOCKET = (uint64_t)1 << 63;
+
+static int hPollSocket = -1;
+
+/**
+ * Register a peer socket, or update its registration. Reads are edge-triggered: an
+ * event is only reported when new data arrives, so fRecvReady stays set until recv()
+ * would block. Writability is only asked for while there is queued data to send.
+ */
+static bool UpdatePollRegistration(CNode* pnode, bool fSend)
+{
+    struct epoll_event event;
+    event.events = EPOLLIN | EPOLLRDHUP | EPOLLET | (fSend ? EPOLLOUT : 0);
+    event.data.u64 = pnode->id;
+    if (epoll_ctl(hPollSocket, pnode->fPollRegistered ? EPOLL_CTL_MOD : EPOLL_CTL_ADD, pnode->hSocket, &event) == SOCKET_ERROR) {
+        LogPrintf("epoll_ctl for peer=%d failed: %s\n", pnode->id, NetworkErrorString(WSAGetLastError()));
+        return false;
+    }
+    pnode->fPollRegistered = true;
+    pnode->fPollSend = fSend;
+    return true;
+}
+#endif
+
+bool InitSocketHandler(std::string& strError)
+{
+#ifdef USE_EPOLL
+    // No select() to fall back to: -maxconnections isn't capped at FD_SETSIZE with epoll
+    if (hPollSocket == -1) {
+        hPollSocket = epoll_create1(EPOLL_CLOEXEC);
+        if (hPollSocket == -1) {
+            strError = strprintf(_("Error: Couldn't create an epoll instance to wait on the network sockets (%s)"), NetworkErrorString(WSAGetLastError()));
+            LogPrintf("%s\n", strError);
+            return false;
+        }
+    }
+#endif
+    return true;
+}
+
 void ThreadSocketHandler()
 {
     unsigned int nPrevNodeCount = 0;
+#ifdef USE_EPOLL
+    // Peers registered with the epoll instance, by id. Events name peers by id so that
+    // an event for a peer that was disconnected in the meantime is simply dropped.
+    map<NodeId, CNode*> mapPollNodes;
+
+    // Created by InitSocketHandler during init
+    assert(hPollSocket != -1);
+    for (unsigned int i = 0; i < vhListenSocket.size(); i++) {
+        struct epoll_event event;
+        event.events = EPOLLIN;
+        event.data.u64 = POLL_LISTEN_SOCKET | i;
+        if (epoll_ctl(hPollSocket, EPOLL_CTL_ADD, vhListenSocket[i].socket, &event) == SOCKET_ERROR)
+            LogPrintf("epoll_ctl for listening socket failed: %s\n", NetworkErrorString(WSAGetLastError()));
+    }
+#endif
     while (true)
     {
         //
@@ -733,6 +849,9 @@ void ThreadSocketHandler()
                 {
                     // remove from vNodes
                     vNodes.erase(remove(vNodes.begin(), vNodes.end(), pnode), vNodes.end());
+#ifdef USE_EPOLL
+                    mapPollNodes.erase(pnode->id);
+#endif
 
                     // release outbound grant (if any)
                     pnode->grantOutbound.Release();
@@ -785,6 +904,61 @@ void ThreadSocketHandler()
         //
         // Find which sockets have data to receive
         //
+        vector<const ListenSocket*> vListenReady;
+#ifdef USE_EPOLL
+        {
+            LOCK(cs_vNodes);
+            BOOST_FOREACH(CNode* pnode, vNodes)
+            {
+                if (pnode->hSocket == INVALID_SOCKET)
+                    continue;
+
+                // Ask for writability only while an optimistic write left data queued.
+                bool fSend = pnode->fPollSend;
+                {
+                    TRY_LOCK(pnode->cs_vSend, lockSend);
+                    if (lockSend)
+                        fSend = !pnode->vSendMsg.empty();
+                }
+                if (pnode->fPollRegistered && fSend == pnode->fPollSend)
+                    continue;
+                if (!UpdatePollRegistration(pnode, fSend))
+                    pnode->fDisconnect = true;
+                else
+                    mapPollNodes[pnode->id] = pnode;
+            }
+        }
+
+        struct epoll_event events[MAX_POLL_EVENTS];
+        int nEvents = epoll_wait(hPollSocket, events, MAX_POLL_EVENTS, 50); // frequency to poll pnode->vSend
+        boost::this_thread::interruption_point();
+
+        if (nEvents == SOCKET_ERROR)
+        {
+            int nErr = WSAGetLastError();
+            if (nErr != WSAEINTR)
+            {
+                LogPrintf("socket epoll_wait error %s\n", NetworkErrorString(nErr));
+                MilliSleep(50);
+            }
+            nEvents = 0;
+        }
+
+        for (int i = 0; i < nEvents; i++)
+        {
+            if (events[i].data.u64 & POLL_LISTEN_SOCKET) {
+                vListenReady.push_back(&vhListenSocket[events[i].data.u64 & ~POLL_LISTEN_SOCKET]);
+                continue;
+            }
+            map<NodeId, CNode*>::iterator mi = mapPollNodes.find(events[i].data.u64);
+            if (mi == mapPollNodes.end())
+                continue;
+            if (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))
+                mi->second->fRecvReady = true;
+            if (events[i].events & EPOLLOUT)
+                mi->second->fSendReady = true;
+        }
+#else
         struct timeval timeout;
         timeout.tv_sec  = 0;
         timeout.tv_usec = 50000; // frequency to poll pnode->vSend
@@ -864,65 +1038,16 @@ void ThreadSocketHandler()
             MilliSleep(timeout.tv_usec/1000);
         }
 
-        //
-        // Accept new connections
-        //
         BOOST_FOREACH(const ListenSocket& hListenSocket, vhListenSocket)
-        {
             if (hListenSocket.socket != INVALID_SOCKET && FD_ISSET(hListenSocket.socket, &fdsetRecv))
-            {
-                struct sockaddr_storage sockaddr;
-                socklen_t len = sizeof(sockaddr);
-                SOCKET hSocket = accept(hListenSocket.socket, (struct sockaddr*)&sockaddr, &len);
-                CAddress addr;
-                int nInbound = 0;
-
-                if (hSocket != INVALID_SOCKET)
-                    if (!addr.SetSockAddr((const struct sockaddr*)&sockaddr))
-                        LogPrintf("Warning: Unknown socket family\n");
-
-                bool whitelisted = hListenSocket.whitelisted || CNode::IsWhitelistedRange(addr);
-                {
-                    LOCK(cs_vNodes);
-                    BOOST_FOREACH(CNode* pnode, vNodes)
-                        if (pnode->fInbound)
-                            nInbound++;
-                }
-
-                if (hSocket == INVALID_SOCKET)
-                {
-                    int nErr = WSAGetLastError();
-                    if (nErr != WSAEWOULDBLOCK)
-                        LogPrintf("socket error accept failed: %s\n", NetworkErrorString(nErr));
-                }
-                else if (!IsSelectableSocket(hSocket))
-                {
-                    LogPrintf("connection from %s dropped: non-selectable socket\n", addr.ToString());
-                    CloseSocket(hSocket);
-                }
-                else if (nInbound >= nMaxConnections - MAX_OUTBOUND_CONNECTIONS)
-                {
-                    LogPrint("net", "connection from %s dropped (full)\n", addr.ToString());
-                    CloseSocket(hSocket);
-                }
-                else if (CNode::IsBanned(addr) && !whitelisted)
-                {
-                    LogPrintf("connection from %s dropped (banned)\n", addr.ToString());
-                    CloseSocket(hSocket);
-                }
-                else
-                {
-                    CNode* pnode = new CNode(hSocket, addr, "", true);
-                    pnode->AddRef();
-                    pnode->fWhitelisted = whitelisted;
+                vListenReady.push_back(&hListenSocket);
+#endif
 
-                    {
-                        LOCK(cs_vNodes);
-                        vNodes.push_back(pnode);
-                    }
-                }
-            }
-        }
+        //
+        // Accept new connections
+        //
+        BOOST_FOREACH(const ListenSocket* pListenSocket, vListenReady)
+            AcceptConnection(*pListenSocket);
 
         //
         // Service each socket
@@ -943,11 +1068,20 @@ void ThreadSocketHandler()
             //
             if (pnode->hSocket == INVALID_SOCKET)
                 continue;
-            if (FD_ISSET(pnode->hSocket, &fdsetRecv) || FD_ISSET(pnode->hSocket, &fdsetError))
+#ifndef USE_EPOLL
+            pnode->fRecvReady = FD_ISSET(pnode->hSocket, &fdsetRecv) || FD_ISSET(pnode->hSocket, &fdsetError);
+            pnode->fSendReady = FD_ISSET(pnode->hSocket, &fdsetSend);
+#endif
+            if (pnode->fRecvReady)
             {
                 TRY_LOCK(pnode->cs_vRecvMsg, lockRecv);
                 if (lockRecv)
                 {
+                    // Read until the socket would block or the receive buffer is full; an
+                    // edge-triggered socket is not reported again for data that is already there.
+                    while (pnode->fRecvReady && pnode->hSocket != INVALID_SOCKET && (
+                        pnode->vRecvMsg.empty() || !pnode->vRecvMsg.front().complete() ||
+                        pnode->GetTotalRecvSize() <= ReceiveFloodSize()))
                     {
                         // typical socket buffer is 8K-64K
                         char pchBuf[0x10000];
@@ -971,12 +1105,16 @@ void ThreadSocketHandler()
                         {
                             // error
                             int nErr = WSAGetLastError();
-                            if (nErr != WSAEWOULDBLOCK && nErr != WSAEMSGSIZE && nErr != WSAEINTR && nErr != WSAEINPROGRESS)
+                            if (nErr == WSAEWOULDBLOCK)
+                                pnode->fRecvReady = false;
+                            else if (nErr != WSAEMSGSIZE && nErr != WSAEINTR && nErr != WSAEINPROGRESS)
                             {
                                 if (!pnode->fDisconnect)
                                     LogPrintf("socket recv error %s\n", NetworkErrorString(nErr));
                                 pnode->CloseSocketDisconnect();
                             }
+                            else
+                                break;
                         }
                     }
                 }
@@ -987,11 +1125,14 @@ void ThreadSocketHandler()
             //
             if (pnode->hSocket == INVALID_SOCKET)
                 continue;
-            if (FD_ISSET(pnode->hSocket, &fdsetSend))
+            if (pnode->fSendReady)
             {
                 TRY_LOCK(pnode->cs_vSend, lockSend);
                 if (lockSend)
+                {
                     SocketSendData(pnode);
+                    pnode->fSendReady = false;
+                }
             }
 
             //
@@ -1436,7 +1577,7 @@ bool OpenNetworkConnection(const CAddress& addrConnect, CSemaphoreGrant *grantOu
 }
 
 
-void ThreadMessageHandler()
+void ThreadMessageHandler(int nThread)
 {
     boost::mutex condition_mutex;
     boost::unique_lock<boost::mutex> lock(condition_mutex);
@@ -1455,16 +1596,25 @@ void ThreadMessageHandler()
 
         // Poll the connected nodes for messages
         CNode* pnodeTrickle = NULL;
-        if (!vNodesCopy.empty())
+        if (nThread == 0 && !vNodesCopy.empty())
             pnodeTrickle = vNodesCopy[GetRand(vNodesCopy.size())];
 
         bool fSleep = true;
 
-        BOOST_FOREACH(CNode* pnode, vNodesCopy)
+        // Every handler thread walks all nodes, each from a different starting point,
+        // and skips the ones another thread is working on. A peer that is slow to
+        // process only holds up its own thread.
+        size_t nStart = vNodesCopy.size() * nThread / nMessageHandlerThreads;
+        for (size_t i = 0; i < vNodesCopy.size(); i++)
         {
+            CNode* pnode = vNodesCopy[(nStart + i) % vNodesCopy.size()];
             if (pnode->fDisconnect)
                 continue;
 
+            TRY_LOCK(pnode->cs_processing, lockProcessing);
+            if (!lockProcessing)
+                continue;
+
             // Receive messages
             {
                 TRY_LOCK(pnode->cs_vRecvMsg, lockRecv);
@@ -1484,12 +1634,10 @@ void ThreadMessageHandler()
             }
             boost::this_thread::interruption_point();
 
-            // Send messages
-            {
-                TRY_LOCK(pnode->cs_vSend, lockSend);
-                if (lockSend)
-                    g_signals.SendMessages(pnode, pnode == pnodeTrickle || pnode->fWhitelisted);
-            }
+            // Send messages. cs_vSend is only taken per message: handlers relaying to
+            // other peers lock cs_vNodes before their cs_vSend, and SendMessages may
+            // lock cs_vNodes itself.
+            g_signals.SendMessages(pnode, pnode == pnodeTrickle || pnode->fWhitelisted);
             boost::this_thread::interruption_point();
         }
 
@@ -1701,7 +1849,8 @@ void StartNode(boost::thread_group& threadGroup)
     threadGroup.create_thread(boost::bind(&TraceThread<void (*)()>, "opencon", &ThreadOpenConnections));
 
     // Process messages
-    threadGroup.create_thread(boost::bind(&TraceThread<void (*)()>, "msghand", &ThreadMessageHandler));
+    for (int i = 0; i < nMessageHandlerThreads; i++)
+        threadGroup.create_thread(boost::bind(&TraceThread<boost::function<void()> >, "msghand", boost::function<void()>(boost::bind(&ThreadMessageHandler, i))));
 
     // Dump network addresses
     threadGroup.create_thread(boost::bind(&LoopForever<void (*)()>, "dumpaddr", &DumpAddresses, DUMP_ADDRESSES_INTERVAL * 1000));
@@ -1740,6 +1889,11 @@ public:
             if (hListenSocket.socket != INVALID_SOCKET)
                 if (!CloseSocket(hListenSocket.socket))
                     LogPrintf("CloseSocket(hListenSocket) failed with error %s\n", NetworkErrorString(WSAGetLastError()));
+#ifdef USE_EPOLL
+        if (hPollSocket != -1)
+            close(hPollSocket);
+        hPollSocket = -1;
+#endif
 
         // clean up some globals (to help leak detection)
         BOOST_FOREACH(CNode *pnode, vNodes)
@@ -1790,8 +1944,10 @@ void RelayTransaction(const CTransaction& tx, const CDataStream& ss)
             vRelayExpiration.pop_front();
         }
 
-        // Save original serialized message so newer versions are preserved
-        mapRelay.insert(std::make_pair(inv, ss));
+        // Save original serialized message so newer versions are preserved,
+        // built once for all the peers that ask for it
+        if (!mapRelay.count(inv))
+            mapRelay.insert(std::make_pair(inv, MakeSerializedMessage(inv.GetCommand(), &ss[0], ss.size())));
         vRelayExpiration.push_back(std::make_pair(GetTime() + 15 * 60, inv));
     }
     LOCK(cs_vNodes);
@@ -2014,6 +2170,12 @@ CNode::CNode(SOCKET hSocketIn, CAddress addrIn, std::string addrNameIn, bool fIn
     nRefCount = 0;
     nSendSize = 0;
     nSendOffset = 0;
+    fRecvReady = false;
+    fSendReady = false;
+#ifdef USE_EPOLL
+    fPollRegistered = false;
+    fPollSend = false;
+#endif
     hashContinue = 0;
     nStartingHeight = -1;
     fGetAddr = false;
@@ -2130,13 +2292,47 @@ void CNode::EndMessage() UNLOCK_FUNCTION(cs_vSend)
 
     LogPrint("net", "(%d bytes) peer=%d\n", nSize, id);
 
-    std::deque<CSerializeData>::iterator it = vSendMsg.insert(vSendMsg.end(), CSerializeData());
-    ssSend.GetAndClear(*it);
-    nSendSize += (*it).size();
+    boost::shared_ptr<CSerializeData> pmsg(new CSerializeData());
+    ssSend.GetAndClear(*pmsg);
+    vSendMsg.push_back(pmsg);
+    nSendSize += pmsg->size();
 
     // If write queue empty, attempt "optimistic write"
-    if (it == vSendMsg.begin())
+    if (vSendMsg.size() == 1)
         SocketSendData(this);
 
     LEAVE_CRITICAL_SECTION(cs_vSend);
 }
+
+void CNode::PushSerializedMessage(const CSerializedMessage& msg)
+{
+    LOCK(cs_vSend);
+
+    const char* pchCommand = &(*msg)[MESSAGE_START_SIZE];
+    LogPrint("net", "sending: %s (%d bytes) peer=%d\n", SanitizeString(std::string(pchCommand, pchCommand + CMessageHeader::COMMAND_SIZE)), msg->size() - CMessageHeader::HEADER_SIZE, id);
+
+    vSendMsg.push_back(msg);
+    nSendSize += msg->size();
+
+    // If write queue empty, attempt "optimistic write"
+    if (vSendMsg.size() == 1)
+        SocketSendData(this);
+}
+
+CSerializedMessage MakeSerializedMessage(const char* pszCommand, const char* pch, size_t nSize)
+{
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss.reserve(CMessageHeader::HEADER_SIZE + nSize);
+    ss << CMessageHeader(pszCommand, nSize);
+    ss.write(pch, nSize);
+
+    // Set the checksum
+    uint256 hash = Hash(pch, pch + nSize);
+    unsigned int nChecksum = 0;
+    memcpy(&nChecksum, &hash, sizeof(nChecksum));
+    memcpy((char*)&ss[CMessageHeader::CHECKSUM_OFFSET], &nChecksum, sizeof(nChecksum));
+
+    boost::shared_ptr<CSerializeData> pmsg(new CSerializeData());
+    ss.GetAndClear(*pmsg);
+    return pmsg;
+}
@@ -9,11 +9,28 @@
 #include "tinyformat.h"
 #include "utilstrencodings.h"
 
+#include <string.h>
+
 uint256 CBlockHeader::GetHash() const
 {
     return HashX11(BEGIN(nVersion), END(nNonce));
 }
 
+void CBlockHeader::GetHashes(const std::vector<CBlockHeader>& vHeaders, std::vector<uint256>& vHashes)
+{
+    vHashes.resize(vHeaders.size());
+    if (vHeaders.empty())
+        return;
+    const size_t nHeaderSize = END(vHeaders[0].nNonce) - BEGIN(vHeaders[0].nVersion);
+    std::vector<unsigned char> vchData(vHeaders.size() * nHeaderSize);
+    std::vector<unsigned char> vchHashes(vHeaders.size() * X11_OUTPUT_SIZE);
+    for (size_t i = 0; i < vHeaders.size(); i++)
+        memcpy(&vchData[i * nHeaderSize], BEGIN(vHeaders[i].nVersion), nHeaderSize);
+    X11Batch(&vchData[0], nHeaderSize, nHeaderSize, vHeaders.size(), &vchHashes[0]);
+    for (size_t i = 0; i < vHeaders.size(); i++)
+        memcpy(vHashes[i].begin(), &vchHashes[i * X11_OUTPUT_SIZE], X11_OUTPUT_SIZE);
+}
+
 uint256 CBlock::BuildMerkleTree(bool* fMutated) const
 {
     /* WARNING! If you're reading this because you're learning about crypto
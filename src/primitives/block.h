@@ -67,6 +67,9 @@ public:
 
     uint256 GetHash() const;
 
+    /** Compute the hashes of many headers at once, vHashes[i] is vHeaders[i].GetHash() */
+    static void GetHashes(const std::vector<CBlockHeader>& vHeaders, std::vector<uint256>& vHashes);
+
     int64_t GetBlockTime() const
     {
         return (int64_t)nTime;
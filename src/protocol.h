@@ -66,6 +66,9 @@ public:
 /** nServices flags */
 enum {
     NODE_NETWORK = (1 << 0),
+    // NODE_COMPACT_FILTERS means the node serves the BIP158 basic block filters,
+    // see BIP157 for the getcfilters, getcfheaders and getcfcheckpt messages.
+    NODE_COMPACT_FILTERS = (1 << 6),
 
     // Bits 24-31 are reserved for temporary experiments. Just pick a bit that
     // isn't getting used, or one not being used much, and notify the
@@ -12,11 +12,136 @@
 #include "ecwrapper.h"
 #endif
 
+#ifdef USE_SECP256K1
+//! anonymous namespace
+namespace {
+
+/**
+ * Re-encode a signature in the loose BER encoding OpenSSL used to accept as
+ * strict DER, so libsecp256k1 accepts exactly the signatures the OpenSSL
+ * based verifier did: long form lengths, excess padding, missing sign bytes
+ * and trailing garbage are tolerated, but R and S must fit in 32 bytes.
+ * Returns false if no (R, S) pair can be extracted.
+ */
+bool NormalizeSignature(const std::vector<unsigned char>& vchSig, std::vector<unsigned char>& vchNorm)
+{
+    const unsigned char* input = vchSig.empty() ? NULL : &vchSig[0];
+    size_t pos = 0, inputlen = vchSig.size();
+    size_t lenbyte, rpos, rlen, spos, slen;
+
+    // Sequence tag byte and length descriptor
+    if (pos == inputlen || input[pos] != 0x30)
+        return false;
+    pos++;
+    if (pos == inputlen)
+        return false;
+    lenbyte = input[pos++];
+    if (lenbyte & 0x80) {
+        lenbyte -= 0x80;
+        if (lenbyte > inputlen - pos)
+            return false;
+        pos += lenbyte;
+    }
+
+    // Integer tag byte and length descriptor for R
+    if (pos == inputlen || input[pos] != 0x02)
+        return false;
+    pos++;
+    if (pos == inputlen)
+        return false;
+    lenbyte = input[pos++];
+    if (lenbyte & 0x80) {
+        lenbyte -= 0x80;
+        if (lenbyte > inputlen - pos)
+            return false;
+        while (lenbyte > 0 && input[pos] == 0) {
+            pos++;
+            lenbyte--;
+        }
+        if (lenbyte >= sizeof(size_t))
+            return false;
+        rlen = 0;
+        while (lenbyte > 0) {
+            rlen = (rlen << 8) + input[pos++];
+            lenbyte--;
+        }
+    } else {
+        rlen = lenbyte;
+    }
+    if (rlen > inputlen - pos)
+        return false;
+    rpos = pos;
+    pos += rlen;
+
+    // Integer tag byte and length descriptor for S
+    if (pos == inputlen || input[pos] != 0x02)
+        return false;
+    pos++;
+    if (pos == inputlen)
+        return false;
+    lenbyte = input[pos++];
+    if (lenbyte & 0x80) {
+        lenbyte -= 0x80;
+        if (lenbyte > inputlen - pos)
+            return false;
+        while (lenbyte > 0 && input[pos] == 0) {
+            pos++;
+            lenbyte--;
+        }
+        if (lenbyte >= sizeof(size_t))
+            return false;
+        slen = 0;
+        while (lenbyte > 0) {
+            slen = (slen << 8) + input[pos++];
+            lenbyte--;
+        }
+    } else {
+        slen = lenbyte;
+    }
+    if (slen > inputlen - pos)
+        return false;
+    spos = pos;
+
+    // Strip leading zeroes; what is left has to fit in a scalar
+    while (rlen > 0 && input[rpos] == 0) {
+        rlen--;
+        rpos++;
+    }
+    while (slen > 0 && input[spos] == 0) {
+        slen--;
+        spos++;
+    }
+    if (rlen == 0 || rlen > 32 || slen == 0 || slen > 32)
+        return false;
+
+    // Minimal DER: a zero byte is prepended to integers with the top bit set
+    bool fPadR = input[rpos] & 0x80, fPadS = input[spos] & 0x80;
+    size_t lenR = rlen + fPadR, lenS = slen + fPadS;
+    vchNorm.resize(6 + lenR + lenS);
+    vchNorm[0] = 0x30;
+    vchNorm[1] = 4 + lenR + lenS;
+    vchNorm[2] = 0x02;
+    vchNorm[3] = lenR;
+    vchNorm[4] = 0x00;
+    memcpy(&vchNorm[4 + fPadR], input + rpos, rlen);
+    vchNorm[4 + lenR] = 0x02;
+    vchNorm[5 + lenR] = lenS;
+    vchNorm[6 + lenR] = 0x00;
+    memcpy(&vchNorm[6 + lenR + fPadS], input + spos, slen);
+    return true;
+}
+
+} // anon namespace
+#endif
+
 bool CPubKey::Verify(const uint256 &hash, const std::vector<unsigned char>& vchSig) const {
     if (!IsValid())
         return false;
 #ifdef USE_SECP256K1
-    if (secp256k1_ecdsa_verify((const unsigned char*)&hash, 32, &vchSig[0], vchSig.size(), begin(), size()) != 1)
+    std::vector<unsigned char> vchNorm;
+    if (!NormalizeSignature(vchSig, vchNorm))
+        return false;
+    if (secp256k1_ecdsa_verify((const unsigned char*)&hash, 32, &vchNorm[0], vchNorm.size(), begin(), size()) != 1)
         return false;
 #else
     CECKey key;
@@ -53,7 +178,7 @@ bool CPubKey::IsFullyValid() const {
     if (!IsValid())
         return false;
 #ifdef USE_SECP256K1
-    if (!secp256k1_ecdsa_pubkey_verify(begin(), size()))
+    if (!secp256k1_ec_pubkey_verify(begin(), size()))
         return false;
 #else
     CECKey key;
@@ -68,7 +193,7 @@ bool CPubKey::Decompress() {
         return false;
 #ifdef USE_SECP256K1
     int clen = size();
-    int ret = secp256k1_ecdsa_pubkey_decompress((unsigned char*)begin(), &clen);
+    int ret = secp256k1_ec_pubkey_decompress((unsigned char*)begin(), &clen);
     assert(ret);
     assert(clen == (int)size());
 #else
@@ -91,7 +216,7 @@ bool CPubKey::Derive(CPubKey& pubkeyChild, unsigned char ccChild[32], unsigned i
     memcpy(ccChild, out+32, 32);
 #ifdef USE_SECP256K1
     pubkeyChild = *this;
-    bool ret = secp256k1_ecdsa_pubkey_tweak_add((unsigned char*)pubkeyChild.begin(), pubkeyChild.size(), out);
+    bool ret = secp256k1_ec_pubkey_tweak_add((unsigned char*)pubkeyChild.begin(), pubkeyChild.size(), out);
 #else
     CECKey key;
     bool ret = key.SetPubKey(begin(), size());
@@ -9,6 +9,8 @@
 #include "rpcserver.h"
 #include "streams.h"
 #include "sync.h"
+#include "txmempool.h"
+#include "util.h"
 #include "utilstrencodings.h"
 #include "version.h"
 
@@ -17,6 +19,9 @@
 using namespace std;
 using namespace json_spirit;
 
+static const int MAX_REST_HEADERS_RESULTS = 2000;
+static const size_t MAX_GETUTXOS_OUTPOINTS = 15; //allow a max of 15 outpoints to be queried at once
+
 enum RetFormat {
     RF_UNDEF,
     RF_BINARY,
@@ -41,8 +46,27 @@ public:
     string message;
 };
 
+/** An unspent output as returned by /rest/getutxos/ */
+struct CCoin {
+    uint32_t nTxVer; // Don't call this nVersion, that name has a special meaning inside IMPLEMENT_SERIALIZE
+    uint32_t nHeight;
+    CTxOut out;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion)
+    {
+        READWRITE(nTxVer);
+        READWRITE(nHeight);
+        READWRITE(out);
+    }
+};
+
 extern void TxToJSON(const CTransaction& tx, const uint256 hashBlock, Object& entry);
 extern Object blockToJSON(const CBlock& block, const CBlockIndex* blockindex, bool txDetails = false);
+extern Object blockHeaderToJSON(const CBlock& block, const CBlockIndex* blockindex);
+extern void ScriptPubKeyToJSON(const CScript& scriptPubKey, Object& out, bool fIncludeHex);
 
 static RestErr RESTERR(enum HTTPStatusCode status, string message)
 {
@@ -91,6 +115,7 @@ static bool ParseHashStr(const string& strReq, uint256& v)
 
 static bool rest_block(AcceptedConnection* conn,
                        string& strReq,
+                       const string& strRequest,
                        map<string, string>& mapHeaders,
                        bool fRun,
                        bool showTxDetails)
@@ -149,22 +174,25 @@ static bool rest_block(AcceptedConnection* conn,
 
 static bool rest_block_extended(AcceptedConnection* conn,
                        string& strReq,
+                       const string& strRequest,
                        map<string, string>& mapHeaders,
                        bool fRun)
 {
-    return rest_block(conn, strReq, mapHeaders, fRun, true);
+    return rest_block(conn, strReq, strRequest, mapHeaders, fRun, true);
 }
 
 static bool rest_block_notxdetails(AcceptedConnection* conn,
                        string& strReq,
+                       const string& strRequest,
                        map<string, string>& mapHeaders,
                        bool fRun)
 {
-    return rest_block(conn, strReq, mapHeaders, fRun, false);
+    return rest_block(conn, strReq, strRequest, mapHeaders, fRun, false);
 }
 
 static bool rest_tx(AcceptedConnection* conn,
                     string& strReq,
+                    const string& strRequest,
                     map<string, string>& mapHeaders,
                     bool fRun)
 {
@@ -214,20 +242,399 @@ static bool rest_tx(AcceptedConnection* conn,
     return true; // continue to process further HTTP reqs on this cxn
 }
 
+static bool rest_headers(AcceptedConnection* conn,
+                         string& strReq,
+                         const string& strRequest,
+                         map<string, string>& mapHeaders,
+                         bool fRun)
+{
+    vector<string> params;
+    enum RetFormat rf = ParseDataFormat(params, strReq);
+    vector<string> path;
+    boost::split(path, params[0], boost::is_any_of("/"));
+
+    if (path.size() != 2)
+        throw RESTERR(HTTP_BAD_REQUEST, "No header count specified. Use /rest/headers/<count>/<hash>.<ext>.");
+
+    long count = strtol(path[0].c_str(), NULL, 10);
+    if (count < 1 || count > MAX_REST_HEADERS_RESULTS)
+        throw RESTERR(HTTP_BAD_REQUEST, "Header count out of range: " + path[0]);
+
+    string hashStr = path[1];
+    uint256 hash;
+    if (!ParseHashStr(hashStr, hash))
+        throw RESTERR(HTTP_BAD_REQUEST, "Invalid hash: " + hashStr);
+
+    // Block index entries are never deleted, so they can be used after cs_main is released
+    std::vector<const CBlockIndex*> headers;
+    headers.reserve(count);
+    {
+        LOCK(cs_main);
+        BlockMap::const_iterator it = mapBlockIndex.find(hash);
+        const CBlockIndex* pindex = (it != mapBlockIndex.end()) ? it->second : NULL;
+        while (pindex != NULL && chainActive.Contains(pindex)) {
+            headers.push_back(pindex);
+            if (headers.size() == (unsigned long)count)
+                break;
+            pindex = chainActive.Next(pindex);
+        }
+    }
+
+    CDataStream ssHeader(SER_NETWORK, PROTOCOL_VERSION);
+    BOOST_FOREACH(const CBlockIndex* pindex, headers)
+        ssHeader << pindex->GetBlockHeader();
+
+    switch (rf) {
+    case RF_BINARY: {
+        string binaryHeader = ssHeader.str();
+        conn->stream() << HTTPReplyHeader(HTTP_OK, fRun, binaryHeader.size(), "application/octet-stream") << binaryHeader << std::flush;
+        return true;
+    }
+
+    case RF_HEX: {
+        string strHex = HexStr(ssHeader.begin(), ssHeader.end()) + "\n";
+        conn->stream() << HTTPReply(HTTP_OK, strHex, fRun, false, "text/plain") << std::flush;
+        return true;
+    }
+
+    case RF_JSON: {
+        Array jsonHeaders;
+        BOOST_FOREACH(const CBlockIndex* pindex, headers) {
+            Object objHeader = blockHeaderToJSON(CBlock(pindex->GetBlockHeader()), pindex);
+            objHeader.insert(objHeader.begin(), Pair("height", pindex->nHeight));
+            objHeader.insert(objHeader.begin(), Pair("hash", pindex->GetBlockHash().GetHex()));
+            jsonHeaders.push_back(objHeader);
+        }
+        string strJSON = write_string(Value(jsonHeaders), false) + "\n";
+        conn->stream() << HTTPReply(HTTP_OK, strJSON, fRun) << std::flush;
+        return true;
+    }
+
+    default: {
+        throw RESTERR(HTTP_NOT_FOUND, "output format not found (available: .bin, .hex, .json)");
+    }
+    }
+
+    // not reached
+    return true; // continue to process further HTTP reqs on this cxn
+}
+
+static bool rest_chaininfo(AcceptedConnection* conn,
+                           string& strReq,
+                           const string& strRequest,
+                           map<string, string>& mapHeaders,
+                           bool fRun)
+{
+    vector<string> params;
+    enum RetFormat rf = ParseDataFormat(params, strReq);
+
+    switch (rf) {
+    case RF_BINARY:
+    case RF_HEX: {
+        // chain name, height, best header height, best block hash and chain work of the tip
+        CDataStream ssChainInfo(SER_NETWORK, PROTOCOL_VERSION);
+        {
+            LOCK(cs_main);
+            ssChainInfo << Params().NetworkIDString() << (int32_t)chainActive.Height()
+                        << (int32_t)(pindexBestHeader ? pindexBestHeader->nHeight : -1)
+                        << chainActive.Tip()->GetBlockHash() << chainActive.Tip()->nChainWork;
+        }
+
+        if (rf == RF_BINARY) {
+            string binaryChainInfo = ssChainInfo.str();
+            conn->stream() << HTTPReplyHeader(HTTP_OK, fRun, binaryChainInfo.size(), "application/octet-stream") << binaryChainInfo << std::flush;
+        } else {
+            string strHex = HexStr(ssChainInfo.begin(), ssChainInfo.end()) + "\n";
+            conn->stream() << HTTPReply(HTTP_OK, strHex, fRun, false, "text/plain") << std::flush;
+        }
+        return true;
+    }
+
+    case RF_JSON: {
+        Value chainInfoObject;
+        {
+            LOCK(cs_main);
+            chainInfoObject = getblockchaininfo(Array(), false);
+        }
+        string strJSON = write_string(chainInfoObject, false) + "\n";
+        conn->stream() << HTTPReply(HTTP_OK, strJSON, fRun) << std::flush;
+        return true;
+    }
+
+    default: {
+        throw RESTERR(HTTP_NOT_FOUND, "output format not found (available: .bin, .hex, .json)");
+    }
+    }
+
+    // not reached
+    return true; // continue to process further HTTP reqs on this cxn
+}
+
+static bool rest_mempool_info(AcceptedConnection* conn,
+                              string& strReq,
+                              const string& strRequest,
+                              map<string, string>& mapHeaders,
+                              bool fRun)
+{
+    vector<string> params;
+    enum RetFormat rf = ParseDataFormat(params, strReq);
+
+    switch (rf) {
+    case RF_BINARY:
+    case RF_HEX: {
+        // transaction count, their total size, memory usage, its limit and the minimum fee rate per kB
+        size_t maxmempool = GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000;
+        CDataStream ssMempoolInfo(SER_NETWORK, PROTOCOL_VERSION);
+        ssMempoolInfo << (uint64_t)mempool.size() << (uint64_t)mempool.GetTotalTxSize()
+                      << (uint64_t)mempool.DynamicMemoryUsage() << (uint64_t)maxmempool
+                      << (int64_t)mempool.GetMinFee(maxmempool).GetFeePerK();
+
+        if (rf == RF_BINARY) {
+            string binaryMempoolInfo = ssMempoolInfo.str();
+            conn->stream() << HTTPReplyHeader(HTTP_OK, fRun, binaryMempoolInfo.size(), "application/octet-stream") << binaryMempoolInfo << std::flush;
+        } else {
+            string strHex = HexStr(ssMempoolInfo.begin(), ssMempoolInfo.end()) + "\n";
+            conn->stream() << HTTPReply(HTTP_OK, strHex, fRun, false, "text/plain") << std::flush;
+        }
+        return true;
+    }
+
+    case RF_JSON: {
+        string strJSON = write_string(getmempoolinfo(Array(), false), false) + "\n";
+        conn->stream() << HTTPReply(HTTP_OK, strJSON, fRun) << std::flush;
+        return true;
+    }
+
+    default: {
+        throw RESTERR(HTTP_NOT_FOUND, "output format not found (available: .bin, .hex, .json)");
+    }
+    }
+
+    // not reached
+    return true; // continue to process further HTTP reqs on this cxn
+}
+
+static bool rest_getutxos(AcceptedConnection* conn,
+                          string& strReq,
+                          const string& strRequest,
+                          map<string, string>& mapHeaders,
+                          bool fRun)
+{
+    vector<string> params;
+    enum RetFormat rf = ParseDataFormat(params, strReq);
+
+    vector<string> uriParts;
+    if (params.size() > 0 && params[0].length() > 0)
+        boost::split(uriParts, params[0], boost::is_any_of("/"));
+
+    // throw exception in case of a empty request
+    if (strRequest.length() == 0 && uriParts.size() == 0)
+        throw RESTERR(HTTP_BAD_REQUEST, "Error: empty request");
+
+    bool fInputParsed = false;
+    bool fCheckMemPool = false;
+    vector<COutPoint> vOutPoints;
+
+    // parse/deserialize input
+    // input-format = output-format, rest/getutxos/bin requires binary input, gives binary output, ...
+
+    if (uriParts.size() > 0)
+    {
+        //inputs is sent over URI scheme (/rest/getutxos/checkmempool/txid1-n/txid2-n/...)
+        if (uriParts[0] == "checkmempool")
+            fCheckMemPool = true;
+
+        for (size_t i = (fCheckMemPool) ? 1 : 0; i < uriParts.size(); i++)
+        {
+            int32_t nOutput;
+            string strTxid = uriParts[i].substr(0, uriParts[i].find("-"));
+            string strOutput = uriParts[i].substr(uriParts[i].find("-") + 1);
+
+            uint256 txid;
+            if (!ParseInt32(strOutput, &nOutput) || nOutput < 0 || !ParseHashStr(strTxid, txid))
+                throw RESTERR(HTTP_BAD_REQUEST, "Parse error");
+
+            vOutPoints.push_back(COutPoint(txid, (uint32_t)nOutput));
+        }
+
+        if (vOutPoints.size() > 0)
+            fInputParsed = true;
+        else
+            throw RESTERR(HTTP_BAD_REQUEST, "Error: empty request");
+    }
+
+    switch (rf) {
+    case RF_HEX:
+    case RF_BINARY: {
+        //deserialize only if user sent a request
+        if (strRequest.size() > 0)
+        {
+            if (fInputParsed) //don't allow sending input over URI and HTTP RAW DATA
+                throw RESTERR(HTTP_BAD_REQUEST, "Combination of URI scheme inputs and raw post data is not allowed");
+
+            vector<unsigned char> vchRequest;
+            if (rf == RF_HEX)
+                vchRequest = ParseHex(strRequest);
+            else
+                vchRequest.assign(strRequest.begin(), strRequest.end());
+
+            try {
+                CDataStream ssRequest(vchRequest, SER_NETWORK, PROTOCOL_VERSION);
+                ssRequest >> fCheckMemPool;
+                ssRequest >> vOutPoints;
+            } catch (const std::ios_base::failure& e) {
+                // abort in case of unreadable binary data
+                throw RESTERR(HTTP_BAD_REQUEST, "Parse error");
+            }
+        }
+        break;
+    }
+
+    case RF_JSON: {
+        if (!fInputParsed)
+            throw RESTERR(HTTP_BAD_REQUEST, "Error: empty request");
+        break;
+    }
+
+    default: {
+        throw RESTERR(HTTP_NOT_FOUND, "output format not found (available: " + AvailableDataFormatsString() + ")");
+    }
+    }
+
+    // limit max outpoints
+    if (vOutPoints.size() > MAX_GETUTXOS_OUTPOINTS)
+        throw RESTERR(HTTP_BAD_REQUEST, strprintf("Error: max outpoints exceeded (max: %d, tried: %d)", MAX_GETUTXOS_OUTPOINTS, vOutPoints.size()));
+
+    // check spentness and form a bitmap (as well as a JSON capable human-readable string representation)
+    vector<unsigned char> bitmap((vOutPoints.size() + 7) / 8);
+    vector<CCoin> outs;
+    string bitmapStringRepresentation;
+    int nHeight;
+    uint256 hashTip;
+    {
+        LOCK2(cs_main, mempool.cs);
+
+        CCoinsView viewDummy;
+        CCoinsViewCache view(&viewDummy);
+
+        CCoinsViewCache& viewChain = *pcoinsTip;
+        CCoinsViewMemPool viewMempool(&viewChain, mempool);
+
+        if (fCheckMemPool)
+            view.SetBackend(viewMempool); // switch cache backend to db+mempool in case user likes to query mempool
+        else
+            view.SetBackend(viewChain);
+
+        for (size_t i = 0; i < vOutPoints.size(); i++) {
+            bool fHit = false;
+            CCoins coins;
+            uint256 hash = vOutPoints[i].hash;
+            if (view.GetCoins(hash, coins)) {
+                if (fCheckMemPool)
+                    mempool.pruneSpent(hash, coins);
+                if (coins.IsAvailable(vOutPoints[i].n)) {
+                    fHit = true;
+                    // Safe to index into vout here because IsAvailable checked if it's off the end of the array, or if
+                    // n is valid but points to an already spent output (IsNull).
+                    CCoin coin;
+                    coin.nTxVer = coins.nVersion;
+                    coin.nHeight = coins.nHeight;
+                    coin.out = coins.vout.at(vOutPoints[i].n);
+                    assert(!coin.out.IsNull());
+                    outs.push_back(coin);
+                }
+            }
+
+            if (fHit)
+                bitmap[i / 8] |= 1 << (i % 8);
+            bitmapStringRepresentation.append(fHit ? "1" : "0"); // form a binary string representation (human-readable for json output)
+        }
+
+        nHeight = chainActive.Height();
+        hashTip = chainActive.Tip()->GetBlockHash();
+    }
+
+    switch (rf) {
+    case RF_BINARY: {
+        // serialize data
+        // use exact same output as mentioned in Bip64
+        CDataStream ssGetUTXOResponse(SER_NETWORK, PROTOCOL_VERSION);
+        ssGetUTXOResponse << nHeight << hashTip << bitmap << outs;
+        string ssGetUTXOResponseString = ssGetUTXOResponse.str();
+
+        conn->stream() << HTTPReplyHeader(HTTP_OK, fRun, ssGetUTXOResponseString.size(), "application/octet-stream") << ssGetUTXOResponseString << std::flush;
+        return true;
+    }
+
+    case RF_HEX: {
+        CDataStream ssGetUTXOResponse(SER_NETWORK, PROTOCOL_VERSION);
+        ssGetUTXOResponse << nHeight << hashTip << bitmap << outs;
+        string strHex = HexStr(ssGetUTXOResponse.begin(), ssGetUTXOResponse.end()) + "\n";
+
+        conn->stream() << HTTPReply(HTTP_OK, strHex, fRun, false, "text/plain") << std::flush;
+        return true;
+    }
+
+    case RF_JSON: {
+        Object objGetUTXOResponse;
+
+        // pack in some essentials
+        // use more or less the same output as mentioned in Bip64
+        objGetUTXOResponse.push_back(Pair("chainHeight", nHeight));
+        objGetUTXOResponse.push_back(Pair("chaintipHash", hashTip.GetHex()));
+        objGetUTXOResponse.push_back(Pair("bitmap", bitmapStringRepresentation));
+
+        Array utxos;
+        BOOST_FOREACH(const CCoin& coin, outs) {
+            Object utxo;
+            utxo.push_back(Pair("txvers", (int32_t)coin.nTxVer));
+            utxo.push_back(Pair("height", (int32_t)coin.nHeight));
+            utxo.push_back(Pair("value", ValueFromAmount(coin.out.nValue)));
+
+            // include the script in a json output
+            Object o;
+            ScriptPubKeyToJSON(coin.out.scriptPubKey, o, true);
+            utxo.push_back(Pair("scriptPubKey", o));
+            utxos.push_back(utxo);
+        }
+        objGetUTXOResponse.push_back(Pair("utxos", utxos));
+
+        // return json string
+        string strJSON = write_string(Value(objGetUTXOResponse), false) + "\n";
+        conn->stream() << HTTPReply(HTTP_OK, strJSON, fRun) << std::flush;
+        return true;
+    }
+
+    default: {
+        throw RESTERR(HTTP_NOT_FOUND, "output format not found (available: " + AvailableDataFormatsString() + ")");
+    }
+    }
+
+    // not reached
+    return true; // continue to process further HTTP reqs on this cxn
+}
+
 static const struct {
     const char* prefix;
     bool (*handler)(AcceptedConnection* conn,
                     string& strURI,
+                    const string& strRequest,
                     map<string, string>& mapHeaders,
                     bool fRun);
 } uri_prefixes[] = {
       {"/rest/tx/", rest_tx},
       {"/rest/block/notxdetails/", rest_block_notxdetails},
       {"/rest/block/", rest_block_extended},
+      {"/rest/chaininfo", rest_chaininfo},
+      {"/rest/mempool/info", rest_mempool_info},
+      {"/rest/headers/", rest_headers},
+      {"/rest/getutxos/", rest_getutxos},
+      {"/rest/getutxos", rest_getutxos},
 };
 
 bool HTTPReq_REST(AcceptedConnection* conn,
                   string& strURI,
+                  const string& strRequest,
                   map<string, string>& mapHeaders,
                   bool fRun)
 {
@@ -240,7 +647,7 @@ bool HTTPReq_REST(AcceptedConnection* conn,
             unsigned int plen = strlen(uri_prefixes[i].prefix);
             if (strURI.substr(0, plen) == uri_prefixes[i].prefix) {
                 string strReq = strURI.substr(plen);
-                return uri_prefixes[i].handler(conn, strReq, mapHeaders, fRun);
+                return uri_prefixes[i].handler(conn, strReq, strRequest, mapHeaders, fRun);
             }
         }
     } catch (RestErr& re) {
@@ -99,6 +99,12 @@ static const CRPCConvertParam vRPCConvertParams[] =
     { "mnbudget", 8 },
     { "mnbudgetvoteraw", 1 },
     { "mnbudgetvoteraw", 4 },
+    { "getaddressbalance", 0 },
+    { "getaddressdeltas", 0 },
+    { "getaddressutxos", 0 },
+    { "getspentinfo", 0 },
+    { "getblockhashes", 0 },
+    { "getblockhashes", 1 },
 };
 
 class CRPCConvertTable
@@ -4,6 +4,7 @@
 // Distributed under the MIT software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
+#include "addressindex.h"
 #include "base58.h"
 #include "clientversion.h"
 #include "init.h"
@@ -12,6 +13,7 @@
 #include "netbase.h"
 #include "rpcserver.h"
 #include "timedata.h"
+#include "txdb.h"
 #include "util.h"
 #include "spork.h"
 #include "masternode-sync.h"
@@ -469,3 +471,248 @@ Value setmocktime(const Array& params, bool fHelp)
 
     return Value::null;
 }
+
+/** Addresses of an {"addresses": [...]} argument, in the form the address index keeps them */
+static vector<CIndexAddress> GetIndexAddresses(const Value& param)
+{
+    const Value& addresses = find_value(param.get_obj(), "addresses");
+    if (addresses.type() != array_type)
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Expected an array of addresses");
+
+    vector<CIndexAddress> vAddresses;
+    BOOST_FOREACH(const Value& value, addresses.get_array()) {
+        CBitcoinAddress address(value.get_str());
+        CTxDestination dest = address.Get();
+        if (const CKeyID* keyID = boost::get<CKeyID>(&dest))
+            vAddresses.push_back(CIndexAddress(INDEX_ADDRESS_PUBKEYHASH, *keyID));
+        else if (const CScriptID* scriptID = boost::get<CScriptID>(&dest))
+            vAddresses.push_back(CIndexAddress(INDEX_ADDRESS_SCRIPTHASH, *scriptID));
+        else
+            throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Invalid address: " + value.get_str());
+    }
+    return vAddresses;
+}
+
+static string IndexAddressToString(const CIndexAddress& address)
+{
+    if (address.nType == INDEX_ADDRESS_SCRIPTHASH)
+        return CBitcoinAddress(CScriptID(address.hash)).ToString();
+    return CBitcoinAddress(CKeyID(address.hash)).ToString();
+}
+
+static bool AddressDeltaEarlier(const pair<CAddressIndexKey, CAmount>& a, const pair<CAddressIndexKey, CAmount>& b)
+{
+    if (a.first.nHeight != b.first.nHeight)
+        return a.first.nHeight < b.first.nHeight;
+    return a.first.nTxIndex < b.first.nTxIndex;
+}
+
+static bool AddressUnspentEarlier(const pair<CAddressUnspentKey, CAddressUnspentValue>& a, const pair<CAddressUnspentKey, CAddressUnspentValue>& b)
+{
+    return a.second.nHeight < b.second.nHeight;
+}
+
+Value getaddressbalance(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() != 1)
+        throw runtime_error(
+            "getaddressbalance {\"addresses\": [\"address\",...]}\n"
+            "\nReturns the balance of addresses, needs -addressindex.\n"
+            "\nArguments:\n"
+            "1. {\"addresses\": [...]}  (object, required) The ic addresses\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"balance\" : x.xxx,    (numeric) The amount the addresses hold in the active chain\n"
+            "  \"received\" : x.xxx    (numeric) The total amount the addresses received, change included\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getaddressbalance", "'{\"addresses\": [\"PwnLY9Tf7Zsef8gMGL2fhWA9ZmMjt4KPwg\"]}'")
+            + HelpExampleRpc("getaddressbalance", "{\"addresses\": [\"PwnLY9Tf7Zsef8gMGL2fhWA9ZmMjt4KPwg\"]}")
+        );
+
+    if (!fAddressIndex)
+        throw JSONRPCError(RPC_MISC_ERROR, "Address index is not enabled, restart with -addressindex -reindex");
+
+    RPCTypeCheck(params, boost::assign::list_of(obj_type));
+    vector<CIndexAddress> vAddresses = GetIndexAddresses(params[0]);
+
+    CAmount nBalance = 0;
+    CAmount nReceived = 0;
+    BOOST_FOREACH(const CIndexAddress& address, vAddresses) {
+        vector<pair<CAddressIndexKey, CAmount> > vDeltas;
+        if (!pblocktree->ReadAddressIndex(address, vDeltas))
+            throw JSONRPCError(RPC_DATABASE_ERROR, "Can't read the address index");
+        for (vector<pair<CAddressIndexKey, CAmount> >::const_iterator it = vDeltas.begin(); it != vDeltas.end(); it++) {
+            nBalance += it->second;
+            if (it->second > 0)
+                nReceived += it->second;
+        }
+    }
+
+    Object result;
+    result.push_back(Pair("balance", ValueFromAmount(nBalance)));
+    result.push_back(Pair("received", ValueFromAmount(nReceived)));
+    return result;
+}
+
+Value getaddressdeltas(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() != 1)
+        throw runtime_error(
+            "getaddressdeltas {\"addresses\": [\"address\",...], \"start\": n, \"end\": n}\n"
+            "\nReturns the amounts addresses received and spent in the active chain, oldest first, needs -addressindex.\n"
+            "\nArguments:\n"
+            "1. {\n"
+            "     \"addresses\": [...]  (array, required) The ic addresses\n"
+            "     \"start\": n          (numeric, optional) The first block height to include\n"
+            "     \"end\": n            (numeric, optional) The last block height to include\n"
+            "   }\n"
+            "\nResult:\n"
+            "[\n"
+            "  {\n"
+            "    \"address\" : \"address\",  (string) The address\n"
+            "    \"txid\" : \"hash\",        (string) The transaction\n"
+            "    \"index\" : n,              (numeric) The output received, or the input spending\n"
+            "    \"blockindex\" : n,         (numeric) The position of the transaction in its block\n"
+            "    \"height\" : n,             (numeric) The block height\n"
+            "    \"amount\" : x.xxx          (numeric) The amount, negative when spent\n"
+            "  }\n"
+            "  ,...\n"
+            "]\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getaddressdeltas", "'{\"addresses\": [\"PwnLY9Tf7Zsef8gMGL2fhWA9ZmMjt4KPwg\"], \"start\": 1000}'")
+            + HelpExampleRpc("getaddressdeltas", "{\"addresses\": [\"PwnLY9Tf7Zsef8gMGL2fhWA9ZmMjt4KPwg\"], \"start\": 1000}")
+        );
+
+    if (!fAddressIndex)
+        throw JSONRPCError(RPC_MISC_ERROR, "Address index is not enabled, restart with -addressindex -reindex");
+
+    RPCTypeCheck(params, boost::assign::list_of(obj_type));
+    vector<CIndexAddress> vAddresses = GetIndexAddresses(params[0]);
+    int nStart = 0;
+    int nEnd = 0;
+    const Value& start = find_value(params[0].get_obj(), "start");
+    if (start.type() == int_type)
+        nStart = start.get_int();
+    const Value& end = find_value(params[0].get_obj(), "end");
+    if (end.type() == int_type)
+        nEnd = end.get_int();
+    if (nStart < 0 || nEnd < 0 || (nEnd > 0 && nEnd < nStart))
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid start or end height");
+
+    vector<pair<CAddressIndexKey, CAmount> > vDeltas;
+    BOOST_FOREACH(const CIndexAddress& address, vAddresses) {
+        if (!pblocktree->ReadAddressIndex(address, vDeltas, nStart, nEnd))
+            throw JSONRPCError(RPC_DATABASE_ERROR, "Can't read the address index");
+    }
+    // Each address comes in chain order, merge them
+    if (vAddresses.size() > 1)
+        stable_sort(vDeltas.begin(), vDeltas.end(), AddressDeltaEarlier);
+
+    Array result;
+    for (vector<pair<CAddressIndexKey, CAmount> >::const_iterator it = vDeltas.begin(); it != vDeltas.end(); it++) {
+        Object delta;
+        delta.push_back(Pair("address", IndexAddressToString(it->first.address)));
+        delta.push_back(Pair("txid", it->first.txhash.GetHex()));
+        delta.push_back(Pair("index", (int)it->first.nIndex));
+        delta.push_back(Pair("blockindex", (int)it->first.nTxIndex));
+        delta.push_back(Pair("height", it->first.nHeight));
+        delta.push_back(Pair("amount", ValueFromAmount(it->second)));
+        result.push_back(delta);
+    }
+    return result;
+}
+
+Value getaddressutxos(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() != 1)
+        throw runtime_error(
+            "getaddressutxos {\"addresses\": [\"address\",...]}\n"
+            "\nReturns the unspent outputs of addresses in the active chain, oldest first, needs -addressindex.\n"
+            "\nArguments:\n"
+            "1. {\"addresses\": [...]}  (object, required) The ic addresses\n"
+            "\nResult:\n"
+            "[\n"
+            "  {\n"
+            "    \"address\" : \"address\",  (string) The address\n"
+            "    \"txid\" : \"hash\",        (string) The transaction\n"
+            "    \"outputIndex\" : n,        (numeric) The output\n"
+            "    \"script\" : \"hex\",       (string) The output script\n"
+            "    \"amount\" : x.xxx,         (numeric) The output amount\n"
+            "    \"height\" : n              (numeric) The height of the block with the transaction\n"
+            "  }\n"
+            "  ,...\n"
+            "]\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getaddressutxos", "'{\"addresses\": [\"PwnLY9Tf7Zsef8gMGL2fhWA9ZmMjt4KPwg\"]}'")
+            + HelpExampleRpc("getaddressutxos", "{\"addresses\": [\"PwnLY9Tf7Zsef8gMGL2fhWA9ZmMjt4KPwg\"]}")
+        );
+
+    if (!fAddressIndex)
+        throw JSONRPCError(RPC_MISC_ERROR, "Address index is not enabled, restart with -addressindex -reindex");
+
+    RPCTypeCheck(params, boost::assign::list_of(obj_type));
+    vector<CIndexAddress> vAddresses = GetIndexAddresses(params[0]);
+
+    vector<pair<CAddressUnspentKey, CAddressUnspentValue> > vUnspent;
+    BOOST_FOREACH(const CIndexAddress& address, vAddresses) {
+        if (!pblocktree->ReadAddressUnspentIndex(address, vUnspent))
+            throw JSONRPCError(RPC_DATABASE_ERROR, "Can't read the address index");
+    }
+    stable_sort(vUnspent.begin(), vUnspent.end(), AddressUnspentEarlier);
+
+    Array result;
+    for (vector<pair<CAddressUnspentKey, CAddressUnspentValue> >::const_iterator it = vUnspent.begin(); it != vUnspent.end(); it++) {
+        Object output;
+        output.push_back(Pair("address", IndexAddressToString(it->first.address)));
+        output.push_back(Pair("txid", it->first.txhash.GetHex()));
+        output.push_back(Pair("outputIndex", (int)it->first.nIndex));
+        output.push_back(Pair("script", HexStr(it->second.script.begin(), it->second.script.end())));
+        output.push_back(Pair("amount", ValueFromAmount(it->second.nValue)));
+        output.push_back(Pair("height", it->second.nHeight));
+        result.push_back(output);
+    }
+    return result;
+}
+
+Value getspentinfo(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() != 1)
+        throw runtime_error(
+            "getspentinfo {\"txid\": \"hash\", \"index\": n}\n"
+            "\nReturns the input spending an output in the active chain, needs -spentindex.\n"
+            "\nArguments:\n"
+            "1. {\n"
+            "     \"txid\": \"hash\"  (string, required) The transaction of the output\n"
+            "     \"index\": n      (numeric, required) The output\n"
+            "   }\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"txid\" : \"hash\",  (string) The spending transaction\n"
+            "  \"index\" : n,        (numeric) The spending input\n"
+            "  \"height\" : n        (numeric) The height of the block with the spending transaction\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getspentinfo", "'{\"txid\": \"0437cd7f8525ceed2324359c2d0ba26006d92d856a9c20fa0241106ee5a597c9\", \"index\": 0}'")
+            + HelpExampleRpc("getspentinfo", "{\"txid\": \"0437cd7f8525ceed2324359c2d0ba26006d92d856a9c20fa0241106ee5a597c9\", \"index\": 0}")
+        );
+
+    if (!fSpentIndex)
+        throw JSONRPCError(RPC_MISC_ERROR, "Spent index is not enabled, restart with -spentindex -reindex");
+
+    RPCTypeCheck(params, boost::assign::list_of(obj_type));
+    const Value& txid = find_value(params[0].get_obj(), "txid");
+    const Value& index = find_value(params[0].get_obj(), "index");
+    if (txid.type() != str_type || index.type() != int_type || index.get_int() < 0)
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Expected a txid and an output index");
+
+    CSpentIndexValue value;
+    if (!pblocktree->ReadSpentIndex(CSpentIndexKey(ParseHashV(txid, "txid"), index.get_int()), value))
+        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Unable to get spent info");
+
+    Object result;
+    result.push_back(Pair("txid", value.txid.GetHex()));
+    result.push_back(Pair("index", (int)value.nInputIndex));
+    result.push_back(Pair("height", value.nHeight));
+    return result;
+}
@@ -160,6 +160,72 @@ Value getpeerinfo(const Array& params, bool fHelp)
     return ret;
 }
 
+Value getblockdownloadinfo(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() != 0)
+        throw runtime_error(
+            "getblockdownloadinfo\n"
+            "\nReturns the state of block download, overall and for each connected peer.\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"blocksinflight\": n,        (numeric) Number of blocks requested and not received yet\n"
+            "  \"peersdownloading\": n,      (numeric) Number of peers we are waiting on for blocks\n"
+            "  \"averageblocksize\": n,      (numeric) Moving average of the size of downloaded blocks in bytes\n"
+            "  \"rerequested\": n,           (numeric) Blocks requested again from a faster peer because they held up the download window\n"
+            "  \"peers\": [\n"
+            "    {\n"
+            "      \"id\": n,                  (numeric) Peer index\n"
+            "      \"addr\":\"host:port\",     (string) The ip address and port of the peer\n"
+            "      \"pingtime\": n,            (numeric) ping time\n"
+            "      \"downloadrate\": n,        (numeric) Moving average of the rate blocks arrive at from the peer in bytes per second, 0 if not measured yet\n"
+            "      \"inflight\": n,            (numeric) Number of blocks requested from the peer and not received yet\n"
+            "      \"inflightlimit\": n,       (numeric) Number of blocks we keep requested from the peer, sized by its download rate\n"
+            "      \"blocks\": n,              (numeric) Number of requested blocks received from the peer\n"
+            "      \"bytes\": n,               (numeric) Total size of those blocks\n"
+            "      \"rerequested\": n          (numeric) Blocks in flight from the peer that were requested again from a faster one\n"
+            "    }\n"
+            "    ,...\n"
+            "  ]\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getblockdownloadinfo", "")
+            + HelpExampleRpc("getblockdownloadinfo", "")
+        );
+
+    vector<CNodeStats> vstats;
+    CopyNodeStats(vstats);
+
+    CBlockDownloadStats downloadstats;
+    GetBlockDownloadStats(downloadstats);
+
+    Object ret;
+    ret.push_back(Pair("blocksinflight", downloadstats.nBlocksInFlight));
+    ret.push_back(Pair("peersdownloading", downloadstats.nPeersDownloading));
+    ret.push_back(Pair("averageblocksize", downloadstats.nAverageBlockSize));
+    ret.push_back(Pair("rerequested", downloadstats.nBlocksRerequested));
+
+    Array peers;
+    BOOST_FOREACH(const CNodeStats& stats, vstats) {
+        CNodeStateStats statestats;
+        if (!GetNodeStateStats(stats.nodeid, statestats))
+            continue;
+        Object obj;
+        obj.push_back(Pair("id", stats.nodeid));
+        obj.push_back(Pair("addr", stats.addrName));
+        obj.push_back(Pair("pingtime", stats.dPingTime));
+        obj.push_back(Pair("downloadrate", statestats.nBlockDownloadRate));
+        obj.push_back(Pair("inflight", (int)statestats.vHeightInFlight.size()));
+        obj.push_back(Pair("inflightlimit", statestats.nBlocksInFlightLimit));
+        obj.push_back(Pair("blocks", statestats.nBlocksDownloaded));
+        obj.push_back(Pair("bytes", statestats.nBlockBytesDownloaded));
+        obj.push_back(Pair("rerequested", statestats.nBlocksRerequested));
+        peers.push_back(obj);
+    }
+    ret.push_back(Pair("peers", peers));
+
+    return ret;
+}
+
 Value addnode(const Array& params, bool fHelp)
 {
     string strCommand;
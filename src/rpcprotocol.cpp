@@ -70,7 +70,9 @@ static const char *httpStatusDescription(int nStatus)
         case HTTP_BAD_REQUEST: return "Bad Request";
         case HTTP_FORBIDDEN: return "Forbidden";
         case HTTP_NOT_FOUND: return "Not Found";
+        case HTTP_REQUEST_TOO_LARGE: return "Request Entity Too Large";
         case HTTP_INTERNAL_SERVER_ERROR: return "Internal Server Error";
+        case HTTP_SERVICE_UNAVAILABLE: return "Service Unavailable";
         default: return "";
     }
 }
@@ -118,6 +120,30 @@ string HTTPReplyHeader(int nStatus, bool keepalive, size_t contentLength, const
         FormatFullVersion());
 }
 
+string HTTPReplyHeaderChunked(int nStatus, bool keepalive, const char *contentType)
+{
+    return strprintf(
+            "HTTP/1.1 %d %s\r\n"
+            "Date: %s\r\n"
+            "Connection: %s\r\n"
+            "Transfer-Encoding: chunked\r\n"
+            "Content-Type: %s\r\n"
+            "Server: ic-json-rpc/%s\r\n"
+            "\r\n",
+        nStatus,
+        httpStatusDescription(nStatus),
+        rfc1123Time(),
+        keepalive ? "keep-alive" : "close",
+        contentType,
+        FormatFullVersion());
+}
+
+string HTTPChunk(const string& strData)
+{
+    // A zero length chunk ends the message
+    return strprintf("%x\r\n", strData.size()) + strData + "\r\n";
+}
+
 string HTTPReply(int nStatus, const string& strMsg, bool keepalive,
                  bool headersOnly, const char *contentType)
 {
@@ -219,7 +245,31 @@ int ReadHTTPMessage(std::basic_istream<char>& stream, map<string,
         return HTTP_INTERNAL_SERVER_ERROR;
 
     // Read message
-    if (nLen > 0)
+    if (mapHeadersRet["transfer-encoding"] == "chunked")
+    {
+        while (true)
+        {
+            string str;
+            std::getline(stream, str);
+            if (!stream)
+                return HTTP_INTERNAL_SERVER_ERROR;
+            size_t nChunk = strtoul(str.c_str(), NULL, 16);
+            if (nChunk == 0)
+                break;
+            if (nChunk > max_size - strMessageRet.size())
+                return HTTP_INTERNAL_SERVER_ERROR;
+            size_t ptr = strMessageRet.size();
+            strMessageRet.resize(ptr + nChunk);
+            stream.read(&strMessageRet[ptr], nChunk);
+            std::getline(stream, str);
+            if (!stream) // Connection lost while reading
+                return HTTP_INTERNAL_SERVER_ERROR;
+        }
+        // Skip trailers
+        map<string, string> mapTrailers;
+        ReadHTTPHeaders(stream, mapTrailers);
+    }
+    else if (nLen > 0)
     {
         vector<char> vch;
         size_t ptr = 0;
@@ -285,6 +335,103 @@ string JSONRPCReply(const Value& result, const Value& error, const Value& id)
     return write_string(Value(reply), false) + "\n";
 }
 
+CJSONStreamWriter::CJSONStreamWriter(const SinkFn& sinkIn, size_t nChunkSizeIn) :
+    sink(sinkIn), nChunkSize(nChunkSizeIn), fFlushed(false), fAfterKey(false)
+{
+}
+
+void CJSONStreamWriter::BeginElement()
+{
+    if (fAfterKey) {
+        fAfterKey = false;
+        return;
+    }
+    if (!vEmpty.empty()) {
+        if (!vEmpty.back())
+            strBuffer += ',';
+        vEmpty.back() = false;
+    }
+}
+
+void CJSONStreamWriter::EndElement()
+{
+    if (strBuffer.size() >= nChunkSize)
+        Flush();
+}
+
+void CJSONStreamWriter::BeginObject()
+{
+    BeginElement();
+    strBuffer += '{';
+    vEmpty.push_back(true);
+}
+
+void CJSONStreamWriter::EndObject()
+{
+    assert(!vEmpty.empty() && !fAfterKey);
+    vEmpty.pop_back();
+    strBuffer += '}';
+    EndElement();
+}
+
+void CJSONStreamWriter::BeginArray()
+{
+    BeginElement();
+    strBuffer += '[';
+    vEmpty.push_back(true);
+}
+
+void CJSONStreamWriter::EndArray()
+{
+    assert(!vEmpty.empty() && !fAfterKey);
+    vEmpty.pop_back();
+    strBuffer += ']';
+    EndElement();
+}
+
+void CJSONStreamWriter::WriteKey(const string& strKey)
+{
+    assert(!fAfterKey);
+    BeginElement();
+    strBuffer += write_string(Value(strKey), false);
+    strBuffer += ':';
+    fAfterKey = true;
+}
+
+void CJSONStreamWriter::WriteValue(const Value& value)
+{
+    if (value.type() == obj_type) {
+        BeginObject();
+        BOOST_FOREACH(const Pair& pair, value.get_obj())
+            WritePair(pair.name_, pair.value_);
+        EndObject();
+    } else if (value.type() == array_type) {
+        BeginArray();
+        BOOST_FOREACH(const Value& v, value.get_array())
+            WriteValue(v);
+        EndArray();
+    } else {
+        BeginElement();
+        strBuffer += write_string(value, false);
+        EndElement();
+    }
+}
+
+void CJSONStreamWriter::WritePair(const string& strKey, const Value& value)
+{
+    WriteKey(strKey);
+    WriteValue(value);
+}
+
+void CJSONStreamWriter::Flush()
+{
+    if (strBuffer.empty())
+        return;
+    fFlushed = true;
+    sink(strBuffer);
+    strBuffer.clear();
+}
+
 Object JSONRPCError(int code, const string& message)
 {
     Object error;
@@ -14,6 +14,7 @@
 #include <boost/iostreams/stream.hpp>
 #include <boost/asio.hpp>
 #include <boost/asio/ssl.hpp>
+#include <boost/function.hpp>
 
 #include "json/json_spirit_reader_template.h"
 #include "json/json_spirit_utils.h"
@@ -27,6 +28,7 @@ enum HTTPStatusCode
     HTTP_UNAUTHORIZED          = 401,
     HTTP_FORBIDDEN             = 403,
     HTTP_NOT_FOUND             = 404,
+    HTTP_REQUEST_TOO_LARGE     = 413,
     HTTP_INTERNAL_SERVER_ERROR = 500,
     HTTP_SERVICE_UNAVAILABLE   = 503,
 };
@@ -147,11 +149,61 @@ private:
     boost::asio::ssl::stream<typename Protocol::socket>& stream;
 };
 
+/** Size in bytes at which a streamed JSON reply is handed to the connection */
+static const size_t JSON_STREAM_CHUNK_SIZE = 64 * 1024;
+
+/**
+ * Writes a JSON document piece by piece, handing the text to a sink each
+ * time about nChunkSize bytes have accumulated, so a large reply never has
+ * to be held as a single string. Nothing is passed to the sink until the
+ * first chunk fills up; if that never happens the whole document is left
+ * in GetBuffer().
+ */
+class CJSONStreamWriter
+{
+public:
+    typedef boost::function<void(const std::string&)> SinkFn;
+
+    CJSONStreamWriter(const SinkFn& sinkIn, size_t nChunkSizeIn = JSON_STREAM_CHUNK_SIZE);
+
+    void BeginObject();
+    void EndObject();
+    void BeginArray();
+    void EndArray();
+    /** Write the key of the next member of the current object */
+    void WriteKey(const std::string& strKey);
+    /** Write a value, objects and arrays are written member by member */
+    void WriteValue(const json_spirit::Value& value);
+    void WritePair(const std::string& strKey, const json_spirit::Value& value);
+
+    /** Pass everything written so far to the sink */
+    void Flush();
+    /** Whether anything has been passed to the sink yet */
+    bool Flushed() const { return fFlushed; }
+    /** Text written since the last flush */
+    const std::string& GetBuffer() const { return strBuffer; }
+
+private:
+    SinkFn sink;
+    size_t nChunkSize;
+    std::string strBuffer;
+    bool fFlushed;
+    //! one entry per open object or array, true until it has a member
+    std::vector<bool> vEmpty;
+    bool fAfterKey;
+
+    void BeginElement();
+    void EndElement();
+};
+
 std::string HTTPPost(const std::string& strMsg, const std::map<std::string,std::string>& mapRequestHeaders);
 std::string HTTPError(int nStatus, bool keepalive,
                       bool headerOnly = false);
 std::string HTTPReplyHeader(int nStatus, bool keepalive, size_t contentLength,
                       const char *contentType = "application/json");
+std::string HTTPReplyHeaderChunked(int nStatus, bool keepalive,
+                      const char *contentType = "application/json");
+std::string HTTPChunk(const std::string& strData);
 std::string HTTPReply(int nStatus, const std::string& strMsg, bool keepalive,
                       bool headerOnly = false,
                       const char *contentType = "application/json");
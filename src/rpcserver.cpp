@@ -19,12 +19,17 @@
 #include <boost/asio.hpp>
 #include <boost/asio/ssl.hpp>
 #include <boost/bind.hpp>
+#include <boost/enable_shared_from_this.hpp>
 #include <boost/filesystem.hpp>
 #include <boost/foreach.hpp>
 #include <boost/iostreams/concepts.hpp>
 #include <boost/iostreams/stream.hpp>
 #include <boost/shared_ptr.hpp>
 #include <boost/thread.hpp>
+
+#include <deque>
+#include <limits>
+#include <sstream>
 #include "json/json_spirit_writer_template.h"
 
 using namespace boost;
@@ -39,6 +44,26 @@ static bool fRPCInWarmup = true;
 static std::string rpcWarmupStatus("RPC server started");
 static CCriticalSection cs_rpcWarmup;
 
+/** Number of latency buckets kept per RPC method: bucket i counts calls faster than 100us << i, the last one the slower ones */
+static const int RPC_LATENCY_BUCKETS = 16;
+
+/** Call count and latency histogram of an RPC method */
+struct CRPCMethodStats
+{
+    uint64_t nCalls;
+    int64_t nTotalMicros;
+    int64_t nMaxMicros;
+    uint64_t vBuckets[RPC_LATENCY_BUCKETS];
+
+    CRPCMethodStats() : nCalls(0), nTotalMicros(0), nMaxMicros(0)
+    {
+        memset(vBuckets, 0, sizeof(vBuckets));
+    }
+};
+
+static std::map<std::string, CRPCMethodStats> mapRPCStats;
+static CCriticalSection cs_rpcStats;
+
 //! These are created by StartRPCThreads, destroyed in StopRPCThreads
 static asio::io_service* rpc_io_service = NULL;
 static map<string, boost::shared_ptr<deadline_timer> > deadlineTimers;
@@ -237,6 +262,90 @@ Value stop(const Array& params, bool fHelp)
 
 
 
+Value getrpcstats(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() != 0)
+        throw runtime_error(
+            "getrpcstats\n"
+            "\nReturns call counts and latencies of the RPC methods called since startup.\n"
+            "Latencies include waiting for locks.\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"method\": {              (json object) for each method called\n"
+            "    \"calls\": n,             (numeric) number of calls\n"
+            "    \"totalms\": n,           (numeric) total time spent in calls in milliseconds\n"
+            "    \"maxms\": n,             (numeric) slowest call in milliseconds\n"
+            "    \"histogram\": [          (array) number of calls by latency\n"
+            "      {\n"
+            "        \"ltms\": n,          (numeric) upper bound of the bucket in milliseconds, missing for the last one\n"
+            "        \"calls\": n          (numeric) number of calls in the bucket\n"
+            "      }, ...\n"
+            "    ]\n"
+            "  }, ...\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getrpcstats", "")
+            + HelpExampleRpc("getrpcstats", "")
+        );
+
+    LOCK(cs_rpcStats);
+    Object ret;
+    BOOST_FOREACH(const PAIRTYPE(std::string, CRPCMethodStats)& item, mapRPCStats)
+    {
+        const CRPCMethodStats& stats = item.second;
+        Object obj;
+        obj.push_back(Pair("calls", stats.nCalls));
+        obj.push_back(Pair("totalms", stats.nTotalMicros / 1000.0));
+        obj.push_back(Pair("maxms", stats.nMaxMicros / 1000.0));
+        Array histogram;
+        for (int i = 0; i < RPC_LATENCY_BUCKETS; i++)
+        {
+            if (stats.vBuckets[i] == 0)
+                continue;
+            Object bucket;
+            if (i < RPC_LATENCY_BUCKETS - 1)
+                bucket.push_back(Pair("ltms", (100 << i) / 1000.0));
+            bucket.push_back(Pair("calls", stats.vBuckets[i]));
+            histogram.push_back(bucket);
+        }
+        obj.push_back(Pair("histogram", histogram));
+        ret.push_back(Pair(item.first, obj));
+    }
+    return ret;
+}
+
+/** Records the latency of an RPC call when it returns or throws */
+class CRPCCallTimer
+{
+private:
+    const std::string& strMethod;
+    int64_t nStart;
+    bool fCancelled;
+
+public:
+    CRPCCallTimer(const std::string& strMethodIn) : strMethod(strMethodIn), nStart(GetTimeMicros()), fCancelled(false) {}
+
+    /** Don't record this call, it will be run again */
+    void Cancel() { fCancelled = true; }
+
+    ~CRPCCallTimer()
+    {
+        if (fCancelled)
+            return;
+        int64_t nMicros = GetTimeMicros() - nStart;
+        int nBucket = 0;
+        while (nBucket < RPC_LATENCY_BUCKETS - 1 && nMicros >= (100 << nBucket))
+            nBucket++;
+
+        LOCK(cs_rpcStats);
+        CRPCMethodStats& stats = mapRPCStats[strMethod];
+        stats.nCalls++;
+        stats.nTotalMicros += nMicros;
+        stats.nMaxMicros = std::max(stats.nMaxMicros, nMicros);
+        stats.vBuckets[nBucket]++;
+    }
+};
+
 /**
  * Call Table
  */
@@ -247,6 +356,7 @@ static const CRPCCommand vRPCCommands[] =
     { "control",            "getinfo",                &getinfo,                true,      false,      false }, /* uses wallet if enabled */
     { "control",            "help",                   &help,                   true,      true,       false },
     { "control",            "stop",                   &stop,                   true,      true,       false },
+    { "control",            "getrpcstats",            &getrpcstats,            true,      true,       false },
 
     /* P2P networking */
     { "network",            "getnetworkinfo",         &getnetworkinfo,         true,      false,      false },
@@ -255,25 +365,34 @@ static const CRPCCommand vRPCCommands[] =
     { "network",            "getconnectioncount",     &getconnectioncount,     true,      false,      false },
     { "network",            "getnettotals",           &getnettotals,           true,      true,       false },
     { "network",            "getpeerinfo",            &getpeerinfo,            true,      false,      false },
+    { "network",            "getblockdownloadinfo",   &getblockdownloadinfo,   true,      false,      false },
     { "network",            "ping",                   &ping,                   true,      false,      false },
 
     /* Block chain and UTXO */
     { "blockchain",         "getblockchaininfo",      &getblockchaininfo,      true,      false,      false },
-    { "blockchain",         "getbestblockhash",       &getbestblockhash,       true,      false,      false },
-    { "blockchain",         "getblockcount",          &getblockcount,          true,      false,      false },
+    { "blockchain",         "getbestblockhash",       &getbestblockhash,       true,      true,       false },
+    { "blockchain",         "getblockcount",          &getblockcount,          true,      true,       false },
     { "blockchain",         "getblock",               &getblock,               true,      false,      false },
+    { "blockchain",         "getblockfilter",         &getblockfilter,         true,      false,      false },
     { "blockchain",         "getblockhash",           &getblockhash,           true,      false,      false },
+    { "blockchain",         "getblockhashes",         &getblockhashes,         true,      true,       false },
     { "blockchain",         "getblockheader",         &getblockheader,         false,     false,      false },
     { "blockchain",         "getchaintips",           &getchaintips,           true,      false,      false },
-    { "blockchain",         "getdifficulty",          &getdifficulty,          true,      false,      false },
+    { "blockchain",         "getdifficulty",          &getdifficulty,          true,      true,       false },
     { "blockchain",         "getmempoolinfo",         &getmempoolinfo,         true,      true,       false },
-    { "blockchain",         "getrawmempool",          &getrawmempool,          true,      false,      false },
+    { "blockchain",         "getrawmempool",          &getrawmempool,          true,      true,       false },
     { "blockchain",         "gettxout",               &gettxout,               true,      false,      false },
     { "blockchain",         "gettxoutsetinfo",        &gettxoutsetinfo,        true,      false,      false },
     { "blockchain",         "verifychain",            &verifychain,            true,      false,      false },
     { "blockchain",         "invalidateblock",        &invalidateblock,        true,      true,       false },
     { "blockchain",         "reconsiderblock",        &reconsiderblock,        true,      true,       false },
 
+    /* Address index */
+    { "addressindex",       "getaddressbalance",      &getaddressbalance,      true,      true,       false },
+    { "addressindex",       "getaddressdeltas",       &getaddressdeltas,       true,      true,       false },
+    { "addressindex",       "getaddressutxos",        &getaddressutxos,        true,      true,       false },
+    { "addressindex",       "getspentinfo",           &getspentinfo,           true,      true,       false },
+
     /* Mining */
     { "mining",             "getblocktemplate",       &getblocktemplate,       true,      false,      false },
     { "mining",             "getmininginfo",          &getmininginfo,          true,      false,      false },
@@ -297,7 +416,7 @@ static const CRPCCommand vRPCCommands[] =
     { "rawtransactions",    "signrawtransaction",     &signrawtransaction,     false,     false,      false }, /* uses wallet if enabled */
 
     /* Utility functions */
-    { "util",               "createmultisig",         &createmultisig,         true,      true ,      false },
+    { "util",               "createmultisig",         &createmultisig,         true,      true,       false },
     { "util",               "validateaddress",        &validateaddress,        true,      false,      false }, /* uses wallet if enabled */
     { "util",               "verifymessage",          &verifymessage,          true,      false,      false },
     { "util",               "estimatefee",            &estimatefee,            true,      true,       false },
@@ -336,9 +455,10 @@ static const CRPCCommand vRPCCommands[] =
     { "wallet",             "gettransaction",         &gettransaction,         false,     false,      true },
     { "wallet",             "getunconfirmedbalance",  &getunconfirmedbalance,  false,     false,      true },
     { "wallet",             "getwalletinfo",          &getwalletinfo,          false,     false,      true },
-    { "wallet",             "importprivkey",          &importprivkey,          true,      false,      true },
-    { "wallet",             "importwallet",           &importwallet,           true,      false,      true },
-    { "wallet",             "importaddress",          &importaddress,          true,      false,      true },
+    { "wallet",             "importprivkey",          &importprivkey,          true,      true,       true }, /* locks only for the import, not the rescan */
+    { "wallet",             "importwallet",           &importwallet,           true,      true,       true },
+    { "wallet",             "importaddress",          &importaddress,          true,      true,       true },
+    { "wallet",             "abortrescan",            &abortrescan,            true,      true,       true },
     { "wallet",             "keypoolrefill",          &keypoolrefill,          true,      false,      true },
     { "wallet",             "keepass",                &keepass,                false,     false,      true },
     { "wallet",             "listaccounts",           &listaccounts,           false,     false,      true },
@@ -364,6 +484,13 @@ static const CRPCCommand vRPCCommands[] =
 #endif // ENABLE_WALLET
 };
 
+/** Methods whose results can be large enough to be worth streaming */
+static const CRPCStreamCommand vRPCStreamCommands[] =
+{ //  name                      actor (function)
+  //  ------------------------  -----------------------
+    { "getrawmempool",          &getrawmempool_stream },
+};
+
 CRPCTable::CRPCTable()
 {
     unsigned int vcidx;
@@ -374,6 +501,8 @@ CRPCTable::CRPCTable()
         pcmd = &vRPCCommands[vcidx];
         mapCommands[pcmd->name] = pcmd;
     }
+    for (vcidx = 0; vcidx < (sizeof(vRPCStreamCommands) / sizeof(vRPCStreamCommands[0])); vcidx++)
+        mapStreamCommands[vRPCStreamCommands[vcidx].name] = vRPCStreamCommands[vcidx].actor;
 }
 
 const CRPCCommand *CRPCTable::operator[](string name) const
@@ -437,23 +566,82 @@ bool ClientAllowed(const boost::asio::ip::address& address)
     return false;
 }
 
-template <typename Protocol>
-class AcceptedConnectionImpl : public AcceptedConnection
+/**
+ * Bounded queue of requests waiting for an RPC worker thread. Requests that
+ * don't fit are refused instead of queued, so that a burst of slow calls
+ * can't hold up every other client indefinitely.
+ */
+class CRPCWorkQueue
+{
+private:
+    boost::mutex mutex;
+    boost::condition_variable cond;
+    std::deque<boost::function<void()> > queue;
+    size_t nMaxDepth;
+    bool fRunning;
+
+public:
+    CRPCWorkQueue(size_t nMaxDepthIn) : nMaxDepth(nMaxDepthIn), fRunning(true) {}
+
+    /** Queue a request, returns false if the queue is full */
+    bool Enqueue(const boost::function<void()>& func)
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        if (queue.size() >= nMaxDepth)
+            return false;
+        queue.push_back(func);
+        cond.notify_one();
+        return true;
+    }
+
+    /** Worker thread: process queued requests until Interrupt() */
+    void Run()
+    {
+        while (true) {
+            boost::function<void()> func;
+            {
+                boost::unique_lock<boost::mutex> lock(mutex);
+                while (fRunning && queue.empty())
+                    cond.wait(lock);
+                if (!fRunning)
+                    return;
+                func = queue.front();
+                queue.pop_front();
+            }
+            func();
+        }
+    }
+
+    void Interrupt()
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        fRunning = false;
+        cond.notify_all();
+    }
+};
+
+static CRPCWorkQueue* rpc_work_queue = NULL;
+
+/**
+ * An RPC client connection. Requests are read and replies written
+ * asynchronously on the RPC I/O thread, so idle keep-alive connections
+ * don't tie up a thread. Each complete request is handed to the work queue,
+ * and the worker writes its reply into stream() to be sent back from the
+ * I/O thread. Large replies can be sent in parts with write_data(); the
+ * worker then waits for the client whenever more than one part is queued.
+ */
+class HTTPConnection : public AcceptedConnection, public boost::enable_shared_from_this<HTTPConnection>
 {
 public:
-    AcceptedConnectionImpl(
-            asio::io_service& io_service,
-            ssl::context &context,
-            bool fUseSSL) :
-        sslStream(io_service, context),
-        _d(sslStream, fUseSSL),
-        _stream(_d)
+    HTTPConnection(asio::io_service& io_service, ssl::context& context, bool fUseSSLIn) :
+        sslStream(io_service, context), fUseSSL(fUseSSLIn), timer(io_service), buf(MAX_HEADERS_SIZE), fKeepAlive(false),
+        fSendFinal(false), fSendFailed(false)
     {
     }
 
     virtual std::iostream& stream()
     {
-        return _stream;
+        return ssReply;
     }
 
     virtual std::string peer_address_to_string() const
@@ -463,42 +651,292 @@ public:
 
     virtual void close()
     {
-        _stream.close();
+        fKeepAlive = false;
     }
 
-    typename Protocol::endpoint peer;
-    asio::ssl::stream<typename Protocol::socket> sslStream;
+    virtual bool can_chunk() const
+    {
+        return nProto >= 1;
+    }
+
+    virtual void write_data(const std::string& strData)
+    {
+        QueueSend(strData, false);
+    }
+
+    void Start()
+    {
+        // Restrict callers by IP. It is important to do this before
+        // reading anything, to filter out certain DoS and misbehaving clients.
+        if (!ClientAllowed(peer.address())) {
+            // Only send a 403 if we're not using SSL to prevent a DoS during the SSL handshake.
+            if (!fUseSSL) {
+                ssReply << HTTPError(HTTP_FORBIDDEN, false);
+                SendReply();
+            }
+            return;
+        }
+        if (fUseSSL) {
+            // A client that stalls the handshake is dropped like one that stalls its request
+            ArmTimeout();
+            sslStream.async_handshake(ssl::stream_base::server,
+                boost::bind(&HTTPConnection::HandleHandshake, shared_from_this(), asio::placeholders::error));
+        } else
+            ReadRequest();
+    }
+
+    /** Run by a worker thread: process the request and queue the reply */
+    void Process();
+
+    typedef ssl::stream<ip::tcp::socket> SSLStream;
+
+    ip::tcp::endpoint peer;
+    SSLStream sslStream;
 
 private:
-    SSLIOStreamDevice<Protocol> _d;
-    iostreams::stream< SSLIOStreamDevice<Protocol> > _stream;
-};
+    bool fUseSSL;
+    deadline_timer timer;
+    // holds the request line and headers, so it's bounded; bodies are read into strRequest
+    asio::streambuf buf;
+
+    // the request being processed
+    int nProto;
+    std::string strMethod;
+    std::string strURI;
+    std::map<std::string, std::string> mapHeaders;
+    std::string strRequest;
+    size_t nContentLength;
+    bool fKeepAlive;
+
+    std::stringstream ssReply;
+
+    // reply data waiting to be sent, the front one is being written
+    boost::mutex cs_send;
+    boost::condition_variable condSend;
+    std::deque<std::string> vSend;
+    bool fSendFinal;
+    bool fSendFailed;
+
+    void HandleHandshake(const boost::system::error_code& error)
+    {
+        if (!error)
+            ReadRequest();
+    }
+
+    /** Close the connection unless the timer is pushed back within -rpcservertimeout */
+    void ArmTimeout()
+    {
+        timer.expires_from_now(posix_time::seconds(GetArg("-rpcservertimeout", DEFAULT_HTTP_SERVER_TIMEOUT)));
+        timer.async_wait(boost::bind(&HTTPConnection::HandleTimeout, shared_from_this(), asio::placeholders::error));
+    }
+
+    void ReadRequest()
+    {
+        // Drop connections that stay idle, or take too long to send a request
+        ArmTimeout();
+
+        if (fUseSSL)
+            asio::async_read_until(sslStream, buf, "\r\n\r\n",
+                boost::bind(&HTTPConnection::HandleHeaders, shared_from_this(), asio::placeholders::error));
+        else
+            asio::async_read_until(sslStream.next_layer(), buf, "\r\n\r\n",
+                boost::bind(&HTTPConnection::HandleHeaders, shared_from_this(), asio::placeholders::error));
+    }
+
+    void HandleTimeout(const boost::system::error_code& error)
+    {
+        // The timer may have fired just before being pushed back
+        if (error || timer.expires_at() > deadline_timer::traits_type::now())
+            return;
+        boost::system::error_code ec;
+        sslStream.lowest_layer().close(ec);
+    }
+
+    void HandleHeaders(const boost::system::error_code& error)
+    {
+        // buf filled up before the end of the headers
+        if (error == asio::error::not_found) {
+            ReplyError(HTTP_REQUEST_TOO_LARGE);
+            return;
+        }
+        if (error)
+            return;
+
+        std::istream stream(&buf);
+        mapHeaders.clear();
+        if (!ReadHTTPRequestLine(stream, nProto, strMethod, strURI)) {
+            ReplyError(HTTP_BAD_REQUEST);
+            return;
+        }
+        int nLen = ReadHTTPHeaders(stream, mapHeaders);
+        if (nLen < 0 || (size_t)nLen > MAX_SIZE) {
+            ReplyError(HTTP_BAD_REQUEST);
+            return;
+        }
+        nContentLength = nLen;
+
+        // Part of the body may have come in with the headers, anything after
+        // the body is the start of the next request and stays in buf
+        size_t nBuffered = std::min(buf.size(), nContentLength);
+        strRequest.resize(nContentLength);
+        std::istream(&buf).read(&strRequest[0], nBuffered);
+
+        if (nBuffered == nContentLength)
+            HandleBody(boost::system::error_code());
+        else if (fUseSSL)
+            asio::async_read(sslStream, asio::buffer(&strRequest[nBuffered], nContentLength - nBuffered),
+                boost::bind(&HTTPConnection::HandleBody, shared_from_this(), asio::placeholders::error));
+        else
+            asio::async_read(sslStream.next_layer(), asio::buffer(&strRequest[nBuffered], nContentLength - nBuffered),
+                boost::bind(&HTTPConnection::HandleBody, shared_from_this(), asio::placeholders::error));
+    }
+
+    void HandleBody(const boost::system::error_code& error)
+    {
+        if (error)
+            return;
+        timer.expires_at(posix_time::pos_infin);
+
+        std::string& strConnection = mapHeaders["connection"];
+        if (strConnection != "close" && strConnection != "keep-alive")
+            strConnection = nProto >= 1 ? "keep-alive" : "close";
+        fKeepAlive = strConnection != "close" && GetBoolArg("-rpckeepalive", true);
+
+        if (!rpc_work_queue->Enqueue(boost::bind(&HTTPConnection::Process, shared_from_this()))) {
+            LogPrint("rpc", "RPC work queue full, refusing request from %s\n", peer_address_to_string());
+            fKeepAlive = false;
+            ssReply << HTTPError(HTTP_SERVICE_UNAVAILABLE, false);
+            SendReply();
+        }
+    }
+
+    /** Answer a request we couldn't parse and close the connection after the reply */
+    void ReplyError(int nStatus)
+    {
+        LogPrint("rpc", "Malformed HTTP request from %s\n", peer_address_to_string());
+        fKeepAlive = false;
+        ssReply << HTTPError(nStatus, false);
+        SendReply();
+    }
+
+    /** Send what's been written to stream(), completing the reply */
+    void SendReply()
+    {
+        std::string strReply = ssReply.str();
+        ssReply.str("");
+        QueueSend(strReply, true);
+    }
 
-void ServiceConnection(AcceptedConnection *conn);
+    /**
+     * Queue data to be written by the I/O thread. Blocks while an earlier
+     * part is still waiting behind the one being written, so a slow client
+     * can't make us buffer a whole streamed reply. Gives up on the client
+     * when the server is stopped, as the I/O thread won't write any more.
+     */
+    void QueueSend(const std::string& strData, bool fFinal)
+    {
+        {
+            boost::unique_lock<boost::mutex> lock(cs_send);
+            while (vSend.size() > 1 && !fSendFailed) {
+                if (!fRPCRunning) {
+                    fSendFailed = true;
+                    break;
+                }
+                condSend.timed_wait(lock, posix_time::milliseconds(200));
+            }
+            if (fSendFailed) {
+                if (fFinal)
+                    return;
+                throw std::runtime_error("RPC client connection lost");
+            }
+            vSend.push_back(strData);
+            fSendFinal = fFinal;
+            // Otherwise the I/O thread moves on to it after the current write
+            if (vSend.size() > 1)
+                return;
+        }
+        // Sockets belong to the I/O thread
+        sslStream.get_io_service().post(boost::bind(&HTTPConnection::WriteNext, shared_from_this()));
+    }
+
+    void WriteNext()
+    {
+        // Elements of a deque stay in place while others are added, so the
+        // front one can be written without holding the lock
+        const std::string* pstrData;
+        {
+            boost::unique_lock<boost::mutex> lock(cs_send);
+            pstrData = &vSend.front();
+        }
+
+        // Don't let a client that stops reading hold on to the worker
+        timer.expires_from_now(posix_time::seconds(GetArg("-rpcservertimeout", DEFAULT_HTTP_SERVER_TIMEOUT)));
+        timer.async_wait(boost::bind(&HTTPConnection::HandleTimeout, shared_from_this(), asio::placeholders::error));
+
+        if (fUseSSL)
+            asio::async_write(sslStream, asio::buffer(*pstrData),
+                boost::bind(&HTTPConnection::HandleWrite, shared_from_this(), asio::placeholders::error));
+        else
+            asio::async_write(sslStream.next_layer(), asio::buffer(*pstrData),
+                boost::bind(&HTTPConnection::HandleWrite, shared_from_this(), asio::placeholders::error));
+    }
+
+    void HandleWrite(const boost::system::error_code& error)
+    {
+        bool fMore, fDone;
+        {
+            boost::unique_lock<boost::mutex> lock(cs_send);
+            vSend.pop_front();
+            if (error) {
+                fSendFailed = true;
+                vSend.clear();
+            }
+            condSend.notify_all();
+            fMore = !vSend.empty();
+            fDone = fSendFinal && !fMore;
+            if (fDone)
+                fSendFinal = false;
+        }
+        if (!error && fMore) {
+            WriteNext();
+            return;
+        }
+        timer.expires_at(posix_time::pos_infin);
+        if (!error && !fDone) {
+            // The worker is still writing the reply
+            return;
+        }
+        if (!error && fKeepAlive && fRPCRunning) {
+            ReadRequest();
+            return;
+        }
+        boost::system::error_code ec;
+        sslStream.lowest_layer().shutdown(ip::tcp::socket::shutdown_both, ec);
+        sslStream.lowest_layer().close(ec);
+    }
+};
 
 //! Forward declaration required for RPCListen
-template <typename Protocol, typename SocketAcceptorService>
-static void RPCAcceptHandler(boost::shared_ptr< basic_socket_acceptor<Protocol, SocketAcceptorService> > acceptor,
+static void RPCAcceptHandler(boost::shared_ptr<ip::tcp::acceptor> acceptor,
                              ssl::context& context,
                              bool fUseSSL,
-                             boost::shared_ptr< AcceptedConnection > conn,
+                             boost::shared_ptr<HTTPConnection> conn,
                              const boost::system::error_code& error);
 
 /**
  * Sets up I/O resources to accept and handle a new connection.
  */
-template <typename Protocol, typename SocketAcceptorService>
-static void RPCListen(boost::shared_ptr< basic_socket_acceptor<Protocol, SocketAcceptorService> > acceptor,
+static void RPCListen(boost::shared_ptr<ip::tcp::acceptor> acceptor,
                    ssl::context& context,
                    const bool fUseSSL)
 {
     // Accept connection
-    boost::shared_ptr< AcceptedConnectionImpl<Protocol> > conn(new AcceptedConnectionImpl<Protocol>(acceptor->get_io_service(), context, fUseSSL));
+    boost::shared_ptr<HTTPConnection> conn(new HTTPConnection(acceptor->get_io_service(), context, fUseSSL));
 
     acceptor->async_accept(
             conn->sslStream.lowest_layer(),
             conn->peer,
-            boost::bind(&RPCAcceptHandler<Protocol, SocketAcceptorService>,
+            boost::bind(&RPCAcceptHandler,
                 acceptor,
                 boost::ref(context),
                 fUseSSL,
@@ -510,38 +948,23 @@ static void RPCListen(boost::shared_ptr< basic_socket_acceptor<Protocol, SocketA
 /**
  * Accept and handle incoming connection.
  */
-template <typename Protocol, typename SocketAcceptorService>
-static void RPCAcceptHandler(boost::shared_ptr< basic_socket_acceptor<Protocol, SocketAcceptorService> > acceptor,
+static void RPCAcceptHandler(boost::shared_ptr<ip::tcp::acceptor> acceptor,
                              ssl::context& context,
                              const bool fUseSSL,
-                             boost::shared_ptr< AcceptedConnection > conn,
+                             boost::shared_ptr<HTTPConnection> conn,
                              const boost::system::error_code& error)
 {
     // Immediately start accepting new connections, except when we're cancelled or our socket is closed.
     if (error != asio::error::operation_aborted && acceptor->is_open())
         RPCListen(acceptor, context, fUseSSL);
 
-    AcceptedConnectionImpl<ip::tcp>* tcp_conn = dynamic_cast< AcceptedConnectionImpl<ip::tcp>* >(conn.get());
-
     if (error)
     {
         // TODO: Actually handle errors
         LogPrintf("%s: Error: %s\n", __func__, error.message());
     }
-    // Restrict callers by IP.  It is important to
-    // do this before starting client thread, to filter out
-    // certain DoS and misbehaving clients.
-    else if (tcp_conn && !ClientAllowed(tcp_conn->peer.address()))
-    {
-        // Only send a 403 if we're not using SSL to prevent a DoS during the SSL handshake.
-        if (!fUseSSL)
-            conn->stream() << HTTPError(HTTP_FORBIDDEN, false) << std::flush;
-        conn->close();
-    }
-    else {
-        ServiceConnection(conn.get());
-        conn->close();
-    }
+    else
+        conn->Start();
 }
 
 static ip::tcp::endpoint ParseEndpoint(const std::string &strEndpoint, int defaultPort)
@@ -706,10 +1129,17 @@ void StartRPCThreads()
         return;
     }
 
-    rpc_worker_group = new boost::thread_group();
-    for (int i = 0; i < GetArg("-rpcthreads", 4); i++)
-        rpc_worker_group->create_thread(boost::bind(&asio::io_service::run, rpc_io_service));
+    int nWorkQueueDepth = std::max((int)GetArg("-rpcworkqueue", DEFAULT_HTTP_WORKQUEUE), 1);
+    rpc_work_queue = new CRPCWorkQueue(nWorkQueueDepth);
     fRPCRunning = true;
+
+    // One thread does all the connection I/O, the others run the requests
+    rpc_worker_group = new boost::thread_group();
+    rpc_worker_group->create_thread(boost::bind(&asio::io_service::run, rpc_io_service));
+    int nThreads = std::max((int)GetArg("-rpcthreads", DEFAULT_HTTP_THREADS), 1);
+    for (int i = 0; i < nThreads; i++)
+        rpc_worker_group->create_thread(boost::bind(&CRPCWorkQueue::Run, rpc_work_queue));
+    LogPrint("rpc", "Started %d RPC worker threads, work queue depth %d\n", nThreads, nWorkQueueDepth);
 }
 
 void StartDummyRPCThread()
@@ -752,9 +1182,13 @@ void StopRPCThreads()
     deadlineTimers.clear();
 
     rpc_io_service->stop();
+    if (rpc_work_queue != NULL)
+        rpc_work_queue->Interrupt();
     cvBlockChange.notify_all();
     if (rpc_worker_group != NULL)
         rpc_worker_group->join_all();
+    // Queued connections must go before the io_service their sockets belong to
+    delete rpc_work_queue; rpc_work_queue = NULL;
     delete rpc_dummy_work; rpc_dummy_work = NULL;
     delete rpc_worker_group; rpc_worker_group = NULL;
     delete rpc_ssl_context; rpc_ssl_context = NULL;
@@ -872,6 +1306,17 @@ static Object JSONRPCExecOne(const Value& req)
     return rpc_result;
 }
 
+/** Reply with an error, or drop the connection if part of the reply has already gone out */
+static bool JSONRPCReplyFailed(AcceptedConnection *conn, const CJSONStreamWriter& writer, const Object& objError, const Value& id)
+{
+    if (writer.Flushed()) {
+        LogPrintf("ThreadRPCServer streamed reply to %s failed: %s\n", conn->peer_address_to_string(), write_string(Value(objError), false));
+        conn->close();
+    } else
+        ErrorReply(conn->stream(), objError, id);
+    return false;
+}
+
 static string JSONRPCExecBatch(const Array& vReq)
 {
     Array ret;
@@ -881,6 +1326,32 @@ static string JSONRPCExecBatch(const Array& vReq)
     return write_string(Value(ret), false) + "\n";
 }
 
+/** Sends the parts of a streamed JSON-RPC reply as HTTP chunks */
+class CChunkedReply
+{
+private:
+    AcceptedConnection* conn;
+    bool fKeepAlive;
+    bool fStarted;
+
+public:
+    CChunkedReply(AcceptedConnection* connIn, bool fKeepAliveIn) : conn(connIn), fKeepAlive(fKeepAliveIn), fStarted(false) {}
+
+    void Write(const std::string& strData)
+    {
+        if (!fStarted) {
+            conn->write_data(HTTPReplyHeaderChunked(HTTP_OK, fKeepAlive));
+            fStarted = true;
+        }
+        conn->write_data(HTTPChunk(strData));
+    }
+
+    void End()
+    {
+        conn->write_data(HTTPChunk(""));
+    }
+};
+
 static bool HTTPReq_JSONRPC(AcceptedConnection *conn,
                             string& strRequest,
                             map<string, string>& mapHeaders,
@@ -906,6 +1377,10 @@ static bool HTTPReq_JSONRPC(AcceptedConnection *conn,
     }
 
     JSONRequest jreq;
+    CChunkedReply chunkedReply(conn, fRun);
+    // Large replies are sent as they're written, to clients that accept that
+    CJSONStreamWriter writer(boost::bind(&CChunkedReply::Write, &chunkedReply, _1),
+                             conn->can_chunk() ? JSON_STREAM_CHUNK_SIZE : std::numeric_limits<size_t>::max());
     try
     {
         // Parse request
@@ -920,76 +1395,69 @@ static bool HTTPReq_JSONRPC(AcceptedConnection *conn,
                 throw JSONRPCError(RPC_IN_WARMUP, rpcWarmupStatus);
         }
 
-        string strReply;
-
         // singleton request
         if (valRequest.type() == obj_type) {
             jreq.parse(valRequest);
 
-            Value result = tableRPC.execute(jreq.strMethod, jreq.params);
-
-            // Send reply
-            strReply = JSONRPCReply(result, Value::null, jreq.id);
+            writer.BeginObject();
+            writer.WriteKey("result");
+            if (!tableRPC.executeStream(jreq.strMethod, jreq.params, writer))
+                writer.WriteValue(tableRPC.execute(jreq.strMethod, jreq.params));
+            writer.WritePair("error", Value::null);
+            writer.WritePair("id", jreq.id);
+            writer.EndObject();
+
+            if (writer.Flushed()) {
+                writer.Flush();
+                chunkedReply.Write("\n");
+                chunkedReply.End();
+            } else {
+                const string& strReply = writer.GetBuffer();
+                conn->stream() << HTTPReplyHeader(HTTP_OK, fRun, strReply.size() + 1) << strReply << "\n" << std::flush;
+            }
 
         // array of requests
-        } else if (valRequest.type() == array_type)
-            strReply = JSONRPCExecBatch(valRequest.get_array());
-        else
+        } else if (valRequest.type() == array_type) {
+            string strReply = JSONRPCExecBatch(valRequest.get_array());
+            conn->stream() << HTTPReplyHeader(HTTP_OK, fRun, strReply.size()) << strReply << std::flush;
+        } else
             throw JSONRPCError(RPC_PARSE_ERROR, "Top-level object parse error");
-
-        conn->stream() << HTTPReplyHeader(HTTP_OK, fRun, strReply.size()) << strReply << std::flush;
     }
     catch (Object& objError)
     {
-        ErrorReply(conn->stream(), objError, jreq.id);
-        return false;
+        return JSONRPCReplyFailed(conn, writer, objError, jreq.id);
     }
     catch (std::exception& e)
     {
-        ErrorReply(conn->stream(), JSONRPCError(RPC_PARSE_ERROR, e.what()), jreq.id);
-        return false;
+        return JSONRPCReplyFailed(conn, writer, JSONRPCError(RPC_PARSE_ERROR, e.what()), jreq.id);
     }
     return true;
 }
 
-void ServiceConnection(AcceptedConnection *conn)
+void HTTPConnection::Process()
 {
-    bool fRun = true;
-    while (fRun && !ShutdownRequested())
-    {
-        int nProto = 0;
-        map<string, string> mapHeaders;
-        string strRequest, strMethod, strURI;
-
-        // Read HTTP request line
-        if (!ReadHTTPRequestLine(conn->stream(), nProto, strMethod, strURI))
-            break;
-
-        // Read HTTP message headers and body
-        ReadHTTPMessage(conn->stream(), mapHeaders, strRequest, nProto, MAX_SIZE);
-
-        // HTTP Keep-Alive is false; close connection immediately
-        if ((mapHeaders["connection"] == "close") || (!GetBoolArg("-rpckeepalive", true)))
-            fRun = false;
+    bool fRun = fKeepAlive && !ShutdownRequested();
 
-        // Process via JSON-RPC API
-        if (strURI == "/") {
-            if (!HTTPReq_JSONRPC(conn, strRequest, mapHeaders, fRun))
-                break;
+    // Process via JSON-RPC API
+    bool fOk;
+    if (strURI == "/") {
+        fOk = HTTPReq_JSONRPC(this, strRequest, mapHeaders, fRun);
 
-        // Process via HTTP REST API
-        } else if (strURI.substr(0, 6) == "/rest/" && GetBoolArg("-rest", false)) {
-            if (!HTTPReq_REST(conn, strURI, mapHeaders, fRun))
-                break;
+    // Process via HTTP REST API
+    } else if (strURI.substr(0, 6) == "/rest/" && GetBoolArg("-rest", false)) {
+        fOk = HTTPReq_REST(this, strURI, strRequest, mapHeaders, fRun);
 
-        } else {
-            conn->stream() << HTTPError(HTTP_NOT_FOUND, false) << std::flush;
-            break;
-        }
+    } else {
+        ssReply << HTTPError(HTTP_NOT_FOUND, false);
+        fOk = false;
     }
+    if (!fOk || !fRun)
+        fKeepAlive = false;
+
+    SendReply();
 }
 
-json_spirit::Value CRPCTable::execute(const std::string &strMethod, const json_spirit::Array &params) const
+const CRPCCommand* CRPCTable::checkCommand(const std::string &strMethod) const
 {
     // Find method
     const CRPCCommand *pcmd = tableRPC[strMethod];
@@ -1006,6 +1474,14 @@ json_spirit::Value CRPCTable::execute(const std::string &strMethod, const json_s
         !pcmd->okSafeMode)
         throw JSONRPCError(RPC_FORBIDDEN_BY_SAFE_MODE, string("Safe mode: ") + strWarning);
 
+    return pcmd;
+}
+
+json_spirit::Value CRPCTable::execute(const std::string &strMethod, const json_spirit::Array &params) const
+{
+    const CRPCCommand *pcmd = checkCommand(strMethod);
+
+    CRPCCallTimer timer(pcmd->name);
     try
     {
         // Execute
@@ -1018,17 +1494,8 @@ json_spirit::Value CRPCTable::execute(const std::string &strMethod, const json_s
                 LOCK(cs_main);
                 result = pcmd->actor(params, false);
             } else {
-                while (true) {
-                    TRY_LOCK(cs_main, lockMain);
-                    if(!lockMain) { MilliSleep(50); continue; }
-                    while (true) {
-                        TRY_LOCK(pwalletMain->cs_wallet, lockWallet);
-                        if(!lockMain) { MilliSleep(50); continue; }
-                        result = pcmd->actor(params, false);
-                        break;
-                    }
-                    break;
-                }
+                LOCK2(cs_main, pwalletMain->cs_wallet);
+                result = pcmd->actor(params, false);
             }
 #else // ENABLE_WALLET
             else {
@@ -1045,6 +1512,28 @@ json_spirit::Value CRPCTable::execute(const std::string &strMethod, const json_s
     }
 }
 
+bool CRPCTable::executeStream(const std::string &strMethod, const json_spirit::Array &params, CJSONStreamWriter& writer) const
+{
+    map<string, rpcstreamfn_type>::const_iterator it = mapStreamCommands.find(strMethod);
+    if (it == mapStreamCommands.end())
+        return false;
+    const CRPCCommand *pcmd = checkCommand(strMethod);
+
+    CRPCCallTimer timer(pcmd->name);
+    try
+    {
+        if (!it->second(params, writer)) {
+            timer.Cancel();
+            return false;
+        }
+        return true;
+    }
+    catch (std::exception& e)
+    {
+        throw JSONRPCError(RPC_MISC_ERROR, e.what());
+    }
+}
+
 std::string HelpExampleCli(string methodname, string args){
     return "> ic-cli " + methodname + " " + args + "\n";
 }
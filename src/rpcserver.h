@@ -22,6 +22,15 @@
 class CBlockIndex;
 class CNetAddr;
 
+/** Default for -rpcthreads, number of threads running RPC requests */
+static const int DEFAULT_HTTP_THREADS = 4;
+/** Default for -rpcworkqueue, number of requests that can wait for an RPC thread before new ones are refused */
+static const int DEFAULT_HTTP_WORKQUEUE = 16;
+/** Default for -rpcservertimeout, seconds a connection may stay idle or take to send a request */
+static const int DEFAULT_HTTP_SERVER_TIMEOUT = 30;
+/** Maximum size of the request line and headers of an RPC request */
+static const size_t MAX_HEADERS_SIZE = 8192;
+
 class AcceptedConnection
 {
 public:
@@ -30,6 +39,10 @@ public:
     virtual std::iostream& stream() = 0;
     virtual std::string peer_address_to_string() const = 0;
     virtual void close() = 0;
+    /** Whether the client accepts a reply in parts (chunked transfer encoding) */
+    virtual bool can_chunk() const = 0;
+    /** Send part of the reply now, ahead of what is written to stream() */
+    virtual void write_data(const std::string& strData) = 0;
 };
 
 /** Start RPC threads */
@@ -92,6 +105,20 @@ public:
     bool reqWallet;
 };
 
+/**
+ * Writes the result of a method straight to a stream instead of returning
+ * it. Returns false, before writing anything, if the params ask for a
+ * result that is better built by the regular method.
+ */
+typedef bool(*rpcstreamfn_type)(const json_spirit::Array& params, CJSONStreamWriter& writer);
+
+class CRPCStreamCommand
+{
+public:
+    std::string name;
+    rpcstreamfn_type actor;
+};
+
 /**
  * Ic RPC command dispatcher.
  */
@@ -99,6 +126,9 @@ class CRPCTable
 {
 private:
     std::map<std::string, const CRPCCommand*> mapCommands;
+    std::map<std::string, rpcstreamfn_type> mapStreamCommands;
+
+    const CRPCCommand* checkCommand(const std::string &method) const;
 public:
     CRPCTable();
     const CRPCCommand* operator[](std::string name) const;
@@ -112,6 +142,15 @@ public:
      * @throws an exception (json_spirit::Value) when an error happens.
      */
     json_spirit::Value execute(const std::string &method, const json_spirit::Array &params) const;
+
+    /**
+     * Execute a method that can write its result to a stream. Unlike
+     * execute(), this doesn't take cs_main or cs_wallet: stream methods
+     * lock what they need themselves, so a slow client can't hold them.
+     * @returns false if the method can't stream this call, nothing has been
+     * written then and the call should go through execute().
+     */
+    bool executeStream(const std::string &method, const json_spirit::Array &params, CJSONStreamWriter& writer) const;
 };
 
 extern const CRPCTable tableRPC;
@@ -140,6 +179,7 @@ extern void EnsureWalletIsUnlocked();
 
 extern json_spirit::Value getconnectioncount(const json_spirit::Array& params, bool fHelp); // in rpcnet.cpp
 extern json_spirit::Value getpeerinfo(const json_spirit::Array& params, bool fHelp);
+extern json_spirit::Value getblockdownloadinfo(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value ping(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value addnode(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value getaddednodeinfo(const json_spirit::Array& params, bool fHelp);
@@ -150,6 +190,7 @@ extern json_spirit::Value importprivkey(const json_spirit::Array& params, bool f
 extern json_spirit::Value importaddress(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value dumpwallet(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value importwallet(const json_spirit::Array& params, bool fHelp);
+extern json_spirit::Value abortrescan(const json_spirit::Array& params, bool fHelp);
 
 extern json_spirit::Value getgenerate(const json_spirit::Array& params, bool fHelp); // in rpcmining.cpp
 extern json_spirit::Value setgenerate(const json_spirit::Array& params, bool fHelp);
@@ -201,6 +242,10 @@ extern json_spirit::Value getblockchaininfo(const json_spirit::Array& params, bo
 extern json_spirit::Value getnetworkinfo(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value keepass(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value setmocktime(const json_spirit::Array& params, bool fHelp);
+extern json_spirit::Value getaddressbalance(const json_spirit::Array& params, bool fHelp);
+extern json_spirit::Value getaddressdeltas(const json_spirit::Array& params, bool fHelp);
+extern json_spirit::Value getaddressutxos(const json_spirit::Array& params, bool fHelp);
+extern json_spirit::Value getspentinfo(const json_spirit::Array& params, bool fHelp);
 
 extern json_spirit::Value getrawtransaction(const json_spirit::Array& params, bool fHelp); // in rcprawtransaction.cpp
 extern json_spirit::Value listunspent(const json_spirit::Array& params, bool fHelp);
@@ -218,9 +263,12 @@ extern json_spirit::Value getdifficulty(const json_spirit::Array& params, bool f
 extern json_spirit::Value settxfee(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value getmempoolinfo(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value getrawmempool(const json_spirit::Array& params, bool fHelp);
+extern bool getrawmempool_stream(const json_spirit::Array& params, CJSONStreamWriter& writer);
 extern json_spirit::Value getblockhash(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value getblock(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value getblockheader(const json_spirit::Array& params, bool fHelp);
+extern json_spirit::Value getblockhashes(const json_spirit::Array& params, bool fHelp);
+extern json_spirit::Value getblockfilter(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value gettxoutsetinfo(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value gettxout(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value verifychain(const json_spirit::Array& params, bool fHelp);
@@ -239,6 +287,7 @@ extern json_spirit::Value mnsync(const json_spirit::Array& params, bool fHelp);
 // in rest.cpp
 extern bool HTTPReq_REST(AcceptedConnection *conn,
                   std::string& strURI,
+                  const std::string& strRequest,
                   std::map<std::string, std::string>& mapHeaders,
                   bool fRun);
 
@@ -3,14 +3,36 @@
 // Distributed under the MIT software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
+#if defined(HAVE_CONFIG_H)
+#include "config/ic-config.h"
+#endif
+
 #include "bitcoinconsensus.h"
 
 #include "primitives/transaction.h"
 #include "script/interpreter.h"
 #include "version.h"
 
+#ifdef USE_SECP256K1
+#include <secp256k1.h>
+#endif
+
 namespace {
 
+#ifdef USE_SECP256K1
+//! The library verifies through pubkey.cpp but doesn't have key.cpp, which starts libsecp256k1 for the rest of the tree
+class CSecp256k1VerifyInit {
+public:
+    CSecp256k1VerifyInit() {
+        secp256k1_start(SECP256K1_START_VERIFY);
+    }
+    ~CSecp256k1VerifyInit() {
+        secp256k1_stop();
+    }
+};
+static CSecp256k1VerifyInit instance_of_csecp256k1verifyinit;
+#endif
+
 /** A class that deserializes a single CTransaction one time. */
 class TxInputStream
 {
@@ -324,6 +324,7 @@ I ReadVarInt(Stream& is)
 
 #define FLATDATA(obj) REF(CFlatData((char*)&(obj), (char*)&(obj) + sizeof(obj)))
 #define VARINT(obj) REF(WrapVarInt(REF(obj)))
+#define BIGENDIAN(obj) REF(WrapBigEndian(REF(obj)))
 #define LIMITED_STRING(obj,n) REF(LimitedString< n >(REF(obj)))
 
 /** 
@@ -422,9 +423,47 @@ public:
     }
 };
 
+/**
+ * Non-negative integer written most significant byte first, so that database
+ * keys containing it sort in numeric order.
+ */
+template<typename I>
+class CBigEndian
+{
+protected:
+    I &n;
+public:
+    CBigEndian(I& nIn) : n(nIn) { }
+
+    unsigned int GetSerializeSize(int, int) const {
+        return sizeof(I);
+    }
+
+    template<typename Stream>
+    void Serialize(Stream &s, int, int) const {
+        unsigned char buf[sizeof(I)];
+        for (unsigned int i = 0; i < sizeof(I); i++)
+            buf[i] = (unsigned char)((uint64_t)n >> (8 * (sizeof(I) - 1 - i)));
+        s.write((char*)buf, sizeof(I));
+    }
+
+    template<typename Stream>
+    void Unserialize(Stream& s, int, int) {
+        unsigned char buf[sizeof(I)];
+        s.read((char*)buf, sizeof(I));
+        uint64_t nValue = 0;
+        for (unsigned int i = 0; i < sizeof(I); i++)
+            nValue = (nValue << 8) | buf[i];
+        n = (I)nValue;
+    }
+};
+
 template<typename I>
 CVarInt<I> WrapVarInt(I& n) { return CVarInt<I>(n); }
 
+template<typename I>
+CBigEndian<I> WrapBigEndian(I& n) { return CBigEndian<I>(n); }
+
 /**
  * Forward declarations
  */
@@ -53,6 +53,8 @@ class CSporkManager;
 
 extern std::map<uint256, CSporkMessage> mapSporks;
 extern std::map<int, CSporkMessage> mapSporksActive;
+/** Protects mapSporks and mapSporksActive, don't take other locks while holding it */
+extern CCriticalSection cs_spork;
 extern CSporkManager sporkManager;
 
 void ProcessSpork(CNode* pfrom, std::string& strCommand, CDataStream& vRecv);
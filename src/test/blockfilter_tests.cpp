@@ -0,0 +1,114 @@
+// Copyright (c) 2014-2015 The Ic developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockfilter.h"
+
+#include "clientversion.h"
+#include "main.h"
+#include "script/script.h"
+#include "streams.h"
+#include "uint256.h"
+#include "utilstrencodings.h"
+
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+
+using namespace std;
+
+static vector<unsigned char> NumberedScript(int n)
+{
+    CScript script = CScript() << OP_DUP << OP_HASH160 << n << OP_EQUALVERIFY << OP_CHECKSIG;
+    return vector<unsigned char>(script.begin(), script.end());
+}
+
+BOOST_AUTO_TEST_SUITE(blockfilter_tests)
+
+BOOST_AUTO_TEST_CASE(blockfilter_match)
+{
+    BlockFilterElements included, excluded;
+    for (int i = 0; i < 200; i++)
+        included.insert(NumberedScript(i));
+    for (int i = 200; i < 1200; i++)
+        excluded.insert(NumberedScript(i));
+
+    CBlockFilter filter(uint256(1), included);
+    BOOST_FOREACH(const vector<unsigned char>& element, included) {
+        BlockFilterElements query;
+        query.insert(element);
+        BOOST_CHECK(filter.MatchAny(query));
+    }
+    BOOST_CHECK(!filter.MatchAny(excluded));
+    BOOST_CHECK(filter.MatchAny(included));
+    BOOST_CHECK(!filter.MatchAny(BlockFilterElements()));
+
+    // Round trip through serialization
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << filter;
+    CBlockFilter filter2;
+    ss >> filter2;
+    BOOST_CHECK(filter2.GetBlockHash() == filter.GetBlockHash());
+    BOOST_CHECK(filter2.GetEncoded() == filter.GetEncoded());
+    BOOST_CHECK(filter2.MatchAny(included));
+
+    // An empty filter matches nothing
+    CBlockFilter empty(uint256(1), BlockFilterElements());
+    BOOST_CHECK(empty.GetEncoded() == vector<unsigned char>(1, 0));
+    BOOST_CHECK(!empty.MatchAny(included));
+}
+
+BOOST_AUTO_TEST_CASE(blockfilter_block)
+{
+    CScript scriptSpent = CScript() << OP_1;
+    CScript scriptPaid = CScript() << OP_2;
+    CScript scriptData = CScript() << OP_RETURN << 3;
+
+    CMutableTransaction coinbase;
+    coinbase.vin.resize(1);
+    coinbase.vout.resize(3);
+    coinbase.vout[0].scriptPubKey = scriptPaid;
+    coinbase.vout[1].scriptPubKey = scriptData;
+    CMutableTransaction spend;
+    spend.vin.resize(1);
+    spend.vin[0].prevout = COutPoint(uint256(2), 0);
+    spend.vout.resize(1);
+    spend.vout[0].scriptPubKey = scriptPaid;
+
+    CBlock block;
+    block.vtx.push_back(coinbase);
+    block.vtx.push_back(spend);
+    CBlockUndo blockundo;
+    blockundo.vtxundo.resize(1);
+    blockundo.vtxundo[0].vprevout.push_back(CTxInUndo(CTxOut(1, scriptSpent)));
+
+    CBlockFilter filter(block, blockundo);
+    BOOST_CHECK(filter.GetBlockHash() == block.GetHash());
+
+    BlockFilterElements query;
+    query.insert(vector<unsigned char>(scriptSpent.begin(), scriptSpent.end()));
+    BOOST_CHECK(filter.MatchAny(query));
+    query.clear();
+    query.insert(vector<unsigned char>(scriptPaid.begin(), scriptPaid.end()));
+    BOOST_CHECK(filter.MatchAny(query));
+    query.clear();
+    query.insert(vector<unsigned char>(scriptData.begin(), scriptData.end()));
+    BOOST_CHECK(!filter.MatchAny(query));
+
+    // Two distinct scripts: the spent one and the one paid twice
+    BOOST_CHECK_EQUAL(filter.GetEncoded()[0], 2);
+}
+
+BOOST_AUTO_TEST_CASE(blockfilter_bip158_vector)
+{
+    // Bitcoin testnet genesis block, from the BIP158 test vectors
+    CScript script = CScript() << ParseHex("04678afdb0fe5548271967f1a67130b7105cd6a828e03909a67962e0ea1f61deb649f6bc3f4cef38c4f35504e51ec112de5c384df7ba0b8d578a4c702b6bf11d5f") << OP_CHECKSIG;
+    BlockFilterElements elements;
+    elements.insert(vector<unsigned char>(script.begin(), script.end()));
+
+    CBlockFilter filter(uint256("000000000933ea01ad0ee984209779baaec3ced90fa3f408719526f8d77f4943"), elements);
+    BOOST_CHECK_EQUAL(HexStr(filter.GetEncoded()), "019dfca8");
+    BOOST_CHECK_EQUAL(filter.GetHeader(uint256(0)).GetHex(), "21584579b7eb08997773e5aeff3a7f932700042d0ed2a6129012b7d7ae81b750");
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,123 @@
+// Copyright (c) 2014-2015 The Ic developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockreader.h"
+
+#include "chainparams.h"
+#include "clientversion.h"
+#include "main.h"
+
+#include <vector>
+
+#include <boost/filesystem.hpp>
+#include <boost/test/unit_test.hpp>
+
+using namespace std;
+
+// a block file of its own, next to the blk00000.dat of the test chain
+static const int TEST_BLOCK_FILE = 9000;
+
+BOOST_AUTO_TEST_SUITE(blockreader_tests)
+
+BOOST_AUTO_TEST_CASE(lrumap_order)
+{
+    CLRUMap<int, int> lru(3);
+    int value;
+    BOOST_CHECK(!lru.Get(1, value));
+
+    lru.Put(1, 10);
+    lru.Put(2, 20);
+    lru.Put(3, 30);
+    BOOST_CHECK(lru.Get(2, value) && value == 20);
+
+    // 1 is the least recently used now, getting it makes that 3
+    BOOST_CHECK(lru.Get(1, value) && value == 10);
+    lru.Put(4, 40);
+    BOOST_CHECK(!lru.Get(3, value));
+    BOOST_CHECK(lru.Get(1, value) && value == 10);
+    BOOST_CHECK(lru.Get(2, value) && value == 20);
+    BOOST_CHECK(lru.Get(4, value) && value == 40);
+
+    // putting a key again replaces its value and makes it the most recent
+    lru.Put(1, 11);
+    lru.Put(5, 50);
+    BOOST_CHECK(!lru.Get(2, value));
+    BOOST_CHECK(lru.Get(1, value) && value == 11);
+
+    // an erased key leaves room, nothing else is dropped for the next one
+    lru.Erase(4);
+    lru.Erase(4);
+    BOOST_CHECK(!lru.Get(4, value));
+    lru.Put(6, 60);
+    BOOST_CHECK(lru.Get(1, value) && value == 11);
+    BOOST_CHECK(lru.Get(5, value) && value == 50);
+    BOOST_CHECK(lru.Get(6, value) && value == 60);
+
+    lru.Clear();
+    BOOST_CHECK(!lru.Get(1, value));
+    BOOST_CHECK(!lru.Get(6, value));
+}
+
+BOOST_AUTO_TEST_CASE(lrumap_capacity)
+{
+    CLRUMap<int, int> lru(MAX_BLOCKS_CACHED);
+    for (int i = 0; i < 100; i++)
+        lru.Put(i, i);
+
+    // only the last ones put are kept
+    int value;
+    for (int i = 0; i < 100; i++)
+        BOOST_CHECK_EQUAL(lru.Get(i, value), i >= 100 - (int)MAX_BLOCKS_CACHED);
+}
+
+BOOST_AUTO_TEST_CASE(blockreader_read)
+{
+    CBlock block1 = Params().GenesisBlock();
+    CBlock block2 = block1;
+    block2.nNonce++;
+
+    CDiskBlockPos pos1(TEST_BLOCK_FILE, 0);
+    BOOST_REQUIRE(WriteBlockToDisk(block1, pos1));
+    CDiskBlockPos pos2(TEST_BLOCK_FILE, pos1.nPos + ::GetSerializeSize(block1, SER_DISK, CLIENT_VERSION));
+    BOOST_REQUIRE(WriteBlockToDisk(block2, pos2));
+
+    CBlock block;
+    {
+        // a finished file is mapped, the same bytes come out as through the file
+        CBlockFileReader readerMapped;
+        CBlockFileReader readerFile;
+        vector<char> vchMapped, vchFile;
+        BOOST_CHECK(readerMapped.ReadRaw(vchMapped, pos2, true));
+        BOOST_CHECK(readerFile.ReadRaw(vchFile, pos2, false));
+        BOOST_CHECK(vchMapped == vchFile);
+
+        BOOST_CHECK(readerMapped.Read(block, pos1, true));
+        BOOST_CHECK(block.GetHash() == block1.GetHash());
+        BOOST_CHECK(readerMapped.Read(block, pos2, true));
+        BOOST_CHECK(block.GetHash() == block2.GetHash());
+        BOOST_CHECK(readerFile.Read(block, pos2, false));
+        BOOST_CHECK(block.GetHash() == block2.GetHash());
+
+        // a position that isn't the start of a block
+        BOOST_CHECK(!readerFile.ReadRaw(vchFile, CDiskBlockPos(TEST_BLOCK_FILE, pos1.nPos + 1), false));
+        BOOST_CHECK(!readerMapped.ReadRaw(vchMapped, CDiskBlockPos(TEST_BLOCK_FILE, pos1.nPos + 1), true));
+    }
+
+    // once read, a block comes from the cache, also with its file gone
+    CBlockFileReader reader;
+    BOOST_CHECK(reader.Read(block, pos1, false));
+    BOOST_CHECK(block.GetHash() == block1.GetHash());
+    reader.CloseFile(TEST_BLOCK_FILE);
+    boost::filesystem::remove(GetBlockPosFilename(pos1, "blk"));
+
+    block.SetNull();
+    BOOST_CHECK(reader.Read(block, pos1, false));
+    BOOST_CHECK(block.GetHash() == block1.GetHash());
+    BOOST_CHECK(!reader.Read(block, pos2, false));
+
+    reader.Clear();
+    BOOST_CHECK(!reader.Read(block, pos1, false));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
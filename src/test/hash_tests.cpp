@@ -46,4 +46,19 @@ BOOST_AUTO_TEST_CASE(murmurhash3)
 #undef T
 }
 
+BOOST_AUTO_TEST_CASE(siphash)
+{
+    // Reference vectors from the SipHash paper: key 00..0f, message 00..(len-1)
+    const uint64_t k0 = 0x0706050403020100ULL, k1 = 0x0F0E0D0C0B0A0908ULL;
+    unsigned char data[16];
+    for (unsigned int i = 0; i < sizeof(data); i++)
+        data[i] = i;
+
+    BOOST_CHECK_EQUAL(SipHash(k0, k1, data, 0), 0x726fdb47dd0e0e31ULL);
+    BOOST_CHECK_EQUAL(SipHash(k0, k1, data, 1), 0x74f839c593dc67fdULL);
+    BOOST_CHECK_EQUAL(SipHash(k0, k1, data, 8), 0x93f5f5799a932462ULL);
+    BOOST_CHECK_EQUAL(SipHash(k0, k1, data, 15), 0xa129ca6149be45e5ULL);
+    BOOST_CHECK_EQUAL(SipHash(k0, k1, data, 16), 0x3f2acc7f57c29bdbULL);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
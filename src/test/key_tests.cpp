@@ -5,6 +5,7 @@
 #include "key.h"
 
 #include "base58.h"
+#include "random.h"
 #include "script/script.h"
 #include "uint256.h"
 #include "util.h"
@@ -187,4 +188,44 @@ BOOST_AUTO_TEST_CASE(key_test1)
     BOOST_CHECK(detsigc == ParseHex("2052d8a32079c11e79db95af63bb9600c5b04f21a9ca33dc129c2bfa8ac9dc1cd561d8ae5e0f6c1a16bde3719c64c2fd70e404b6428ab9a69566962e8771b5944d"));
 }
 
+BOOST_AUTO_TEST_CASE(key_signature_lax_der)
+{
+    CKey key1;
+    key1.MakeNewKey(true);
+    CPubKey pubkey1 = key1.GetPubKey();
+    uint256 hashMsg = GetRandHash();
+
+    // Take apart a strict DER signature: 30 len 02 lenR R 02 lenS S
+    vector<unsigned char> sig;
+    BOOST_CHECK(key1.Sign(hashMsg, sig));
+    BOOST_CHECK(pubkey1.Verify(hashMsg, sig));
+    vector<unsigned char> r(sig.begin() + 4, sig.begin() + 4 + sig[3]);
+    vector<unsigned char> s(sig.begin() + 6 + sig[3], sig.end());
+
+    // Encodings the OpenSSL verifier accepted before BIP66 still verify.
+    vector<unsigned char> padded;
+    padded.push_back(0x30); padded.push_back(sig[1] + 2);
+    padded.push_back(0x02); padded.push_back(r.size() + 1); padded.push_back(0x00);
+    padded.insert(padded.end(), r.begin(), r.end());
+    padded.push_back(0x02); padded.push_back(s.size() + 1); padded.push_back(0x00);
+    padded.insert(padded.end(), s.begin(), s.end());
+    BOOST_CHECK(pubkey1.Verify(hashMsg, padded));
+
+    vector<unsigned char> longform;
+    longform.push_back(0x30); longform.push_back(0x81); longform.push_back(sig[1] + 2);
+    longform.push_back(0x02); longform.push_back(0x82); longform.push_back(0x00); longform.push_back(r.size());
+    longform.insert(longform.end(), r.begin(), r.end());
+    longform.push_back(0x02); longform.push_back(s.size());
+    longform.insert(longform.end(), s.begin(), s.end());
+    BOOST_CHECK(pubkey1.Verify(hashMsg, longform));
+
+    vector<unsigned char> trailing(sig);
+    trailing.push_back(0x01);
+    BOOST_CHECK(pubkey1.Verify(hashMsg, trailing));
+
+    // Truncated encodings never verify.
+    BOOST_CHECK(!pubkey1.Verify(hashMsg, vector<unsigned char>()));
+    BOOST_CHECK(!pubkey1.Verify(hashMsg, vector<unsigned char>(sig.begin(), sig.end() - 1)));
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,160 @@
+// Copyright (c) 2014-2015 The Ic developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "main.h"
+#include "masternode.h"
+#include "masternodeman.h"
+#include "random.h"
+#include "timedata.h"
+
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+
+/** Lets the tests drive the validation callback without going through the signals */
+class CTestMasternodeMan : public CMasternodeMan
+{
+public:
+    using CMasternodeMan::SyncTransaction;
+};
+
+static CMutableTransaction CollateralTx(int n)
+{
+    CMutableTransaction tx;
+    tx.vin.resize(1);
+    tx.vin[0].scriptSig = CScript() << OP_11 << n;
+    tx.vout.resize(1);
+    tx.vout[0].scriptPubKey = CScript() << OP_TRUE;
+    tx.vout[0].nValue = 1000 * COIN;
+    return tx;
+}
+
+static CMutableTransaction SpendTx(const COutPoint& collateral)
+{
+    CMutableTransaction tx;
+    tx.vin.resize(1);
+    tx.vin[0].prevout = collateral;
+    tx.vout.resize(1);
+    tx.vout[0].scriptPubKey = CScript() << OP_TRUE;
+    tx.vout[0].nValue = 999 * COIN;
+    return tx;
+}
+
+static CMasternode PingedMasternode(const COutPoint& collateral)
+{
+    CMasternode mn;
+    mn.vin = CTxIn(collateral);
+    mn.lastPing.vin = mn.vin;
+    mn.lastPing.sigTime = GetAdjustedTime();
+    return mn;
+}
+
+// a few block indexes on top of the tip, the scores need a block hash below the height they are taken at
+struct TestChain
+{
+    std::vector<uint256> vHashes;
+    std::vector<CBlockIndex> vIndex;
+    CBlockIndex* pindexOldTip;
+
+    TestChain(int nBlocks) : vHashes(nBlocks), vIndex(nBlocks)
+    {
+        LOCK(cs_main);
+        pindexOldTip = chainActive.Tip();
+        CBlockIndex* pindexPrev = pindexOldTip;
+        for (int i = 0; i < nBlocks; i++)
+        {
+            vHashes[i] = GetRandHash();
+            vIndex[i].phashBlock = &vHashes[i];
+            vIndex[i].pprev = pindexPrev;
+            vIndex[i].nHeight = pindexPrev->nHeight + 1;
+            vIndex[i].BuildSkip();
+            pindexPrev = &vIndex[i];
+        }
+        chainActive.SetTip(pindexPrev);
+    }
+    ~TestChain()
+    {
+        LOCK(cs_main);
+        chainActive.SetTip(pindexOldTip);
+    }
+};
+
+BOOST_AUTO_TEST_SUITE(masternode_tests)
+
+BOOST_AUTO_TEST_CASE(collateral_spend_reorg)
+{
+    LOCK(cs_main);
+
+    CTransaction txCollateral = CollateralTx(0);
+    uint256 hash = txCollateral.GetHash();
+    pcoinsTip->ModifyCoins(hash)->FromTx(txCollateral, 1);
+
+    CTestMasternodeMan mnman;
+    CMasternode mn = PingedMasternode(COutPoint(hash, 0));
+    BOOST_CHECK(mnman.Add(mn));
+
+    CMutableTransaction txSpend = SpendTx(COutPoint(hash, 0));
+    CBlock block;
+    block.vtx.push_back(txSpend);
+
+    // A spend that is only in the mempool doesn't mark it
+    mnman.SyncTransaction(txSpend, NULL);
+    BOOST_CHECK(mnman.Find(mn.vin)->IsEnabled());
+
+    // Connected in a block
+    pcoinsTip->ModifyCoins(hash)->Spend(0);
+    mnman.SyncTransaction(txSpend, &block);
+    BOOST_CHECK_EQUAL(mnman.Find(mn.vin)->activeState, CMasternode::MASTERNODE_VIN_SPENT);
+
+    // Still spent in the chain, e.g. the tx was re-accepted to the mempool
+    mnman.SyncTransaction(txSpend, NULL);
+    BOOST_CHECK_EQUAL(mnman.Find(mn.vin)->activeState, CMasternode::MASTERNODE_VIN_SPENT);
+
+    // The block is disconnected and the collateral is unspent again
+    pcoinsTip->ModifyCoins(hash)->FromTx(txCollateral, 1);
+    mnman.SyncTransaction(txSpend, NULL);
+    BOOST_CHECK(mnman.Find(mn.vin)->IsEnabled());
+
+    pcoinsTip->ModifyCoins(hash)->Clear();
+}
+
+BOOST_AUTO_TEST_CASE(rank_cache_invalidation)
+{
+    TestChain chain(2);
+    int nBlockHeight = chain.vIndex.back().nHeight + 1;
+
+    LOCK(cs_main);
+
+    CTestMasternodeMan mnman;
+    CMasternode mn0 = PingedMasternode(COutPoint(CollateralTx(0).GetHash(), 0));
+    CMasternode mn1 = PingedMasternode(COutPoint(CollateralTx(1).GetHash(), 0));
+    CMasternode mn2 = PingedMasternode(COutPoint(CollateralTx(2).GetHash(), 0));
+    BOOST_CHECK(mnman.Add(mn0));
+    BOOST_CHECK(mnman.Add(mn1));
+
+    // builds the table for the block
+    int nRank0 = mnman.GetMasternodeRank(mn0.vin, nBlockHeight);
+    int nRank1 = mnman.GetMasternodeRank(mn1.vin, nBlockHeight);
+    BOOST_CHECK_EQUAL(nRank0 + nRank1, 3);
+    BOOST_CHECK_EQUAL(mnman.GetMasternodeRank(mn2.vin, nBlockHeight), -1);
+
+    // a new entry is ranked right away, not only once the table expires
+    BOOST_CHECK(mnman.Add(mn2));
+    int nRank2 = mnman.GetMasternodeRank(mn2.vin, nBlockHeight);
+    BOOST_CHECK(nRank2 >= 1 && nRank2 <= 3);
+    BOOST_CHECK_EQUAL(mnman.GetMasternodeRank(mn0.vin, nBlockHeight) + mnman.GetMasternodeRank(mn1.vin, nBlockHeight) + nRank2, 6);
+    BOOST_CHECK(mnman.GetMasternodeByRank(nRank2, nBlockHeight, 0, true) == mnman.Find(mn2.vin));
+
+    // a spent collateral drops out of the active ranks right away
+    CMutableTransaction txSpend = SpendTx(mn2.vin.prevout);
+    CBlock block;
+    block.vtx.push_back(txSpend);
+    mnman.SyncTransaction(txSpend, &block);
+    BOOST_CHECK_EQUAL(mnman.GetMasternodeRank(mn2.vin, nBlockHeight), -1);
+    BOOST_CHECK_EQUAL(mnman.GetMasternodeRank(mn0.vin, nBlockHeight) + mnman.GetMasternodeRank(mn1.vin, nBlockHeight), 3);
+    // but still counts where inactive entries are ranked too
+    BOOST_CHECK(mnman.GetMasternodeRank(mn2.vin, nBlockHeight, 0, false) != -1);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -99,4 +99,143 @@ BOOST_AUTO_TEST_CASE(MempoolRemoveTest)
     removed.clear();
 }
 
+static CMutableTransaction MakeTx(const uint256& hashPrev, unsigned int nPrevOut, unsigned int nOut, CAmount nValue)
+{
+    CMutableTransaction tx;
+    tx.vin.resize(1);
+    tx.vin[0].scriptSig = CScript() << OP_11;
+    tx.vin[0].prevout.hash = hashPrev;
+    tx.vin[0].prevout.n = nPrevOut;
+    tx.vout.resize(nOut);
+    for (unsigned int i = 0; i < nOut; i++) {
+        tx.vout[i].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+        tx.vout[i].nValue = nValue;
+    }
+    return tx;
+}
+
+static void CheckPackage(CTxMemPool& pool, const CMutableTransaction& tx, uint64_t nCount, CAmount nFees)
+{
+    CTxMemPool::txiter it = pool.mapTx.find(tx.GetHash());
+    BOOST_REQUIRE(it != pool.mapTx.end());
+    BOOST_CHECK_EQUAL(it->GetCountWithDescendants(), nCount);
+    BOOST_CHECK_EQUAL(it->GetModFeesWithDescendants(), nFees);
+}
+
+BOOST_AUTO_TEST_CASE(MempoolDescendantsTest)
+{
+    CTxMemPool pool(CFeeRate(0));
+    pool.setSanityCheck(true);
+    std::list<CTransaction> removed;
+
+    // Parent with two children, the first of which has a child of its own
+    CMutableTransaction txFunding = MakeTx(uint256(1), 0, 1, 66000LL);
+    CMutableTransaction txParent = MakeTx(txFunding.GetHash(), 0, 2, 33000LL);
+    CMutableTransaction txChild1 = MakeTx(txParent.GetHash(), 0, 1, 11000LL);
+    CMutableTransaction txChild2 = MakeTx(txParent.GetHash(), 1, 1, 11000LL);
+    CMutableTransaction txGrandChild = MakeTx(txChild1.GetHash(), 0, 1, 11000LL);
+
+    // check() needs the parent's prevout in the chain
+    CCoinsView dummy;
+    CCoinsViewCache view(&dummy);
+    view.SetBestBlock(chainActive.Tip()->GetBlockHash());
+    view.ModifyCoins(txFunding.GetHash())->FromTx(txFunding, 0);
+
+    pool.addUnchecked(txParent.GetHash(), CTxMemPoolEntry(txParent, 1000, 0, 0.0, 1));
+    pool.check(&view);
+    pool.addUnchecked(txChild1.GetHash(), CTxMemPoolEntry(txChild1, 2000, 0, 0.0, 1));
+    pool.check(&view);
+    pool.addUnchecked(txChild2.GetHash(), CTxMemPoolEntry(txChild2, 3000, 0, 0.0, 1));
+    pool.check(&view);
+    pool.addUnchecked(txGrandChild.GetHash(), CTxMemPoolEntry(txGrandChild, 4000, 0, 0.0, 1));
+    pool.check(&view);
+    CheckPackage(pool, txParent, 4, 10000);
+    CheckPackage(pool, txChild1, 2, 6000);
+    CheckPackage(pool, txGrandChild, 1, 4000);
+
+    // Fee deltas count towards the packages of the ancestors
+    pool.PrioritiseTransaction(txGrandChild.GetHash(), txGrandChild.GetHash().ToString(), 0.0, 500);
+    CheckPackage(pool, txParent, 4, 10500);
+    CheckPackage(pool, txChild1, 2, 6500);
+    pool.check(&view);
+    pool.ClearPrioritisation(txGrandChild.GetHash());
+
+    // Removing a child takes its descendants out of the parent's package
+    pool.remove(txChild1, removed, true);
+    BOOST_CHECK_EQUAL(removed.size(), 2);
+    CheckPackage(pool, txParent, 2, 4000);
+    pool.check(&view);
+    removed.clear();
+
+    // The parent is mined, its outputs are in the chain now
+    pool.remove(txParent, removed, false);
+    BOOST_CHECK_EQUAL(pool.size(), 1);
+    CheckPackage(pool, txChild2, 1, 3000);
+    view.ModifyCoins(txParent.GetHash())->FromTx(txParent, 1);
+    pool.check(&view);
+
+    // A parent that comes back after its children (as in a reorg) picks them up
+    view.ModifyCoins(txParent.GetHash())->Clear();
+    pool.addUnchecked(txParent.GetHash(), CTxMemPoolEntry(txParent, 1000, 0, 0.0, 1));
+    CheckPackage(pool, txParent, 2, 4000);
+    BOOST_CHECK(pool.GetMemPoolChildren(pool.mapTx.find(txParent.GetHash())).size() == 1);
+    pool.check(&view);
+
+    pool.clear();
+    BOOST_CHECK_EQUAL(pool.size(), 0);
+    BOOST_CHECK_EQUAL(pool.DynamicMemoryUsage(), 0);
+    pool.check(&view);
+}
+
+BOOST_AUTO_TEST_CASE(MempoolSizeLimitTest)
+{
+    CTxMemPool pool(CFeeRate(1000));
+
+    CMutableTransaction txLow = MakeTx(uint256(1), 0, 1, 10000LL);
+    CMutableTransaction txMid = MakeTx(uint256(2), 0, 1, 10000LL);
+    CMutableTransaction txHigh = MakeTx(uint256(3), 0, 1, 10000LL);
+    pool.addUnchecked(txLow.GetHash(), CTxMemPoolEntry(txLow, 1000, 0, 0.0, 1));
+    pool.addUnchecked(txMid.GetHash(), CTxMemPoolEntry(txMid, 5000, 0, 0.0, 1));
+    pool.addUnchecked(txHigh.GetHash(), CTxMemPoolEntry(txHigh, 10000, 0, 0.0, 1));
+
+    // Highest fee rate first in mining order
+    BOOST_CHECK(pool.mapTx.get<3>().begin()->GetTx().GetHash() == txHigh.GetHash());
+
+    // A high fee child makes the low fee parent worth more than the middle transaction
+    CMutableTransaction txChild = MakeTx(txLow.GetHash(), 0, 1, 9000LL);
+    pool.addUnchecked(txChild.GetHash(), CTxMemPoolEntry(txChild, 20000, 0, 0.0, 1));
+
+    BOOST_CHECK(pool.GetMinFee(1).GetFeePerK() == 0);
+    pool.TrimToSize(pool.DynamicMemoryUsage() - 1);
+    BOOST_CHECK_EQUAL(pool.size(), 3);
+    BOOST_CHECK(!pool.exists(txMid.GetHash()));
+    BOOST_CHECK(pool.exists(txLow.GetHash()));
+    BOOST_CHECK(pool.exists(txChild.GetHash()));
+
+    // Evicting raised the minimum fee above the fee rate of what was evicted
+    CFeeRate evicted(5000, ::GetSerializeSize(txMid, SER_NETWORK, PROTOCOL_VERSION));
+    BOOST_CHECK(pool.GetMinFee(1) > evicted);
+
+    // Trimming to nothing leaves an empty pool
+    pool.TrimToSize(0);
+    BOOST_CHECK_EQUAL(pool.size(), 0);
+}
+
+BOOST_AUTO_TEST_CASE(MempoolExpireTest)
+{
+    CTxMemPool pool(CFeeRate(0));
+
+    CMutableTransaction txOld = MakeTx(uint256(1), 0, 1, 10000LL);
+    CMutableTransaction txOldChild = MakeTx(txOld.GetHash(), 0, 1, 9000LL);
+    CMutableTransaction txNew = MakeTx(uint256(2), 0, 1, 10000LL);
+    pool.addUnchecked(txOld.GetHash(), CTxMemPoolEntry(txOld, 1000, 100, 0.0, 1));
+    pool.addUnchecked(txOldChild.GetHash(), CTxMemPoolEntry(txOldChild, 1000, 300, 0.0, 1));
+    pool.addUnchecked(txNew.GetHash(), CTxMemPoolEntry(txNew, 1000, 300, 0.0, 1));
+
+    // Expiring a transaction takes its descendants with it
+    BOOST_CHECK_EQUAL(pool.Expire(200), 2);
+    BOOST_CHECK_EQUAL(pool.size(), 1);
+    BOOST_CHECK(pool.exists(txNew.GetHash()));
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -9,6 +9,7 @@
 #include "netbase.h"
 
 #include <boost/algorithm/string.hpp>
+#include <boost/bind.hpp>
 #include <boost/test/unit_test.hpp>
 
 using namespace std;
@@ -172,4 +173,56 @@ BOOST_AUTO_TEST_CASE(rpc_boostasiotocnetaddr)
     BOOST_CHECK_EQUAL(BoostAsioToCNetAddr(boost::asio::ip::address::from_string("::ffff:127.0.0.1")).ToString(), "127.0.0.1");
 }
 
+static void AppendChunk(std::string* pstr, const std::string& strChunk)
+{
+    BOOST_CHECK(!strChunk.empty());
+    *pstr += strChunk;
+}
+
+BOOST_AUTO_TEST_CASE(rpc_json_stream_writer)
+{
+    Value value;
+    BOOST_CHECK(read_string(std::string("{\"a\":[1,\"x\\\"y\",{},[]],\"b\":{\"c\":null,\"d\":true},\"e\":1.5}"), value));
+
+    // Small chunks: everything goes through the sink
+    std::string strOut;
+    CJSONStreamWriter writer(boost::bind(&AppendChunk, &strOut, _1), 4);
+    writer.WriteValue(value);
+    writer.Flush();
+    BOOST_CHECK(writer.Flushed());
+    BOOST_CHECK(writer.GetBuffer().empty());
+    BOOST_CHECK_EQUAL(strOut, write_string(value, false));
+
+    // Big chunks: nothing reaches the sink
+    std::string strUnused;
+    CJSONStreamWriter writer2(boost::bind(&AppendChunk, &strUnused, _1), 1024);
+    writer2.BeginObject();
+    writer2.WritePair("a", value.get_obj()[0].value_);
+    writer2.WriteKey("b");
+    writer2.BeginArray();
+    writer2.WriteValue(1);
+    writer2.WriteValue(2);
+    writer2.EndArray();
+    writer2.EndObject();
+    BOOST_CHECK(!writer2.Flushed());
+    BOOST_CHECK(strUnused.empty());
+    BOOST_CHECK_EQUAL(writer2.GetBuffer(), "{\"a\":[1,\"x\\\"y\",{},[]],\"b\":[1,2]}");
+}
+
+BOOST_AUTO_TEST_CASE(rpc_read_chunked_message)
+{
+    std::stringstream ss;
+    ss << "Transfer-Encoding: chunked\r\n\r\n" << HTTPChunk("{\"result\":") << HTTPChunk("[1,2]}") << HTTPChunk("");
+    std::map<std::string, std::string> mapHeaders;
+    std::string strMessage;
+    BOOST_CHECK_EQUAL(ReadHTTPMessage(ss, mapHeaders, strMessage, 1, 1024), HTTP_OK);
+    BOOST_CHECK_EQUAL(strMessage, "{\"result\":[1,2]}");
+
+    // Over the size limit
+    ss.clear();
+    ss.str("");
+    ss << "Transfer-Encoding: chunked\r\n\r\n" << HTTPChunk(std::string(600, 'x')) << HTTPChunk(std::string(600, 'x')) << HTTPChunk("");
+    BOOST_CHECK_EQUAL(ReadHTTPMessage(ss, mapHeaders, strMessage, 1, 1024), HTTP_INTERNAL_SERVER_ERROR);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -45,6 +45,27 @@ BOOST_AUTO_TEST_CASE(varints)
     }
 }
 
+BOOST_AUTO_TEST_CASE(bigendian)
+{
+    CDataStream ss(SER_DISK, 0);
+    unsigned int n = 0x01020304;
+    ss << BIGENDIAN(n);
+    BOOST_CHECK(ss.str() == std::string("\x01\x02\x03\x04", 4));
+    BOOST_CHECK_EQUAL(::GetSerializeSize(BIGENDIAN(n), 0, 0), 4U);
+
+    // Serialized values sort like the numbers
+    std::string strLast;
+    for (int i = 0; i < 100000000; i += 9973) {
+        CDataStream ssValue(SER_DISK, 0);
+        ssValue << BIGENDIAN(i);
+        BOOST_CHECK(strLast < ssValue.str());
+        strLast = ssValue.str();
+        int j = -1;
+        ssValue >> BIGENDIAN(j);
+        BOOST_CHECK_EQUAL(i, j);
+    }
+}
+
 BOOST_AUTO_TEST_CASE(compactsize)
 {
     CDataStream ss(SER_DISK, 0);
@@ -4,6 +4,12 @@
 
 #include "wallet.h"
 
+#include "clientversion.h"
+#include "main.h"
+#include "random.h"
+#include "txmempool.h"
+#include "walletdb.h"
+
 #include <set>
 #include <stdint.h>
 #include <utility>
@@ -305,4 +311,356 @@ BOOST_AUTO_TEST_CASE(coin_selection_tests)
     empty_wallet();
 }
 
+// a denominated amount, also without the denominations of init.cpp
+static const CAmount DS_DENOM = COIN + 1000;
+
+static CMutableTransaction make_denominated_tx(const COutPoint& prevout, const CScript& scriptPubKey)
+{
+    static int nextLockTime = 0;
+    CMutableTransaction tx;
+    tx.nLockTime = nextLockTime++;        // so all transactions get different hashes
+    tx.vin.push_back(CTxIn(prevout));
+    tx.vout.push_back(CTxOut(DS_DENOM, scriptPubKey));
+    tx.vout.push_back(CTxOut(DS_DENOM, scriptPubKey));
+    return tx;
+}
+
+// adds DS_DENOM to the denominations for one test case, the next ones get them back unchanged
+struct DarksendDenominationsSetup {
+    std::vector<int64_t> vSavedDenominations;
+    DarksendDenominationsSetup() : vSavedDenominations(darkSendDenominations)
+    {
+        darkSendDenominations.push_back(DS_DENOM);
+    }
+    ~DarksendDenominationsSetup()
+    {
+        darkSendDenominations = vSavedDenominations;
+    }
+};
+
+static void open_keyed_wallet(CWallet& testwallet, CScript& scriptPubKey)
+{
+    bool fFirstRun;
+    testwallet.LoadWallet(fFirstRun);
+    CKey key;
+    key.MakeNewKey(true);
+    BOOST_CHECK(testwallet.AddKeyPubKey(key, key.GetPubKey()));
+    scriptPubKey = GetScriptForDestination(key.GetPubKey().GetID());
+}
+
+static int real_rounds(const CWallet& dswallet, const CTransaction& tx)
+{
+    LOCK(dswallet.cs_wallet);
+    return dswallet.GetRealInputDarksendRounds(CTxIn(tx.GetHash(), 0), 0);
+}
+
+BOOST_FIXTURE_TEST_CASE(darksend_rounds_chain, DarksendDenominationsSetup)
+{
+    CWallet dswallet("wallet_dsrounds_chain.dat");
+    CScript scriptPubKey;
+    open_keyed_wallet(dswallet, scriptPubKey);
+
+    // A comes from outside the wallet, B spends A and C spends B
+    CMutableTransaction txA = make_denominated_tx(COutPoint(GetRandHash(), 0), scriptPubKey);
+    CMutableTransaction txB = make_denominated_tx(COutPoint(txA.GetHash(), 0), scriptPubKey);
+    CMutableTransaction txC = make_denominated_tx(COutPoint(txB.GetHash(), 0), scriptPubKey);
+    BOOST_CHECK(dswallet.AddToWallet(CWalletTx(&dswallet, txA)));
+    BOOST_CHECK(dswallet.AddToWallet(CWalletTx(&dswallet, txB)));
+    BOOST_CHECK(dswallet.AddToWallet(CWalletTx(&dswallet, txC)));
+    BOOST_CHECK_EQUAL(real_rounds(dswallet, txA), 0);
+    BOOST_CHECK_EQUAL(real_rounds(dswallet, txB), 1);
+    BOOST_CHECK_EQUAL(real_rounds(dswallet, txC), 2);
+
+    // the values come from the cache once known
+    dswallet.LoadDarksendRounds(COutPoint(txB.GetHash(), 0), 7);
+    dswallet.LoadDarksendRounds(COutPoint(txC.GetHash(), 0), 9);
+    BOOST_CHECK_EQUAL(real_rounds(dswallet, txB), 7);
+    BOOST_CHECK_EQUAL(real_rounds(dswallet, txC), 9);
+
+    // B2 double spends A, B loses and its rounds and those of C are recomputed
+    CMutableTransaction txB2 = make_denominated_tx(COutPoint(txA.GetHash(), 0), scriptPubKey);
+    dswallet.SyncTransaction(txB2, NULL);
+    BOOST_CHECK_EQUAL(real_rounds(dswallet, txB2), 1);
+    BOOST_CHECK_EQUAL(real_rounds(dswallet, txB), 1);
+    BOOST_CHECK_EQUAL(real_rounds(dswallet, txC), 2);
+
+    // erasing B drops C's entry too, C starts a chain of its own then
+    dswallet.EraseFromWallet(txB.GetHash());
+    BOOST_CHECK_EQUAL(real_rounds(dswallet, txB), -1);
+    BOOST_CHECK_EQUAL(real_rounds(dswallet, txC), 0);
+    BOOST_CHECK_EQUAL(real_rounds(dswallet, txA), 0);
+}
+
+BOOST_FIXTURE_TEST_CASE(darksend_rounds_late_parent, DarksendDenominationsSetup)
+{
+    CWallet dswallet("wallet_dsrounds_late.dat");
+    CScript scriptPubKey;
+    open_keyed_wallet(dswallet, scriptPubKey);
+
+    CMutableTransaction txA = make_denominated_tx(COutPoint(GetRandHash(), 0), scriptPubKey);
+    CMutableTransaction txB = make_denominated_tx(COutPoint(txA.GetHash(), 0), scriptPubKey);
+    CMutableTransaction txC = make_denominated_tx(COutPoint(txB.GetHash(), 0), scriptPubKey);
+
+    // without A, B looks like the start of the chain
+    BOOST_CHECK(dswallet.AddToWallet(CWalletTx(&dswallet, txB)));
+    BOOST_CHECK(dswallet.AddToWallet(CWalletTx(&dswallet, txC)));
+    BOOST_CHECK_EQUAL(real_rounds(dswallet, txB), 0);
+    BOOST_CHECK_EQUAL(real_rounds(dswallet, txC), 1);
+
+    // adding A drops what was derived without it
+    BOOST_CHECK(dswallet.AddToWallet(CWalletTx(&dswallet, txA)));
+    BOOST_CHECK_EQUAL(real_rounds(dswallet, txA), 0);
+    BOOST_CHECK_EQUAL(real_rounds(dswallet, txB), 1);
+    BOOST_CHECK_EQUAL(real_rounds(dswallet, txC), 2);
+}
+
+BOOST_FIXTURE_TEST_CASE(darksend_rounds_load, DarksendDenominationsSetup)
+{
+    CWallet dswallet("wallet_dsrounds_load.dat");
+    CScript scriptPubKey;
+    open_keyed_wallet(dswallet, scriptPubKey);
+
+    CMutableTransaction txA = make_denominated_tx(COutPoint(GetRandHash(), 0), scriptPubKey);
+    CMutableTransaction txB = make_denominated_tx(COutPoint(txA.GetHash(), 0), scriptPubKey);
+    BOOST_CHECK(dswallet.AddToWallet(CWalletTx(&dswallet, txA)));
+    BOOST_CHECK(dswallet.AddToWallet(CWalletTx(&dswallet, txB)));
+    BOOST_CHECK(CWalletDB(dswallet.strWalletFile).WriteDarksendRounds(COutPoint(txB.GetHash(), 0), 5));
+
+    // the "dsrounds" records come back through LoadDarksendRounds
+    CWallet dswalletLoaded(dswallet.strWalletFile);
+    bool fFirstRun;
+    BOOST_CHECK_EQUAL(dswalletLoaded.LoadWallet(fFirstRun), DB_LOAD_OK);
+    BOOST_CHECK_EQUAL(real_rounds(dswalletLoaded, txA), 0);
+    BOOST_CHECK_EQUAL(real_rounds(dswalletLoaded, txB), 5);
+}
+
+// a block file of its own, next to the blk00000.dat of the test chain
+static const int RESCAN_BLOCK_FILE = 9001;
+
+BOOST_AUTO_TEST_CASE(rescan_batches)
+{
+    CWallet rescanwallet("wallet_rescan.dat");
+    bool fFirstRun;
+    rescanwallet.LoadWallet(fFirstRun);
+    CKey key;
+    key.MakeNewKey(true);
+    BOOST_CHECK(rescanwallet.AddKeyPubKey(key, key.GetPubKey()));
+    CScript scriptPubKey = GetScriptForDestination(key.GetPubKey().GetID());
+
+    // a few batches and then some on top of the tip, each block paying to the wallet once
+    const unsigned int nBlocks = 2 * RESCAN_BATCH_BLOCKS + 10;
+    vector<uint256> vHashes(nBlocks);
+    vector<CBlockIndex> vIndex(nBlocks);
+    vector<uint256> vTxHashes;
+
+    CBlockIndex* pindexOldTip;
+    {
+        LOCK(cs_main);
+        pindexOldTip = chainActive.Tip();
+        CBlockIndex* pindexPrev = pindexOldTip;
+        unsigned int nNextPos = 0;
+        for (unsigned int i = 0; i < nBlocks; i++)
+        {
+            CMutableTransaction tx;
+            tx.vin.push_back(CTxIn(COutPoint(GetRandHash(), 0)));
+            tx.vout.push_back(CTxOut(COIN, scriptPubKey));
+
+            CBlock block;
+            block.nVersion = 1;
+            block.hashPrevBlock = pindexPrev->GetBlockHash();
+            block.nTime = GetTime();
+            block.vtx.push_back(tx);
+            block.hashMerkleRoot = block.BuildMerkleTree();
+            CDiskBlockPos pos(RESCAN_BLOCK_FILE, nNextPos);
+            BOOST_REQUIRE(WriteBlockToDisk(block, pos));
+            nNextPos = pos.nPos + ::GetSerializeSize(block, SER_DISK, CLIENT_VERSION);
+
+            vHashes[i] = block.GetHash();
+            vIndex[i] = CBlockIndex(block);
+            vIndex[i].phashBlock = &vHashes[i];
+            vIndex[i].pprev = pindexPrev;
+            vIndex[i].nHeight = pindexPrev->nHeight + 1;
+            vIndex[i].nFile = pos.nFile;
+            vIndex[i].nDataPos = pos.nPos;
+            vIndex[i].nStatus = BLOCK_HAVE_DATA;
+            vIndex[i].BuildSkip();
+            pindexPrev = &vIndex[i];
+            vTxHashes.push_back(tx.GetHash());
+        }
+        chainActive.SetTip(pindexPrev);
+    }
+
+    // every block is scanned once, in its own batch or the next one, and the scan comes back
+    CBlockIndex* pindexAborted = pindexOldTip;
+    BOOST_CHECK_EQUAL(rescanwallet.ScanForWalletTransactions(&vIndex[0], true, &pindexAborted), (int)nBlocks);
+    BOOST_CHECK(pindexAborted == NULL);
+    {
+        LOCK(rescanwallet.cs_wallet);
+        BOOST_CHECK_EQUAL(rescanwallet.mapWallet.size(), nBlocks);
+        for (unsigned int i = 0; i < nBlocks; i++)
+        {
+            map<uint256, CWalletTx>::const_iterator it = rescanwallet.mapWallet.find(vTxHashes[i]);
+            BOOST_REQUIRE(it != rescanwallet.mapWallet.end());
+            BOOST_CHECK(it->second.hashBlock == vHashes[i]);
+        }
+    }
+
+    LOCK(cs_main);
+    chainActive.SetTip(pindexOldTip);
+}
+
+// a block with one transaction on top of pindexPrev, known to mapBlockIndex but not made the tip
+struct TestBlock
+{
+    CBlock block;
+    uint256 hash;
+    CBlockIndex index;
+
+    TestBlock(CBlockIndex* pindexPrev, const CTransaction& tx)
+    {
+        block.nVersion = 1;
+        block.hashPrevBlock = pindexPrev->GetBlockHash();
+        block.nTime = pindexPrev->nTime + 1;
+        block.vtx.push_back(tx);
+        block.hashMerkleRoot = block.BuildMerkleTree();
+        hash = block.GetHash();
+        index = CBlockIndex(block);
+        index.phashBlock = &hash;
+        index.pprev = pindexPrev;
+        index.nHeight = pindexPrev->nHeight + 1;
+        index.BuildSkip();
+        LOCK(cs_main);
+        mapBlockIndex[hash] = &index;
+    }
+    ~TestBlock()
+    {
+        LOCK(cs_main);
+        mapBlockIndex.erase(hash);
+    }
+};
+
+static CMutableTransaction make_spend(const CTransaction& txFrom)
+{
+    CMutableTransaction tx;
+    tx.vin.push_back(CTxIn(COutPoint(txFrom.GetHash(), 0)));
+    tx.vout.push_back(CTxOut(txFrom.vout[0].nValue, CScript() << OP_TRUE));
+    return tx;
+}
+
+static bool is_available(const CWallet& testwallet, const CTransaction& tx)
+{
+    vector<COutput> vAvailable;
+    testwallet.AvailableCoins(vAvailable, false, NULL, ALL_COINS, false);
+    BOOST_FOREACH(const COutput& out, vAvailable)
+        if (out.tx->GetHash() == tx.GetHash())
+            return true;
+    return false;
+}
+
+BOOST_AUTO_TEST_CASE(unspent_candidates_mempool_spend)
+{
+    CWallet testwallet("wallet_candidates_mempool.dat");
+    CScript scriptPubKey;
+    open_keyed_wallet(testwallet, scriptPubKey);
+
+    CMutableTransaction txParent;
+    txParent.vin.push_back(CTxIn(COutPoint(GetRandHash(), 0)));
+    txParent.vout.push_back(CTxOut(COIN, scriptPubKey));
+    CMutableTransaction txSpend = make_spend(txParent);
+
+    CBlockIndex* pindexOldTip = chainActive.Tip();
+    TestBlock block(pindexOldTip, txParent);
+    {
+        LOCK(cs_main);
+        chainActive.SetTip(&block.index);
+    }
+    testwallet.SyncTransaction(txParent, &block.block);
+    BOOST_CHECK(is_available(testwallet, txParent));
+    BOOST_CHECK_EQUAL(testwallet.GetBalance(), COIN);
+
+    // spent in the mempool
+    {
+        LOCK(cs_main);
+        mempool.addUnchecked(txSpend.GetHash(), CTxMemPoolEntry(txSpend, 0, GetTime(), 0.0, 1));
+    }
+    testwallet.SyncTransaction(txSpend, NULL);
+    BOOST_CHECK(!is_available(testwallet, txParent));
+    BOOST_CHECK_EQUAL(testwallet.GetBalance(), 0);
+
+    // the spend leaves the mempool without the wallet hearing about it, the parent is still there to use
+    {
+        LOCK(cs_main);
+        list<CTransaction> removed;
+        mempool.remove(txSpend, removed, false);
+    }
+    BOOST_CHECK(is_available(testwallet, txParent));
+
+    LOCK(cs_main);
+    chainActive.SetTip(pindexOldTip);
+}
+
+BOOST_AUTO_TEST_CASE(unspent_candidates_disconnected_spend)
+{
+    CWallet testwallet("wallet_candidates_disconnect.dat");
+    CScript scriptPubKey;
+    open_keyed_wallet(testwallet, scriptPubKey);
+
+    CMutableTransaction txParent;
+    txParent.vin.push_back(CTxIn(COutPoint(GetRandHash(), 0)));
+    txParent.vout.push_back(CTxOut(COIN, scriptPubKey));
+    CMutableTransaction txSpend = make_spend(txParent);
+
+    CBlockIndex* pindexOldTip = chainActive.Tip();
+    TestBlock blockParent(pindexOldTip, txParent);
+    TestBlock blockSpend(&blockParent.index, txSpend);
+    {
+        LOCK(cs_main);
+        chainActive.SetTip(&blockSpend.index);
+    }
+    testwallet.SyncTransaction(txParent, &blockParent.block);
+    testwallet.SyncTransaction(txSpend, &blockSpend.block);
+    BOOST_CHECK(!is_available(testwallet, txParent));
+    BOOST_CHECK_EQUAL(testwallet.GetBalance(), 0);
+
+    // the block with the spend is disconnected, the parent is unspent again
+    {
+        LOCK(cs_main);
+        chainActive.SetTip(&blockParent.index);
+    }
+    testwallet.SyncTransaction(txSpend, NULL);
+    BOOST_CHECK(is_available(testwallet, txParent));
+    BOOST_CHECK_EQUAL(testwallet.GetBalance(), COIN);
+
+    LOCK(cs_main);
+    chainActive.SetTip(pindexOldTip);
+}
+
+BOOST_AUTO_TEST_CASE(cached_balances_tip_change)
+{
+    CWallet testwallet("wallet_balances_tip.dat");
+    CScript scriptPubKey;
+    open_keyed_wallet(testwallet, scriptPubKey);
+
+    CMutableTransaction txParent;
+    txParent.vin.push_back(CTxIn(COutPoint(GetRandHash(), 0)));
+    txParent.vout.push_back(CTxOut(COIN, scriptPubKey));
+
+    // the wallet learns about a block that isn't in the active chain yet
+    CBlockIndex* pindexOldTip = chainActive.Tip();
+    TestBlock block(pindexOldTip, txParent);
+    testwallet.SyncTransaction(txParent, &block.block);
+    BOOST_CHECK_EQUAL(testwallet.GetBalance(), 0);
+
+    // it becomes the tip without the wallet being told, the cached balances are not used
+    {
+        LOCK(cs_main);
+        chainActive.SetTip(&block.index);
+    }
+    BOOST_CHECK_EQUAL(testwallet.GetBalance(), COIN);
+
+    LOCK(cs_main);
+    chainActive.SetTip(pindexOldTip);
+    BOOST_CHECK_EQUAL(testwallet.GetBalance(), 0);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,112 @@
+// Copyright (c) 2014-2015 The Ic developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "chainparams.h"
+#include "crypto/x11.h"
+#include "hash.h"
+#include "primitives/block.h"
+#include "random.h"
+#include "streams.h"
+#include "utilstrencodings.h"
+#include "version.h"
+
+#include <string.h>
+#include <string>
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+
+using namespace std;
+
+BOOST_AUTO_TEST_SUITE(x11_tests)
+
+static string X11Hex(const vector<unsigned char>& in)
+{
+    unsigned char hash[X11_OUTPUT_SIZE];
+    X11(in.empty() ? NULL : &in[0], in.size(), hash);
+    return HexStr(hash, hash + X11_OUTPUT_SIZE);
+}
+
+static string X11ReferenceHex(const vector<unsigned char>& in)
+{
+    unsigned char hash[X11_OUTPUT_SIZE];
+    X11Reference(in.empty() ? NULL : &in[0], in.size(), hash);
+    return HexStr(hash, hash + X11_OUTPUT_SIZE);
+}
+
+BOOST_AUTO_TEST_CASE(x11_known_answers)
+{
+    // Digests produced by the original sphlib chain.
+    const string quickfox = "The quick brown fox jumps over the lazy dog";
+    vector<unsigned char> counting;
+    for (int i = 0; i < 200; i++)
+        counting.push_back(i);
+
+    BOOST_CHECK_EQUAL(X11Hex(vector<unsigned char>()), "51b572209083576ea221c27e62b4e22063257571ccb6cc3dc3cd17eb67584eba");
+    BOOST_CHECK_EQUAL(X11Hex(vector<unsigned char>(quickfox.begin(), quickfox.end())), "534536a4e4f16b32447f02f77200449dc2f23b532e3d9878fe111c9de666bc5c");
+    BOOST_CHECK_EQUAL(X11Hex(counting), "5d8b97991e082d3d57f701fa9b962485f3e57686a61b71dfe442d4b14a64708f");
+
+    BOOST_CHECK_EQUAL(X11ReferenceHex(vector<unsigned char>()), "51b572209083576ea221c27e62b4e22063257571ccb6cc3dc3cd17eb67584eba");
+    BOOST_CHECK_EQUAL(X11ReferenceHex(counting), "5d8b97991e082d3d57f701fa9b962485f3e57686a61b71dfe442d4b14a64708f");
+
+    // The main network genesis header.
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << Params(CBaseChainParams::MAIN).GenesisBlock().GetBlockHeader();
+    BOOST_CHECK_EQUAL(HashX11(ss.begin(), ss.end()).GetHex(), "00000b5425f8f17435355326cc48edb3bbfbf481b7cd7e80dbc804dde8fca1e7");
+}
+
+BOOST_AUTO_TEST_CASE(x11_matches_reference)
+{
+    for (int len = 0; len < 300; len += 7) {
+        vector<unsigned char> in(len);
+        for (int i = 0; i < len; i++)
+            in[i] = insecure_rand();
+        BOOST_CHECK_EQUAL(X11Hex(in), X11ReferenceHex(in));
+    }
+}
+
+BOOST_AUTO_TEST_CASE(x11_batch)
+{
+    // Odd counts exercise partially filled lanes; a stride larger than the
+    // message length exercises non-contiguous inputs.
+    const size_t nLen = 80, nStride = 96;
+    for (size_t nCount = 0; nCount <= 3 * X11_LANES + 1; nCount++) {
+        vector<unsigned char> data(nCount * nStride + 1);
+        for (size_t i = 0; i < data.size(); i++)
+            data[i] = insecure_rand();
+        vector<unsigned char> out(nCount * X11_OUTPUT_SIZE + 1, 0xa5);
+        X11Batch(&data[0], nLen, nStride, nCount, &out[0]);
+        for (size_t i = 0; i < nCount; i++) {
+            unsigned char hash[X11_OUTPUT_SIZE];
+            X11Reference(&data[i * nStride], nLen, hash);
+            BOOST_CHECK(memcmp(hash, &out[i * X11_OUTPUT_SIZE], X11_OUTPUT_SIZE) == 0);
+        }
+        BOOST_CHECK_EQUAL(out[nCount * X11_OUTPUT_SIZE], 0xa5);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(blockheader_hashes)
+{
+    CBlockHeader header = Params(CBaseChainParams::MAIN).GenesisBlock().GetBlockHeader();
+    BOOST_CHECK_EQUAL(header.GetHash().GetHex(), "00000b5425f8f17435355326cc48edb3bbfbf481b7cd7e80dbc804dde8fca1e7");
+
+    // Batched hashing gives the same hashes as one header at a time.
+    vector<CBlockHeader> vHeaders(2 * X11_LANES + 1, header);
+    for (size_t i = 0; i < vHeaders.size(); i++)
+        vHeaders[i].nNonce = i;
+    vector<uint256> vHashes;
+    CBlockHeader::GetHashes(vHeaders, vHashes);
+    BOOST_REQUIRE_EQUAL(vHashes.size(), vHeaders.size());
+    for (size_t i = 0; i < vHeaders.size(); i++) {
+        CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+        ss << vHeaders[i];
+        BOOST_CHECK(vHashes[i] == HashX11(ss.begin(), ss.end()));
+        BOOST_CHECK(vHashes[i] == vHeaders[i].GetHash());
+    }
+
+    CBlockHeader::GetHashes(vector<CBlockHeader>(), vHashes);
+    BOOST_CHECK(vHashes.empty());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
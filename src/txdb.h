@@ -14,7 +14,15 @@
 #include <utility>
 #include <vector>
 
+struct CAddressIndexKey;
+struct CAddressUnspentKey;
+struct CAddressUnspentValue;
+class CBlockFilter;
 class CCoins;
+struct CIndexAddress;
+struct CSpentIndexKey;
+struct CSpentIndexValue;
+struct CTimestampIndexKey;
 class uint256;
 
 //! -dbcache default (MiB)
@@ -57,9 +65,40 @@ public:
     bool ReadReindexing(bool &fReindex);
     bool ReadTxIndex(const uint256 &txid, CDiskTxPos &pos);
     bool WriteTxIndex(const std::vector<std::pair<uint256, CDiskTxPos> > &list);
+    bool WriteAddressIndex(const std::vector<std::pair<CAddressIndexKey, CAmount> > &vect);
+    bool EraseAddressIndex(const std::vector<std::pair<CAddressIndexKey, CAmount> > &vect);
+    /** Entries of address, in chain order, from height nStart up to nEnd if they're not 0 */
+    bool ReadAddressIndex(const CIndexAddress &address, std::vector<std::pair<CAddressIndexKey, CAmount> > &vect, int nStart = 0, int nEnd = 0);
+    /** Add unspent outputs, or remove them where the value is null, in the order given */
+    bool UpdateAddressUnspentIndex(const std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > &vect);
+    bool ReadAddressUnspentIndex(const CIndexAddress &address, std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > &vect);
+    /** Add spent outputs, or remove them where the value is null */
+    bool UpdateSpentIndex(const std::vector<std::pair<CSpentIndexKey, CSpentIndexValue> > &vect);
+    bool ReadSpentIndex(const CSpentIndexKey &key, CSpentIndexValue &value);
+    bool WriteTimestampIndex(const CTimestampIndexKey &key);
+    bool EraseTimestampIndex(const CTimestampIndexKey &key);
+    /** Blocks with a time from nLow up to but not including nHigh, in time order */
+    bool ReadTimestampIndex(unsigned int nHigh, unsigned int nLow, std::vector<uint256> &vHashes);
     bool WriteFlag(const std::string &name, bool fValue);
     bool ReadFlag(const std::string &name, bool &fValue);
     bool LoadBlockIndexGuts();
 };
 
+/** Access to the compact block filter index (blocks/filter/) */
+class CBlockFilterDB : public CLevelDBWrapper
+{
+public:
+    CBlockFilterDB(size_t nCacheSize, bool fMemory = false, bool fWipe = false);
+private:
+    CBlockFilterDB(const CBlockFilterDB&);
+    void operator=(const CBlockFilterDB&);
+public:
+    bool ReadFilter(const uint256 &hash, CBlockFilter &filter);
+    bool ReadFilterHeader(const uint256 &hash, uint256 &header);
+    /** Store the filter and header of a block and make it the last block indexed */
+    bool WriteFilter(const CBlockFilter &filter, const uint256 &header);
+    bool ReadBestBlock(uint256 &hash);
+    bool WriteBestBlock(const uint256 &hash);
+};
+
 #endif // BITCOIN_TXDB_H
@@ -9,20 +9,24 @@
 #include "base58.h"
 #include "checkpoints.h"
 #include "coincontrol.h"
+#include "init.h"
 #include "net.h"
 #include "masternode-budget.h"
 #include "keepass.h"
 #include "instantx.h"
 #include "script/script.h"
 #include "script/sign.h"
+#include "script/standard.h"
 #include "spork.h"
 #include "timedata.h"
+#include "txdb.h"
 #include "util.h"
 #include "utilmoneystr.h"
 
 #include <assert.h>
 
 #include <boost/algorithm/string/replace.hpp>
+#include <boost/bind.hpp>
 #include <boost/thread.hpp>
 
 
@@ -455,6 +459,22 @@ bool CWallet::IsSpent(const uint256& hash, unsigned int n) const
     return false;
 }
 
+/** Like IsSpent, but only counts spends that are in a block */
+bool CWallet::IsSpentInChain(const uint256& hash, unsigned int n) const
+{
+    const COutPoint outpoint(hash, n);
+    pair<TxSpends::const_iterator, TxSpends::const_iterator> range;
+    range = mapTxSpends.equal_range(outpoint);
+
+    for (TxSpends::const_iterator it = range.first; it != range.second; ++it)
+    {
+        std::map<uint256, CWalletTx>::const_iterator mit = mapWallet.find(it->second);
+        if (mit != mapWallet.end() && mit->second.GetDepthInMainChain() > 0)
+            return true;
+    }
+    return false;
+}
+
 void CWallet::AddToSpends(const COutPoint& outpoint, const uint256& wtxid)
 {
     mapTxSpends.insert(make_pair(outpoint, wtxid));
@@ -621,7 +641,48 @@ void CWallet::MarkDirty()
     {
         LOCK(cs_wallet);
         BOOST_FOREACH(PAIRTYPE(const uint256, CWalletTx)& item, mapWallet)
+        {
             item.second.MarkDirty();
+            setUnspentCandidates.insert(item.first);
+        }
+        fBalancesCached = false;
+    }
+}
+
+void CWallet::AddUnspentCandidates(const CWalletTx& wtx)
+{
+    AssertLockHeld(cs_wallet); // setUnspentCandidates
+    setUnspentCandidates.insert(wtx.GetHash());
+    // What it spends may have become unspent again
+    BOOST_FOREACH(const CTxIn& txin, wtx.vin)
+        if (mapWallet.count(txin.prevout.hash))
+            setUnspentCandidates.insert(txin.prevout.hash);
+    fBalancesCached = false;
+}
+
+void CWallet::GetUnspentCandidates(std::vector<const CWalletTx*>& vCoins) const
+{
+    AssertLockHeld(cs_wallet); // setUnspentCandidates
+    vCoins.clear();
+    vCoins.reserve(setUnspentCandidates.size());
+    std::set<uint256>::iterator it = setUnspentCandidates.begin();
+    while (it != setUnspentCandidates.end())
+    {
+        map<uint256, CWalletTx>::const_iterator mi = mapWallet.find(*it);
+        if (mi == mapWallet.end()) {
+            setUnspentCandidates.erase(it++);
+            continue;
+        }
+        const CWalletTx& wtx = mi->second;
+        bool fUnspent = false;
+        for (unsigned int i = 0; i < wtx.vout.size() && !fUnspent; i++)
+            fUnspent = IsMine(wtx.vout[i]) != ISMINE_NO && !IsSpentInChain(*it, i);
+        if (!fUnspent) {
+            setUnspentCandidates.erase(it++);
+            continue;
+        }
+        vCoins.push_back(&wtx);
+        ++it;
     }
 }
 
@@ -634,6 +695,7 @@ bool CWallet::AddToWallet(const CWalletTx& wtxIn, bool fFromLoadWallet)
         mapWallet[hash] = wtxIn;
         mapWallet[hash].BindWallet(this);
         AddToSpends(hash);
+        AddUnspentCandidates(mapWallet[hash]);
     }
     else
     {
@@ -728,6 +790,16 @@ bool CWallet::AddToWallet(const CWalletTx& wtxIn, bool fFromLoadWallet)
 
         // Break debit/credit balance caches:
         wtx.MarkDirty();
+        AddUnspentCandidates(wtx);
+
+        if (fInsertedNew && !fLiteMode)
+        {
+            // Spends of it seen before it may have been given too few rounds
+            InvalidateDarksendRounds(hash);
+            for (unsigned int i = 0; i < wtx.vout.size(); i++)
+                if (IsMine(wtx.vout[i]) == ISMINE_SPENDABLE && IsDenominatedAmount(wtx.vout[i].nValue))
+                    GetInputDarksendRounds(CTxIn(hash, i));
+        }
 
         // Notify UI of new or updated transaction
         NotifyTransactionChanged(this, hash, fInsertedNew ? CT_NEW : CT_UPDATED);
@@ -782,6 +854,12 @@ void CWallet::SyncTransaction(const CTransaction& tx, const CBlock* pblock)
         if (mapWallet.count(txin.prevout.hash))
             mapWallet[txin.prevout.hash].MarkDirty();
     }
+    AddUnspentCandidates(mapWallet[tx.GetHash()]);
+
+    // Outputs of double-spent transactions will never be mixed, forget their rounds
+    BOOST_FOREACH(const uint256& txid, GetConflicts(tx.GetHash()))
+        if (mapWallet[txid].GetDepthInMainChain() < 0)
+            InvalidateDarksendRounds(txid);
 }
 
 void CWallet::EraseFromWallet(const uint256 &hash)
@@ -790,8 +868,11 @@ void CWallet::EraseFromWallet(const uint256 &hash)
         return;
     {
         LOCK(cs_wallet);
+        InvalidateDarksendRounds(hash);
         if (mapWallet.erase(hash))
             CWalletDB(strWalletFile).EraseTx(hash);
+        setUnspentCandidates.erase(hash);
+        fBalancesCached = false;
     }
     return;
 }
@@ -831,7 +912,7 @@ CAmount CWallet::GetDebit(const CTxIn &txin, const isminefilter& filter) const
 // Recursively determine the rounds of a given input (How deep is the Darksend chain for a given input)
 int CWallet::GetRealInputDarksendRounds(CTxIn in, int rounds) const
 {
-    static std::map<uint256, CMutableTransaction> mDenomWtxes;
+    AssertLockHeld(cs_wallet); // mapDarksendRounds
 
     if(rounds >= 16) return 15; // 16 rounds max
 
@@ -839,91 +920,124 @@ int CWallet::GetRealInputDarksendRounds(CTxIn in, int rounds) const
     unsigned int nout = in.prevout.n;
 
     const CWalletTx* wtx = GetWalletTx(hash);
-    if(wtx != NULL)
-    {
-        std::map<uint256, CMutableTransaction>::const_iterator mdwi = mDenomWtxes.find(hash);
-        // not known yet, let's add it
-        if(mdwi == mDenomWtxes.end())
-        {
-            LogPrint("darksend", "GetInputDarksendRounds INSERTING %s\n", hash.ToString());
-            mDenomWtxes[hash] = CMutableTransaction(*wtx);
-        }
-        // found and it's not an initial value, just return it
-        else if(mDenomWtxes[hash].vout[nout].nRounds != -10)
-        {
-            return mDenomWtxes[hash].vout[nout].nRounds;
-        }
-
+    if(wtx == NULL) return rounds-1;
 
-        // bounds check
-        if(nout >= wtx->vout.size())
-        {
-            // should never actually hit this
-            LogPrint("darksend", "GetInputDarksendRounds UPDATED   %s %3d %3d\n", hash.ToString(), nout, -4);
-            return -4;
-        }
-
-        if(pwalletMain->IsCollateralAmount(wtx->vout[nout].nValue))
-        {
-            mDenomWtxes[hash].vout[nout].nRounds = -3;
-            LogPrint("darksend", "GetInputDarksendRounds UPDATED   %s %3d %3d\n", hash.ToString(), nout, mDenomWtxes[hash].vout[nout].nRounds);
-            return mDenomWtxes[hash].vout[nout].nRounds;
-        }
+    // already known, just return it
+    std::map<COutPoint, int>::const_iterator mi = mapDarksendRounds.find(in.prevout);
+    if(mi != mapDarksendRounds.end()) return mi->second;
 
-        //make sure the final output is non-denominate
-        if(/*rounds == 0 && */!IsDenominatedAmount(wtx->vout[nout].nValue)) //NOT DENOM
-        {
-            mDenomWtxes[hash].vout[nout].nRounds = -2;
-            LogPrint("darksend", "GetInputDarksendRounds UPDATED   %s %3d %3d\n", hash.ToString(), nout, mDenomWtxes[hash].vout[nout].nRounds);
-            return mDenomWtxes[hash].vout[nout].nRounds;
-        }
+    // bounds check
+    if(nout >= wtx->vout.size())
+    {
+        // should never actually hit this
+        LogPrint("darksend", "GetInputDarksendRounds UPDATED   %s %3d %3d\n", hash.ToString(), nout, -4);
+        return -4;
+    }
 
+    int nRounds;
+    if(IsCollateralAmount(wtx->vout[nout].nValue))
+    {
+        nRounds = -3;
+    }
+    //make sure the final output is non-denominate
+    else if(!IsDenominatedAmount(wtx->vout[nout].nValue)) //NOT DENOM
+    {
+        nRounds = -2;
+    }
+    else
+    {
         bool fAllDenoms = true;
-        BOOST_FOREACH(CTxOut out, wtx->vout)
+        BOOST_FOREACH(const CTxOut& out, wtx->vout)
         {
             fAllDenoms = fAllDenoms && IsDenominatedAmount(out.nValue);
         }
-        // this one is denominated but there is another non-denominated output found in the same tx
-        if(!fAllDenoms)
-        {
-            mDenomWtxes[hash].vout[nout].nRounds = 0;
-            LogPrint("darksend", "GetInputDarksendRounds UPDATED   %s %3d %3d\n", hash.ToString(), nout, mDenomWtxes[hash].vout[nout].nRounds);
-            return mDenomWtxes[hash].vout[nout].nRounds;
-        }
 
         int nShortest = -10; // an initial value, should be no way to get this by calculations
         bool fDenomFound = false;
         // only denoms here so let's look up
-        BOOST_FOREACH(CTxIn in2, wtx->vin)
+        if(fAllDenoms)
         {
-            if(IsMine(in2))
+            BOOST_FOREACH(const CTxIn& in2, wtx->vin)
             {
-                int n = GetRealInputDarksendRounds(in2, rounds+1);
-                // denom found, find the shortest chain or initially assign nShortest with the first found value
-                if(n >= 0 && (n < nShortest || nShortest == -10))
+                if(IsMine(in2))
                 {
-                    nShortest = n;
-                    fDenomFound = true;
+                    int n = GetRealInputDarksendRounds(in2, rounds+1);
+                    // denom found, find the shortest chain or initially assign nShortest with the first found value
+                    if(n >= 0 && (n < nShortest || nShortest == -10))
+                    {
+                        nShortest = n;
+                        fDenomFound = true;
+                    }
                 }
             }
         }
-        mDenomWtxes[hash].vout[nout].nRounds = fDenomFound
+        // a denominated output next to a non-denominated one in the same tx starts a new chain
+        nRounds = fDenomFound
                 ? (nShortest >= 15 ? 16 : nShortest + 1) // good, we a +1 to the shortest one but only 16 rounds max allowed
                 : 0;            // too bad, we are the fist one in that chain
-        LogPrint("darksend", "GetInputDarksendRounds UPDATED   %s %3d %3d\n", hash.ToString(), nout, mDenomWtxes[hash].vout[nout].nRounds);
-        return mDenomWtxes[hash].vout[nout].nRounds;
     }
 
-    return rounds-1;
+    mapDarksendRounds[in.prevout] = nRounds;
+    LogPrint("darksend", "GetInputDarksendRounds UPDATED   %s %3d %3d\n", hash.ToString(), nout, nRounds);
+    return nRounds;
 }
 
 // respect current settings
 int CWallet::GetInputDarksendRounds(CTxIn in) const {
     LOCK(cs_wallet);
-    int realDarksendRounds = GetRealInputDarksendRounds(in, 0);
+    int realDarksendRounds;
+    std::map<COutPoint, int>::const_iterator mi = mapDarksendRounds.find(in.prevout);
+    if (mi != mapDarksendRounds.end()) {
+        realDarksendRounds = mi->second;
+    } else {
+        realDarksendRounds = GetRealInputDarksendRounds(in, 0);
+        // only our own outputs get an entry, keep it for the next start
+        if (fFileBacked && mapDarksendRounds.count(in.prevout))
+            CWalletDB(strWalletFile).WriteDarksendRounds(in.prevout, realDarksendRounds);
+    }
     return realDarksendRounds > nDarksendRounds ? nDarksendRounds : realDarksendRounds;
 }
 
+bool CWallet::LoadDarksendRounds(const COutPoint& outpoint, int nRounds)
+{
+    mapDarksendRounds[outpoint] = nRounds;
+    return true;
+}
+
+void CWallet::InvalidateDarksendRounds(const uint256& hash)
+{
+    AssertLockHeld(cs_wallet); // mapDarksendRounds, mapTxSpends
+
+    std::set<uint256> setDone;
+    std::vector<uint256> vTodo(1, hash);
+    std::vector<COutPoint> vErased;
+    while (!vTodo.empty())
+    {
+        uint256 txid = vTodo.back();
+        vTodo.pop_back();
+        if (!setDone.insert(txid).second)
+            continue;
+
+        // Rounds of everything spending these outputs were derived from them
+        COutPoint first(txid, 0);
+        std::map<COutPoint, int>::iterator mi = mapDarksendRounds.lower_bound(first);
+        while (mi != mapDarksendRounds.end() && mi->first.hash == txid)
+        {
+            vErased.push_back(mi->first);
+            mapDarksendRounds.erase(mi++);
+        }
+        for (TxSpends::const_iterator it = mapTxSpends.lower_bound(first); it != mapTxSpends.end() && it->first.hash == txid; ++it)
+            vTodo.push_back(it->second);
+    }
+
+    if (fFileBacked && !vErased.empty())
+    {
+        CWalletDB walletdb(strWalletFile);
+        BOOST_FOREACH(const COutPoint& outpoint, vErased)
+            walletdb.EraseDarksendRounds(outpoint);
+    }
+}
+
 bool CWallet::IsDenominated(const CTxIn &txin) const
 {
     {
@@ -1125,19 +1239,139 @@ bool CWalletTx::WriteToDisk()
     return CWalletDB(pwallet->strWalletFile).WriteTx(GetHash(), *this);
 }
 
+/** A block read by a rescan thread, with the transactions paying to the wallet marked */
+struct CRescanBlock
+{
+    CBlock block;
+    bool fRead;
+    std::vector<bool> vPaysToMe;
+};
+
+/**
+ * Reads the blocks of a rescan on a few threads and finds the transactions
+ * with outputs paying to the wallet, which is the expensive part of the
+ * match. Only the keystore is touched, so no cs_main or cs_wallet needed.
+ * Blocks are handed out in chain order and the threads stay a bounded
+ * number of blocks ahead of the caller. With -blockfilterindex, blocks
+ * whose filter matches none of the wallet scripts aren't read at all.
+ */
+class CWalletRescanReader
+{
+private:
+    const CWallet& wallet;
+    const std::vector<CBlockIndex*>& vBlocks;
+    const BlockFilterElements& filterElements;
+    size_t nReadAhead;
+
+    boost::mutex mutex;
+    boost::condition_variable condRead;
+    boost::condition_variable condTaken;
+    size_t nNextRead;
+    size_t nNextTaken;
+    std::map<size_t, boost::shared_ptr<CRescanBlock> > mapRead;
+    bool fStop;
+
+public:
+    CWalletRescanReader(const CWallet& walletIn, const std::vector<CBlockIndex*>& vBlocksIn, const BlockFilterElements& filterElementsIn, size_t nReadAheadIn) :
+        wallet(walletIn), vBlocks(vBlocksIn), filterElements(filterElementsIn), nReadAhead(nReadAheadIn), nNextRead(0), nNextTaken(0), fStop(false) {}
+
+    /** False if the filter index says the block can't involve the wallet */
+    bool MayInvolveWallet(const CBlockIndex* pindex) const
+    {
+        CBlockFilter filter;
+        if (!fBlockFilterIndex || filterElements.empty() || !pblockfilterdb->ReadFilter(pindex->GetBlockHash(), filter))
+            return true;
+        return filter.MatchAny(filterElements);
+    }
+
+    void Thread()
+    {
+        RenameThread("ic-rescan");
+        while (true)
+        {
+            size_t nBlock;
+            {
+                boost::unique_lock<boost::mutex> lock(mutex);
+                while (!fStop && nNextRead < vBlocks.size() && nNextRead >= nNextTaken + nReadAhead)
+                    condTaken.wait(lock);
+                if (fStop || nNextRead >= vBlocks.size())
+                    return;
+                nBlock = nNextRead++;
+            }
+
+            boost::shared_ptr<CRescanBlock> pblock(new CRescanBlock());
+            if (!MayInvolveWallet(vBlocks[nBlock]))
+                pblock->fRead = true; // nothing to add from it, leave the block empty
+            else
+                pblock->fRead = ReadBlockFromDisk(pblock->block, vBlocks[nBlock]);
+            if (pblock->fRead)
+            {
+                pblock->vPaysToMe.reserve(pblock->block.vtx.size());
+                BOOST_FOREACH(const CTransaction& tx, pblock->block.vtx)
+                {
+                    bool fPaysToMe = false;
+                    for (unsigned int i = 0; i < tx.vout.size() && !fPaysToMe; i++)
+                        fPaysToMe = wallet.IsMine(tx.vout[i]) != ISMINE_NO;
+                    pblock->vPaysToMe.push_back(fPaysToMe);
+                }
+            }
+
+            {
+                boost::unique_lock<boost::mutex> lock(mutex);
+                mapRead[nBlock] = pblock;
+            }
+            condRead.notify_all();
+        }
+    }
+
+    /** Take the next block in chain order, NULL when all were taken */
+    boost::shared_ptr<CRescanBlock> Take(bool fWait)
+    {
+        boost::shared_ptr<CRescanBlock> pblock;
+        {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            if (nNextTaken >= vBlocks.size())
+                return pblock;
+            while (fWait && !mapRead.count(nNextTaken))
+                condRead.wait(lock);
+            std::map<size_t, boost::shared_ptr<CRescanBlock> >::iterator it = mapRead.find(nNextTaken);
+            if (it == mapRead.end())
+                return pblock;
+            pblock = it->second;
+            mapRead.erase(it);
+            nNextTaken++;
+        }
+        condTaken.notify_all();
+        return pblock;
+    }
+
+    void Stop()
+    {
+        {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            fStop = true;
+        }
+        condTaken.notify_all();
+    }
+};
+
 /**
  * Scan the block chain (starting in pindexStart) for transactions
  * from or to us. If fUpdate is true, found transactions that already
- * exist in the wallet will be updated.
+ * exist in the wallet will be updated. If ppindexAborted is given, it's
+ * set to the first block left unscanned by an abort or shutdown, or to
+ * NULL when the scan reached the tip.
  */
-int CWallet::ScanForWalletTransactions(CBlockIndex* pindexStart, bool fUpdate)
+int CWallet::ScanForWalletTransactions(CBlockIndex* pindexStart, bool fUpdate, CBlockIndex** ppindexAborted)
 {
     int ret = 0;
     int64_t nNow = GetTime();
+    fAbortRescan = false;
 
     CBlockIndex* pindex = pindexStart;
+    double dProgressStart, dProgressTip;
     {
-        LOCK2(cs_main, cs_wallet);
+        LOCK(cs_main);
 
         // no need to read and scan block, if block was created before
         // our wallet birthday (as adjusted for block time variability)
@@ -1145,31 +1379,134 @@ int CWallet::ScanForWalletTransactions(CBlockIndex* pindexStart, bool fUpdate)
             pindex = chainActive.Next(pindex);
 
         ShowProgress(_("Rescanning..."), 0); // show rescan progress in GUI as dialog or on splashscreen, if -rescan on startup
-        double dProgressStart = Checkpoints::GuessVerificationProgress(pindex, false);
-        double dProgressTip = Checkpoints::GuessVerificationProgress(chainActive.Tip(), false);
-        while (pindex)
+        dProgressStart = Checkpoints::GuessVerificationProgress(pindex, false);
+        dProgressTip = Checkpoints::GuessVerificationProgress(chainActive.Tip(), false);
+    }
+
+    int nThreads = std::max(1, std::min((int)boost::thread::hardware_concurrency(), MAX_RESCAN_THREADS));
+    BlockFilterElements filterElements;
+    if (fBlockFilterIndex)
+        GetBlockFilterElements(filterElements);
+    // Blocks can be connected while we scan, go on until we reach the tip
+    while (pindex && !fAbortRescan)
+    {
+        std::vector<CBlockIndex*> vBlocks;
         {
-            if (pindex->nHeight % 100 == 0 && dProgressTip - dProgressStart > 0.0)
-                ShowProgress(_("Rescanning..."), std::max(1, std::min(99, (int)((Checkpoints::GuessVerificationProgress(pindex, false) - dProgressStart) / (dProgressTip - dProgressStart) * 100))));
+            LOCK(cs_main);
+            for (CBlockIndex* pindexNext = pindex; pindexNext; pindexNext = chainActive.Next(pindexNext))
+                vBlocks.push_back(pindexNext);
+        }
 
-            CBlock block;
-            ReadBlockFromDisk(block, pindex);
-            BOOST_FOREACH(CTransaction& tx, block.vtx)
+        CWalletRescanReader reader(*this, vBlocks, filterElements, nThreads * RESCAN_READ_AHEAD);
+        boost::thread_group threads;
+        for (int i = 0; i < nThreads; i++)
+            threads.create_thread(boost::bind(&CWalletRescanReader::Thread, &reader));
+
+        // Add what was found in short batches, so the node isn't held up for the whole rescan
+        size_t nBlock = 0;
+        try {
+            while (nBlock < vBlocks.size() && !fAbortRescan && !ShutdownRequested())
             {
-                if (AddToWalletIfInvolvingMe(tx, &block, fUpdate))
-                    ret++;
-            }
-            pindex = chainActive.Next(pindex);
-            if (GetTime() >= nNow + 60) {
-                nNow = GetTime();
-                LogPrintf("Still rescanning. At block %d. Progress=%f\n", pindex->nHeight, Checkpoints::GuessVerificationProgress(pindex));
+                boost::shared_ptr<CRescanBlock> pblock = reader.Take(true);
+
+                LOCK2(cs_main, cs_wallet);
+                for (unsigned int nBatch = 0; pblock; )
+                {
+                    pindex = vBlocks[nBlock++];
+                    if (pindex->nHeight % 100 == 0 && dProgressTip - dProgressStart > 0.0)
+                        ShowProgress(_("Rescanning..."), std::max(1, std::min(99, (int)((Checkpoints::GuessVerificationProgress(pindex, false) - dProgressStart) / (dProgressTip - dProgressStart) * 100))));
+
+                    // A block disconnected meanwhile gives its transactions back through SyncTransaction
+                    if (pblock->fRead && chainActive.Contains(pindex))
+                    {
+                        for (unsigned int i = 0; i < pblock->block.vtx.size(); i++)
+                        {
+                            const CTransaction& tx = pblock->block.vtx[i];
+                            // Spending from the wallet is a map lookup, only those and
+                            // the ones found paying to us need the full check
+                            bool fInvolvesMe = pblock->vPaysToMe[i] || mapWallet.count(tx.GetHash());
+                            for (unsigned int j = 0; j < tx.vin.size() && !fInvolvesMe; j++)
+                                fInvolvesMe = mapWallet.count(tx.vin[j].prevout.hash);
+                            if (fInvolvesMe && AddToWalletIfInvolvingMe(tx, &pblock->block, fUpdate))
+                                ret++;
+                        }
+                    }
+
+                    if (GetTime() >= nNow + 60) {
+                        nNow = GetTime();
+                        LogPrintf("Still rescanning. At block %d. Progress=%f\n", pindex->nHeight, Checkpoints::GuessVerificationProgress(pindex));
+                    }
+                    // Only take a block that's scanned in this batch, a taken block can't be given back
+                    if (++nBatch >= RESCAN_BATCH_BLOCKS)
+                        break;
+                    pblock = reader.Take(false);
+                }
             }
+        } catch (...) {
+            reader.Stop();
+            threads.join_all();
+            throw;
         }
-        ShowProgress(_("Rescanning..."), 100); // hide progress dialog in GUI
+
+        reader.Stop();
+        threads.join_all();
+
+        if (nBlock < vBlocks.size())
+        {
+            pindex = vBlocks[nBlock];
+            break;
+        }
+
+        LOCK(cs_main);
+        const CBlockIndex* pindexFork = chainActive.FindFork(vBlocks.back());
+        pindex = pindexFork ? chainActive.Next(pindexFork) : NULL;
     }
+    // Anything left in pindex wasn't scanned
+    if (pindex)
+        LogPrintf("Rescan aborted at block %d\n", pindex->nHeight);
+    if (ppindexAborted)
+        *ppindexAborted = pindex;
+    ShowProgress(_("Rescanning..."), 100); // hide progress dialog in GUI
     return ret;
 }
 
+void CWallet::GetBlockFilterElements(BlockFilterElements& elements) const
+{
+    elements.clear();
+
+    std::set<CKeyID> setKeys;
+    GetKeys(setKeys);
+    BOOST_FOREACH(const CKeyID& keyid, setKeys)
+    {
+        CScript script = GetScriptForDestination(keyid);
+        elements.insert(std::vector<unsigned char>(script.begin(), script.end()));
+        CPubKey pubkey;
+        if (GetPubKey(keyid, pubkey)) {
+            script = CScript() << ToByteVector(pubkey) << OP_CHECKSIG;
+            elements.insert(std::vector<unsigned char>(script.begin(), script.end()));
+        }
+    }
+    {
+        LOCK(cs_KeyStore);
+        BOOST_FOREACH(const PAIRTYPE(CScriptID, CScript)& item, mapScripts)
+        {
+            CScript script = GetScriptForDestination(item.first);
+            elements.insert(std::vector<unsigned char>(script.begin(), script.end()));
+        }
+        BOOST_FOREACH(const CScript& script, setWatchOnly)
+            elements.insert(std::vector<unsigned char>(script.begin(), script.end()));
+    }
+
+    // Anything else already known to be ours, like bare multisig
+    LOCK(cs_wallet);
+    BOOST_FOREACH(const PAIRTYPE(const uint256, CWalletTx)& item, mapWallet)
+    {
+        BOOST_FOREACH(const CTxOut& txout, item.second.vout)
+            if (IsMine(txout) != ISMINE_NO)
+                elements.insert(std::vector<unsigned char>(txout.scriptPubKey.begin(), txout.scriptPubKey.end()));
+    }
+}
+
 void CWallet::ReacceptWalletTransactions()
 {
     LOCK2(cs_main, cs_wallet);
@@ -1199,7 +1536,10 @@ void CWalletTx::RelayWalletTransaction(std::string strCommand)
             LogPrintf("Relaying wtx %s\n", hash.ToString());
 
             if(strCommand == "ix"){
-                mapTxLockReq.insert(make_pair(hash, (CTransaction)*this));
+                {
+                    LOCK(cs_instantx);
+                    mapTxLockReq.insert(make_pair(hash, (CTransaction)*this));
+                }
                 CreateNewLock(((CTransaction)*this));
                 RelayTransactionLockReq((CTransaction)*this, true);
             } else {
@@ -1270,58 +1610,75 @@ void CWallet::ResendWalletTransactions()
  */
 
 
-CAmount CWallet::GetBalance() const
+CWalletBalances CWallet::GetBalances() const
 {
-    CAmount nTotal = 0;
+    LOCK2(cs_main, cs_wallet);
+
+    uint256 hashTip = chainActive.Tip() ? chainActive.Tip()->GetBlockHash() : uint256();
+    unsigned int nMempoolUpdated = mempool.GetTransactionsUpdated();
+    if (fBalancesCached && hashBalancesTip == hashTip && nBalancesMempoolUpdated == nMempoolUpdated &&
+        nBalancesTXLocks == nCompleteTXLocks && nBalancesDarksendRounds == nDarksendRounds)
+        return cachedBalances;
+
+    CWalletBalances balances;
+    // Finality by time changes without anything else changing, don't keep those
+    bool fCacheable = true;
+    vector<const CWalletTx*> vCandidates;
+    GetUnspentCandidates(vCandidates);
+    BOOST_FOREACH(const CWalletTx* pcoin, vCandidates)
     {
-        LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
-        {
-            const CWalletTx* pcoin = &(*it).second;
-            if (pcoin->IsTrusted())
-                nTotal += pcoin->GetAvailableCredit();
+        bool fFinal = IsFinalTx(*pcoin);
+        bool fTrusted = pcoin->IsTrusted();
+        if (!fFinal)
+            fCacheable = false;
+
+        if (fTrusted) {
+            balances.nBalance += pcoin->GetAvailableCredit();
+            balances.nWatchOnly += pcoin->GetAvailableWatchOnlyCredit();
+        }
+        if (!fFinal || (!fTrusted && pcoin->GetDepthInMainChain() == 0)) {
+            balances.nUnconfirmed += pcoin->GetAvailableCredit();
+            balances.nUnconfirmedWatchOnly += pcoin->GetAvailableWatchOnlyCredit();
+        }
+        balances.nImmature += pcoin->GetImmatureCredit();
+        balances.nImmatureWatchOnly += pcoin->GetImmatureWatchOnlyCredit();
+
+        if (fLiteMode)
+            continue;
+        if (fTrusted) {
+            balances.nAnonymizable += pcoin->GetAnonymizableCredit();
+            balances.nAnonymized += pcoin->GetAnonymizedCredit();
         }
+        balances.nDenominatedConfirmed += pcoin->GetDenominatedCredit(false);
+        balances.nDenominatedUnconfirmed += pcoin->GetDenominatedCredit(true);
     }
 
-    return nTotal;
+    cachedBalances = balances;
+    fBalancesCached = fCacheable;
+    hashBalancesTip = hashTip;
+    nBalancesMempoolUpdated = nMempoolUpdated;
+    nBalancesTXLocks = nCompleteTXLocks;
+    nBalancesDarksendRounds = nDarksendRounds;
+    return balances;
+}
+
+CAmount CWallet::GetBalance() const
+{
+    return GetBalances().nBalance;
 }
 
 CAmount CWallet::GetAnonymizableBalance() const
 {
     if(fLiteMode) return 0;
 
-    CAmount nTotal = 0;
-    {
-        LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
-        {
-            const CWalletTx* pcoin = &(*it).second;
-
-            if (pcoin->IsTrusted())
-               nTotal += pcoin->GetAnonymizableCredit();
-        }
-    }
-
-    return nTotal;
+    return GetBalances().nAnonymizable;
 }
 
 CAmount CWallet::GetAnonymizedBalance() const
 {
     if(fLiteMode) return 0;
 
-    CAmount nTotal = 0;
-    {
-        LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
-        {
-            const CWalletTx* pcoin = &(*it).second;
-
-            if (pcoin->IsTrusted())
-                nTotal += pcoin->GetAnonymizedCredit();
-        }
-    }
-
-    return nTotal;
+    return GetBalances().nAnonymized;
 }
 
 // Note: calculated including unconfirmed,
@@ -1335,11 +1692,11 @@ double CWallet::GetAverageAnonymizedRounds() const
 
     {
         LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+        vector<const CWalletTx*> vCandidates;
+        GetUnspentCandidates(vCandidates);
+        BOOST_FOREACH(const CWalletTx* pcoin, vCandidates)
         {
-            const CWalletTx* pcoin = &(*it).second;
-
-            uint256 hash = (*it).first;
+            uint256 hash = pcoin->GetHash();
 
             for (unsigned int i = 0; i < pcoin->vout.size(); i++) {
 
@@ -1369,11 +1726,11 @@ CAmount CWallet::GetNormalizedAnonymizedBalance() const
 
     {
         LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+        vector<const CWalletTx*> vCandidates;
+        GetUnspentCandidates(vCandidates);
+        BOOST_FOREACH(const CWalletTx* pcoin, vCandidates)
         {
-            const CWalletTx* pcoin = &(*it).second;
-
-            uint256 hash = (*it).first;
+            uint256 hash = pcoin->GetHash();
 
             for (unsigned int i = 0; i < pcoin->vout.size(); i++) {
 
@@ -1395,92 +1752,33 @@ CAmount CWallet::GetDenominatedBalance(bool unconfirmed) const
 {
     if(fLiteMode) return 0;
 
-    CAmount nTotal = 0;
-    {
-        LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
-        {
-            const CWalletTx* pcoin = &(*it).second;
-
-            nTotal += pcoin->GetDenominatedCredit(unconfirmed);
-        }
-    }
-
-    return nTotal;
+    CWalletBalances balances = GetBalances();
+    return unconfirmed ? balances.nDenominatedUnconfirmed : balances.nDenominatedConfirmed;
 }
 
 CAmount CWallet::GetUnconfirmedBalance() const
 {
-    CAmount nTotal = 0;
-    {
-        LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
-        {
-            const CWalletTx* pcoin = &(*it).second;
-            if (!IsFinalTx(*pcoin) || (!pcoin->IsTrusted() && pcoin->GetDepthInMainChain() == 0))
-                nTotal += pcoin->GetAvailableCredit();
-        }
-    }
-    return nTotal;
+    return GetBalances().nUnconfirmed;
 }
 
 CAmount CWallet::GetImmatureBalance() const
 {
-    CAmount nTotal = 0;
-    {
-        LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
-        {
-            const CWalletTx* pcoin = &(*it).second;
-            nTotal += pcoin->GetImmatureCredit();
-        }
-    }
-    return nTotal;
+    return GetBalances().nImmature;
 }
 
 CAmount CWallet::GetWatchOnlyBalance() const
 {
-    CAmount nTotal = 0;
-    {
-        LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
-        {
-            const CWalletTx* pcoin = &(*it).second;
-            if (pcoin->IsTrusted())
-                nTotal += pcoin->GetAvailableWatchOnlyCredit();
-        }
-    }
-
-    return nTotal;
+    return GetBalances().nWatchOnly;
 }
 
 CAmount CWallet::GetUnconfirmedWatchOnlyBalance() const
 {
-    CAmount nTotal = 0;
-    {
-        LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
-        {
-            const CWalletTx* pcoin = &(*it).second;
-            if (!IsFinalTx(*pcoin) || (!pcoin->IsTrusted() && pcoin->GetDepthInMainChain() == 0))
-                nTotal += pcoin->GetAvailableWatchOnlyCredit();
-        }
-    }
-    return nTotal;
+    return GetBalances().nUnconfirmedWatchOnly;
 }
 
 CAmount CWallet::GetImmatureWatchOnlyBalance() const
 {
-    CAmount nTotal = 0;
-    {
-        LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
-        {
-            const CWalletTx* pcoin = &(*it).second;
-            nTotal += pcoin->GetImmatureWatchOnlyCredit();
-        }
-    }
-    return nTotal;
+    return GetBalances().nImmatureWatchOnly;
 }
 
 /**
@@ -1492,10 +1790,11 @@ void CWallet::AvailableCoins(vector<COutput>& vCoins, bool fOnlyConfirmed, const
 
     {
         LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+        vector<const CWalletTx*> vCandidates;
+        GetUnspentCandidates(vCandidates);
+        BOOST_FOREACH(const CWalletTx* pcoin, vCandidates)
         {
-            const uint256& wtxid = it->first;
-            const CWalletTx* pcoin = &(*it).second;
+            const uint256& wtxid = pcoin->GetHash();
 
             if (!IsFinalTx(*pcoin))
                 continue;
@@ -1528,8 +1827,8 @@ void CWallet::AvailableCoins(vector<COutput>& vCoins, bool fOnlyConfirmed, const
 
                 isminetype mine = IsMine(pcoin->vout[i]);
                 if (!(IsSpent(wtxid, i)) && mine != ISMINE_NO &&
-                    !IsLockedCoin((*it).first, i) && pcoin->vout[i].nValue > 0 &&
-                    (!coinControl || !coinControl->HasSelected() || coinControl->IsSelected((*it).first, i)))
+                    !IsLockedCoin(wtxid, i) && pcoin->vout[i].nValue > 0 &&
+                    (!coinControl || !coinControl->HasSelected() || coinControl->IsSelected(wtxid, i)))
                         vCoins.push_back(COutput(pcoin, i, nDepth, (mine & ISMINE_SPENDABLE) != ISMINE_NO));
             }
         }
@@ -1940,9 +2239,10 @@ int CWallet::CountInputsWithAmount(int64_t nInputAmount)
     int64_t nTotal = 0;
     {
         LOCK(cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+        vector<const CWalletTx*> vCandidates;
+        GetUnspentCandidates(vCandidates);
+        BOOST_FOREACH(const CWalletTx* pcoin, vCandidates)
         {
-            const CWalletTx* pcoin = &(*it).second;
             if (pcoin->IsTrusted()){
                 int nDepth = pcoin->GetDepthInMainChain(false);
 
@@ -3257,6 +3557,7 @@ int CMerkleTx::GetTransactionLockSignatures() const
     if(!fEnableInstantX) return -1;
 
     //compile consessus vote
+    LOCK(cs_instantx);
     std::map<uint256, CTransactionLock>::iterator i = mapTxLocks.find(GetHash());
     if (i != mapTxLocks.end()){
         return (*i).second.CountSignatures();
@@ -3270,6 +3571,7 @@ bool CMerkleTx::IsTransactionLockTimedOut() const
     if(!fEnableInstantX) return 0;
 
     //compile consessus vote
+    LOCK(cs_instantx);
     std::map<uint256, CTransactionLock>::iterator i = mapTxLocks.find(GetHash());
     if (i != mapTxLocks.end()){
         return GetTime() > (*i).second.nTimeout;
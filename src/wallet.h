@@ -8,6 +8,7 @@
 #define BITCOIN_WALLET_H
 
 #include "amount.h"
+#include "blockfilter.h"
 #include "primitives/block.h"
 #include "primitives/transaction.h"
 #include "crypter.h"
@@ -48,6 +49,12 @@ static const CAmount DEFAULT_TRANSACTION_MAXFEE = 0.1 * COIN;
 static const CAmount nHighTransactionMaxFeeWarning = 100 * nHighTransactionFeeWarning;
 //! Largest (in bytes) free transaction we're willing to create
 static const unsigned int MAX_FREE_TRANSACTION_CREATE_SIZE = 1000;
+//! Most threads reading and matching blocks during a rescan
+static const int MAX_RESCAN_THREADS = 8;
+//! Blocks a rescan adds to the wallet for each time it takes cs_main and cs_wallet
+static const unsigned int RESCAN_BATCH_BLOCKS = 50;
+//! Blocks each rescan thread may read ahead of the ones added to the wallet
+static const unsigned int RESCAN_READ_AHEAD = 8;
 
 class CAccountingEntry;
 class CCoinControl;
@@ -113,6 +120,34 @@ public:
     StringMap destdata;
 };
 
+/** All the wallet balances, computed together in one pass over the unspent coins */
+struct CWalletBalances
+{
+    CAmount nBalance;
+    CAmount nUnconfirmed;
+    CAmount nImmature;
+    CAmount nWatchOnly;
+    CAmount nUnconfirmedWatchOnly;
+    CAmount nImmatureWatchOnly;
+    CAmount nAnonymizable;
+    CAmount nAnonymized;
+    CAmount nDenominatedConfirmed;
+    CAmount nDenominatedUnconfirmed;
+
+    CWalletBalances()
+    {
+        SetNull();
+    }
+
+    void SetNull()
+    {
+        nBalance = nUnconfirmed = nImmature = 0;
+        nWatchOnly = nUnconfirmedWatchOnly = nImmatureWatchOnly = 0;
+        nAnonymizable = nAnonymized = 0;
+        nDenominatedConfirmed = nDenominatedUnconfirmed = 0;
+    }
+};
+
 /** 
  * A CWallet is an extension of a keystore, which also maintains a set of transactions and balances,
  * and provides the ability to create new transactions.
@@ -134,6 +169,9 @@ private:
     int64_t nNextResend;
     int64_t nLastResend;
 
+    //! Set by AbortRescan(), checked between blocks by ScanForWalletTransactions()
+    volatile bool fAbortRescan;
+
     /**
      * Used to keep track of spent outpoints, and
      * detect and report conflicts (double-spends or
@@ -146,6 +184,40 @@ private:
 
     void SyncMetaData(std::pair<TxSpends::iterator, TxSpends::iterator>);
 
+    /**
+     * Transactions that may still have unspent outputs of ours. Everything
+     * that only looks at unspent coins walks this instead of all of mapWallet.
+     * Transactions are dropped lazily once all their outputs are spent in
+     * the chain and put back when they, or a transaction spending them,
+     * change. A spend that is only in the mempool doesn't drop them, it can
+     * leave the mempool without the wallet hearing about it.
+     */
+    mutable std::set<uint256> setUnspentCandidates;
+    void AddUnspentCandidates(const CWalletTx& wtx);
+    bool IsSpentInChain(const uint256& hash, unsigned int n) const;
+    void GetUnspentCandidates(std::vector<const CWalletTx*>& vCoins) const;
+
+    /**
+     * Balances from the last GetBalances() call, valid as long as the wallet,
+     * the tip, the mempool, the completed IX locks and the number of
+     * Darksend rounds stay the same.
+     */
+    mutable CWalletBalances cachedBalances;
+    mutable bool fBalancesCached;
+    mutable uint256 hashBalancesTip;
+    mutable unsigned int nBalancesMempoolUpdated;
+    mutable int nBalancesTXLocks;
+    mutable int nBalancesDarksendRounds;
+
+    /**
+     * Darksend rounds of our outputs, filled as transactions arrive or get
+     * asked about and kept in the wallet file. An entry depends on the
+     * transactions before it, so it is dropped together with everything
+     * spending it when one of those changes.
+     */
+    mutable std::map<COutPoint, int> mapDarksendRounds;
+    void InvalidateDarksendRounds(const uint256& hash);
+
 public:
 //    bool SelectCoins(int64_t nTargetValue, std::set<std::pair<const CWalletTx*,unsigned int> >& setCoinsRet, int64_t& nValueRet, const CCoinControl *coinControl = NULL, AvailableCoinsType coin_type=ALL_COINS, bool useIX = true) const;
     bool SelectCoinsDark(int64_t nValueMin, int64_t nValueMax, std::vector<CTxIn>& setCoinsRet, int64_t& nValueRet, int nDarksendRoundsMin, int nDarksendRoundsMax) const;
@@ -207,6 +279,8 @@ public:
         nLastResend = 0;
         nTimeFirstKey = 0;
         fWalletUnlockAnonymizeOnly = false;
+        fBalancesCached = false;
+        fAbortRescan = false;
     }
 
     std::map<uint256, CWalletTx> mapWallet;
@@ -302,9 +376,15 @@ public:
     void SyncTransaction(const CTransaction& tx, const CBlock* pblock);
     bool AddToWalletIfInvolvingMe(const CTransaction& tx, const CBlock* pblock, bool fUpdate);
     void EraseFromWallet(const uint256 &hash);
-    int ScanForWalletTransactions(CBlockIndex* pindexStart, bool fUpdate = false);
+    //! Takes cs_main and cs_wallet a batch of blocks at a time, call it with neither held
+    int ScanForWalletTransactions(CBlockIndex* pindexStart, bool fUpdate = false, CBlockIndex** ppindexAborted = NULL);
+    //! Scripts of the wallet to look for in block filters
+    void GetBlockFilterElements(BlockFilterElements& elements) const;
+    //! Stop a running ScanForWalletTransactions() at the next block
+    void AbortRescan() { fAbortRescan = true; }
     void ReacceptWalletTransactions();
     void ResendWalletTransactions();
+    CWalletBalances GetBalances() const;
     CAmount GetBalance() const;
     CAmount GetUnconfirmedBalance() const;
     CAmount GetImmatureBalance() const;
@@ -350,6 +430,8 @@ public:
     int GetRealInputDarksendRounds(CTxIn in, int rounds) const;
     // respect current settings
     int GetInputDarksendRounds(CTxIn in) const;
+    //! Adds a Darksend rounds entry to the wallet (used by LoadWallet)
+    bool LoadDarksendRounds(const COutPoint& outpoint, int nRounds);
 
     bool IsDenominated(const CTxIn &txin) const;
     bool IsDenominated(const CTransaction& tx) const;